@@ -0,0 +1,39 @@
+#!/bin/sh
+# Runs every benchmark in bench/ and prints the results as a JSON document
+# Each benchmark file runs in its own benzl process, so max-rss-kb is the
+# peak memory used by that file's workloads
+#
+# Usage: bench/run.sh [scale]
+# scale multiplies the size of each workload (default 1)
+#
+# Part of benzl - https://github.com/pokeb/benzl
+
+scale=${1:-1}
+cd "$(dirname "$0")/.." || exit 1
+
+version=$(sed -n 's/.*version_number = "\(.*\)";/\1/p' src/benzl-constants.c)
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo "unknown")
+
+results=""
+for file in bench/*.benzl; do
+    if [ "$file" = "bench/bench-runner.benzl" ]; then
+        continue
+    fi
+    # Benchmarks print one JSON object per line (anything else is ignored)
+    output=$(./benzl "$file" "$scale" | grep '^{"benchmark"')
+    if [ -z "$output" ]; then
+        echo "Benchmark $file failed" >&2
+        exit 1
+    fi
+    results="$results$output
+"
+done
+
+# image.benzl writes out the images it renders, and json.benzl and csv.benzl
+# write data files
+rm -f benzl-test.bmp benzl-native-test.bmp benzl-bench.ndjson benzl-bench.csv
+
+printf '{\n  "version": "%s",\n  "commit": "%s",\n  "scale": %s,\n  "results": [\n' \
+    "$version" "$commit" "$scale"
+printf '%s' "$results" | sed -e 's/^/    /' -e '$!s/$/,/'
+printf '  ]\n}\n'
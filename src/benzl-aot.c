@@ -0,0 +1,726 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <libgen.h>
+
+#include "benzl-aot.h"
+#include "benzl-call-count-debug.h"
+#include "benzl-quicken.h"
+#include "benzl-runtime.h"
+#include "benzl-runtime-stats.h"
+#include "benzl-parse.h"
+
+// The program being run, if it was compiled with --emit-c
+static const aot_program *current_program = NULL;
+
+// Set once the built-ins called directly have been looked up
+static bool builtins_resolved = false;
+
+#pragma mark - Expressions in a module
+
+// List of the expressions in a module that could be evaluated as code,
+// in the order they appear in the source
+typedef struct {
+    lval **items;
+    size_t *sizes; // Number of expressions in each item (including itself)
+    size_t count;
+    size_t capacity;
+} expression_list;
+
+// Returns the expression in v that should be visited (or NULL)
+static lval* expression_in(lval *v)
+{
+    if (v->type == LVAL_KEY_VALUE_PAIR) {
+        v = v->val.vkvpair.value;
+    }
+    if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+        return v;
+    }
+    return NULL;
+}
+
+static void collect_expressions(expression_list *l, lval *v)
+{
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity == 0 ? 256 : l->capacity*2;
+        l->items = realloc(l->items, sizeof(lval *)*l->capacity);
+        l->sizes = realloc(l->sizes, sizeof(size_t)*l->capacity);
+    }
+    size_t k = l->count++;
+    l->items[k] = v;
+    for (size_t i=0; i<count(v); i++) {
+        lval *x = expression_in(child(v, i));
+        if (x != NULL) {
+            collect_expressions(l, x);
+        }
+    }
+    l->sizes[k] = l->count-k;
+}
+
+// Lists the expressions in a parsed module
+// This must visit expressions in the same order when the program is compiled
+// and when compiled code is attached to them
+static void collect_module_expressions(expression_list *l, lval *expr)
+{
+    for (size_t i=0; i<count(expr); i++) {
+        lval *x = expression_in(child(expr, i));
+        if (x != NULL) {
+            collect_expressions(l, x);
+        }
+    }
+}
+
+static void free_expression_list(expression_list *l)
+{
+    free(l->items);
+    free(l->sizes);
+}
+
+#pragma mark - Running compiled programs
+
+int aot_main(const aot_program *program, int argc, char **argv)
+{
+    current_program = program;
+    if (!runtime_read_environment()) {
+        return 1;
+    }
+    lenv *e = runtime_create_env();
+    if (runtime_load_standard_library(e)) {
+        const aot_module *m = &program->modules[program->main_module];
+        runtime_run_program(e, m->path, argc-1, argv+1);
+    }
+    runtime_finish(e);
+    return 0;
+}
+
+const char* aot_module_source(const char *path)
+{
+    if (current_program == NULL) {
+        return NULL;
+    }
+    for (size_t i=0; i<current_program->module_count; i++) {
+        if (strcmp(current_program->modules[i].path, path) == 0) {
+            return current_program->modules[i].source;
+        }
+    }
+    return NULL;
+}
+
+// Looks up the functions the built-ins called by compiled code are bound to
+// Compiled calls check the symbol is still bound to the same function
+static void resolve_builtins(lenv *e)
+{
+    while (e->parent != NULL) {
+        e = e->parent;
+    }
+    for (size_t i=0; i<current_program->builtin_count; i++) {
+        const aot_builtin *b = &current_program->builtins[i];
+        lval *sym = lval_sym((char *)b->name);
+        lval_entry *entry = lval_table_get_entry(e->items, sym);
+        if (entry != NULL && entry->value->type == LVAL_FUN &&
+            entry->value->val.vfunc.builtin == b->func) {
+            // Retained so the function can't be freed and its address reused
+            current_program->builtin_values[i] = lval_retain(entry->value);
+        }
+        lval_release(sym);
+    }
+    builtins_resolved = true;
+}
+
+void aot_attach(lenv *e, lval *expr, const lval *label, const char *source)
+{
+    if (current_program == NULL || label == NULL || label->type != LVAL_STR) {
+        return;
+    }
+    const aot_module *m = NULL;
+    for (size_t i=0; i<current_program->module_count; i++) {
+        const aot_module *mi = &current_program->modules[i];
+        if (strcmp(mi->path, label->val.vstr) == 0 &&
+            strcmp(mi->source, source) == 0) {
+            m = mi;
+            break;
+        }
+    }
+    if (m == NULL || m->natives == NULL) {
+        return;
+    }
+    if (!builtins_resolved) {
+        resolve_builtins(e);
+    }
+
+    expression_list l = {0};
+    collect_module_expressions(&l, expr);
+    if (l.count == m->expression_count) {
+        for (size_t i=0; i<l.count; i++) {
+            if (m->natives[i] != NULL) {
+                lval_attach_native(l.items[i], m->natives[i], NULL);
+            }
+        }
+    }
+    free_expression_list(&l);
+}
+
+#pragma mark - Helpers called from compiled code
+
+lval* aot_args(const lval *v, size_t n)
+{
+    lval *a = lval_sexpr_with_size(n);
+    a->source_position = code_pos_retain(v->source_position);
+    return a;
+}
+
+// Returns the first error in a (retained), or NULL
+static lval* first_error(const lval *a)
+{
+    for (size_t i=0; i<count(a); i++) {
+        if (child(a, i)->type == LVAL_ERR) {
+            return lval_retain(child(a, i));
+        }
+    }
+    return NULL;
+}
+
+lval* aot_call_builtin(lenv *e, const lval *v, lval *f, lbuiltin func,
+                       lval *a)
+{
+    lval *r = first_error(a);
+    if (r == NULL) {
+        if (stats_enabled_for(STATS_CALLS) && f->bound_name != NULL) {
+            record_function_call(f);
+        }
+        r = quickened_call(v, f, a);
+        if (r == NULL) {
+            r = func(e, a);
+        }
+    }
+    lval_release(f);
+    lval_release(a);
+    return r;
+}
+
+lval* aot_call(lenv *e, const lval *v, lval *f, lval *a)
+{
+    lval *r = first_error(a);
+    if (r == NULL) {
+        if (stats_enabled_for(STATS_CALLS) && f->bound_name != NULL) {
+            record_function_call(f);
+        }
+        if (f->val.vfunc.builtin != NULL) {
+            r = quickened_call(v, f, a);
+        }
+        if (r == NULL) {
+            r = lval_call(e, f, a);
+        }
+    }
+    lval_release(f);
+    lval_release(a);
+    return r;
+}
+
+int aot_condition(lenv *e, const lval *v, lval *f, lval *c, lval **r)
+{
+    if (c->type == LVAL_ERR) {
+        lval_release(f);
+        *r = c;
+        return -1;
+    }
+    if (stats_enabled_for(STATS_CALLS) && f->bound_name != NULL) {
+        record_function_call(f);
+    }
+    // Let 'if' report conditions it doesn't accept
+    if (!lval_is_number(c) && c->type != LVAL_STR) {
+        lval *a = aot_args(v, 3);
+        aot_arg(a, c);
+        lval_add(a, child(v, 2));
+        lval_add(a, child(v, 3));
+        *r = builtin_if(e, a);
+        lval_release(a);
+        lval_release(f);
+        return -1;
+    }
+    int t = 1;
+    if (c->type == LVAL_INT) {
+        t = c->val.vint != 0;
+    } else if (c->type == LVAL_FLT) {
+        t = c->val.vflt != 0;
+    } else if (c->type == LVAL_BYTE) {
+        t = c->val.vbyte != 0;
+    }
+    lval_release(c);
+    lval_release(f);
+    return t;
+}
+
+lval* aot_symbol_expression(lenv *e, const lval *v)
+{
+    stack_push_frame(v);
+    lval *x = lenv_get_cached(e, child(v, 0));
+    stack_pop_frame();
+    // A function on its own is called with no arguments
+    if (x->type == LVAL_FUN) {
+        lval_release(x);
+        return lval_eval_sexpr_interpreted(e, v);
+    }
+    return x;
+}
+
+lval* aot_value_expression(lenv *e, const lval *v)
+{
+    return lval_retain(child(v, 0));
+}
+
+#pragma mark - Compiler
+
+// How an expression is compiled
+typedef enum {
+    form_none = 0, // Not compiled (always interpreted)
+    form_symbol, // A single symbol (aot_symbol_expression)
+    form_value, // A single value (aot_value_expression)
+    form_builtin, // Call to a known built-in
+    form_if, // (if condition {...} {...})
+    form_call // Call to any other function
+} expression_form;
+
+typedef struct {
+    char *path; // Path (or label) of the module
+    char *source;
+    lval *expr; // Parsed source
+    expression_list expressions;
+    expression_form *forms;
+} compiled_module;
+
+typedef struct {
+    FILE *out;
+    lenv *env;
+    compiled_module *modules;
+    size_t module_count;
+    aot_builtin *builtins; // Built-ins called directly
+    size_t builtin_count;
+} aot_compiler;
+
+// Returns the built-in sym is bound to at the top level, if it is one
+static lval* known_builtin(aot_compiler *c, const lval *sym)
+{
+    lval_entry *entry = lval_table_get_entry(c->env->items, sym);
+    if (entry == NULL || entry->value->type != LVAL_FUN ||
+        entry->value->val.vfunc.builtin == NULL ||
+        builtin_c_name(entry->value->val.vfunc.builtin) == NULL) {
+        return NULL;
+    }
+    return entry->value;
+}
+
+static expression_form form_for_expression(aot_compiler *c, const lval *v)
+{
+    size_t n = count(v);
+    if (n == 0) {
+        return form_none;
+    }
+    lval *head = child(v, 0);
+    if (head->type != LVAL_SYM) {
+        if (n == 1 && head->type != LVAL_SEXPR) {
+            return form_value;
+        }
+        return form_none;
+    }
+    lval *f = known_builtin(c, head);
+    if (f == NULL) {
+        return n == 1 ? form_symbol : form_call;
+    }
+    // Special forms evaluate their own arguments (the calls in them are
+    // still compiled)
+    if (special_form_for(f->val.vfunc.builtin) != NULL) {
+        return form_none;
+    }
+    if (f->val.vfunc.builtin == builtin_if && n == 4 &&
+        child(v, 2)->type == LVAL_QEXPR && child(v, 3)->type == LVAL_QEXPR) {
+        return form_if;
+    }
+    return form_builtin;
+}
+
+// Index in c->builtins of the built-in the symbol sym is bound to
+// (adding it if needed)
+static size_t builtin_index(aot_compiler *c, const lval *sym)
+{
+    for (size_t i=0; i<c->builtin_count; i++) {
+        if (strcmp(c->builtins[i].name, sym->val.vsym.name) == 0) {
+            return i;
+        }
+    }
+    c->builtins = realloc(c->builtins,
+                          sizeof(aot_builtin)*(c->builtin_count+1));
+    c->builtins[c->builtin_count].name = sym->val.vsym.name;
+    c->builtins[c->builtin_count].func =
+        known_builtin(c, sym)->val.vfunc.builtin;
+    return c->builtin_count++;
+}
+
+static char* read_source(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *input = malloc(length+1);
+    size_t unused __attribute__((unused)) = fread(input, 1, length, file);
+    fclose(file);
+    input[length] = 0x00;
+    return input;
+}
+
+static void add_module(aot_compiler *c, char *path, char *source)
+{
+    c->modules = realloc(c->modules, sizeof(compiled_module)*(c->module_count+1));
+    compiled_module *m = &c->modules[c->module_count++];
+    *m = (compiled_module){0};
+    m->path = path;
+    m->source = source;
+
+    // Parse exactly as builtin_load_str does
+    size_t pos = 0;
+    lval *label = lval_str(path);
+    m->expr = lval_read_expr(source, &pos, '\0', label);
+    lval_release(label);
+    if (m->expr->type == LVAL_ERR) {
+        return;
+    }
+    collect_module_expressions(&m->expressions, m->expr);
+    m->forms = malloc(sizeof(expression_form)*(m->expressions.count+1));
+    for (size_t i=0; i<m->expressions.count; i++) {
+        m->forms[i] = form_for_expression(c, m->expressions.items[i]);
+    }
+}
+
+static bool has_module(aot_compiler *c, const char *path)
+{
+    for (size_t i=0; i<c->module_count; i++) {
+        if (strcmp(c->modules[i].path, path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds the modules loaded by module m with a literal path, eg (load "file")
+static void add_loaded_modules(aot_compiler *c, size_t m)
+{
+    // Modules are found relative to the current directory, or the directory
+    // of the script that loads them
+    char *path_copy = strdup(c->modules[m].path);
+    char *script_path = strdup(dirname(path_copy));
+    free(path_copy);
+
+    for (size_t i=0; i<c->modules[m].expressions.count; i++) {
+        lval *v = c->modules[m].expressions.items[i];
+        if (count(v) != 2 || child(v, 0)->type != LVAL_SYM ||
+            child(v, 1)->type != LVAL_STR) {
+            continue;
+        }
+        char *name = child(v, 0)->val.vsym.name;
+        if (strcmp(name, "load") != 0 && strcmp(name, "require") != 0) {
+            continue;
+        }
+        lval *path = path_for_file(child(v, 1)->val.vstr, script_path);
+        if (path->type == LVAL_STR && !has_module(c, path->val.vstr)) {
+            char *source = read_source(path->val.vstr);
+            if (source != NULL) {
+                add_module(c, strdup(path->val.vstr), source);
+            }
+        }
+        lval_release(path);
+    }
+    free(script_path);
+}
+
+// Writes s as a C string literal, one line of source per line
+static void emit_c_string(FILE *out, const char *s)
+{
+    fprintf(out, "\"");
+    for (const unsigned char *p = (const unsigned char *)s; *p != 0; p++) {
+        if (*p == '\n') {
+            fprintf(out, "\\n\"\n    \"");
+        } else if (*p == '"' || *p == '\\' || *p == '?') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p == '\t') {
+            fprintf(out, "\\t");
+        } else if (*p < 32 || *p > 126) {
+            fprintf(out, "\\%03o", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fprintf(out, "\"");
+}
+
+// Writes a one line description of v for a comment
+static void emit_comment(FILE *out, const lval *v)
+{
+    char *s = lval_to_string(v);
+    size_t len = strlen(s);
+    if (len > 60) {
+        strcpy(s+57, "...");
+    }
+    for (char *p = s; *p != 0; p++) {
+        if ((unsigned char)*p < 32) {
+            *p = ' ';
+        }
+    }
+    fprintf(out, "// %s (line %d)\n", s, v->source_position.row+1);
+    free(s);
+}
+
+static void emit_function_name(FILE *out, size_t m, size_t k)
+{
+    fprintf(out, "expr_%zu_%zu", m, k);
+}
+
+// Writes code that evaluates the expression x (child i of v, which is
+// expression k in module m) as an S-Expression
+static void emit_evaluate_expression(aot_compiler *c, size_t m, size_t k,
+                                     size_t i)
+{
+    FILE *out = c->out;
+    switch (c->modules[m].forms[k]) {
+        case form_none:
+            fprintf(out, "lval_eval_sexpr(e, child(v, %zu))", i);
+            break;
+        case form_symbol:
+            fprintf(out, "aot_symbol_expression(e, child(v, %zu))", i);
+            break;
+        case form_value:
+            fprintf(out, "aot_value_expression(e, child(v, %zu))", i);
+            break;
+        default:
+            emit_function_name(out, m, k);
+            fprintf(out, "(e, child(v, %zu))", i);
+            break;
+    }
+}
+
+// Index of the expression for child i of expression k
+static size_t child_expression_index(compiled_module *module, size_t k,
+                                     size_t i)
+{
+    lval *v = module->expressions.items[k];
+    size_t next = k+1;
+    for (size_t j=0; j<i; j++) {
+        if (expression_in(child(v, j)) != NULL) {
+            next += module->expressions.sizes[next];
+        }
+    }
+    return next;
+}
+
+// Writes code that evaluates child i of expression k in module m
+static void emit_value(aot_compiler *c, size_t m, size_t k, size_t i)
+{
+    lval *x = child(c->modules[m].expressions.items[k], i);
+    if (x->type == LVAL_SYM) {
+        fprintf(c->out, "lenv_get_cached(e, child(v, %zu))", i);
+    } else if (x->type == LVAL_SEXPR) {
+        size_t index = child_expression_index(&c->modules[m], k, i);
+        emit_evaluate_expression(c, m, index, i);
+    } else {
+        fprintf(c->out, "lval_retain(child(v, %zu))", i);
+    }
+}
+
+static void emit_expression(aot_compiler *c, size_t m, size_t k)
+{
+    FILE *out = c->out;
+    compiled_module *module = &c->modules[m];
+    expression_form form = module->forms[k];
+    if (form != form_builtin && form != form_if && form != form_call) {
+        return;
+    }
+    lval *v = module->expressions.items[k];
+
+    emit_comment(out, v);
+    fprintf(out, "static lval* ");
+    emit_function_name(out, m, k);
+    fprintf(out, "(lenv *e, const lval *v)\n{\n");
+    fprintf(out, "    lval *f = lenv_get_cached(e, child(v, 0));\n");
+
+    if (form == form_call) {
+        fprintf(out, "    if (f->type != LVAL_FUN) {\n");
+    } else {
+        fprintf(out, "    if (f != builtins[%zu]) {\n",
+                builtin_index(c, child(v, 0)));
+    }
+    fprintf(out, "        lval_release(f);\n"
+                 "        return lval_eval_sexpr_interpreted(e, v);\n"
+                 "    }\n"
+                 "    stack_push_frame(v);\n");
+
+    if (form == form_if) {
+        fprintf(out, "    lval *r = NULL;\n"
+                     "    int t = aot_condition(e, v, f, ");
+        emit_value(c, m, k, 1);
+        fprintf(out, ", &r);\n    if (t == 1) {\n        r = ");
+        emit_evaluate_expression(c, m, child_expression_index(module, k, 2), 2);
+        fprintf(out, ";\n    } else if (t == 0) {\n        r = ");
+        emit_evaluate_expression(c, m, child_expression_index(module, k, 3), 3);
+        fprintf(out, ";\n    }\n");
+    } else {
+        fprintf(out, "    lval *a = aot_args(v, %zu);\n", count(v)-1);
+        for (size_t i=1; i<count(v); i++) {
+            fprintf(out, "    aot_arg(a, ");
+            emit_value(c, m, k, i);
+            fprintf(out, ");\n");
+        }
+        if (form == form_call) {
+            fprintf(out, "    lval *r = aot_call(e, v, f, a);\n");
+        } else {
+            lbuiltin func = known_builtin(c, child(v, 0))->val.vfunc.builtin;
+            fprintf(out, "    lval *r = aot_call_builtin(e, v, f, %s, a);\n",
+                    builtin_c_name(func));
+        }
+    }
+    fprintf(out, "    stack_pop_frame();\n    return r;\n}\n\n");
+}
+
+static void emit_module(aot_compiler *c, size_t m)
+{
+    FILE *out = c->out;
+    compiled_module *module = &c->modules[m];
+
+    fprintf(out, "#pragma mark - %s\n\n", module->path);
+    fprintf(out, "static const char source_%zu[] =\n    ", m);
+    emit_c_string(out, module->source);
+    fprintf(out, ";\n\n");
+
+    if (module->expr->type == LVAL_ERR) {
+        return;
+    }
+
+    // Expressions call the expressions inside them, which come after them
+    // in the list, so write them out in reverse order
+    for (size_t k=module->expressions.count; k>0; k--) {
+        emit_expression(c, m, k-1);
+    }
+
+    fprintf(out, "static const lnative natives_%zu[] = {\n", m);
+    for (size_t k=0; k<module->expressions.count; k++) {
+        fprintf(out, "    ");
+        switch (module->forms[k]) {
+            case form_none:
+                fprintf(out, "NULL");
+                break;
+            case form_symbol:
+                fprintf(out, "aot_symbol_expression");
+                break;
+            case form_value:
+                fprintf(out, "aot_value_expression");
+                break;
+            default:
+                emit_function_name(out, m, k);
+                break;
+        }
+        fprintf(out, k+1 < module->expressions.count ? ",\n" : "\n");
+    }
+    // (Empty initializers aren't allowed)
+    if (module->expressions.count == 0) {
+        fprintf(out, "    NULL\n");
+    }
+    fprintf(out, "};\n\n");
+}
+
+int aot_emit_c(lenv *e, const char *path, FILE *out)
+{
+    lval *full_path = path_for_file((char *)path, e->script_path);
+    if (full_path->type == LVAL_ERR) {
+        fprintf(stderr, "%s\n", full_path->val.verr.message);
+        lval_release(full_path);
+        return 1;
+    }
+    char *source = read_source(full_path->val.vstr);
+    if (source == NULL) {
+        fprintf(stderr, "Could not load '%s'\n", full_path->val.vstr);
+        lval_release(full_path);
+        return 1;
+    }
+
+    aot_compiler c = {0};
+    c.out = out;
+    c.env = e;
+
+    // The standard library, the program, then the modules it loads
+    add_module(&c, strdup("benzl-standard-library"),
+               benzl_standard_library());
+    add_module(&c, strdup(full_path->val.vstr), source);
+    lval_release(full_path);
+    for (size_t m=1; m<c.module_count; m++) {
+        add_loaded_modules(&c, m);
+    }
+
+    fprintf(out, "// Generated by benzl --emit-c from %s\n", c.modules[1].path);
+    fprintf(out, "// Build it with the benzl runtime (every src/benz*.c file "
+                 "apart from benzl.c),\n"
+                 "// eg: make native PROGRAM=program.benzl\n\n");
+    fprintf(out, "#include \"benzl-aot.h\"\n\n");
+
+    // Number the built-ins called directly
+    for (size_t m=0; m<c.module_count; m++) {
+        for (size_t k=0; k<c.modules[m].expressions.count; k++) {
+            expression_form form = c.modules[m].forms[k];
+            if (form == form_builtin || form == form_if) {
+                builtin_index(&c, child(c.modules[m].expressions.items[k], 0));
+            }
+        }
+    }
+    // (Arrays can't be empty)
+    fprintf(out, "static lval *builtins[%zu];\n\n", c.builtin_count+1);
+
+    for (size_t m=0; m<c.module_count; m++) {
+        emit_module(&c, m);
+    }
+
+    fprintf(out, "#pragma mark - Program\n\n");
+    fprintf(out, "static const aot_builtin builtin_functions[] = {\n");
+    for (size_t i=0; i<c.builtin_count; i++) {
+        fprintf(out, "    {");
+        emit_c_string(out, c.builtins[i].name);
+        fprintf(out, ", %s},\n", builtin_c_name(c.builtins[i].func));
+    }
+    fprintf(out, "    {NULL, NULL}\n};\n\n");
+
+    fprintf(out, "static const aot_module modules[] = {\n");
+    for (size_t m=0; m<c.module_count; m++) {
+        compiled_module *module = &c.modules[m];
+        fprintf(out, "    {");
+        emit_c_string(out, module->path);
+        if (module->expr->type == LVAL_ERR) {
+            fprintf(out, ", source_%zu, NULL, 0}", m);
+        } else {
+            fprintf(out, ", source_%zu, natives_%zu, %zu}", m, m,
+                    module->expressions.count);
+        }
+        fprintf(out, m+1 < c.module_count ? ",\n" : "\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const aot_program program = {\n"
+                 "    modules, %zu, 1,\n"
+                 "    builtin_functions, builtins, %zu\n"
+                 "};\n\n", c.module_count, c.builtin_count);
+    fprintf(out, "int main(int argc, char **argv)\n{\n"
+                 "    return aot_main(&program, argc, argv);\n}\n");
+
+    for (size_t m=0; m<c.module_count; m++) {
+        free(c.modules[m].path);
+        free(c.modules[m].source);
+        lval_release(c.modules[m].expr);
+        free_expression_list(&c.modules[m].expressions);
+        free(c.modules[m].forms);
+    }
+    free(c.modules);
+    free(c.builtins);
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Ahead-of-time compiler from benzl to C
+// benzl --emit-c program.benzl > program.c translates a program, the modules
+// it loads with a literal path (eg (require "geometry")) and the standard
+// library into C that links against the benzl runtime (every src/benz*.c
+// file apart from benzl.c).
+//
+// Each expression that is evaluated as code becomes a C function. Calls to
+// built-ins that are known when the program is compiled (eg + or nth) call
+// the C function for that built-in directly, instead of looking up the symbol
+// and going through lval_call. Calls to anything else (including functions
+// the program defines) look up the function when the call is made and go
+// through lval_call, as the function can be redefined while the program
+// runs; only the evaluation of their arguments is compiled.
+//
+// The compiled program still contains the source of each module, and parses
+// it at startup in the same way the interpreter does. Compiled code is then
+// attached to the parsed expressions (see vexp.native), so code that treats
+// expressions as data (eg passing a Q-Expression to eval, or printing a
+// function) and stack traces behave exactly as they do in the interpreter.
+// A compiled call to a built-in checks the symbol is still bound to it, and
+// hands the expression to the interpreter if it isn't (eg if + has been
+// redefined), so compiled programs give the same results as benzl does.
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stdio.h>
+
+#include "benzl-lval.h"
+#include "benzl-lenv.h"
+#include "benzl-lval-eval.h"
+#include "benzl-builtins.h"
+#include "benzl-stacktrace.h"
+
+// A built-in function called directly by compiled code
+typedef struct {
+    const char *name; // Name the built-in is bound to
+    lbuiltin func;
+} aot_builtin;
+
+// A source file that has been compiled into a program
+typedef struct {
+    const char *path; // Path (or label) the source is loaded with
+    const char *source; // Source code
+    const lnative *natives; // Compiled code for each expression, or NULL
+    size_t expression_count; // Number of expressions in the source
+} aot_module;
+
+// A program compiled with --emit-c
+typedef struct {
+    const aot_module *modules;
+    size_t module_count;
+    size_t main_module; // Index of the module to run
+    const aot_builtin *builtins; // Built-ins called directly
+    lval **builtin_values; // Functions those built-ins are bound to at startup
+    size_t builtin_count;
+} aot_program;
+
+// Writes out C code for the program at path (and the modules it loads)
+// e must have the built-ins and standard library loaded
+// Returns 0 on success, or prints an error and returns 1
+int aot_emit_c(lenv *e, const char *path, FILE *out);
+
+// Entry point for compiled programs
+// Runs the program's main module with the rest of argv as launch-args
+int aot_main(const aot_program *program, int argc, char **argv);
+
+// Returns the source of the module at path, if it has been compiled into this
+// program, or NULL
+const char* aot_module_source(const char *path);
+
+// Attaches compiled code to the expressions parsed from source, if source is
+// the same as a module compiled into this program
+void aot_attach(lenv *e, lval *expr, const lval *label, const char *source);
+
+#pragma mark - Helpers called from compiled code
+
+// Creates an argument list for a call made by the expression v
+lval* aot_args(const lval *v, size_t n);
+
+// Adds an argument to a list created by aot_args (consumes x)
+static inline void aot_arg(lval *a, lval *x)
+{
+    lval_add(a, x);
+    lval_release(x);
+}
+
+// Calls the built-in f (implemented by func) with the arguments a
+// Consumes f and a
+lval* aot_call_builtin(lenv *e, const lval *v, lval *f, lbuiltin func,
+                       lval *a);
+
+// Calls the function f with the arguments a. Consumes f and a
+lval* aot_call(lenv *e, const lval *v, lval *f, lval *a);
+
+// Checks the condition c of (if c {...} {...}). Consumes f and c
+// Returns 1 or 0 for which branch to take, or -1 if the result is in r
+// (eg an error)
+int aot_condition(lenv *e, const lval *v, lval *f, lval *c, lval **r);
+
+// Compiled code for an expression with a single symbol, eg {n}
+lval* aot_symbol_expression(lenv *e, const lval *v);
+
+// Compiled code for an expression with a single value, eg {1}
+lval* aot_value_expression(lenv *e, const lval *v);
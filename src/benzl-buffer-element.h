@@ -0,0 +1,100 @@
+// Types of number that can be stored in a Buffer, as elements of a fixed
+// size in the native byte order (like get-unsigned-integer etc.)
+// buffer-map passes elements of these types to its function, and csv-columns
+// decodes numeric columns into Buffers of them
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "benzl-lval.h"
+
+// The element types (element_types has their names and sizes)
+typedef enum {
+    element_u8, element_i8, element_u16, element_i16, element_u32,
+    element_i32, element_u64, element_i64, element_f32, element_f64,
+    element_type_count
+} element_type;
+
+static const struct {
+    const char *name;
+    size_t size;
+} element_types[element_type_count] = {
+    {"u8", 1}, {"i8", 1}, {"u16", 2}, {"i16", 2}, {"u32", 4},
+    {"i32", 4}, {"u64", 8}, {"i64", 8}, {"f32", 4}, {"f64", 8}
+};
+
+static inline bool element_type_named(const char *name, element_type *t)
+{
+    for (int i=0; i<element_type_count; i++) {
+        if (strcmp(element_types[i].name, name) == 0) {
+            *t = (element_type)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if i fits in an element of integer type t (writing it won't
+// truncate it). The largest u64 values don't fit in a long, so callers
+// need to read those separately
+static inline bool element_int_fits(element_type t, long i)
+{
+    switch (t) {
+        case element_u8: return i >= 0 && i <= UINT8_MAX;
+        case element_i8: return i >= INT8_MIN && i <= INT8_MAX;
+        case element_u16: return i >= 0 && i <= UINT16_MAX;
+        case element_i16: return i >= INT16_MIN && i <= INT16_MAX;
+        case element_u32: return i >= 0 && i <= (long)UINT32_MAX;
+        case element_i32: return i >= INT32_MIN && i <= INT32_MAX;
+        case element_u64: return i >= 0;
+        default: return true;
+    }
+}
+
+// Reads the element at p into v (an Integer, or a Float for f32 and f64)
+// Elements are in the native byte order, like get-unsigned-integer etc.
+#define READ_ELEMENT(_type, _field) { \
+_type __x; memcpy(&__x, p, sizeof(_type)); v->val._field = __x; break; }
+
+static inline void read_element(element_type t, const uint8_t *p, lval *v)
+{
+    switch (t) {
+        case element_u8: READ_ELEMENT(uint8_t, vint);
+        case element_i8: READ_ELEMENT(int8_t, vint);
+        case element_u16: READ_ELEMENT(uint16_t, vint);
+        case element_i16: READ_ELEMENT(int16_t, vint);
+        case element_u32: READ_ELEMENT(uint32_t, vint);
+        case element_i32: READ_ELEMENT(int32_t, vint);
+        case element_u64: READ_ELEMENT(uint64_t, vint);
+        case element_i64: READ_ELEMENT(int64_t, vint);
+        case element_f32: READ_ELEMENT(float, vflt);
+        case element_f64: READ_ELEMENT(double, vflt);
+        default: break;
+    }
+}
+
+// Writes a number to the element at p (i if it's an integer type, otherwise f)
+#define WRITE_ELEMENT(_type, _value) { \
+_type __x = (_type)(_value); memcpy(p, &__x, sizeof(_type)); break; }
+
+static inline void write_element(element_type t, uint8_t *p, long i, double f)
+{
+    switch (t) {
+        case element_u8: WRITE_ELEMENT(uint8_t, i);
+        case element_i8: WRITE_ELEMENT(int8_t, i);
+        case element_u16: WRITE_ELEMENT(uint16_t, i);
+        case element_i16: WRITE_ELEMENT(int16_t, i);
+        case element_u32: WRITE_ELEMENT(uint32_t, i);
+        case element_i32: WRITE_ELEMENT(int32_t, i);
+        case element_u64: WRITE_ELEMENT(uint64_t, i);
+        case element_i64: WRITE_ELEMENT(int64_t, i);
+        case element_f32: WRITE_ELEMENT(float, f);
+        case element_f64: WRITE_ELEMENT(double, f);
+        default: break;
+    }
+}
@@ -6,6 +6,7 @@
 #include "benzl-lval.h"
 #include "benzl-lval-eval.h"
 #include "benzl-error-macros.h"
+#include "benzl-buffer-element.h"
 
 lval* builtin_create_buffer(lenv *e, const lval *a)
 {
@@ -35,59 +36,141 @@ lval* builtin_buffer_with_bytes(lenv *e, const lval *a)
     return r;
 }
 
+#pragma mark - buffer-map
+
+// Writes the value returned by buffer-map's function for an element
+// With an element type, the value must be a number. Otherwise (when the
+// elements are chunks of bytes) the value's bytes are copied
+// Returns false if the value can't be written
+static bool write_result(uint8_t *p, size_t size, bool typed, element_type t,
+                         const lval *r)
+{
+    switch (r->type) {
+        case LVAL_INT:
+            if (typed) {
+                write_element(t, p, r->val.vint, (double)r->val.vint);
+            } else {
+                memcpy(p, &r->val.vint, MIN(sizeof(long), size));
+            }
+            return true;
+        case LVAL_BYTE:
+            if (typed) {
+                write_element(t, p, r->val.vbyte, r->val.vbyte);
+            } else {
+                *p = r->val.vbyte;
+            }
+            return true;
+        case LVAL_FLT:
+            if (typed) {
+                write_element(t, p, (long)r->val.vflt, r->val.vflt);
+            } else {
+                memcpy(p, &r->val.vflt, MIN(sizeof(double), size));
+            }
+            return true;
+        case LVAL_BUF:
+            if (!typed) {
+                memcpy(p, r->val.vbuf.data, MIN(r->val.vbuf.size, size));
+            }
+            return !typed;
+        default:
+            // Other values leave the element zeroed when mapping bytes
+            return !typed;
+    }
+}
+
 lval* builtin_buffer_map(lenv *e, const lval *a)
 {
-    if (count(a) < 3 || child(a, 0)->type != LVAL_BUF ||
-        child(a, 1)->type != LVAL_INT || child(a, 2)->type != LVAL_FUN) {
+    if (count(a) != 3 || child(a, 0)->type != LVAL_BUF ||
+        (child(a, 1)->type != LVAL_INT && child(a, 1)->type != LVAL_STR) ||
+        child(a, 2)->type != LVAL_FUN) {
         return lval_err_for_val(
-            a, "buffer-map expects 3 arguments in the form"
-               "(buffer-map buffer:Buffer componentSize:Integer func:function)"
+            a, "buffer-map expects 3 arguments in the form "
+               "(buffer-map buffer:Buffer componentSize:Integer func:Function) "
+               "or (buffer-map buffer:Buffer elementType:String func:Function)"
         );
     }
-    lval *buffer = child(a, 0);
-    size_t size = child(a, 1)->val.vint;
-    lval *fun = child(a, 2);
-    lval *new_buffer = lval_buf(buffer->val.vbuf.size);
-
-    lval *data = lval_buf(size);
-    lval *offset = lval_int(0);
-
-    lval *args = lval_qexpr_with_size(2);
-    lval_add(args, data);
-    lval_add(args, offset);
-
-    for (size_t i=0; i<buffer->val.vbuf.size; i+=size) {
-
-        // Update the args
-        memcpy(data->val.vbuf.data, buffer->val.vbuf.data+i, size);
-        offset->val.vint = i/size;
+    const lval *buffer = child(a, 0);
+    const lval *fun = child(a, 2);
+
+    // Either the size of the chunks of bytes passed to the function (as
+    // Buffers), or the type of number the elements are
+    bool typed = child(a, 1)->type == LVAL_STR;
+    element_type t = element_u8;
+    long size;
+    if (typed) {
+        const char *name = child(a, 1)->val.vstr;
+        LASSERTV(a, "buffer-map", element_type_named(name, &t),
+                 "buffer-map: unknown element type '%s' (Expected: u8, i8, "
+                 "u16, i16, u32, i32, u64, i64, f32 or f64)", name);
+        size = (long)element_types[t].size;
+    } else {
+        size = child(a, 1)->val.vint;
+        LASSERTV(a, "buffer-map", size > 0,
+                 "buffer-map: component size must be positive (Got: %ld)",
+                 size);
+    }
+    size_t buffer_size = buffer->val.vbuf.size;
+    LASSERTV(a, "buffer-map", buffer_size % size == 0,
+             "buffer-map: buffer size (%zu bytes) isn't a multiple of the "
+             "element size (%ld bytes)", buffer_size, size);
+
+    bool is_float = typed && (t == element_f32 || t == element_f64);
+    lval *new_buffer = lval_buf(buffer_size);
+    lval *value = !typed ? lval_buf(size) : is_float ? lval_float(0) : lval_int(0);
+    lval *index = lval_int(0);
+    lval *args[2] = {value, index};
+
+    // The function is called with the same environment each time, and the
+    // element and index values are changed in place when the function didn't
+    // keep hold of them
+    lcall_frame frame;
+    lcall_frame_init(&frame, e, fun, 2);
+
+    lval *err = NULL;
+    for (size_t i=0; i<buffer_size; i+=size) {
+        const uint8_t *p = buffer->val.vbuf.data + i;
+        if (!lcall_frame_arg_reusable(&frame, 0, args[0])) {
+            lval_release(args[0]);
+            args[0] = !typed ? lval_buf(size) : is_float ? lval_float(0) : lval_int(0);
+        }
+        if (!lcall_frame_arg_reusable(&frame, 1, args[1])) {
+            lval_release(args[1]);
+            args[1] = lval_int(0);
+        }
+        if (typed) {
+            read_element(t, p, args[0]);
+        } else {
+            memcpy(args[0]->val.vbuf.data, p, size);
+        }
+        args[1]->val.vint = i/size;
 
-        lval *r = lval_call(e, fun, args);
+        lval *r = lcall_frame_call(&frame, args);
         if (r->type == LVAL_ERR) {
-            lval_release(args);
-            lval_release(data);
-            lval_release(offset);
-            return r;
+            err = r;
+            break;
         }
-        memset(new_buffer->val.vbuf.data+i, 0, size);
-        if (r->type == LVAL_BYTE) {
-            new_buffer->val.vbuf.data[i] = r->val.vbyte;
-        } else if (r->type == LVAL_INT) {
-            memcpy(new_buffer->val.vbuf.data+i, &r->val.vint, MIN(sizeof(long), size));
-        } else if (r->type == LVAL_FLT) {
-            memcpy(new_buffer->val.vbuf.data+i, &r->val.vflt, MIN(sizeof(double), size));
-        } else if (r->type == LVAL_BUF) {
-            memcpy(new_buffer->val.vbuf.data+i, &r->val.vbuf.data, MIN(r->val.vbuf.size, size));
+        if (!write_result(new_buffer->val.vbuf.data + i, size, typed, t, r)) {
+            err = lval_err_for_val(
+                a, "buffer-map: function returned %s for element %zu "
+                   "(Expected: a number)", ltype_name(r->type), i/size
+            );
+            lval_release(r);
+            break;
         }
-
         lval_release(r);
     }
-    lval_release(args);
-    lval_release(data);
-    lval_release(offset);
+    lcall_frame_free(&frame);
+    lval_release(args[0]);
+    lval_release(args[1]);
+    if (err != NULL) {
+        lval_release(new_buffer);
+        return err;
+    }
     return new_buffer;
 }
 
+#pragma mark - Getting and setting values
+
 static inline lval* bad_args(const lval *a, const char *func_name)
 {
     return lval_err_for_val(
@@ -4,36 +4,15 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "benzl-builtins.h"
 #include "benzl-lval.h"
 #include "benzl-lval-eval.h"
 #include "benzl-lenv.h"
+#include "benzl-hashmap.h"
 #include "benzl-error-macros.h"
 
-static bool lval_is_true(lval *a) {
-    if (a->type == LVAL_INT) {
-        if (a->val.vint != 0) {
-            return true;
-        }
-    } else if (a->type == LVAL_FLT) {
-        if (a->val.vflt != 0) {
-            return true;
-        }
-    } else if (a->type == LVAL_BYTE) {
-        if (a->val.vbyte != 0) {
-            return true;
-        }
-    } else if (a->type == LVAL_QEXPR) {
-        if (count(a) > 0) {
-            return true;
-        }
-    } else {
-        return true;
-    }
-    return false;
-}
-
 lval* builtin_if(lenv *e, const lval *a) {
 
     lval *v = child(a, 0);
@@ -89,3 +68,204 @@ lval* builtin_logical_not(lenv *e, const lval *a) {
     }
     return lval_int(r);
 }
+
+#pragma mark - select and case
+
+// Checks a {condition value} clause of select, returning the evaluated value
+// if the condition is true, NULL if it isn't, or an error
+static lval* select_clause(lenv *e, const lval *clause)
+{
+    if (clause->type != LVAL_QEXPR || count(clause) != 2) {
+        return lval_err_for_val(clause, "Function 'select' expects clauses "
+                                        "in the form {condition value}");
+    }
+    lval *c = lval_eval(e, child(clause, 0));
+    if (c->type == LVAL_ERR) {
+        return c;
+    }
+    bool is_true = lval_is_true(c);
+    lval_release(c);
+    return is_true ? lval_eval(e, child(clause, 1)) : NULL;
+}
+
+// Checks a {key value} clause of case, returning the evaluated value if the
+// key equals x, NULL if it doesn't, or an error
+static lval* case_clause(lenv *e, const lval *x, const lval *clause)
+{
+    if (clause->type != LVAL_QEXPR || count(clause) != 2) {
+        return lval_err_for_val(clause, "Function 'case' expects clauses in "
+                                        "the form {key value}");
+    }
+    lval *k = lval_eval(e, child(clause, 0));
+    if (k->type == LVAL_ERR) {
+        return k;
+    }
+    bool matches = lval_eq(x, k);
+    lval_release(k);
+    return matches ? lval_eval(e, child(clause, 1)) : NULL;
+}
+
+lval* builtin_select(lenv *e, const lval *a)
+{
+    for (size_t i=0; i<count(a); i++) {
+        lval *r = select_clause(e, child(a, i));
+        if (r != NULL) {
+            return r;
+        }
+    }
+    return lval_err_for_val(a, "No Selection Found");
+}
+
+lval* builtin_case(lenv *e, const lval *a)
+{
+    LASSERTV(a, "case", count(a) >= 1, "Function 'case' expects a value and "
+             "{key value} clauses, eg (case x {1 \"one\"} {2 \"two\"})");
+    for (size_t i=1; i<count(a); i++) {
+        lval *r = case_clause(e, child(a, 0), child(a, i));
+        if (r != NULL) {
+            return r;
+        }
+    }
+    return lval_err_for_val(a, "No case found!");
+}
+
+#pragma mark - Special forms
+
+// Evaluates the arguments of (and ...) or (or ...) in order, stopping at the
+// first one that decides the result (a false one for and, a true one for or)
+static lval* short_circuit(lenv *e, const lval *v, bool decider)
+{
+    for (size_t i=1; i<count(v); i++) {
+        lval *x = lval_eval(e, child(v, i));
+        if (x->type == LVAL_ERR) {
+            return x;
+        }
+        bool is_true = lval_is_true(x);
+        lval_release(x);
+        if (is_true == decider) {
+            return lval_int(decider);
+        }
+    }
+    return lval_int(!decider);
+}
+
+static lval* special_form_and(lenv *e, const lval *v)
+{
+    return short_circuit(e, v, false);
+}
+
+static lval* special_form_or(lenv *e, const lval *v)
+{
+    return short_circuit(e, v, true);
+}
+
+static lval* special_form_select(lenv *e, const lval *v)
+{
+    for (size_t i=1; i<count(v); i++) {
+        lval *clause = lval_eval(e, child(v, i));
+        lval *r = clause->type == LVAL_ERR ? lval_retain(clause)
+                                           : select_clause(e, clause);
+        lval_release(clause);
+        if (r != NULL) {
+            return r;
+        }
+    }
+    return lval_err_for_val(v, "No Selection Found");
+}
+
+// A case expression whose keys are all literals finds its clause with a hash
+// table, built the first time the expression is evaluated
+// The tables are kept in a small direct mapped cache (keyed by the address of
+// the expression, which the cache retains so the address can't be reused)
+#define CASE_CACHE_SIZE 64
+
+static struct {
+    lval *site; // The case expression, or NULL
+    lhashmap *clauses; // Key -> index of its clause, or NULL if not literal
+} case_cache[CASE_CACHE_SIZE];
+
+// Returns a table of the clause index for each key of the case expression v,
+// or NULL if its keys aren't all literals
+static const lhashmap* case_clauses(const lval *v)
+{
+    size_t slot = (((uintptr_t)v >> 4) * 0x9E3779B97F4A7C15ull) >> 58;
+    if (case_cache[slot].site == v) {
+        return case_cache[slot].clauses;
+    }
+
+    lhashmap *clauses = lhashmap_alloc(count(v));
+    for (size_t i=2; i<count(v) && clauses != NULL; i++) {
+        const lval *clause = child(v, i);
+        uint64_t hash;
+        if (clause->type != LVAL_QEXPR || count(clause) != 2 ||
+            !(lval_is_number(child(clause, 0)) ||
+              child(clause, 0)->type == LVAL_STR) ||
+            !lval_hash(child(clause, 0), &hash)) {
+            lhashmap_free(clauses);
+            clauses = NULL;
+        } else if (lhashmap_get(clauses, child(clause, 0), hash) == NULL) {
+            // The first clause with a key is the one that matches
+            lval *index = lval_int((long)i);
+            lhashmap_put(clauses, child(clause, 0), hash, index);
+            lval_release(index);
+        }
+    }
+
+    if (case_cache[slot].site != NULL) {
+        lval_release(case_cache[slot].site);
+        if (case_cache[slot].clauses != NULL) {
+            lhashmap_free(case_cache[slot].clauses);
+        }
+    }
+    case_cache[slot].site = lval_retain(v);
+    case_cache[slot].clauses = clauses;
+    return clauses;
+}
+
+static lval* special_form_case(lenv *e, const lval *v)
+{
+    LASSERTV(v, "case", count(v) >= 2, "Function 'case' expects a value and "
+             "{key value} clauses, eg (case x {1 \"one\"} {2 \"two\"})");
+    lval *x = lval_eval(e, child(v, 1));
+    if (x->type == LVAL_ERR) {
+        return x;
+    }
+
+    lval *r = NULL;
+    const lhashmap *clauses = case_clauses(v);
+    if (clauses != NULL) {
+        uint64_t hash;
+        const lval *index = NULL;
+        if (lval_hash(x, &hash)) {
+            index = lhashmap_get(clauses, x, hash);
+        }
+        if (index != NULL) {
+            r = lval_eval(e, child(child(v, index->val.vint), 1));
+        }
+    } else {
+        for (size_t i=2; i<count(v) && r == NULL; i++) {
+            lval *clause = lval_eval(e, child(v, i));
+            r = clause->type == LVAL_ERR ? lval_retain(clause)
+                                         : case_clause(e, x, clause);
+            lval_release(clause);
+        }
+    }
+    lval_release(x);
+    return r != NULL ? r : lval_err_for_val(v, "No case found!");
+}
+
+lspecial_form special_form_for(lbuiltin f)
+{
+    if (f == builtin_logical_and) {
+        return special_form_and;
+    } else if (f == builtin_logical_or) {
+        return special_form_or;
+    } else if (f == builtin_select) {
+        return special_form_select;
+    } else if (f == builtin_case) {
+        return special_form_case;
+    } else if (f == builtin_do) {
+        return special_form_do;
+    }
+    return NULL;
+}
@@ -0,0 +1,528 @@
+// This file implements built-in functions for reading CSV (and TSV) data
+// csv-each reads one row at a time, calling a function with each row as a
+// list of Strings. csv-columns decodes chosen columns straight into Buffers of
+// numbers (see benzl-buffer-element.h), without creating a String for each
+// value
+// Fields are separated by a delimiter (a comma, unless another is passed),
+// rows end with \n or \r\n, and fields in quotes ("...") can contain the
+// delimiter, newlines and quotes (written as ""), as described in RFC 4180
+// Files are mapped into memory rather than read into a buffer, so only the
+// pages being parsed need to be in memory
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+#include "benzl-error-macros.h"
+#include "benzl-buffer-element.h"
+
+// The data being read, either a mapped file or a Buffer's bytes
+typedef struct {
+    const char *data;
+    size_t size;
+    void *mapped; // The mapping to unmap when finished, or NULL
+} csv_source;
+
+// State while reading rows
+typedef struct {
+    const char *p; // Next character to read
+    const char *end;
+    char delimiter;
+    size_t line; // Line number of p
+    size_t row_line; // Line number the current row starts on
+    // The current row's fields, one after the other, each NUL terminated
+    char *fields;
+    size_t fields_size;
+    size_t fields_capacity;
+    size_t *offsets; // Offset of each field in fields
+    size_t field_count;
+    size_t offsets_capacity;
+    char error[128]; // Set if the data isn't valid CSV
+} csv_reader;
+
+#pragma mark - Reading rows
+
+static void append_chars(csv_reader *r, const char *s, size_t len)
+{
+    if (r->fields_size + len > r->fields_capacity) {
+        size_t capacity = r->fields_capacity == 0 ? 256 : r->fields_capacity;
+        while (r->fields_size + len > capacity) {
+            capacity *= 2;
+        }
+        r->fields = realloc(r->fields, capacity);
+        r->fields_capacity = capacity;
+    }
+    memcpy(r->fields + r->fields_size, s, len);
+    r->fields_size += len;
+}
+
+static void start_field(csv_reader *r)
+{
+    if (r->field_count == r->offsets_capacity) {
+        r->offsets_capacity = r->offsets_capacity == 0 ?
+            16 : r->offsets_capacity * 2;
+        r->offsets = realloc(r->offsets, r->offsets_capacity*sizeof(size_t));
+    }
+    r->offsets[r->field_count++] = r->fields_size;
+}
+
+// Every byte of a word with 1 in the lowest or highest bit
+#define CSV_ONES 0x0101010101010101ULL
+#define CSV_HIGHS 0x8080808080808080ULL
+
+// True if any of the 8 bytes in w is the byte repeated in c
+static inline bool has_byte(uint64_t w, uint64_t c)
+{
+    uint64_t x = w ^ c;
+    return ((x - CSV_ONES) & ~x & CSV_HIGHS) != 0;
+}
+
+// Finds the end of an unquoted field starting at p (the next delimiter or
+// line ending), checking 8 bytes at a time while none of them can end it
+static const char* unquoted_field_end(const csv_reader *r, const char *p)
+{
+    const uint64_t delimiters = CSV_ONES * (uint8_t)r->delimiter;
+    const uint64_t newlines = CSV_ONES * '\n';
+    const uint64_t returns = CSV_ONES * '\r';
+    while (r->end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        if (has_byte(w, delimiters) || has_byte(w, newlines) ||
+            has_byte(w, returns)) {
+            break;
+        }
+        p += 8;
+    }
+    while (p < r->end && *p != r->delimiter && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    return p;
+}
+
+static bool reader_error(csv_reader *r, const char *message, size_t line)
+{
+    snprintf(r->error, sizeof(r->error), "%s on line %zu", message, line);
+    return false;
+}
+
+// Reads a field in quotes, starting at the opening quote
+static bool read_quoted_field(csv_reader *r)
+{
+    const size_t start_line = r->line;
+    r->p++;
+    while (true) {
+        const char *quote = memchr(r->p, '"', (size_t)(r->end - r->p));
+        if (quote == NULL) {
+            return reader_error(r, "Quoted field isn't closed", start_line);
+        }
+        for (const char *nl = r->p;
+             (nl = memchr(nl, '\n', (size_t)(quote - nl))) != NULL; nl++) {
+            r->line++;
+        }
+        append_chars(r, r->p, (size_t)(quote - r->p));
+        r->p = quote + 1;
+        // Two quotes are a quote in the field, one is the end of it
+        if (r->p < r->end && *r->p == '"') {
+            append_chars(r, "\"", 1);
+            r->p++;
+        } else {
+            break;
+        }
+    }
+    if (r->p < r->end && *r->p != r->delimiter && *r->p != '\n' &&
+        *r->p != '\r') {
+        return reader_error(r, "Unexpected character after a quoted field",
+                            r->line);
+    }
+    return true;
+}
+
+// Reads the next row into the reader's fields, skipping blank lines
+// Returns false after the last row, or if the row isn't valid (with the
+// reader's error set)
+static bool read_row(csv_reader *r)
+{
+    while (r->p < r->end && (*r->p == '\n' || *r->p == '\r')) {
+        if (*r->p == '\n') {
+            r->line++;
+        }
+        r->p++;
+    }
+    if (r->p == r->end) {
+        return false;
+    }
+    r->row_line = r->line;
+    r->fields_size = 0;
+    r->field_count = 0;
+    while (true) {
+        start_field(r);
+        if (*r->p == '"') {
+            if (!read_quoted_field(r)) {
+                return false;
+            }
+        } else {
+            const char *field_end = unquoted_field_end(r, r->p);
+            append_chars(r, r->p, (size_t)(field_end - r->p));
+            r->p = field_end;
+        }
+        append_chars(r, "", 1);
+        if (r->p == r->end) {
+            return true;
+        }
+        char c = *r->p++;
+        if (c != r->delimiter) {
+            if (c == '\r' && r->p < r->end && *r->p == '\n') {
+                r->p++;
+            }
+            r->line++;
+            return true;
+        }
+        if (r->p == r->end) {
+            // A delimiter at the very end is followed by an empty field
+            start_field(r);
+            append_chars(r, "", 1);
+            return true;
+        }
+    }
+}
+
+static void reader_free(csv_reader *r)
+{
+    free(r->fields);
+    free(r->offsets);
+}
+
+#pragma mark - Sources and options
+
+// Maps the file at the path into memory, or uses the Buffer's bytes
+// Returns an error, or NULL if the source can be read
+static lval* open_source(const lval *a, const lval *source, csv_source *s)
+{
+    *s = (csv_source){.data = NULL, .size = 0, .mapped = NULL};
+    if (source->type == LVAL_BUF) {
+        s->data = (const char *)source->val.vbuf.data;
+        s->size = source->val.vbuf.size;
+        return NULL;
+    }
+    const char *path = source->val.vstr;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return lval_err_for_val(a, "Unable to read the file at '%s'", path);
+    }
+    s->size = (size_t)st.st_size;
+    if (s->size > 0) {
+        s->mapped = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (s->mapped == MAP_FAILED) {
+            s->mapped = NULL;
+            close(fd);
+            return lval_err_for_val(a, "Unable to read the file at '%s'",
+                                    path);
+        }
+        // Rows are read from start to end, so the kernel can read ahead
+        // and drop pages once they've been parsed
+        madvise(s->mapped, s->size, MADV_SEQUENTIAL);
+        s->data = s->mapped;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void close_source(csv_source *s)
+{
+    if (s->mapped != NULL) {
+        munmap(s->mapped, s->size);
+    }
+}
+
+// Reads options (delimiter:"\t" header:true) from the arguments from first on
+// Returns an error, or NULL if they are valid
+static lval* read_options(lenv *e, const lval *a, char *func, size_t first,
+                          char *delimiter, bool *header)
+{
+    for (size_t i=first; i<count(a); i++) {
+        lval *option = child(a, i);
+        LASSERTV(a, func, option->type == LVAL_KEY_VALUE_PAIR,
+                 "Options for '%s' take the form delimiter:\"\\t\" "
+                 "header:true (Got: %s)", func, ltype_name(option->type));
+        char *name = option->val.vkvpair.key->val.vsym.name;
+        LASSERTV(a, func, strcmp(name, "delimiter") == 0 ||
+                 strcmp(name, "header") == 0, "Unknown option for '%s': '%s' "
+                 "(Expected: delimiter or header)", func, name);
+
+        lval *v = lval_eval(e, option->val.vkvpair.value);
+        if (v->type == LVAL_ERR) {
+            return v;
+        }
+        bool valid;
+        if (strcmp(name, "delimiter") == 0) {
+            valid = v->type == LVAL_STR && strlen(v->val.vstr) == 1 &&
+                    v->val.vstr[0] != '"' && v->val.vstr[0] != '\n' &&
+                    v->val.vstr[0] != '\r';
+            if (valid) {
+                *delimiter = v->val.vstr[0];
+            }
+        } else {
+            valid = v->type == LVAL_INT;
+            if (valid) {
+                *header = v->val.vint != 0;
+            }
+        }
+        lval_release(v);
+        LASSERTV(a, func, valid, strcmp(name, "delimiter") == 0 ?
+                 "Option 'delimiter' for '%s' must be a String of one "
+                 "character (other than a quote or newline)" :
+                 "Option 'header' for '%s' must be true or false", func);
+    }
+    return NULL;
+}
+
+#pragma mark - Typed columns
+
+// How csv-columns decodes a column
+typedef struct {
+    bool skip;
+    bool strings;
+    element_type type; // If it's not skipped or strings
+    lval *values; // The list of Strings, if strings
+    uint8_t *data; // The elements, otherwise
+    size_t size;
+    size_t capacity;
+} csv_column;
+
+// Decodes a field into the column's next element
+static bool append_number(csv_reader *r, csv_column *c, const char *field,
+                          size_t column_index)
+{
+    size_t element_size = element_types[c->type].size;
+    if (c->size + element_size > c->capacity) {
+        c->capacity = c->capacity == 0 ? 1024 : c->capacity * 2;
+        c->data = realloc(c->data, c->capacity);
+    }
+    char *end;
+    long i = 0;
+    double f;
+    bool in_range = true;
+    errno = 0;
+    if (c->type == element_f32 || c->type == element_f64) {
+        f = strtod(field, &end);
+    } else if (c->type == element_u64) {
+        // strtoull would negate a negative number rather than rejecting it
+        unsigned long long u = strtoull(field, &end, 10);
+        in_range = errno != ERANGE && field[strspn(field, " ")] != '-';
+        i = (long)u;
+        f = (double)u;
+    } else {
+        i = strtol(field, &end, 10);
+        in_range = errno != ERANGE && element_int_fits(c->type, i);
+        f = (double)i;
+    }
+    while (*end == ' ') {
+        end++;
+    }
+    if (end == field || *end != 0x00 || !in_range) {
+        snprintf(r->error, sizeof(r->error), "'%.32s' in column %zu on line "
+                 "%zu isn't a valid %s", field, column_index, r->row_line,
+                 element_types[c->type].name);
+        return false;
+    }
+    write_element(c->type, c->data + c->size, i, f);
+    c->size += element_size;
+    return true;
+}
+
+// Reads the column types passed to csv-columns
+// Returns an error, or NULL if they are valid
+static lval* read_column_types(const lval *a, const lval *types,
+                               csv_column *columns)
+{
+    for (size_t i=0; i<count(types); i++) {
+        const lval *t = child(types, i);
+        csv_column *c = &columns[i];
+        *c = (csv_column){.values = NULL, .data = NULL};
+        bool valid = t->type == LVAL_STR;
+        if (valid && strcmp(t->val.vstr, "skip") == 0) {
+            c->skip = true;
+        } else if (valid && strcmp(t->val.vstr, "str") == 0) {
+            c->strings = true;
+            c->values = lval_qexpr();
+        } else {
+            valid = valid && element_type_named(t->val.vstr, &c->type);
+        }
+        if (!valid) {
+            char *s = lval_to_string(t);
+            lval *err = lval_err_for_val(a, "csv-columns: unknown column "
+                                         "type %s (Expected: str, skip, u8, "
+                                         "i8, u16, i16, u32, i32, u64, i64, "
+                                         "f32 or f64)", s);
+            free(s);
+            return err;
+        }
+    }
+    return NULL;
+}
+
+#pragma mark - Built-in functions
+
+lval* builtin_csv_each(lenv *e, const lval *a)
+{
+    LASSERTV(a, "csv-each", count(a) >= 2, "Function 'csv-each' expects a "
+             "file path (or Buffer) and a function, eg (csv-each \"data.csv\" "
+             "(lambda {row} {...}) delimiter:\"\\t\" header:true)");
+    const lval *source = child(a, 0);
+    LASSERTV(a, "csv-each", source->type == LVAL_STR ||
+             source->type == LVAL_BUF, "Function 'csv-each' passed incorrect "
+             "type for arg 0 (Got: %s Expected: String (a file path) or "
+             "Buffer)", ltype_name(source->type));
+    LASSERT_ARG_TYPE("csv-each", a, 1, LVAL_FUN);
+
+    char delimiter = ',';
+    bool header = false;
+    lval *err = read_options(e, a, "csv-each", 2, &delimiter, &header);
+    if (err != NULL) {
+        return err;
+    }
+    csv_source s;
+    err = open_source(a, source, &s);
+    if (err != NULL) {
+        return err;
+    }
+
+    // The function is called with the same environment for every row
+    lcall_frame frame;
+    lcall_frame_init(&frame, e, child(a, 1), 1);
+    csv_reader r = {
+        .p = s.data, .end = s.data + s.size, .delimiter = delimiter,
+        .line = 1, .fields = NULL, .offsets = NULL
+    };
+    size_t row_count = 0;
+    if (header) {
+        read_row(&r);
+    }
+    while (r.error[0] == 0x00 && read_row(&r)) {
+        lval *row = lval_qexpr_with_size(r.field_count);
+        for (size_t i=0; i<r.field_count; i++) {
+            lval *field = lval_str(r.fields + r.offsets[i]);
+            lval_add(row, field);
+            lval_release(field);
+        }
+        row_count++;
+        lval *result = lcall_frame_call(&frame, &row);
+        lval_release(row);
+        if (result->type == LVAL_ERR) {
+            err = result;
+            break;
+        }
+        lval_release(result);
+    }
+    if (err == NULL && r.error[0] != 0x00) {
+        err = lval_err_for_val(a, "csv-each: %s", r.error);
+    }
+    reader_free(&r);
+    lcall_frame_free(&frame);
+    close_source(&s);
+    return err != NULL ? err : lval_int((long)row_count);
+}
+
+lval* builtin_csv_columns(lenv *e, const lval *a)
+{
+    LASSERTV(a, "csv-columns", count(a) >= 2, "Function 'csv-columns' "
+             "expects a file path (or Buffer) and a list of column types, eg "
+             "(csv-columns \"data.csv\" {\"str\" \"skip\" \"f64\"} "
+             "header:true)");
+    const lval *source = child(a, 0);
+    LASSERTV(a, "csv-columns", source->type == LVAL_STR ||
+             source->type == LVAL_BUF, "Function 'csv-columns' passed "
+             "incorrect type for arg 0 (Got: %s Expected: String (a file "
+             "path) or Buffer)", ltype_name(source->type));
+    LASSERT_ARG_TYPE("csv-columns", a, 1, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("csv-columns", a, 1);
+
+    char delimiter = ',';
+    bool header = false;
+    lval *err = read_options(e, a, "csv-columns", 2, &delimiter, &header);
+    if (err != NULL) {
+        return err;
+    }
+    const lval *types = child(a, 1);
+    size_t column_count = count(types);
+    csv_column *columns = calloc(column_count, sizeof(csv_column));
+    err = read_column_types(a, types, columns);
+    csv_source s = {.mapped = NULL};
+    if (err == NULL) {
+        err = open_source(a, source, &s);
+    }
+
+    csv_reader r = {
+        .p = s.data, .end = s.data + s.size, .delimiter = delimiter,
+        .line = 1, .fields = NULL, .offsets = NULL
+    };
+    if (err == NULL && header) {
+        read_row(&r);
+    }
+    while (err == NULL && r.error[0] == 0x00 && read_row(&r)) {
+        if (r.field_count < column_count) {
+            snprintf(r.error, sizeof(r.error), "Row on line %zu has %zu "
+                     "fields (Expected at least %zu)", r.row_line,
+                     r.field_count, column_count);
+            break;
+        }
+        for (size_t i=0; i<column_count; i++) {
+            csv_column *c = &columns[i];
+            char *field = r.fields + r.offsets[i];
+            if (c->strings) {
+                lval *value = lval_str(field);
+                lval_add(c->values, value);
+                lval_release(value);
+            } else if (!c->skip && !append_number(&r, c, field, i)) {
+                break;
+            }
+        }
+    }
+    if (err == NULL && r.error[0] != 0x00) {
+        err = lval_err_for_val(a, "csv-columns: %s", r.error);
+    }
+
+    // One value for each column that isn't skipped, a list of Strings or a
+    // Buffer of numbers
+    lval *result = err == NULL ? lval_qexpr_with_size(column_count) : NULL;
+    for (size_t i=0; i<column_count; i++) {
+        csv_column *c = &columns[i];
+        if (result != NULL && c->strings) {
+            lval_add(result, c->values);
+        } else if (result != NULL && !c->skip) {
+            // The Buffer takes the decoded elements rather than a copy
+            lval *buffer = lval_buf(0);
+            if (c->size > 0) {
+                free(buffer->val.vbuf.data);
+                buffer->val.vbuf.data = realloc(c->data, c->size);
+                buffer->val.vbuf.size = c->size;
+                c->data = NULL;
+            }
+            lval_add(result, buffer);
+            lval_release(buffer);
+        }
+        if (c->values != NULL) {
+            lval_release(c->values);
+        }
+        free(c->data);
+    }
+    free(columns);
+    reader_free(&r);
+    close_source(&s);
+    return err != NULL ? err : result;
+}
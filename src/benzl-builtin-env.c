@@ -4,6 +4,7 @@
 // Part of benzl - https://github.com/pokeb/benzl
 
 #include <stddef.h>
+#include <string.h>
 
 #include "benzl-builtins.h"
 #include "benzl-lval.h"
@@ -162,35 +163,62 @@ lval* builtin_set_prop(lenv *e, const lval *a) {
 
     lval *prop_name = child(syms, 1);
 
-    lval *type_props = obj->val.vinst.type->val.vtype.props;
-    bool found = false;
-    for (size_t i=0; i<count(type_props); i++) {
-        lval *prop = child(type_props, i);
-        if (prop->type == LVAL_KEY_VALUE_PAIR) {
-            prop = prop->val.vkvpair.key;
-        }
-        if (equal_symbols(prop, prop_name)) {
-            found = true;
-            break;
-        }
-    }
-    if (!found) {
+    long slot = instance_slot(obj, prop_name, 0);
+    if (slot < 0) {
         lval *err = lval_err_for_val(a, "set-prop: %s has no property %s'",
                                     obj->val.vinst.type->val.vtype.name,
-                                    prop_name->val.vsym);
+                                    prop_name->val.vsym.name);
         lval_release(obj);
         return err;
     }
-    lval_table_insert(obj->val.vinst.props, prop_name, child(a, 1));
+    lval *value = lval_retain(child(a, 1));
+    lval_release(obj->val.vinst.slots[slot]);
+    obj->val.vinst.slots[slot] = value;
     return obj;
 }
 
-static void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
+// C function names of the built-ins, for code generated by --emit-c
+#define MAX_BUILTINS 256
+static struct {
+    lbuiltin func;
+    const char *c_name;
+} builtin_c_names[MAX_BUILTINS];
+static size_t builtin_count = 0;
+
+static void lenv_add_builtin_named(lenv *e, char *name, lbuiltin func,
+                                   const char *c_name) {
     lval *sym = lval_sym(name);
     lval *fun = lval_fun(func);
     lenv_def(e, sym, fun);
     lval_release(sym);
     lval_release(fun);
+
+    if (builtin_count < MAX_BUILTINS && builtin_c_name(func) == NULL) {
+        builtin_c_names[builtin_count].func = func;
+        builtin_c_names[builtin_count].c_name = c_name;
+        builtin_count++;
+    }
+}
+
+#define lenv_add_builtin(e, name, func) \
+    lenv_add_builtin_named(e, name, func, #func)
+
+const char* builtin_c_name(lbuiltin func) {
+    for (size_t i=0; i<builtin_count; i++) {
+        if (builtin_c_names[i].func == func) {
+            return builtin_c_names[i].c_name;
+        }
+    }
+    return NULL;
+}
+
+lbuiltin builtin_named(const char *c_name) {
+    for (size_t i=0; i<builtin_count; i++) {
+        if (strcmp(builtin_c_names[i].c_name, c_name) == 0) {
+            return builtin_c_names[i].func;
+        }
+    }
+    return NULL;
 }
 
 void lenv_add_builtins(lenv *e) {
@@ -217,6 +245,14 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "last", builtin_last);
     lenv_add_builtin(e, "nth", builtin_nth);
 
+    // Sequences
+    lenv_add_builtin(e, "range", builtin_range);
+    lenv_add_builtin(e, "iterate", builtin_iterate);
+    lenv_add_builtin(e, "lazy-map", builtin_lazy_map);
+    lenv_add_builtin(e, "lazy-filter", builtin_lazy_filter);
+    lenv_add_builtin(e, "take-while", builtin_take_while);
+    lenv_add_builtin(e, "collect", builtin_collect);
+
 
     // Mathematical functions
     lenv_add_builtin(e, "+", builtin_add);
@@ -242,6 +278,11 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "==", builtin_equal);
     lenv_add_builtin(e, "!=", builtin_not_equal);
 
+    // Loops
+    lenv_add_builtin(e, "while", builtin_while);
+    lenv_add_builtin(e, "for", builtin_for);
+    lenv_add_builtin(e, "for-each", builtin_for_each);
+
     // Errors
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "try", builtin_try);
@@ -254,6 +295,9 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "or", builtin_logical_or);
     lenv_add_builtin(e, "and", builtin_logical_and);
     lenv_add_builtin(e, "not", builtin_logical_not);
+    lenv_add_builtin(e, "select", builtin_select);
+    lenv_add_builtin(e, "cond", builtin_select);
+    lenv_add_builtin(e, "case", builtin_case);
 
     // Buffers
     lenv_add_builtin(e, "create-buffer", builtin_create_buffer);
@@ -282,6 +326,17 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "get-string", builtin_get_string);
     lenv_add_builtin(e, "put-bytes", builtin_put_bytes);
     lenv_add_builtin(e, "get-bytes", builtin_get_bytes);
+    lenv_add_builtin(e, "pack-struct", builtin_pack_struct);
+    lenv_add_builtin(e, "unpack-struct", builtin_unpack_struct);
+    lenv_add_builtin(e, "unpack-struct-array", builtin_unpack_struct_array);
+    lenv_add_builtin(e, "serialize", builtin_serialize);
+    lenv_add_builtin(e, "deserialize", builtin_deserialize);
+    lenv_add_builtin(e, "deserialize-file", builtin_deserialize_file);
+    lenv_add_builtin(e, "json-parse", builtin_json_parse);
+    lenv_add_builtin(e, "json-stringify", builtin_json_stringify);
+    lenv_add_builtin(e, "json-each", builtin_json_each);
+    lenv_add_builtin(e, "csv-each", builtin_csv_each);
+    lenv_add_builtin(e, "csv-columns", builtin_csv_columns);
 
 
     // String format
@@ -293,6 +348,8 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "eval", builtin_eval);
     lenv_add_builtin(e, "eval-string", builtin_eval_string);
     lenv_add_builtin(e, "load", builtin_load);
+    lenv_add_builtin(e, "do", builtin_do);
+    lenv_add_builtin(e, "let", builtin_let);
 
     // Type functions
     lenv_add_builtin(e, "type-of", builtin_type_of);
@@ -303,17 +360,55 @@ void lenv_add_builtins(lenv *e) {
     // Dictionary functions
     lenv_add_builtin(e, "dict", builtin_dictionary);
 
+    // Map and set functions
+    lenv_add_builtin(e, "hash-map", builtin_hash_map);
+    lenv_add_builtin(e, "put", builtin_put);
+    lenv_add_builtin(e, "remove", builtin_remove);
+    lenv_add_builtin(e, "persistent-map", builtin_persistent_map);
+    lenv_add_builtin(e, "assoc", builtin_assoc);
+    lenv_add_builtin(e, "dissoc", builtin_dissoc);
+    lenv_add_builtin(e, "ordered-map", builtin_ordered_map);
+    lenv_add_builtin(e, "ordered-set", builtin_ordered_set);
+    lenv_add_builtin(e, "add", builtin_add_key);
+    lenv_add_builtin(e, "rank", builtin_rank);
+    lenv_add_builtin(e, "key-at", builtin_key_at);
+    lenv_add_builtin(e, "between", builtin_between);
+    lenv_add_builtin(e, "get", builtin_get);
+    lenv_add_builtin(e, "has", builtin_has);
+    lenv_add_builtin(e, "keys", builtin_keys);
+    lenv_add_builtin(e, "values", builtin_values);
+    lenv_add_builtin(e, "entries", builtin_entries);
+    lenv_add_builtin(e, "hash-set", builtin_hash_set);
+    lenv_add_builtin(e, "from-list", builtin_from_list);
+    lenv_add_builtin(e, "to-list", builtin_to_list);
+    lenv_add_builtin(e, "union", builtin_union);
+    lenv_add_builtin(e, "intersection", builtin_intersection);
+    lenv_add_builtin(e, "difference", builtin_difference);
+
+    // Image functions
+    lenv_add_builtin(e, "fill-rect", builtin_fill_rect);
+    lenv_add_builtin(e, "fill-gradient", builtin_fill_gradient);
+    lenv_add_builtin(e, "fill-circle", builtin_fill_circle);
+    lenv_add_builtin(e, "draw-line", builtin_draw_line);
+    lenv_add_builtin(e, "blit", builtin_blit);
+    lenv_add_builtin(e, "blend", builtin_blend);
+    lenv_add_builtin(e, "mix-rgba", builtin_mix_rgba);
+    lenv_add_builtin(e, "encode-bmp", builtin_encode_bmp);
+    lenv_add_builtin(e, "encode-ppm", builtin_encode_ppm);
+
     // File functions
     lenv_add_builtin(e, "read-file", builtin_read_file);
     lenv_add_builtin(e, "write-file", builtin_write_file);
 
     // Time
     lenv_add_builtin(e, "cpu-time-since", builtin_cpu_time_since);
+    lenv_add_builtin(e, "bench", builtin_bench);
 
     // Misc
     lenv_add_builtin(e, "console-size", builtin_console_size);
     lenv_add_builtin(e, "version", builtin_version);
     lenv_add_builtin(e, "print-env", builtin_print_env);
+    lenv_add_builtin(e, "runtime-stats", builtin_runtime_stats);
     lenv_add_builtin(e, "exit", builtin_exit);
 }
 
@@ -421,6 +516,10 @@ char* builtin_func_string(lbuiltin func) {
         return "console-size";
     } else if (func == builtin_version) {
         return "version";
+    } else if (func == builtin_bench) {
+        return "bench";
+    } else if (func == builtin_runtime_stats) {
+        return "runtime-stats";
     } else if (func == builtin_create_buffer) {
         return "create-buffer";
     } else if (func == builtin_buffer_with_bytes) {
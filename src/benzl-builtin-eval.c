@@ -17,6 +17,8 @@
 #include "benzl-lenv.h"
 #include "benzl-parse.h"
 #include "benzl-error-macros.h"
+#include "benzl-fold.h"
+#include "benzl-aot.h"
 
 lval* builtin_eval(lenv *e, const lval *a) {
 
@@ -65,6 +67,9 @@ lval* builtin_load_str(lenv *e, char *input, lval *source_file) {
     if (expr->type == LVAL_ERR) {
         lval_println(expr);
     } else {
+        fold_constants(e, expr);
+        // Use compiled code, if this source was compiled with --emit-c
+        aot_attach(e, expr, source_file, input);
         for (size_t i=0; i<count(expr); i++) {
             lval *x = lval_eval(e, child(expr, i));
             if (x->type == LVAL_ERR) {
@@ -143,23 +148,38 @@ lval* builtin_load(lenv *e, const lval *a) {
         return lval_sexpr();
     }
 
-    FILE *file = fopen(path->val.vstr, "rb");
-    if (file == NULL){
+    // Programs compiled with --emit-c include the modules they load
+    const char *compiled_source = aot_module_source(path->val.vstr);
+
+    FILE *file = compiled_source ? NULL : fopen(path->val.vstr, "rb");
+    if (file == NULL && compiled_source == NULL){
         lval *err = lval_err("Could not load library '%s'", path->val.vstr);
+        lval_release(path);
         return err;
     }
 
     // Store the directory that contains this script in the environment
     // this will help when scripts use require to load modules in the same directory
-    e->script_path = dirname(path->val.vstr);
+    // (dirname may modify its argument, so we pass it a copy of the path)
+    char *path_copy = strdup(path->val.vstr);
+    if (e->script_path != NULL) {
+        free(e->script_path);
+    }
+    e->script_path = strdup(dirname(path_copy));
+    free(path_copy);
 
-    fseek(file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    char *input = malloc(length+1);
-    size_t unused __attribute__((unused)) = fread(input, 1, length, file);
-    fclose(file);
-    input[length] = 0x00;
+    char *input = NULL;
+    if (compiled_source != NULL) {
+        input = strdup(compiled_source);
+    } else {
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        input = malloc(length+1);
+        size_t unused __attribute__((unused)) = fread(input, 1, length, file);
+        fclose(file);
+        input[length] = 0x00;
+    }
 
     record_module_loaded(e, path->val.vstr);
 
@@ -169,3 +189,43 @@ lval* builtin_load(lenv *e, const lval *a) {
     return r;
 }
 
+
+#pragma mark - do and let
+
+lval* builtin_do(lenv *e, const lval *a)
+{
+    if (count(a) == 0) {
+        return lval_qexpr();
+    }
+    return lval_retain(child(a, count(a)-1));
+}
+
+lval* special_form_do(lenv *e, const lval *v)
+{
+    // Each expression is evaluated in the caller's environment, and only the
+    // last value is kept
+    lval *r = NULL;
+    for (size_t i=1; i<count(v); i++) {
+        if (r != NULL) {
+            lval_release(r);
+        }
+        r = lval_eval(e, child(v, i));
+        if (r->type == LVAL_ERR) {
+            break;
+        }
+    }
+    return r != NULL ? r : lval_qexpr();
+}
+
+lval* builtin_let(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("let", a, 1);
+    LASSERT_ARG_TYPE("let", a, 0, LVAL_QEXPR);
+
+    // Anything defined in the body is only visible inside it
+    lenv *scope = lenv_alloc(1);
+    scope->parent = e;
+    lval *r = lval_eval_sexpr(scope, child(a, 0));
+    lenv_free(scope);
+    return r;
+}
@@ -54,11 +54,14 @@ lval *builtin_fun(lenv *e, const lval *a) {
 
     lval *fname = child(args, 0);
 
-    lval *fargs = lval_qexpr_with_size(count(args)-1);
+    lval *params = lval_qexpr_with_size(count(args)-1);
     for (size_t i=1; i<count(args); i++) {
-        lval_add(fargs, child(args, i));
+        lval_add(params, child(args, i));
     }
+    // Look up parameter types once, rather than on every call
+    lval *fargs = resolve_param_types(e, params);
     lval *fun = lval_lambda(fargs, fbody);
+    lval_release(params);
     lval_release(fargs);
 
     lval *err = lenv_def(e, fname, fun);
@@ -111,7 +114,10 @@ lval *builtin_lambda(lenv *e, const lval *a) {
         }
     }
 
-    args = child(a, 0);
+    // Look up parameter types once, rather than on every call
+    args = resolve_param_types(e, child(a, 0));
     fbody = child(a, 1);
-    return lval_lambda(args, fbody);
+    lval *r = lval_lambda(args, fbody);
+    lval_release(args);
+    return r;
 }
@@ -0,0 +1,504 @@
+// This file implements built-in functions for drawing into images
+// An image is a Buffer of 32 bit RGBA pixels (0xRRGGBBAA, in the native byte
+// order, as get-unsigned-integer reads them), with the same layout as the
+// Image type in sample/bitmap.benzl: rows are stored bottom row first (like a
+// BMP file), but y = 0 is the top row. Functions take the buffer and the
+// width of the image in pixels (the height is worked out from the size)
+// Like other built-ins, drawing functions return a new buffer rather than
+// changing the one they are passed. Passing the option in-place:true opts in
+// to drawing into the buffer itself (and returning it), so drawing shape after
+// shape on a large image doesn't copy it every time
+// The inner loops work on whole rows of pixels at a time, and are written so
+// the compiler can vectorize them
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+#include "benzl-error-macros.h"
+
+// Returns the error from _expr (a call returning an error lval or NULL)
+#define LCHECK(_expr) { \
+lval *__err = (_expr); \
+if (__err != NULL) { return __err; } }
+
+// An image passed to a built-in function
+typedef struct {
+    lval *buffer;
+    uint32_t *pixels;
+    long width;
+    long height;
+} image;
+
+#pragma mark - Arguments
+
+// Gets the image passed as arguments i (the buffer) and i+1 (its width)
+// Returns an error if they aren't a valid image, or NULL
+static lval* image_arg(const lval *a, char *func, int i, image *img)
+{
+    LASSERT_ARG_TYPE(func, a, i, LVAL_BUF);
+    LASSERT_ARG_TYPE(func, a, i+1, LVAL_INT);
+    lval *buffer = child(a, i);
+    long width = child(a, i+1)->val.vint;
+    size_t size = buffer->val.vbuf.size;
+    LASSERTV(a, func, width > 0 && size % (width*4) == 0,
+             "Function '%s' passed a buffer of %zu bytes, which isn't an "
+             "image %ld pixels wide (4 bytes per pixel)", func, size, width);
+    img->buffer = buffer;
+    img->pixels = (uint32_t *)buffer->val.vbuf.data;
+    img->width = width;
+    img->height = (long)(size / (width*4));
+    return NULL;
+}
+
+// Gets number argument i as a double
+// Returns an error if it isn't a number, or NULL
+static lval* number_arg(const lval *a, char *func, int i, double *n)
+{
+    const lval *v = child(a, i);
+    LASSERTV(a, func, lval_is_number(v),
+             "Function '%s' passed incorrect type for arg %d "
+             "(Got: %s Expected: a number)", func, i, ltype_name(v->type));
+    switch (v->type) {
+        case LVAL_FLT: *n = v->val.vflt; break;
+        case LVAL_BYTE: *n = v->val.vbyte; break;
+        default: *n = (double)v->val.vint; break;
+    }
+    return NULL;
+}
+
+// Gets n number arguments, starting at argument i
+static lval* number_args(const lval *a, char *func, int i, double *n,
+                         int count)
+{
+    for (int j=0; j<count; j++) {
+        LCHECK(number_arg(a, func, i+j, &n[j]));
+    }
+    return NULL;
+}
+
+// Gets colour argument i (an Integer in the form 0xRRGGBBAA)
+// Small hex literals like 0x000000FF are read as Bytes, so allow those too
+static lval* color_arg(const lval *a, char *func, int i, uint32_t *color)
+{
+    const lval *v = child(a, i);
+    LASSERTV(a, func, v->type == LVAL_INT || v->type == LVAL_BYTE,
+             "Function '%s' passed incorrect type for arg %d "
+             "(Got: %s Expected: a colour)", func, i, ltype_name(v->type));
+    *color = v->type == LVAL_INT ? (uint32_t)v->val.vint : v->val.vbyte;
+    return NULL;
+}
+
+// Reads the in-place:true option, if it is the last argument, and sets
+// *arg_count to the number of arguments before it
+static lval* in_place_option(lenv *e, const lval *a, char *func,
+                             size_t *arg_count, bool *in_place)
+{
+    *arg_count = count(a);
+    *in_place = false;
+    if (count(a) == 0 || child(a, count(a)-1)->type != LVAL_KEY_VALUE_PAIR) {
+        return NULL;
+    }
+    const lval *option = child(a, count(a)-1);
+    char *name = option->val.vkvpair.key->val.vsym.name;
+    LASSERTV(a, func, strcmp(name, "in-place") == 0,
+             "Unknown option for '%s': '%s' (Expected: in-place)", func, name);
+    lval *v = lval_eval(e, option->val.vkvpair.value);
+    if (v->type == LVAL_ERR) {
+        return v;
+    }
+    bool valid = v->type == LVAL_INT;
+    *in_place = valid && v->val.vint != 0;
+    lval_release(v);
+    LASSERTV(a, func, valid, "Option 'in-place' for '%s' must be true or "
+             "false", func);
+    (*arg_count)--;
+    return NULL;
+}
+
+// Checks the number of arguments (not counting in-place:true) is between
+// min and max
+static lval* drawing_args(lenv *e, const lval *a, char *func, size_t min,
+                          size_t max, bool *in_place, size_t *arg_count)
+{
+    LCHECK(in_place_option(e, a, func, arg_count, in_place));
+    if (min == max) {
+        LASSERTV(a, func, *arg_count == min, "Function '%s' passed wrong "
+                 "number of arguments (Got: %zu Expected: %zu)",
+                 func, *arg_count, min);
+    } else {
+        LASSERTV(a, func, *arg_count >= min && *arg_count <= max,
+                 "Function '%s' passed wrong number of arguments "
+                 "(Got: %zu Expected: %zu or %zu)", func, *arg_count, min, max);
+    }
+    return NULL;
+}
+
+// Makes img a copy of the image to draw into, unless drawing in place
+static void begin_drawing(image *img, bool in_place)
+{
+    img->buffer = in_place ? lval_retain(img->buffer) : lval_copy(img->buffer);
+    img->pixels = (uint32_t *)img->buffer->val.vbuf.data;
+}
+
+#pragma mark - Pixels
+
+// Returns the pixels of row y (where y = 0 is the top row)
+static inline uint32_t* image_row(const image *img, long y)
+{
+    return img->pixels + (img->height - 1 - y) * img->width;
+}
+
+// Mixes two colours: amount 0 is all c1, amount 1 is all c2
+static inline uint32_t mix(uint32_t c1, uint32_t c2, float amount)
+{
+    uint32_t r = 0;
+    for (int shift=0; shift<32; shift+=8) {
+        float x = (float)((c1 >> shift) & 0xFF);
+        float y = (float)((c2 >> shift) & 0xFF);
+        r |= (uint32_t)(int32_t)(x + (y - x) * amount) << shift;
+    }
+    return r;
+}
+
+// Returns src drawn over dst, using the alpha of src
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t src)
+{
+    uint32_t alpha = src & 0xFF;
+    uint32_t r = 0;
+    for (int shift=8; shift<32; shift+=8) {
+        uint32_t s = (src >> shift) & 0xFF;
+        uint32_t d = (dst >> shift) & 0xFF;
+        r |= ((s * alpha + d * (255 - alpha) + 127) / 255) << shift;
+    }
+    return r | (alpha + ((dst & 0xFF) * (255 - alpha) + 127) / 255);
+}
+
+// Sets pixels x0 (inclusive) to x1 (exclusive) of a row to color
+static inline void fill_span(uint32_t *restrict row, long x0, long x1,
+                             uint32_t color)
+{
+    for (long x=x0; x<x1; x++) {
+        row[x] = color;
+    }
+}
+
+// Returns the first whole pixel coordinate >= v, clipped to 0..max
+static inline long clip(double v, long max)
+{
+    return !(v > 0) ? 0 : v >= max ? max : (long)ceil(v);
+}
+
+// The range of whole pixel coordinates from start (inclusive) to end
+// (exclusive), clipped to 0..max
+static inline void clip_span(double start, double end, long max,
+                             long *from, long *to)
+{
+    *from = clip(start, max);
+    *to = clip(end, max);
+}
+
+#pragma mark - Drawing
+
+lval* builtin_fill_rect(lenv *e, const lval *a)
+{
+    image img;
+    double r[4];
+    uint32_t color;
+    bool in_place;
+    size_t n;
+    LCHECK(drawing_args(e, a, "fill-rect", 7, 7, &in_place, &n));
+    LCHECK(image_arg(a, "fill-rect", 0, &img));
+    LCHECK(number_args(a, "fill-rect", 2, r, 4));
+    LCHECK(color_arg(a, "fill-rect", 6, &color));
+    begin_drawing(&img, in_place);
+    long x0, x1, y0, y1;
+    clip_span(r[0], r[0] + r[2], img.width, &x0, &x1);
+    clip_span(r[1], r[1] + r[3], img.height, &y0, &y1);
+    for (long y=y0; y<y1; y++) {
+        fill_span(image_row(&img, y), x0, x1, color);
+    }
+    return img.buffer;
+}
+
+lval* builtin_fill_gradient(lenv *e, const lval *a)
+{
+    image img;
+    double r[4];
+    uint32_t top, bottom;
+    bool in_place;
+    size_t n;
+    LCHECK(drawing_args(e, a, "fill-gradient", 8, 8, &in_place, &n));
+    LCHECK(image_arg(a, "fill-gradient", 0, &img));
+    LCHECK(number_args(a, "fill-gradient", 2, r, 4));
+    LCHECK(color_arg(a, "fill-gradient", 6, &top));
+    LCHECK(color_arg(a, "fill-gradient", 7, &bottom));
+    begin_drawing(&img, in_place);
+    long x0, x1, y0, y1;
+    clip_span(r[0], r[0] + r[2], img.width, &x0, &x1);
+    clip_span(r[1], r[1] + r[3], img.height, &y0, &y1);
+    for (long y=y0; y<y1; y++) {
+        float amount = r[3] > 0 ? (float)((y - r[1]) / r[3]) : 0;
+        fill_span(image_row(&img, y), x0, x1, mix(top, bottom, amount));
+    }
+    return img.buffer;
+}
+
+// Sets pixels x0 to x1 of row y to a radial gradient, from center at the
+// point cx, cy to edge at distance sqrt(r2)
+// Colours are mixed by the squared distance from the centre
+static void radial_span(uint32_t *restrict row, long x0, long x1,
+                        double cx, double dy, double r2,
+                        uint32_t center, uint32_t edge)
+{
+    float dy2 = (float)(dy * dy);
+    float inv_r2 = (float)(1.0 / r2);
+    float dx0 = (float)(x0 - cx);
+    // (An int counter and float offsets keep the loop vectorizable)
+    row += x0;
+    for (int i=0; i<(int)(x1 - x0); i++) {
+        float dx = dx0 + (float)i;
+        row[i] = mix(center, edge, (dx * dx + dy2) * inv_r2);
+    }
+}
+
+lval* builtin_fill_circle(lenv *e, const lval *a)
+{
+    image img;
+    double c[3];
+    uint32_t color, edge;
+    bool in_place;
+    size_t n;
+    LCHECK(drawing_args(e, a, "fill-circle", 6, 7, &in_place, &n));
+    LCHECK(image_arg(a, "fill-circle", 0, &img));
+    LCHECK(number_args(a, "fill-circle", 2, c, 3));
+    LCHECK(color_arg(a, "fill-circle", 5, &color));
+    if (n == 7) {
+        LCHECK(color_arg(a, "fill-circle", 6, &edge));
+    }
+    begin_drawing(&img, in_place);
+    double cx = c[0], cy = c[1], r2 = c[2] * c[2];
+    long y0, y1;
+    clip_span(cy - c[2], cy + c[2], img.height, &y0, &y1);
+    for (long y=y0; y<y1; y++) {
+        // Pixels in this row are in the circle where dx^2 + dy^2 < r^2
+        double dy = y - cy;
+        if (dy * dy >= r2) {
+            continue;
+        }
+        double half_width = sqrt(r2 - dy * dy);
+        long x0 = clip(floor(cx - half_width) + 1, img.width);
+        long x1 = clip(cx + half_width, img.width);
+        uint32_t *row = image_row(&img, y);
+        if (n == 7) {
+            radial_span(row, x0, x1, cx, dy, r2, color, edge);
+        } else {
+            fill_span(row, x0, x1, color);
+        }
+    }
+    return img.buffer;
+}
+
+lval* builtin_draw_line(lenv *e, const lval *a)
+{
+    image img;
+    double p[4];
+    uint32_t color;
+    bool in_place;
+    size_t n;
+    LCHECK(drawing_args(e, a, "draw-line", 7, 7, &in_place, &n));
+    LCHECK(image_arg(a, "draw-line", 0, &img));
+    LCHECK(number_args(a, "draw-line", 2, p, 4));
+    LCHECK(color_arg(a, "draw-line", 6, &color));
+    begin_drawing(&img, in_place);
+    // Bresenham's line algorithm
+    long x = lround(p[0]), y = lround(p[1]);
+    long x1 = lround(p[2]), y1 = lround(p[3]);
+    long dx = labs(x1 - x), dy = -labs(y1 - y);
+    long sx = x < x1 ? 1 : -1, sy = y < y1 ? 1 : -1;
+    long error = dx + dy;
+    while (true) {
+        if (x >= 0 && x < img.width && y >= 0 && y < img.height) {
+            image_row(&img, y)[x] = color;
+        }
+        if (x == x1 && y == y1) {
+            break;
+        }
+        long e2 = 2 * error;
+        if (e2 >= dy) {
+            error += dy;
+            x += sx;
+        }
+        if (e2 <= dx) {
+            error += dx;
+            y += sy;
+        }
+    }
+    return img.buffer;
+}
+
+#pragma mark - Combining images
+
+// Draws src onto dst with its top left corner at x, y (or blends it, if
+// blend is true)
+static lval* draw_image(lenv *e, const lval *a, char *func, bool blend)
+{
+    image dst, src;
+    double p[2];
+    bool in_place;
+    size_t n;
+    LCHECK(drawing_args(e, a, func, 6, 6, &in_place, &n));
+    LCHECK(image_arg(a, func, 0, &dst));
+    LCHECK(image_arg(a, func, 2, &src));
+    LCHECK(number_args(a, func, 4, p, 2));
+    begin_drawing(&dst, in_place);
+    long x = lround(p[0]), y = lround(p[1]);
+    long x0, x1, y0, y1;
+    clip_span(x, x + src.width, dst.width, &x0, &x1);
+    clip_span(y, y + src.height, dst.height, &y0, &y1);
+    uint32_t *copy = NULL;
+    if (dst.buffer == src.buffer) {
+        // Draw from a copy, so drawing doesn't change the pixels it reads
+        copy = malloc(src.buffer->val.vbuf.size);
+        memcpy(copy, src.pixels, src.buffer->val.vbuf.size);
+        src.pixels = copy;
+    }
+    for (long row=y0; row<y1; row++) {
+        uint32_t *restrict d = image_row(&dst, row) + x0;
+        const uint32_t *restrict s = image_row(&src, row - y) + (x0 - x);
+        if (blend) {
+            for (long i=0; i<x1-x0; i++) {
+                d[i] = blend_pixel(d[i], s[i]);
+            }
+        } else if (x1 > x0) {
+            memcpy(d, s, sizeof(uint32_t) * (x1 - x0));
+        }
+    }
+    free(copy);
+    return dst.buffer;
+}
+
+lval* builtin_blit(lenv *e, const lval *a)
+{
+    return draw_image(e, a, "blit", false);
+}
+
+lval* builtin_blend(lenv *e, const lval *a)
+{
+    return draw_image(e, a, "blend", true);
+}
+
+// Mixes two spans of n pixels into dst
+static void mix_span(uint32_t *restrict dst, const uint32_t *restrict p1,
+                     const uint32_t *restrict p2, size_t n, float amount)
+{
+    for (size_t i=0; i<n; i++) {
+        dst[i] = mix(p1[i], p2[i], amount);
+    }
+}
+
+lval* builtin_mix_rgba(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("mix-rgba", a, 3);
+    double amount;
+    LCHECK(number_arg(a, "mix-rgba", 2, &amount));
+    float t = (float)fmin(fmax(amount, 0), 1);
+    if (child(a, 0)->type != LVAL_BUF) {
+        uint32_t c1, c2;
+        LCHECK(color_arg(a, "mix-rgba", 0, &c1));
+        LCHECK(color_arg(a, "mix-rgba", 1, &c2));
+        return lval_int(mix(c1, c2, t));
+    }
+    // Two Buffers of pixels are mixed pixel by pixel into a new Buffer
+    LASSERT_ARG_TYPE("mix-rgba", a, 1, LVAL_BUF);
+    const vbuf *b1 = &child(a, 0)->val.vbuf;
+    const vbuf *b2 = &child(a, 1)->val.vbuf;
+    LASSERTV(a, "mix-rgba", b1->size == b2->size && b1->size % 4 == 0,
+             "Function 'mix-rgba' passed buffers of %zu and %zu bytes "
+             "(Expected: the same number of 4 byte pixels)",
+             b1->size, b2->size);
+    lval *r = lval_buf(b1->size);
+    mix_span((uint32_t *)r->val.vbuf.data, (const uint32_t *)b1->data,
+             (const uint32_t *)b2->data, b1->size / 4, t);
+    return r;
+}
+
+#pragma mark - Encoding
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xFFFF);
+    put_le16(p+2, v >> 16);
+}
+
+lval* builtin_encode_bmp(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("encode-bmp", a, 2);
+    image img;
+    LCHECK(image_arg(a, "encode-bmp", 0, &img));
+    // A BITMAPFILEHEADER and BITMAPV3INFOHEADER (which has an alpha mask),
+    // see http://paulbourke.net/dataformats/bmp/
+    const uint32_t header_size = 14 + 56;
+    uint32_t data_size = (uint32_t)(img.width * img.height * 4);
+    lval *r = lval_buf(header_size + data_size);
+    uint8_t *p = r->val.vbuf.data;
+    memset(p, 0, header_size);
+    put_le16(p, 0x4D42); // "BM"
+    put_le32(p+2, header_size + data_size);
+    put_le32(p+10, header_size);
+    put_le32(p+14, 56);
+    put_le32(p+18, (uint32_t)img.width);
+    put_le32(p+22, (uint32_t)img.height); // Positive: rows are bottom up
+    put_le16(p+26, 1); // Planes
+    put_le16(p+28, 32); // Bits per pixel
+    put_le32(p+30, 3); // BI_BITFIELDS
+    put_le32(p+34, data_size);
+    put_le32(p+38, 1000); // Pixels per meter
+    put_le32(p+42, 1000);
+    put_le32(p+54, 0xFF000000); // Red, green, blue and alpha masks
+    put_le32(p+58, 0x00FF0000);
+    put_le32(p+62, 0x0000FF00);
+    put_le32(p+66, 0x000000FF);
+    uint8_t *out = p + header_size;
+    for (long i=0; i<img.width*img.height; i++) {
+        put_le32(out + i*4, img.pixels[i]);
+    }
+    return r;
+}
+
+lval* builtin_encode_ppm(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("encode-ppm", a, 2);
+    image img;
+    LCHECK(image_arg(a, "encode-ppm", 0, &img));
+    // Binary PPM: a text header, then RGB bytes for each row, top to bottom
+    // (PPM has no alpha channel)
+    char header[64];
+    int header_size = snprintf(header, sizeof(header), "P6\n%ld %ld\n255\n",
+                               img.width, img.height);
+    lval *r = lval_buf(header_size + img.width * img.height * 3);
+    memcpy(r->val.vbuf.data, header, header_size);
+    uint8_t *out = r->val.vbuf.data + header_size;
+    for (long y=0; y<img.height; y++) {
+        const uint32_t *row = image_row(&img, y);
+        for (long x=0; x<img.width; x++) {
+            *out++ = row[x] >> 24;
+            *out++ = (row[x] >> 16) & 0xFF;
+            *out++ = (row[x] >> 8) & 0xFF;
+        }
+    }
+    return r;
+}
@@ -0,0 +1,879 @@
+// This file implements built-in functions for parsing and writing JSON
+// JSON objects are parsed into HashMaps (with String keys, in the order they
+// appear), arrays into lists, numbers into Integers (or Floats, if they have
+// a fraction or exponent or don't fit in an Integer), true and false into
+// 1 and 0 (like benzl's true and false), and null into {} (nil). Numbers too
+// large for a Float are an error, as JSON has no way to write inf
+// json-each reads newline-delimited JSON (one value per line) a line at a
+// time, so files much bigger than memory can be processed
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+#include "benzl-hashmap.h"
+#include "benzl-persistent-map.h"
+#include "benzl-ordered-map.h"
+#include "benzl-error-macros.h"
+
+// Values nested deeper than this are rejected (rather than overflowing the
+// stack parsing them, or writing a value that contains itself)
+#define JSON_MAX_DEPTH 1000
+
+// Number of object keys remembered while parsing (a power of 2)
+#define JSON_KEY_CACHE_SIZE 64
+
+// An object key that has been parsed before
+typedef struct {
+    lval *key; // String, or NULL
+    uint64_t hash; // lval_hash of key
+} json_cached_key;
+
+// State while parsing JSON text
+typedef struct {
+    const char *start;
+    const char *p; // Next character to parse
+    const char *end;
+    char *scratch; // Space for building strings
+    size_t scratch_size;
+    // Objects usually repeat the same keys (eg an array of records), so keys
+    // are shared between objects rather than allocated for each of them
+    json_cached_key keys[JSON_KEY_CACHE_SIZE];
+    char error[128]; // Set if the text isn't valid JSON
+} json_parser;
+
+// State while writing JSON text
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    char error[128]; // Set if a value can't be written as JSON
+} json_writer;
+
+// Returns true if x is infinity or NaN (which have every exponent bit set)
+// This checks the bits rather than calling isfinite(), which -Ofast assumes
+// is always true
+static inline bool is_inf_or_nan(double x)
+{
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return ((bits >> 52) & 0x7FF) == 0x7FF;
+}
+
+#pragma mark - Parsing
+
+static lval* json_error(json_parser *j, const char *message)
+{
+    if (j->p >= j->end) {
+        snprintf(j->error, sizeof(j->error), "%s at the end of the text",
+                 message);
+    } else {
+        snprintf(j->error, sizeof(j->error), "%s at offset %td ('%c')",
+                 message, j->p - j->start, *j->p);
+    }
+    return NULL;
+}
+
+static void skip_whitespace(json_parser *j)
+{
+    while (j->p < j->end &&
+           (*j->p == ' ' || *j->p == '\n' || *j->p == '\r' || *j->p == '\t')) {
+        j->p++;
+    }
+}
+
+// Adds a byte to the string being built in scratch
+static inline void scratch_put(json_parser *j, size_t *len, char c)
+{
+    if (*len + 1 >= j->scratch_size) {
+        j->scratch_size = MAX(j->scratch_size * 2, 64);
+        j->scratch = realloc(j->scratch, j->scratch_size);
+    }
+    j->scratch[(*len)++] = c;
+}
+
+// Reads the 4 hex digits of a \u escape
+static bool read_hex4(json_parser *j, uint32_t *x)
+{
+    if (j->end - j->p < 4) {
+        return false;
+    }
+    *x = 0;
+    for (int i=0; i<4; i++) {
+        char c = *j->p++;
+        *x <<= 4;
+        if (c >= '0' && c <= '9') {
+            *x |= (uint32_t)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            *x |= (uint32_t)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            *x |= (uint32_t)(c - 'A' + 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if none of the 8 bytes in w is a quote, backslash or control
+// character (so they can be copied into a string as they are)
+static inline bool plain_chars(uint64_t w)
+{
+    const uint64_t ones = 0x0101010101010101;
+    const uint64_t high = 0x8080808080808080;
+    uint64_t quote = w ^ (ones * '"');
+    uint64_t backslash = w ^ (ones * '\\');
+    // Sets the high bit of bytes that are 0 (in quote or backslash), or
+    // less than 0x20 (in w)
+    return ((((quote - ones) & ~quote) | ((backslash - ones) & ~backslash) |
+             ((w - ones * 0x20) & ~w)) & high) == 0;
+}
+
+// Parses a string (j->p is just after the opening quote) into scratch,
+// setting len to its length
+// Returns false if the string isn't valid
+static bool parse_string_chars(json_parser *j, size_t *string_len)
+{
+    size_t len = 0;
+    while (true) {
+        // Copy the run of characters up to the next quote or escape,
+        // checking 8 characters at a time while there are enough left
+        const char *run = j->p;
+        uint64_t w;
+        while (j->end - j->p >= 8 && (memcpy(&w, j->p, 8), plain_chars(w))) {
+            j->p += 8;
+        }
+        while (j->p < j->end && *j->p != '"' && *j->p != '\\' &&
+               (uint8_t)*j->p >= 0x20) {
+            j->p++;
+        }
+        size_t n = (size_t)(j->p - run);
+        if (len + n + 1 >= j->scratch_size) {
+            j->scratch_size = MAX(j->scratch_size * 2, len + n + 64);
+            j->scratch = realloc(j->scratch, j->scratch_size);
+        }
+        memcpy(j->scratch + len, run, n);
+        len += n;
+
+        if (j->p >= j->end) {
+            json_error(j, "Unterminated string");
+            return false;
+        }
+        char c = *j->p++;
+        if (c == '"') {
+            j->scratch[len] = 0x00;
+            *string_len = len;
+            return true;
+        }
+        if (c != '\\') {
+            j->p--;
+            json_error(j, "Control character in string");
+            return false;
+        }
+        if (j->p >= j->end) {
+            json_error(j, "Unterminated string");
+            return false;
+        }
+        switch (*j->p++) {
+            case '"': scratch_put(j, &len, '"'); break;
+            case '\\': scratch_put(j, &len, '\\'); break;
+            case '/': scratch_put(j, &len, '/'); break;
+            case 'b': scratch_put(j, &len, '\b'); break;
+            case 'f': scratch_put(j, &len, '\f'); break;
+            case 'n': scratch_put(j, &len, '\n'); break;
+            case 'r': scratch_put(j, &len, '\r'); break;
+            case 't': scratch_put(j, &len, '\t'); break;
+            case 'u': {
+                uint32_t cp;
+                if (!read_hex4(j, &cp)) {
+                    json_error(j, "Invalid \\u escape");
+                    return false;
+                }
+                // A surrogate pair encodes a code point above 0xFFFF
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    uint32_t low;
+                    if (j->end - j->p < 2 || j->p[0] != '\\' || j->p[1] != 'u') {
+                        json_error(j, "Unpaired surrogate in \\u escape");
+                        return false;
+                    }
+                    j->p += 2;
+                    if (!read_hex4(j, &low) || low < 0xDC00 || low > 0xDFFF) {
+                        json_error(j, "Unpaired surrogate in \\u escape");
+                        return false;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    json_error(j, "Unpaired surrogate in \\u escape");
+                    return false;
+                }
+                if (cp == 0) {
+                    // Strings are NUL terminated, so can't contain NUL
+                    json_error(j, "\\u0000 in string");
+                    return false;
+                }
+                // Encode the code point as UTF-8
+                if (cp < 0x80) {
+                    scratch_put(j, &len, (char)cp);
+                } else if (cp < 0x800) {
+                    scratch_put(j, &len, (char)(0xC0 | (cp >> 6)));
+                    scratch_put(j, &len, (char)(0x80 | (cp & 0x3F)));
+                } else if (cp < 0x10000) {
+                    scratch_put(j, &len, (char)(0xE0 | (cp >> 12)));
+                    scratch_put(j, &len, (char)(0x80 | ((cp >> 6) & 0x3F)));
+                    scratch_put(j, &len, (char)(0x80 | (cp & 0x3F)));
+                } else {
+                    scratch_put(j, &len, (char)(0xF0 | (cp >> 18)));
+                    scratch_put(j, &len, (char)(0x80 | ((cp >> 12) & 0x3F)));
+                    scratch_put(j, &len, (char)(0x80 | ((cp >> 6) & 0x3F)));
+                    scratch_put(j, &len, (char)(0x80 | (cp & 0x3F)));
+                }
+                break;
+            }
+            default:
+                j->p--;
+                json_error(j, "Invalid escape in string");
+                return false;
+        }
+    }
+}
+
+static bool is_digit(const json_parser *j)
+{
+    return j->p < j->end && *j->p >= '0' && *j->p <= '9';
+}
+
+static lval* parse_number(json_parser *j)
+{
+    const char *start = j->p;
+    bool negative = j->p < j->end && *j->p == '-';
+    if (negative) {
+        j->p++;
+    }
+    if (!is_digit(j)) {
+        return json_error(j, "Invalid number");
+    }
+
+    // Integer part, accumulated as an Integer while it fits
+    bool is_float = false;
+    unsigned long x = 0;
+    const unsigned long limit = negative ? (unsigned long)LONG_MAX + 1 :
+                                           (unsigned long)LONG_MAX;
+    if (*j->p == '0') {
+        j->p++;
+    } else {
+        while (is_digit(j)) {
+            unsigned long digit = (unsigned long)(*j->p++ - '0');
+            if (x > (limit - digit) / 10) {
+                is_float = true;
+            }
+            x = x * 10 + digit;
+        }
+    }
+    if (j->p < j->end && *j->p == '.') {
+        j->p++;
+        if (!is_digit(j)) {
+            return json_error(j, "Invalid number");
+        }
+        while (is_digit(j)) {
+            j->p++;
+        }
+        is_float = true;
+    }
+    if (j->p < j->end && (*j->p == 'e' || *j->p == 'E')) {
+        j->p++;
+        if (j->p < j->end && (*j->p == '+' || *j->p == '-')) {
+            j->p++;
+        }
+        if (!is_digit(j)) {
+            return json_error(j, "Invalid number");
+        }
+        while (is_digit(j)) {
+            j->p++;
+        }
+        is_float = true;
+    }
+    if (!is_float) {
+        return lval_int(negative ? (long)(0 - x) : (long)x);
+    }
+
+    // strtod needs a NUL terminated copy of the number
+    size_t len = (size_t)(j->p - start);
+    if (len + 1 > j->scratch_size) {
+        j->scratch_size = len + 64;
+        j->scratch = realloc(j->scratch, j->scratch_size);
+    }
+    memcpy(j->scratch, start, len);
+    j->scratch[len] = 0x00;
+    double d = strtod(j->scratch, NULL);
+    // Numbers too large for a Float (eg 1e999) would become inf, which
+    // json-stringify can't write back out (ones too small become 0)
+    if (is_inf_or_nan(d)) {
+        return json_error(j, "Number out of range");
+    }
+    return lval_float(d);
+}
+
+// Checks the text continues with word (eg "true")
+static bool parse_word(json_parser *j, const char *word, size_t len)
+{
+    if ((size_t)(j->end - j->p) < len || memcmp(j->p, word, len) != 0) {
+        return false;
+    }
+    j->p += len;
+    return true;
+}
+
+// Returns the String for the object key in scratch (which is len bytes long),
+// setting hash to its lval_hash
+static lval* cached_key(json_parser *j, size_t len, uint64_t *hash)
+{
+    // FNV-1a hash of (up to) the first and last 8 bytes and the length
+    uint32_t h = 2166136261u ^ (uint32_t)len;
+    for (size_t i=0; i<len && i<8; i++) {
+        h = (h ^ (uint8_t)j->scratch[i]) * 16777619u;
+    }
+    for (size_t i=len > 8 ? len-8 : len; i<len; i++) {
+        h = (h ^ (uint8_t)j->scratch[i]) * 16777619u;
+    }
+    json_cached_key *slot = &j->keys[h & (JSON_KEY_CACHE_SIZE-1)];
+    if (slot->key == NULL || strcmp(slot->key->val.vstr, j->scratch) != 0) {
+        if (slot->key != NULL) {
+            lval_release(slot->key);
+        }
+        slot->key = lval_str(j->scratch);
+        lval_hash(slot->key, &slot->hash);
+    }
+    *hash = slot->hash;
+    return lval_retain(slot->key);
+}
+
+// Releases the keys remembered by the parser, and its scratch space
+static void parser_free(json_parser *j)
+{
+    for (size_t i=0; i<JSON_KEY_CACHE_SIZE; i++) {
+        if (j->keys[i].key != NULL) {
+            lval_release(j->keys[i].key);
+        }
+    }
+    free(j->scratch);
+}
+
+static lval* parse_value(json_parser *j, int depth);
+
+static lval* parse_array(json_parser *j, int depth)
+{
+    lval *v = lval_qexpr();
+    skip_whitespace(j);
+    if (j->p < j->end && *j->p == ']') {
+        j->p++;
+        return v;
+    }
+    while (true) {
+        lval *x = parse_value(j, depth);
+        if (x == NULL) {
+            lval_release(v);
+            return NULL;
+        }
+        lval_add(v, x);
+        lval_release(x);
+        skip_whitespace(j);
+        if (j->p < j->end && *j->p == ',') {
+            j->p++;
+        } else if (j->p < j->end && *j->p == ']') {
+            j->p++;
+            return v;
+        } else {
+            lval_release(v);
+            return json_error(j, "Expected ',' or ']'");
+        }
+    }
+}
+
+static lval* parse_object(json_parser *j, int depth)
+{
+    lval *v = lval_hashmap(8);
+    skip_whitespace(j);
+    if (j->p < j->end && *j->p == '}') {
+        j->p++;
+        return v;
+    }
+    while (true) {
+        skip_whitespace(j);
+        if (j->p >= j->end || *j->p != '"') {
+            lval_release(v);
+            return json_error(j, "Expected a string key");
+        }
+        j->p++;
+        size_t len;
+        if (!parse_string_chars(j, &len)) {
+            lval_release(v);
+            return NULL;
+        }
+        uint64_t hash;
+        lval *key = cached_key(j, len, &hash);
+        skip_whitespace(j);
+        if (j->p >= j->end || *j->p != ':') {
+            lval_release(key);
+            lval_release(v);
+            return json_error(j, "Expected ':'");
+        }
+        j->p++;
+        lval *x = parse_value(j, depth);
+        if (x == NULL) {
+            lval_release(key);
+            lval_release(v);
+            return NULL;
+        }
+        lhashmap_put(v->val.vmap, key, hash, x);
+        lval_release(key);
+        lval_release(x);
+        skip_whitespace(j);
+        if (j->p < j->end && *j->p == ',') {
+            j->p++;
+        } else if (j->p < j->end && *j->p == '}') {
+            j->p++;
+            return v;
+        } else {
+            lval_release(v);
+            return json_error(j, "Expected ',' or '}'");
+        }
+    }
+}
+
+static lval* parse_value(json_parser *j, int depth)
+{
+    if (depth > JSON_MAX_DEPTH) {
+        return json_error(j, "Too deeply nested");
+    }
+    skip_whitespace(j);
+    if (j->p >= j->end) {
+        return json_error(j, "Expected a value");
+    }
+    switch (*j->p) {
+        case '{':
+            j->p++;
+            return parse_object(j, depth + 1);
+        case '[':
+            j->p++;
+            return parse_array(j, depth + 1);
+        case '"': {
+            j->p++;
+            size_t len;
+            return parse_string_chars(j, &len) ? lval_str(j->scratch) : NULL;
+        }
+        case 't':
+            return parse_word(j, "true", 4) ? lval_int(1) :
+                   json_error(j, "Invalid value");
+        case 'f':
+            return parse_word(j, "false", 5) ? lval_int(0) :
+                   json_error(j, "Invalid value");
+        case 'n':
+            return parse_word(j, "null", 4) ? lval_qexpr() :
+                   json_error(j, "Invalid value");
+        default:
+            return parse_number(j);
+    }
+}
+
+// Parses a whole JSON text (a single value, with optional whitespace around
+// it). Returns NULL (with j->error set) if it isn't valid
+static lval* parse_text(json_parser *j, const char *text, size_t len)
+{
+    j->start = j->p = text;
+    j->end = text + len;
+    lval *v = parse_value(j, 0);
+    if (v != NULL) {
+        skip_whitespace(j);
+        if (j->p < j->end) {
+            lval_release(v);
+            return json_error(j, "Unexpected text after the value");
+        }
+    }
+    return v;
+}
+
+#pragma mark - Writing
+
+static void write_chars(json_writer *w, const char *s, size_t len)
+{
+    if (w->size + len + 1 > w->capacity) {
+        w->capacity = MAX(w->capacity * 2, w->size + len + 64);
+        w->data = realloc(w->data, w->capacity);
+    }
+    memcpy(w->data + w->size, s, len);
+    w->size += len;
+}
+
+static void write_str(json_writer *w, const char *s)
+{
+    write_chars(w, s, strlen(s));
+}
+
+static void write_string(json_writer *w, const char *s)
+{
+    write_chars(w, "\"", 1);
+    while (*s != 0x00) {
+        // Copy the run of characters that don't need escaping
+        const char *run = s;
+        while (*s != 0x00 && *s != '"' && *s != '\\' && (uint8_t)*s >= 0x20) {
+            s++;
+        }
+        write_chars(w, run, (size_t)(s - run));
+        if (*s == 0x00) {
+            break;
+        }
+        char escaped[8];
+        switch (*s) {
+            case '"': write_str(w, "\\\""); break;
+            case '\\': write_str(w, "\\\\"); break;
+            case '\b': write_str(w, "\\b"); break;
+            case '\f': write_str(w, "\\f"); break;
+            case '\n': write_str(w, "\\n"); break;
+            case '\r': write_str(w, "\\r"); break;
+            case '\t': write_str(w, "\\t"); break;
+            default:
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (uint8_t)*s);
+                write_str(w, escaped);
+                break;
+        }
+        s++;
+    }
+    write_chars(w, "\"", 1);
+}
+
+static bool write_number(json_writer *w, const lval *v)
+{
+    char temp[32];
+    if (v->type == LVAL_INT) {
+        snprintf(temp, sizeof(temp), "%ld", v->val.vint);
+    } else if (v->type == LVAL_BYTE) {
+        snprintf(temp, sizeof(temp), "%d", v->val.vbyte);
+    } else {
+        double x = v->val.vflt;
+        if (is_inf_or_nan(x)) {
+            snprintf(w->error, sizeof(w->error),
+                     "Infinity and NaN can't be written as JSON");
+            return false;
+        }
+        // The shortest of 15 or 17 digits that reads back as the same Float,
+        // with a ".0" if needed so it is read back as a Float
+        snprintf(temp, sizeof(temp), "%.15g", x);
+        if (strtod(temp, NULL) != x) {
+            snprintf(temp, sizeof(temp), "%.17g", x);
+        }
+        if (strpbrk(temp, ".e") == NULL) {
+            strcat(temp, ".0");
+        }
+    }
+    write_str(w, temp);
+    return true;
+}
+
+// Writes a map key, which must be a String, Symbol or number
+static bool write_key(json_writer *w, const lval *key)
+{
+    if (key->type == LVAL_STR) {
+        write_string(w, key->val.vstr);
+        return true;
+    } else if (key->type == LVAL_SYM) {
+        write_string(w, key->val.vsym.name);
+        return true;
+    } else if (lval_is_number(key)) {
+        write_chars(w, "\"", 1);
+        bool ok = write_number(w, key);
+        write_chars(w, "\"", 1);
+        return ok;
+    }
+    snprintf(w->error, sizeof(w->error), "%s can't be a JSON object key",
+             ltype_name(key->type));
+    return false;
+}
+
+static bool write_value(json_writer *w, const lval *v, int depth);
+
+// Callbacks for writing the entries of maps
+typedef struct {
+    json_writer *w;
+    int depth;
+    bool first;
+    bool ok;
+} write_ctx;
+
+static bool write_entry(write_ctx *c, const lval *key, const lval *value)
+{
+    if (!c->first) {
+        write_chars(c->w, ",", 1);
+    }
+    c->first = false;
+    if (!write_key(c->w, key)) {
+        c->ok = false;
+        return false;
+    }
+    write_chars(c->w, ":", 1);
+    c->ok = write_value(c->w, value, c->depth);
+    return c->ok;
+}
+
+static void write_pmap_entry(const lval *key, const lval *value, void *ctx)
+{
+    write_ctx *c = ctx;
+    if (c->ok) {
+        write_entry(c, key, value);
+    }
+}
+
+static bool write_btree_entry(const lval *key, const lval *value, void *ctx)
+{
+    return write_entry(ctx, key, value);
+}
+
+static bool write_btree_key(const lval *key, const lval *value, void *ctx)
+{
+    write_ctx *c = ctx;
+    if (!c->first) {
+        write_chars(c->w, ",", 1);
+    }
+    c->first = false;
+    c->ok = write_value(c->w, key, c->depth);
+    return c->ok;
+}
+
+static bool write_value(json_writer *w, const lval *v, int depth)
+{
+    if (depth > JSON_MAX_DEPTH) {
+        snprintf(w->error, sizeof(w->error), "Value is nested more than %d "
+                 "levels deep", JSON_MAX_DEPTH);
+        return false;
+    }
+    depth++;
+    switch (v->type) {
+        case LVAL_INT:
+        case LVAL_FLT:
+        case LVAL_BYTE:
+            return write_number(w, v);
+        case LVAL_STR:
+            write_string(w, v->val.vstr);
+            return true;
+        case LVAL_SYM:
+            write_string(w, v->val.vsym.name);
+            return true;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            write_chars(w, "[", 1);
+            for (size_t i=0; i<count(v); i++) {
+                if (i > 0) {
+                    write_chars(w, ",", 1);
+                }
+                if (!write_value(w, child(v, i), depth)) {
+                    return false;
+                }
+            }
+            write_chars(w, "]", 1);
+            return true;
+        case LVAL_BUF: {
+            write_chars(w, "[", 1);
+            char temp[8];
+            for (size_t i=0; i<v->val.vbuf.size; i++) {
+                snprintf(temp, sizeof(temp), i > 0 ? ",%d" : "%d",
+                         v->val.vbuf.data[i]);
+                write_str(w, temp);
+            }
+            write_chars(w, "]", 1);
+            return true;
+        }
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET: {
+            bool is_set = v->type == LVAL_HASH_SET;
+            write_chars(w, is_set ? "[" : "{", 1);
+            write_ctx ctx = {w, depth, true, true};
+            for (size_t i=0; ctx.ok && i<v->val.vmap->entry_count; i++) {
+                const lhashmap_entry *entry = &v->val.vmap->entries[i];
+                if (entry->key == NULL) {
+                    continue;
+                }
+                if (is_set) {
+                    write_btree_key(entry->key, NULL, &ctx);
+                } else {
+                    write_entry(&ctx, entry->key, entry->value);
+                }
+            }
+            write_chars(w, is_set ? "]" : "}", 1);
+            return ctx.ok;
+        }
+        case LVAL_PERSISTENT_MAP: {
+            write_chars(w, "{", 1);
+            write_ctx ctx = {w, depth, true, true};
+            lpmap_node_iterate(v->val.vpmap.root, write_pmap_entry, &ctx);
+            write_chars(w, "}", 1);
+            return ctx.ok;
+        }
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET: {
+            bool is_set = v->type == LVAL_ORDERED_SET;
+            write_chars(w, is_set ? "[" : "{", 1);
+            write_ctx ctx = {w, depth, true, true};
+            lbtree_iterate(v->val.vbtree, NULL, NULL,
+                           is_set ? write_btree_key : write_btree_entry, &ctx);
+            write_chars(w, is_set ? "]" : "}", 1);
+            return ctx.ok;
+        }
+        case LVAL_DICT: {
+            write_chars(w, "{", 1);
+            lval_entry **entries;
+            size_t n = lval_table_entries(v->val.vdict, &entries);
+            write_ctx ctx = {w, depth, true, true};
+            for (size_t i=0; ctx.ok && i<n; i++) {
+                write_entry(&ctx, entries[i]->key, entries[i]->value);
+            }
+            free(entries);
+            write_chars(w, "}", 1);
+            return ctx.ok;
+        }
+        case LVAL_CUSTOM_TYPE_INSTANCE: {
+            const lval *type = v->val.vinst.type;
+            write_chars(w, "{", 1);
+            write_ctx ctx = {w, depth, true, true};
+            for (size_t i=0; ctx.ok && i<custom_type_slot_count(type); i++) {
+                write_entry(&ctx, custom_type_slot_name(type, i),
+                            v->val.vinst.slots[i]);
+            }
+            write_chars(w, "}", 1);
+            return ctx.ok;
+        }
+        default:
+            snprintf(w->error, sizeof(w->error), "%s can't be written as JSON",
+                     ltype_name(v->type));
+            return false;
+    }
+}
+
+#pragma mark - Built-in functions
+
+lval* builtin_json_parse(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("json-parse", a, 1);
+    const lval *text = child(a, 0);
+    LASSERTV(a, "json-parse", text->type == LVAL_STR || text->type == LVAL_BUF,
+             "Function 'json-parse' passed incorrect type for arg 0 "
+             "(Got: %s Expected: String or Buffer)", ltype_name(text->type));
+
+    json_parser j = {.scratch = NULL, .scratch_size = 0};
+    lval *v = text->type == LVAL_STR ?
+        parse_text(&j, text->val.vstr, strlen(text->val.vstr)) :
+        parse_text(&j, (const char *)text->val.vbuf.data, text->val.vbuf.size);
+    parser_free(&j);
+    if (v == NULL) {
+        return lval_err_for_val(a, "json-parse: %s", j.error);
+    }
+    return v;
+}
+
+lval* builtin_json_stringify(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("json-stringify", a, 1);
+
+    json_writer w = {.data = NULL, .size = 0, .capacity = 0};
+    bool ok = write_value(&w, child(a, 0), 0);
+    lval *r;
+    if (ok) {
+        // write_chars always leaves space for a NUL terminator
+        w.data[w.size] = 0x00;
+        r = lval_str(w.data);
+    } else {
+        r = lval_err_for_val(a, "json-stringify: %s", w.error);
+    }
+    free(w.data);
+    return r;
+}
+
+// Parses one line of newline-delimited JSON and calls the function with it,
+// counting the values in value_count (blank lines are skipped)
+// Returns an error, or NULL to continue
+static lval* each_line(json_parser *j, lcall_frame *frame, const lval *a,
+                       const char *line, size_t len, size_t line_number,
+                       size_t *value_count)
+{
+    const char *p = line;
+    while (p < line + len &&
+           (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    if (p == line + len) {
+        return NULL;
+    }
+    lval *v = parse_text(j, line, len);
+    if (v == NULL) {
+        return lval_err_for_val(a, "json-each: %s on line %zu", j->error,
+                                line_number);
+    }
+    (*value_count)++;
+    lval *r = lcall_frame_call(frame, &v);
+    lval_release(v);
+    if (r->type == LVAL_ERR) {
+        return r;
+    }
+    lval_release(r);
+    return NULL;
+}
+
+lval* builtin_json_each(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("json-each", a, 2);
+    const lval *source = child(a, 0);
+    LASSERTV(a, "json-each", source->type == LVAL_STR ||
+             source->type == LVAL_BUF, "Function 'json-each' passed incorrect "
+             "type for arg 0 (Got: %s Expected: String (a file path) or "
+             "Buffer)", ltype_name(source->type));
+    LASSERT_ARG_TYPE("json-each", a, 1, LVAL_FUN);
+
+    FILE *file = NULL;
+    if (source->type == LVAL_STR) {
+        file = fopen(source->val.vstr, "r");
+        if (file == NULL) {
+            return lval_err_for_val(a, "Unable to read the file at '%s'",
+                                    source->val.vstr);
+        }
+    }
+
+    // The function is called with the same environment for every value
+    lcall_frame frame;
+    lcall_frame_init(&frame, e, child(a, 1), 1);
+    json_parser j = {.scratch = NULL, .scratch_size = 0};
+    lval *err = NULL;
+    size_t line_number = 0;
+    size_t value_count = 0;
+    if (file != NULL) {
+        // Only one line is held in memory at a time
+        char *line = NULL;
+        size_t capacity = 0;
+        ssize_t len;
+        while (err == NULL && (len = getline(&line, &capacity, file)) != -1) {
+            line_number++;
+            err = each_line(&j, &frame, a, line, (size_t)len, line_number,
+                            &value_count);
+        }
+        free(line);
+        fclose(file);
+    } else {
+        const char *p = (const char *)source->val.vbuf.data;
+        const char *end = p + source->val.vbuf.size;
+        while (err == NULL && p < end) {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            const char *line_end = nl != NULL ? nl : end;
+            line_number++;
+            err = each_line(&j, &frame, a, p, (size_t)(line_end - p),
+                            line_number, &value_count);
+            p = line_end + 1;
+        }
+    }
+    parser_free(&j);
+    lcall_frame_free(&frame);
+    return err != NULL ? err : lval_int((long)value_count);
+}
@@ -12,6 +12,9 @@
 #include "benzl-lval-eval.h"
 #include "benzl-lenv.h"
 #include "benzl-sprintf.h"
+#include "benzl-hashmap.h"
+#include "benzl-ordered-map.h"
+#include "benzl-sequence.h"
 #include "benzl-error-macros.h"
 
 lval* builtin_head(lenv *e, const lval *a)
@@ -201,6 +204,14 @@ lval *builtin_take(lenv *e, const lval *a)
     lval *v = child(a, 1);
     size_t num_to_take = child(a, 0)->val.vint;
 
+    // If this is a sequence, make a sequence of its first values
+    if (v->type == LVAL_SEQUENCE) {
+        LASSERTV(a, "take", child(a, 0)->val.vint >= 0,
+                 "take: can't take a negative number of values (Got: %ld)",
+                 child(a, 0)->val.vint);
+        return lval_sequence(lseq_take(num_to_take, v));
+    }
+
     // If this is a list
     // Remove the first item
     if (v->type == LVAL_QEXPR) {
@@ -476,9 +487,23 @@ lval* builtin_len(lenv *e, const lval *a)
         case LVAL_BUF:
             r = a->val.vbuf.size;
             break;
+        // Hash map or set: count the keys
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET:
+            r = a->val.vmap->count;
+            break;
+        // Persistent map: count the keys
+        case LVAL_PERSISTENT_MAP:
+            r = a->val.vpmap.count;
+            break;
+        // Ordered map or set: count the keys
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET:
+            r = lbtree_count(a->val.vbtree);
+            break;
         default:
             return lval_err_for_val(
-                a, "len works on strings, lists and buffers (got %s)",
+                a, "len works on strings, lists, buffers, maps and sets (got %s)",
                 ltype_name(a->type)
             );
     }
@@ -0,0 +1,346 @@
+// This file implements the built-in loops: while, for and for-each
+// Each loop evaluates its body over and over in one environment, which holds
+// the loop variables and is reused for every iteration. Unlike a recursive
+// function such as loop, iterating doesn't call a function, allocate an
+// environment or use any C stack, however many times the body is evaluated
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+#include "benzl-lenv.h"
+#include "benzl-sequence.h"
+#include "benzl-error-macros.h"
+
+#pragma mark - Loop environments
+
+#define LOOP_MAX_VARS 2
+
+// The environment a loop's body is evaluated in, with the loop's variables
+// bound in it (by lenv_rebind, like the parameters of an lcall_frame)
+typedef struct {
+    lenv *caller;
+    lenv *env; // NULL until the variables are first bound
+    lval *names[LOOP_MAX_VARS];
+    lval_entry *vars[LOOP_MAX_VARS];
+    size_t var_count;
+} loop_env;
+
+static void loop_env_init(loop_env *l, lenv *e)
+{
+    l->caller = e;
+    l->env = NULL;
+    l->var_count = 0;
+}
+
+// Binds the loop's variables to values, reusing the environment if it has one
+static void loop_env_bind(loop_env *l, lval **values)
+{
+    lenv_rebind(&l->env, l->caller, l->names, l->vars, values, l->var_count);
+}
+
+// Binds an Integer loop variable to i, changing the Integer in place when
+// nothing else has kept hold of it
+static void loop_env_bind_int(loop_env *l, long i)
+{
+    if (l->env != NULL) {
+        lval *v = l->vars[0]->value;
+        if (v->ref_count == 1 && v->type == LVAL_INT) {
+            v->val.vint = i;
+            return;
+        }
+    }
+    lval *v = lval_int(i);
+    loop_env_bind(l, &v);
+    lval_release(v);
+}
+
+// Evaluates the loop's body (after binding its variables), returning an error it produces, or NULL
+static lval* loop_env_eval(loop_env *l, const lval *body)
+{
+    lval *r = lval_eval_sexpr(l->env, body);
+    // If the body defined something in the loop's environment, start the next
+    // iteration with a fresh one
+    lenv_rebind_reset_if_changed(&l->env, l->var_count);
+    if (r->type == LVAL_ERR) {
+        return r;
+    }
+    lval_release(r);
+    return NULL;
+}
+
+static void loop_env_free(loop_env *l)
+{
+    if (l->env != NULL) {
+        lenv_free(l->env);
+        l->env = NULL;
+    }
+}
+
+#pragma mark - while
+
+lval* builtin_while(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("while", a, 2);
+    LASSERT_ARG_TYPE("while", a, 0, LVAL_QEXPR);
+    LASSERT_ARG_TYPE("while", a, 1, LVAL_QEXPR);
+    const lval *condition = child(a, 0);
+    const lval *body = child(a, 1);
+
+    // while has no variables of its own, so its body is evaluated in e
+    while (true) {
+        lval *c = lval_eval_sexpr(e, condition);
+        if (c->type == LVAL_ERR) {
+            return c;
+        }
+        bool is_true = lval_is_true(c);
+        lval_release(c);
+        if (!is_true) {
+            break;
+        }
+        lval *r = lval_eval_sexpr(e, body);
+        if (r->type == LVAL_ERR) {
+            return r;
+        }
+        lval_release(r);
+    }
+    return lval_qexpr();
+}
+
+#pragma mark - for
+
+// Evaluates one of the Integers in a for loop's range into x
+static lval* eval_bound(lenv *e, const lval *a, const lval *v, long *x)
+{
+    lval *r = lval_eval(e, v);
+    if (r->type == LVAL_ERR) {
+        return r;
+    }
+    if (r->type != LVAL_INT) {
+        lval *err = lval_err_for_val(a, "Function 'for' expects Integers for "
+                                        "its range (Got: %s)",
+                                     ltype_name(r->type));
+        lval_release(r);
+        return err;
+    }
+    *x = r->val.vint;
+    lval_release(r);
+    return NULL;
+}
+
+lval* builtin_for(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("for", a, 2);
+    LASSERT_ARG_TYPE("for", a, 0, LVAL_QEXPR);
+    LASSERT_ARG_TYPE("for", a, 1, LVAL_QEXPR);
+    const lval *spec = child(a, 0);
+    const lval *body = child(a, 1);
+    LASSERTV(a, "for", (count(spec) == 3 || count(spec) == 4) &&
+             child(spec, 0)->type == LVAL_SYM, "Function 'for' expects a "
+             "variable and range, eg (for {i 0 10} {print i}) or "
+             "(for {i 10 0 -2} {print i})");
+
+    long start = 0, end = 0, step = 1;
+    lval *err = eval_bound(e, a, child(spec, 1), &start);
+    if (err == NULL) {
+        err = eval_bound(e, a, child(spec, 2), &end);
+    }
+    if (err == NULL && count(spec) == 4) {
+        err = eval_bound(e, a, child(spec, 3), &step);
+    }
+    if (err != NULL) {
+        return err;
+    }
+    LASSERTV(a, "for", step != 0, "Function 'for' can't have a step of 0");
+
+    loop_env l;
+    loop_env_init(&l, e);
+    l.names[0] = child(spec, 0);
+    l.var_count = 1;
+    // The counter is a C long: setting the variable in the body doesn't
+    // change which iteration comes next
+    for (long i=start; step > 0 ? i < end : i > end; i += step) {
+        loop_env_bind_int(&l, i);
+        err = loop_env_eval(&l, body);
+        if (err != NULL) {
+            break;
+        }
+        // Stop rather than overflowing past LONG_MAX or LONG_MIN
+        if (step > 0 ? i > LONG_MAX - step : i < LONG_MIN - step) {
+            break;
+        }
+    }
+    loop_env_free(&l);
+    return err != NULL ? err : lval_qexpr();
+}
+
+#pragma mark - for-each
+
+// The values a for-each loop goes through
+typedef struct {
+    lval *items; // List (or String or Buffer) of values
+    size_t index;
+    lseq_iter *seq; // Values of a Sequence, or NULL
+} loop_items;
+
+// Gets the values of a collection, or returns an error if it can't be
+// iterated over
+static lval* loop_items_init(loop_items *it, lenv *e, const lval *a,
+                             lval *v)
+{
+    it->index = 0;
+    it->seq = NULL;
+    it->items = NULL;
+    switch (v->type) {
+        case LVAL_QEXPR:
+        case LVAL_STR:
+        case LVAL_BUF:
+            it->items = lval_retain(v);
+            return NULL;
+        case LVAL_SEQUENCE:
+            it->items = lval_retain(v);
+            it->seq = lseq_iter_alloc(e, v->val.vseq);
+            return NULL;
+        case LVAL_DICT: {
+            lval_entry **entries = NULL;
+            size_t n = lval_table_entries(v->val.vdict, &entries);
+            it->items = lval_qexpr_with_size(n);
+            for (size_t i=0; i<n; i++) {
+                lval *pair = lval_qexpr_with_size(2);
+                lval_add(pair, entries[i]->key);
+                lval_add(pair, entries[i]->value);
+                lval_add(it->items, pair);
+                lval_release(pair);
+            }
+            free(entries);
+            return NULL;
+        }
+        case LVAL_HASHMAP:
+        case LVAL_PERSISTENT_MAP:
+        case LVAL_ORDERED_MAP:
+        case LVAL_HASH_SET:
+        case LVAL_ORDERED_SET: {
+            // Iterate over a snapshot, so the body can change the map
+            lval *args = lval_qexpr_with_size(1);
+            lval_add(args, v);
+            bool is_set = v->type == LVAL_HASH_SET ||
+                          v->type == LVAL_ORDERED_SET;
+            it->items = is_set ? builtin_keys(e, args)
+                               : builtin_entries(e, args);
+            lval_release(args);
+            return NULL;
+        }
+        default:
+            return lval_err_for_val(a, "Function 'for-each' can't iterate "
+                                       "over values of type %s",
+                                    ltype_name(v->type));
+    }
+}
+
+// Returns the next value, NULL once there are no more, or an error from a
+// sequence
+static lval* loop_items_next(loop_items *it)
+{
+    if (it->seq != NULL) {
+        return lseq_iter_next(it->seq);
+    }
+    const lval *items = it->items;
+    switch (items->type) {
+        case LVAL_STR: {
+            char c = items->val.vstr[it->index];
+            if (c == '\0') {
+                return NULL;
+            }
+            it->index++;
+            char s[2] = { c, '\0' };
+            return lval_str(s);
+        }
+        case LVAL_BUF:
+            if (it->index >= items->val.vbuf.size) {
+                return NULL;
+            }
+            return lval_byte(items->val.vbuf.data[it->index++]);
+        default:
+            if (it->index >= count(items)) {
+                return NULL;
+            }
+            return lval_retain(child(items, it->index++));
+    }
+}
+
+static void loop_items_free(loop_items *it)
+{
+    if (it->seq != NULL) {
+        lseq_iter_free(it->seq);
+    }
+    lval_release(it->items);
+}
+
+lval* builtin_for_each(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("for-each", a, 2);
+    LASSERT_ARG_TYPE("for-each", a, 0, LVAL_QEXPR);
+    LASSERT_ARG_TYPE("for-each", a, 1, LVAL_QEXPR);
+    const lval *spec = child(a, 0);
+    const lval *body = child(a, 1);
+    size_t var_count = count(spec) - 1;
+    LASSERTV(a, "for-each", count(spec) == 2 || count(spec) == 3,
+             "Function 'for-each' expects variables and a collection, eg "
+             "(for-each {x items} {print x}) or "
+             "(for-each {k v (hash-map {{\"a\" 1}})} {print k v})");
+    for (size_t i=0; i<var_count; i++) {
+        LASSERTV(a, "for-each", child(spec, i)->type == LVAL_SYM,
+                 "Function 'for-each' expects a symbol for variable %zu "
+                 "(Got: %s)", i, ltype_name(child(spec, i)->type));
+    }
+
+    lval *collection = lval_eval(e, child(spec, var_count));
+    if (collection->type == LVAL_ERR) {
+        return collection;
+    }
+    loop_items it;
+    lval *err = loop_items_init(&it, e, a, collection);
+    lval_release(collection);
+    if (err != NULL) {
+        return err;
+    }
+
+    loop_env l;
+    loop_env_init(&l, e);
+    for (size_t i=0; i<var_count; i++) {
+        l.names[i] = child(spec, i);
+    }
+    l.var_count = var_count;
+    lval *x;
+    while ((x = loop_items_next(&it)) != NULL) {
+        if (x->type == LVAL_ERR) {
+            err = x;
+            break;
+        }
+        if (var_count == 1) {
+            loop_env_bind(&l, &x);
+        } else if (x->type == LVAL_QEXPR && count(x) == 2) {
+            // Two variables take the parts of a {key value} pair
+            loop_env_bind(&l, x->val.vexp.cell);
+        } else {
+            err = lval_err_for_val(a, "Function 'for-each' expects {key value} "
+                                      "pairs when given two variables");
+        }
+        lval_release(x);
+        if (err == NULL) {
+            err = loop_env_eval(&l, body);
+        }
+        if (err != NULL) {
+            break;
+        }
+    }
+    loop_env_free(&l);
+    loop_items_free(&it);
+    return err != NULL ? err : lval_qexpr();
+}
@@ -0,0 +1,628 @@
+// This file implements built-in functions for working with hash maps and
+// sets, persistent maps and ordered maps and sets
+// Hash maps, ordered maps and sets are mutable: put, add and remove change the
+// map (or set) they are passed (like set-prop does for dictionaries) and
+// return it
+// Persistent maps never change: assoc and dissoc return a new version of
+// the map they are passed, which shares most of its memory with it
+// get, has, keys, values, entries (and len) work with all kinds of map
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-lenv.h"
+#include "benzl-hashmap.h"
+#include "benzl-persistent-map.h"
+#include "benzl-ordered-map.h"
+#include "benzl-error-macros.h"
+
+// Calculates the hash of key, for use with function func
+// Returns an error if key can't be used as a map key, or NULL
+static lval* hash_key(const lval *a, char *func, const lval *key,
+                      uint64_t *hash)
+{
+    if (!lval_hash(key, hash)) {
+        lval *err = lval_err_for_val(
+            a, "Function '%s' can't use a %s as a key",
+            func, ltype_name(key->type)
+        );
+        return err;
+    }
+    return NULL;
+}
+
+// Returns true if v is a hash map, persistent map or ordered map
+// (or, if sets is true, a hash set or ordered set)
+static inline bool is_map(const lval *v, bool sets)
+{
+    return v->type == LVAL_HASHMAP || v->type == LVAL_PERSISTENT_MAP ||
+           v->type == LVAL_ORDERED_MAP ||
+           (sets && (v->type == LVAL_HASH_SET || v->type == LVAL_ORDERED_SET));
+}
+
+// Returns an error if argument i of a isn't a map (or a set, if _sets is true)
+#define LASSERT_MAP_ARG(_func_name, _a, _index, _sets) {\
+LASSERTV(_a, _func_name, is_map(child(_a, _index), _sets), \
+"Function '%s' passed incorrect type for arg %d (Got: %s Expected: %s)", \
+_func_name, _index, ltype_name(child(_a, _index)->type), \
+_sets ? "a map or set" : "a map"); }
+
+// Get the value stored for key in the map (or set) m, or NULL
+// Sets *err if key can't be used as a key for m
+static lval* map_get(const lval *a, char *func, const lval *m, const lval *key,
+                     lval **err)
+{
+    if (m->type == LVAL_ORDERED_MAP || m->type == LVAL_ORDERED_SET) {
+        // Keys an ordered map can't contain aren't errors (just missing)
+        if (!lbtree_accepts_key(m->val.vbtree, key)) {
+            return NULL;
+        }
+        return lbtree_get(m->val.vbtree, key);
+    }
+    uint64_t hash;
+    *err = hash_key(a, func, key, &hash);
+    if (*err != NULL) {
+        return NULL;
+    } else if (m->type == LVAL_HASHMAP || m->type == LVAL_HASH_SET) {
+        return lhashmap_get(m->val.vmap, key, hash);
+    }
+    return lpmap_node_get(m->val.vpmap.root, key, hash);
+}
+
+// Returns an error if key can't be stored in the ordered map or set m, or NULL
+static lval* check_ordered_key(const lval *a, char *func, const lval *m,
+                               const lval *key)
+{
+    if (!lbtree_accepts_key(m->val.vbtree, key)) {
+        return lval_err_for_val(
+            a, "Function '%s' can't use a %s as a key in this %s "
+               "(Keys must be all numbers or all strings)",
+            func, ltype_name(key->type), ltype_name(m->type)
+        );
+    }
+    return NULL;
+}
+
+// Returns an error if the initial entries for a map aren't a list of
+// {key value} pairs, or NULL
+static lval* check_initial_entries(const lval *a, char *func)
+{
+    LASSERTV(a, func, count(a) <= 1,
+             "Function '%s' passed wrong number of arguments "
+             "(Got: %d Expected: 0 or 1)", func, count(a));
+    if (count(a) == 0) {
+        return NULL;
+    }
+    LASSERT_ARG_TYPE(func, a, 0, LVAL_QEXPR);
+    const lval *pairs = child(a, 0);
+    for (size_t i=0; i<count(pairs); i++) {
+        const lval *pair = child(pairs, i);
+        LASSERTV(a, func, pair->type == LVAL_QEXPR && count(pair) == 2,
+                 "Initial entries for a map must take the form "
+                 "(%s {{key1 value1} {key2 value2}})", func);
+    }
+    return NULL;
+}
+
+#pragma mark - Hash maps
+
+lval* builtin_hash_map(lenv *e, const lval *a)
+{
+    lval *err = check_initial_entries(a, "hash-map");
+    if (err != NULL) {
+        return err;
+    } else if (count(a) == 0) {
+        return lval_hashmap(0);
+    }
+    const lval *pairs = child(a, 0);
+    lval *m = lval_hashmap(count(pairs));
+    for (size_t i=0; i<count(pairs); i++) {
+        const lval *pair = child(pairs, i);
+        uint64_t hash;
+        err = hash_key(a, "hash-map", child(pair, 0), &hash);
+        if (err != NULL) {
+            lval_release(m);
+            return err;
+        }
+        lhashmap_put(m->val.vmap, child(pair, 0), hash, child(pair, 1));
+    }
+    return m;
+}
+
+lval* builtin_put(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("put", a, 3);
+    lval *m = child(a, 0);
+    LASSERTV(a, "put", m->type == LVAL_HASHMAP || m->type == LVAL_ORDERED_MAP,
+             "Function 'put' passed incorrect type for arg 0 "
+             "(Got: %s Expected: HashMap or OrderedMap)", ltype_name(m->type));
+
+    if (m->type == LVAL_ORDERED_MAP) {
+        lval *err = check_ordered_key(a, "put", m, child(a, 1));
+        if (err != NULL) {
+            return err;
+        }
+        lbtree_put(m->val.vbtree, child(a, 1), child(a, 2));
+        return lval_retain(m);
+    }
+    uint64_t hash;
+    lval *err = hash_key(a, "put", child(a, 1), &hash);
+    if (err != NULL) {
+        return err;
+    }
+    lhashmap_put(m->val.vmap, child(a, 1), hash, child(a, 2));
+    return lval_retain(m);
+}
+
+lval* builtin_remove(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("remove", a, 2);
+    lval *m = child(a, 0);
+    LASSERTV(a, "remove", m->type == LVAL_HASHMAP || m->type == LVAL_HASH_SET ||
+             m->type == LVAL_ORDERED_MAP || m->type == LVAL_ORDERED_SET,
+             "Function 'remove' passed incorrect type for arg 0 "
+             "(Got: %s Expected: HashMap, HashSet, OrderedMap or OrderedSet)",
+             ltype_name(m->type));
+
+    if (m->type == LVAL_ORDERED_MAP || m->type == LVAL_ORDERED_SET) {
+        if (lbtree_accepts_key(m->val.vbtree, child(a, 1))) {
+            lbtree_remove(m->val.vbtree, child(a, 1));
+        }
+        return lval_retain(m);
+    }
+    uint64_t hash;
+    lval *err = hash_key(a, "remove", child(a, 1), &hash);
+    if (err != NULL) {
+        return err;
+    }
+    lhashmap_remove(m->val.vmap, child(a, 1), hash);
+    return lval_retain(m);
+}
+
+#pragma mark - Persistent maps
+
+lval* builtin_persistent_map(lenv *e, const lval *a)
+{
+    lval *err = check_initial_entries(a, "persistent-map");
+    if (err != NULL) {
+        return err;
+    }
+    lpmap_node *root = NULL;
+    size_t n = 0;
+    for (size_t i=0; count(a) > 0 && i<count(child(a, 0)); i++) {
+        const lval *pair = child(child(a, 0), i);
+        uint64_t hash;
+        err = hash_key(a, "persistent-map", child(pair, 0), &hash);
+        if (err != NULL) {
+            lpmap_node_release(root);
+            return err;
+        }
+        bool added;
+        lpmap_node *r = lpmap_node_assoc(root, child(pair, 0), hash,
+                                         child(pair, 1), &added);
+        lpmap_node_release(root);
+        root = r;
+        n += added;
+    }
+    return lval_persistent_map(root, n);
+}
+
+lval* builtin_assoc(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("assoc", a, 3);
+    LASSERT_ARG_TYPE("assoc", a, 0, LVAL_PERSISTENT_MAP);
+
+    uint64_t hash;
+    lval *err = hash_key(a, "assoc", child(a, 1), &hash);
+    if (err != NULL) {
+        return err;
+    }
+    const vpmap *m = &child(a, 0)->val.vpmap;
+    bool added;
+    lpmap_node *root = lpmap_node_assoc(m->root, child(a, 1), hash,
+                                        child(a, 2), &added);
+    return lval_persistent_map(root, m->count + added);
+}
+
+lval* builtin_dissoc(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("dissoc", a, 2);
+    LASSERT_ARG_TYPE("dissoc", a, 0, LVAL_PERSISTENT_MAP);
+
+    uint64_t hash;
+    lval *err = hash_key(a, "dissoc", child(a, 1), &hash);
+    if (err != NULL) {
+        return err;
+    }
+    const lval *m = child(a, 0);
+    bool removed;
+    lpmap_node *root = lpmap_node_dissoc(m->val.vpmap.root, child(a, 1), hash,
+                                         &removed);
+    if (!removed) {
+        lpmap_node_release(root);
+        return lval_retain(m);
+    }
+    return lval_persistent_map(root, m->val.vpmap.count - 1);
+}
+
+#pragma mark - Ordered maps and sets
+
+lval* builtin_ordered_map(lenv *e, const lval *a)
+{
+    lval *err = check_initial_entries(a, "ordered-map");
+    if (err != NULL) {
+        return err;
+    }
+    lval *m = lval_ordered_map(LVAL_ORDERED_MAP);
+    for (size_t i=0; count(a) > 0 && i<count(child(a, 0)); i++) {
+        const lval *pair = child(child(a, 0), i);
+        err = check_ordered_key(a, "ordered-map", m, child(pair, 0));
+        if (err != NULL) {
+            lval_release(m);
+            return err;
+        }
+        lbtree_put(m->val.vbtree, child(pair, 0), child(pair, 1));
+    }
+    return m;
+}
+
+lval* builtin_ordered_set(lenv *e, const lval *a)
+{
+    LASSERTV(a, "ordered-set", count(a) <= 1,
+             "Function 'ordered-set' passed wrong number of arguments "
+             "(Got: %d Expected: 0 or 1)", count(a));
+    lval *s = lval_ordered_map(LVAL_ORDERED_SET);
+    if (count(a) == 0) {
+        return s;
+    }
+    LASSERT_ARG_TYPE("ordered-set", a, 0, LVAL_QEXPR);
+    const lval *keys = child(a, 0);
+    for (size_t i=0; i<count(keys); i++) {
+        lval *err = check_ordered_key(a, "ordered-set", s, child(keys, i));
+        if (err != NULL) {
+            lval_release(s);
+            return err;
+        }
+        lbtree_put(s->val.vbtree, child(keys, i), child(keys, i));
+    }
+    return s;
+}
+
+lval* builtin_add_key(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("add", a, 2);
+    lval *s = child(a, 0);
+    LASSERTV(a, "add", s->type == LVAL_HASH_SET || s->type == LVAL_ORDERED_SET,
+             "Function 'add' passed incorrect type for arg 0 "
+             "(Got: %s Expected: HashSet or OrderedSet)", ltype_name(s->type));
+
+    if (s->type == LVAL_HASH_SET) {
+        uint64_t hash;
+        lval *err = hash_key(a, "add", child(a, 1), &hash);
+        if (err != NULL) {
+            return err;
+        }
+        lhashmap_put(s->val.vmap, child(a, 1), hash, child(a, 1));
+        return lval_retain(s);
+    }
+    lval *err = check_ordered_key(a, "add", s, child(a, 1));
+    if (err != NULL) {
+        return err;
+    }
+    lbtree_put(s->val.vbtree, child(a, 1), child(a, 1));
+    return lval_retain(s);
+}
+
+// Returns an error if argument i of a isn't an ordered map or set
+#define LASSERT_ORDERED_ARG(_func_name, _a, _index) {\
+LASSERTV(_a, _func_name, child(_a, _index)->type == LVAL_ORDERED_MAP || \
+         child(_a, _index)->type == LVAL_ORDERED_SET, \
+"Function '%s' passed incorrect type for arg %d " \
+"(Got: %s Expected: OrderedMap or OrderedSet)", \
+_func_name, _index, ltype_name(child(_a, _index)->type)); }
+
+lval* builtin_rank(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("rank", a, 2);
+    LASSERT_ORDERED_ARG("rank", a, 0);
+
+    const lval *m = child(a, 0);
+    lval *err = check_ordered_key(a, "rank", m, child(a, 1));
+    if (err != NULL) {
+        return err;
+    }
+    return lval_int((long)lbtree_rank(m->val.vbtree, child(a, 1)));
+}
+
+lval* builtin_key_at(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("key-at", a, 2);
+    LASSERT_ORDERED_ARG("key-at", a, 0);
+    LASSERT_ARG_TYPE("key-at", a, 1, LVAL_INT);
+
+    const lbtree *tree = child(a, 0)->val.vbtree;
+    long index = child(a, 1)->val.vint;
+    LASSERTV(a, "key-at", index >= 0 && (size_t)index < lbtree_count(tree),
+             "Function 'key-at' passed out of range index %ld (Count: %zu)",
+             index, lbtree_count(tree));
+    lval *key, *value;
+    lbtree_at(tree, (size_t)index, &key, &value);
+    return lval_retain(key);
+}
+
+// Adds an entry to the ordered map (or set) in ctx
+static bool add_to_ordered_map(const lval *key, const lval *value, void *ctx)
+{
+    lbtree_put(((lval *)ctx)->val.vbtree, key, value);
+    return true;
+}
+
+lval* builtin_between(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("between", a, 3);
+    LASSERT_ORDERED_ARG("between", a, 0);
+
+    const lval *m = child(a, 0);
+    for (size_t i=1; i<=2; i++) {
+        lval *err = check_ordered_key(a, "between", m, child(a, i));
+        if (err != NULL) {
+            return err;
+        }
+    }
+    lval *r = lval_ordered_map(m->type);
+    lbtree_iterate(m->val.vbtree, child(a, 1), child(a, 2),
+                   add_to_ordered_map, r);
+    return r;
+}
+
+#pragma mark - All maps
+
+lval* builtin_get(lenv *e, const lval *a)
+{
+    LASSERTV(a, "get", count(a) == 2 || count(a) == 3,
+             "Function 'get' passed wrong number of arguments "
+             "(Got: %d Expected: 2 or 3)", count(a));
+    LASSERT_MAP_ARG("get", a, 0, false);
+
+    const lval *key = child(a, 1);
+    lval *err = NULL;
+    lval *v = map_get(a, "get", child(a, 0), key, &err);
+    if (err != NULL) {
+        return err;
+    } else if (v != NULL) {
+        return lval_retain(v);
+    } else if (count(a) == 3) {
+        return lval_retain(child(a, 2));
+    }
+    char *k = lval_to_string(key);
+    err = lval_err_for_val(a, "Function 'get': map has no key %s", k);
+    free(k);
+    return err;
+}
+
+lval* builtin_has(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("has", a, 2);
+    LASSERT_MAP_ARG("has", a, 0, true);
+
+    lval *err = NULL;
+    lval *v = map_get(a, "has", child(a, 0), child(a, 1), &err);
+    if (err != NULL) {
+        return err;
+    }
+    return lval_int(v != NULL);
+}
+
+// What to collect from each entry of a map
+typedef enum {
+    collect_keys,
+    collect_values,
+    collect_entries
+} collect_action;
+
+// List of keys, values or entries being collected from a map
+typedef struct {
+    lval *list;
+    collect_action action;
+} collection;
+
+// Adds the key, value or entry to the collection in ctx
+static bool collect_entry(const lval *key, const lval *value, void *ctx)
+{
+    collection *c = ctx;
+    switch (c->action) {
+        case collect_keys:
+            lval_add(c->list, key);
+            break;
+        case collect_values:
+            lval_add(c->list, value);
+            break;
+        case collect_entries: {
+            lval *pair = lval_qexpr_with_size(2);
+            lval_add(pair, key);
+            lval_add(pair, value);
+            lval_add(c->list, pair);
+            lval_release(pair);
+            break;
+        }
+    }
+    return true;
+}
+
+// Adds an entry of a persistent map to the collection in ctx
+static void collect_pmap_entry(const lval *key, const lval *value, void *ctx)
+{
+    collect_entry(key, value, ctx);
+}
+
+// Returns a list of the keys, values or entries of a map (or the keys of
+// an ordered set), in the order the keys were added for hash maps, and in
+// sorted order for ordered maps
+static lval* collect(const lval *a, char *func, collect_action action)
+{
+    LASSERT_NUM_ARGS(func, a, 1);
+    LASSERT_MAP_ARG(func, a, 0, action == collect_keys);
+
+    const lval *m = child(a, 0);
+    if (m->type == LVAL_PERSISTENT_MAP) {
+        collection c = { lval_qexpr_with_size(m->val.vpmap.count), action };
+        lpmap_node_iterate(m->val.vpmap.root, collect_pmap_entry, &c);
+        return c.list;
+    } else if (m->type == LVAL_ORDERED_MAP || m->type == LVAL_ORDERED_SET) {
+        size_t n = lbtree_count(m->val.vbtree);
+        collection c = { lval_qexpr_with_size(n), action };
+        lbtree_iterate(m->val.vbtree, NULL, NULL, collect_entry, &c);
+        return c.list;
+    }
+    const lhashmap *map = m->val.vmap;
+    collection c = { lval_qexpr_with_size(map->count), action };
+    for (size_t i=0; i<map->entry_count; i++) {
+        const lhashmap_entry *entry = &map->entries[i];
+        if (entry->key != NULL) {
+            collect_entry(entry->key, entry->value, &c);
+        }
+    }
+    return c.list;
+}
+
+lval* builtin_keys(lenv *e, const lval *a)
+{
+    return collect(a, "keys", collect_keys);
+}
+
+lval* builtin_values(lenv *e, const lval *a)
+{
+    return collect(a, "values", collect_values);
+}
+
+lval* builtin_entries(lenv *e, const lval *a)
+{
+    return collect(a, "entries", collect_entries);
+}
+
+#pragma mark - Hash sets
+
+// Returns a new hash set of the values in the list l, or an error if one of
+// them can't be hashed
+static lval* hash_set_from_list(const lval *a, char *func, const lval *l)
+{
+    lval *s = lval_hash_set(count(l));
+    for (size_t i=0; i<count(l); i++) {
+        uint64_t hash;
+        lval *err = hash_key(a, func, child(l, i), &hash);
+        if (err != NULL) {
+            lval_release(s);
+            return err;
+        }
+        lhashmap_put(s->val.vmap, child(l, i), hash, child(l, i));
+    }
+    return s;
+}
+
+lval* builtin_hash_set(lenv *e, const lval *a)
+{
+    LASSERTV(a, "hash-set", count(a) <= 1,
+             "Function 'hash-set' passed wrong number of arguments "
+             "(Got: %d Expected: 0 or 1)", count(a));
+    if (count(a) == 0) {
+        return lval_hash_set(0);
+    }
+    LASSERT_ARG_TYPE("hash-set", a, 0, LVAL_QEXPR);
+    return hash_set_from_list(a, "hash-set", child(a, 0));
+}
+
+lval* builtin_from_list(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("from-list", a, 1);
+    LASSERT_ARG_TYPE("from-list", a, 0, LVAL_QEXPR);
+    return hash_set_from_list(a, "from-list", child(a, 0));
+}
+
+lval* builtin_to_list(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("to-list", a, 1);
+    const lval *s = child(a, 0);
+    LASSERTV(a, "to-list", s->type == LVAL_HASH_SET ||
+             s->type == LVAL_ORDERED_SET,
+             "Function 'to-list' passed incorrect type for arg 0 "
+             "(Got: %s Expected: HashSet or OrderedSet)", ltype_name(s->type));
+    return collect(a, "to-list", collect_keys);
+}
+
+// Returns an error if a has no arguments, or one of them isn't a hash set
+static lval* check_set_args(const lval *a, char *func)
+{
+    LASSERTV(a, func, count(a) >= 1,
+             "Function '%s' passed wrong number of arguments "
+             "(Got: %d Expected: 1 or more)", func, count(a));
+    for (int i=0; i<(int)count(a); i++) {
+        LASSERT_ARG_TYPE(func, a, i, LVAL_HASH_SET);
+    }
+    return NULL;
+}
+
+lval* builtin_union(lenv *e, const lval *a)
+{
+    lval *err = check_set_args(a, "union");
+    if (err != NULL) {
+        return err;
+    }
+    lval *r = lval_copy(child(a, 0));
+    for (size_t i=1; i<count(a); i++) {
+        const lhashmap *map = child(a, i)->val.vmap;
+        for (size_t j=0; j<map->entry_count; j++) {
+            const lhashmap_entry *entry = &map->entries[j];
+            if (entry->key != NULL &&
+                lhashmap_get(r->val.vmap, entry->key, entry->hash) == NULL) {
+                lhashmap_put(r->val.vmap, entry->key, entry->hash, entry->key);
+            }
+        }
+    }
+    return r;
+}
+
+// Returns a new hash set of the values in the first set in a that are in
+// all of the other sets (or, if in_others is false, in none of them)
+static lval* filter_first_set(const lval *a, bool in_others)
+{
+    const lhashmap *first = child(a, 0)->val.vmap;
+    lval *r = lval_hash_set(0);
+    for (size_t i=0; i<first->entry_count; i++) {
+        const lhashmap_entry *entry = &first->entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+        bool keep = true;
+        for (size_t j=1; j<count(a) && keep; j++) {
+            const lhashmap *other = child(a, j)->val.vmap;
+            bool found = lhashmap_get(other, entry->key, entry->hash) != NULL;
+            keep = found == in_others;
+        }
+        if (keep) {
+            lhashmap_put(r->val.vmap, entry->key, entry->hash, entry->key);
+        }
+    }
+    return r;
+}
+
+lval* builtin_intersection(lenv *e, const lval *a)
+{
+    lval *err = check_set_args(a, "intersection");
+    if (err != NULL) {
+        return err;
+    }
+    return filter_first_set(a, true);
+}
+
+lval* builtin_difference(lenv *e, const lval *a)
+{
+    lval *err = check_set_args(a, "difference");
+    if (err != NULL) {
+        return err;
+    }
+    return filter_first_set(a, false);
+}
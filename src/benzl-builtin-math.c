@@ -9,6 +9,7 @@
 #include "benzl-builtins.h"
 #include "benzl-lval.h"
 #include "benzl-lval-eval.h"
+#include "benzl-ordered-map.h"
 
 // Type representing a mathematical operation
 typedef enum {
@@ -332,6 +333,18 @@ lval *builtin_min(lenv *e, const lval *a) {
     if (count(a) == 1 && child(a, 0)->type == LVAL_QEXPR) {
         return builtin_min(e, child(a, 0));
     }
+    // If we got an ordered map or set, return its smallest key
+    if (count(a) == 1 && (child(a, 0)->type == LVAL_ORDERED_MAP ||
+                          child(a, 0)->type == LVAL_ORDERED_SET)) {
+        const lbtree *tree = child(a, 0)->val.vbtree;
+        if (lbtree_count(tree) == 0) {
+            return lval_err_for_val(a, "min passed an empty %s",
+                                    ltype_name(child(a, 0)->type));
+        }
+        lval *key, *value;
+        lbtree_at(tree, 0, &key, &value);
+        return lval_retain(key);
+    }
     if (count(a) < 2) {
         return lval_err_for_val(a, "min requires least two numeric arguments");
     }
@@ -360,6 +373,18 @@ lval *builtin_max(lenv *e, const lval *a) {
     if (count(a) == 1 && child(a, 0)->type == LVAL_QEXPR) {
         return builtin_max(e, child(a, 0));
     }
+    // If we got an ordered map or set, return its largest key
+    if (count(a) == 1 && (child(a, 0)->type == LVAL_ORDERED_MAP ||
+                          child(a, 0)->type == LVAL_ORDERED_SET)) {
+        const lbtree *tree = child(a, 0)->val.vbtree;
+        if (lbtree_count(tree) == 0) {
+            return lval_err_for_val(a, "max passed an empty %s",
+                                    ltype_name(child(a, 0)->type));
+        }
+        lval *key, *value;
+        lbtree_at(tree, lbtree_count(tree)-1, &key, &value);
+        return lval_retain(key);
+    }
     if (count(a) < 2) {
         return lval_err("max requires at least two numeric arguments");
     }
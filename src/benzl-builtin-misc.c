@@ -3,10 +3,18 @@
 // Part of benzl - https://github.com/pokeb/benzl
 
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
 
 #include "benzl-builtins.h"
 #include "benzl-lval.h"
@@ -14,6 +22,9 @@
 #include "benzl-lenv.h"
 #include "benzl-error-macros.h"
 #include "benzl-constants.h"
+#include "benzl-lval-pool.h"
+#include "benzl-runtime-stats.h"
+#include "benzl-call-count-debug.h"
 
 lval* builtin_console_size(lenv *e, const lval *a) {
     struct winsize ws;
@@ -41,12 +52,224 @@ lval* builtin_cpu_time_since(lenv *e, const lval *a) {
             ltype_name(a->type)
         );
     }
+    // benzl runs on a single thread, so this is the same as the process CPU
+    // time, but it stays precise while the profiler's ITIMER_PROF is armed
+    // (Linux only updates the process clock on each tick while it is)
     struct timespec time;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
     double now = (time.tv_sec*1000.0)+time.tv_nsec/1000000.0;
     return lval_float(now-v);
 }
 
+// Adds an integer counter to a dictionary of stats
+static void add_counter(lval *d, char *name, size_t value)
+{
+    lval *k = lval_sym(name);
+    lval *v = lval_int((long)value);
+    lval_table_insert(d->val.vdict, k, v);
+    lval_release(k);
+    lval_release(v);
+}
+
+lval* builtin_runtime_stats(lenv *e, const lval *a) {
+    LASSERT_NUM_ARGS("runtime-stats", a, 0);
+
+    lval *d = lval_dict(32);
+
+    // Which categories are being counted
+    lval *enabled = lval_qexpr();
+    char *names[] = {"calls", "pool", "tables", "envs"};
+    stats_category categories[] = {STATS_CALLS, STATS_POOL, STATS_TABLES, STATS_ENVS};
+    for (size_t i=0; i<4; i++) {
+        if (stats_enabled & categories[i]) {
+            lval *s = lval_str(names[i]);
+            lval_add(enabled, s);
+            lval_release(s);
+        }
+    }
+    lval *k = lval_sym("enabled");
+    lval_table_insert(d->val.vdict, k, enabled);
+    lval_release(k);
+    lval_release(enabled);
+
+    lval_pool *pool = global_pool();
+    add_counter(d, "pool-allocations", pool->total_allocated);
+    add_counter(d, "pool-frees", pool->total_freed);
+    add_counter(d, "pool-in-use", pool->total_allocated-pool->total_freed);
+    add_counter(d, "table-lookups", runtime_stats.table_lookups);
+    add_counter(d, "table-collisions", runtime_stats.table_collisions);
+    add_counter(d, "env-allocations", runtime_stats.env_allocs);
+    add_counter(d, "env-frees", runtime_stats.env_frees);
+    add_counter(d, "function-calls", runtime_stats.function_calls);
+
+    // Peak resident set size (ru_maxrss is in bytes on macOS, KB elsewhere)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    add_counter(d, "max-rss-kb", usage.ru_maxrss/1024);
+#else
+    add_counter(d, "max-rss-kb", usage.ru_maxrss);
+#endif
+
+    lval *calls = call_counts_dict();
+    k = lval_sym("call-counts");
+    lval_table_insert(d->val.vdict, k, calls);
+    lval_release(k);
+    lval_release(calls);
+
+    return d;
+}
+
+// Returns the number of bytes currently allocated with malloc
+// (or 0 if this isn't supported on this platform)
+static size_t heap_bytes_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+    return (size_t)(unsigned int)mallinfo().uordblks;
+#elif defined(__APPLE__)
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return stats.size_in_use;
+#else
+    return 0;
+#endif
+}
+
+static int compare_doubles(const void *v1, const void *v2)
+{
+    double d1 = *((double *)v1);
+    double d2 = *((double *)v2);
+    return (d1 > d2) - (d1 < d2);
+}
+
+// Adds a float to a dictionary of results
+static void add_result(lval *d, char *name, double value)
+{
+    lval *k = lval_sym(name);
+    lval *v = lval_float(value);
+    lval_table_insert(d->val.vdict, k, v);
+    lval_release(k);
+    lval_release(v);
+}
+
+lval* builtin_bench(lenv *e, const lval *a) {
+    LASSERTV(a, "bench", count(a) >= 1,
+             "Function 'bench' expects an expression to measure, "
+             "eg (bench {fib 20} iterations:100 warmup:10)");
+    LASSERT_ARG_TYPE("bench", a, 0, LVAL_QEXPR);
+
+    long iterations = 10;
+    long warmup = 1;
+    for (size_t i=1; i<count(a); i++) {
+        lval *option = child(a, i);
+        LASSERTV(a, "bench", option->type == LVAL_KEY_VALUE_PAIR,
+                 "Options for 'bench' take the form iterations:N warmup:M "
+                 "(Got: %s)", ltype_name(option->type));
+        char *name = option->val.vkvpair.key->val.vsym.name;
+        LASSERTV(a, "bench", strcmp(name, "iterations") == 0 ||
+                 strcmp(name, "warmup") == 0,
+                 "Unknown option for 'bench': '%s' "
+                 "(Expected: iterations or warmup)", name);
+
+        lval *v = lval_eval(e, option->val.vkvpair.value);
+        if (v->type == LVAL_ERR) {
+            return v;
+        }
+        bool valid = v->type == LVAL_INT && v->val.vint >= 0;
+        long n = valid ? v->val.vint : 0;
+        lval_release(v);
+        LASSERTV(a, "bench", valid,
+                 "Option '%s' for 'bench' must be a positive Integer", name);
+        if (strcmp(name, "iterations") == 0) {
+            iterations = n;
+        } else {
+            warmup = n;
+        }
+    }
+    LASSERTV(a, "bench", iterations > 0,
+             "Option 'iterations' for 'bench' must be at least 1");
+
+    lval *expr = child(a, 0);
+    for (long i=0; i<warmup; i++) {
+        lval *r = lval_eval_sexpr(e, expr);
+        if (r->type == LVAL_ERR) {
+            return r;
+        }
+        lval_release(r);
+    }
+
+    // Count lval allocations while we measure, even if pool stats are off
+    // (if they are off, we'll put the counters back afterwards)
+    lval_pool *pool = global_pool();
+    unsigned int previous_stats = stats_enabled;
+    size_t previous_allocated = pool->total_allocated;
+    size_t previous_freed = pool->total_freed;
+    stats_enabled |= STATS_POOL;
+
+    double *times = malloc(iterations*sizeof(double));
+    size_t start_heap = heap_bytes_in_use();
+    lval *err = NULL;
+    for (long i=0; i<iterations; i++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lval *r = lval_eval_sexpr(e, expr);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (r->type == LVAL_ERR) {
+            err = r;
+            break;
+        }
+        lval_release(r);
+        times[i] = (end.tv_sec-start.tv_sec)*1000.0 +
+                   (end.tv_nsec-start.tv_nsec)/1000000.0;
+    }
+    double heap_growth = (double)heap_bytes_in_use()-(double)start_heap;
+    size_t allocations = pool->total_allocated-previous_allocated;
+
+    stats_enabled = previous_stats;
+    if (!(previous_stats & STATS_POOL)) {
+        pool->total_allocated = previous_allocated;
+        pool->total_freed = previous_freed;
+    }
+    if (err != NULL) {
+        free(times);
+        return err;
+    }
+
+    double total = 0;
+    for (long i=0; i<iterations; i++) {
+        total += times[i];
+    }
+    double mean = total/iterations;
+    double variance = 0;
+    for (long i=0; i<iterations; i++) {
+        variance += (times[i]-mean)*(times[i]-mean);
+    }
+    variance = iterations > 1 ? variance/(iterations-1) : 0;
+
+    qsort(times, iterations, sizeof(double), compare_doubles);
+    double median = (iterations % 2 == 1) ? times[iterations/2] :
+                    (times[iterations/2-1]+times[iterations/2])/2;
+    // Nearest-rank percentile
+    long p99_index = (long)ceil(0.99*iterations)-1;
+
+    lval *d = lval_dict(24);
+    add_counter(d, "iterations", iterations);
+    add_counter(d, "warmup", warmup);
+    add_result(d, "min", times[0]);
+    add_result(d, "max", times[iterations-1]);
+    add_result(d, "median", median);
+    add_result(d, "mean", mean);
+    add_result(d, "p99", times[p99_index]);
+    add_result(d, "stddev", sqrt(variance));
+    add_result(d, "total", total);
+    add_result(d, "allocations", allocations/(double)iterations);
+    add_result(d, "heap-bytes", heap_growth/iterations);
+    free(times);
+    return d;
+}
+
 lval* builtin_exit(lenv *e, const lval *a) {
     if (count(a) > 0) {
         lval *code = child(a, 0);
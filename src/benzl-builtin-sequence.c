@@ -0,0 +1,102 @@
+// This file implements built-in functions for making and consuming lazy
+// sequences (see benzl-sequence.h)
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdlib.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+#include "benzl-sequence.h"
+#include "benzl-error-macros.h"
+
+lval* builtin_range(lenv *e, const lval *a)
+{
+    LASSERTV(a, "range", count(a) >= 1 && count(a) <= 3, "Function 'range' "
+             "expects 1 to 3 Integers, eg (range 10), (range 1 10) or "
+             "(range 10 0 -2) (Got: %zu arguments)", count(a));
+    for (size_t i=0; i<count(a); i++) {
+        LASSERT_ARG_TYPE("range", a, i, LVAL_INT);
+    }
+    long start = 0;
+    long end;
+    long step = 1;
+    if (count(a) == 1) {
+        end = child(a, 0)->val.vint;
+    } else {
+        start = child(a, 0)->val.vint;
+        end = child(a, 1)->val.vint;
+    }
+    if (count(a) == 3) {
+        step = child(a, 2)->val.vint;
+        LASSERTV(a, "range", step != 0, "Function 'range' can't have a step "
+                 "of 0");
+    }
+    return lval_sequence(lseq_range(start, end, step));
+}
+
+lval* builtin_iterate(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("iterate", a, 2);
+    LASSERT_ARG_TYPE("iterate", a, 0, LVAL_FUN);
+    return lval_sequence(lseq_iterate(child(a, 0), child(a, 1)));
+}
+
+// Makes a sequence transforming the Sequence or List in a with its function
+static lval* transform(const lval *a, char *func, lseq_kind kind)
+{
+    LASSERT_NUM_ARGS(func, a, 2);
+    LASSERT_ARG_TYPE(func, a, 0, LVAL_FUN);
+    lval *source = child(a, 1);
+    LASSERTV(a, func, source->type == LVAL_SEQUENCE ||
+             source->type == LVAL_QEXPR, "Function '%s' passed incorrect "
+             "type for arg 1 (Got: %s Expected: Sequence or List)", func,
+             ltype_name(source->type));
+    if (source->type == LVAL_SEQUENCE) {
+        return lval_sequence(lseq_transform(kind, child(a, 0), source));
+    }
+    lval *items = lval_sequence(lseq_list(source));
+    lval *r = lval_sequence(lseq_transform(kind, child(a, 0), items));
+    lval_release(items);
+    return r;
+}
+
+lval* builtin_lazy_map(lenv *e, const lval *a)
+{
+    return transform(a, "lazy-map", LSEQ_MAP);
+}
+
+lval* builtin_lazy_filter(lenv *e, const lval *a)
+{
+    return transform(a, "lazy-filter", LSEQ_FILTER);
+}
+
+lval* builtin_take_while(lenv *e, const lval *a)
+{
+    return transform(a, "take-while", LSEQ_TAKE_WHILE);
+}
+
+lval* builtin_collect(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("collect", a, 1);
+    LASSERT_ARG_TYPE("collect", a, 0, LVAL_SEQUENCE);
+    const lseq *s = child(a, 0)->val.vseq;
+    LASSERTV(a, "collect", lseq_ends(s), "Function 'collect' passed a "
+             "Sequence that never ends (use take or take-while to end it)");
+
+    lval *r = lval_qexpr();
+    lseq_iter *it = lseq_iter_alloc(e, s);
+    lval *x;
+    while ((x = lseq_iter_next(it)) != NULL) {
+        if (x->type == LVAL_ERR) {
+            lval_release(r);
+            r = x;
+            break;
+        }
+        lval_add(r, x);
+        lval_release(x);
+    }
+    lseq_iter_free(it);
+    return r;
+}
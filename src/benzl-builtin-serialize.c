@@ -0,0 +1,801 @@
+// This file implements built-in functions for serializing values to a
+// compact binary form, and deserializing them again
+// Serialized data starts with an 8 byte header ("BNZL", a format version and
+// 3 bytes of padding), followed by the value. Each value is a tag byte (its
+// lval_type) followed by its data, with numbers stored little endian:
+//   Integer, Float  8 bytes       Byte  1 byte
+//   Symbol, String  32 bit length, the bytes, and a NUL terminator
+//   Buffer  64 bit size, padding to the next multiple of 8 bytes, the bytes
+//   Lists, maps and sets  64 bit count, then each item (or key and value)
+//   Function  0 and the C name of a built-in, or 1, the parameters and body
+//   Type  0 and a primitive type, or 1, the name and properties of a custom
+//         type (which must be defined when the value is deserialized)
+//   Custom type instance  the type, then the value of each property
+// Buffers are aligned to 8 bytes from the start of the data, so when
+// deserialize-file maps a file into memory, buffers in the value can use the
+// mapped memory directly instead of copying it
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-lenv.h"
+#include "benzl-hashmap.h"
+#include "benzl-persistent-map.h"
+#include "benzl-ordered-map.h"
+#include "benzl-error-macros.h"
+
+#define SERIALIZE_MAGIC "BNZL"
+#define SERIALIZE_VERSION 1
+#define SERIALIZE_HEADER_SIZE 8
+
+// Values nested deeper than this can't be serialized (which also stops
+// values that contain themselves, eg a dictionary stored in itself)
+#define SERIALIZE_MAX_DEPTH 1000
+
+// State while serializing a value
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    char error[256]; // Set if the value can't be serialized
+} writer;
+
+// State while deserializing a value
+typedef struct {
+    lenv *e; // Used to look up custom types
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    // The mapped file buffers point into, or NULL to copy buffers
+    lval *owner;
+    char error[256]; // Set if the data isn't valid
+} reader;
+
+#pragma mark - Writing
+
+static void write_bytes(writer *w, const void *bytes, size_t size)
+{
+    if (w->size + size > w->capacity) {
+        w->capacity = MAX(w->capacity * 2, w->size + size);
+        w->data = realloc(w->data, w->capacity);
+    }
+    memcpy(w->data + w->size, bytes, size);
+    w->size += size;
+}
+
+static void write_u8(writer *w, uint8_t x)
+{
+    write_bytes(w, &x, 1);
+}
+
+static void write_u64(writer *w, uint64_t x)
+{
+    uint8_t bytes[8];
+    for (int i=0; i<8; i++) {
+        bytes[i] = (uint8_t)(x >> (i * 8));
+    }
+    write_bytes(w, bytes, 8);
+}
+
+static void write_string(writer *w, const char *s)
+{
+    uint32_t len = (uint32_t)strlen(s);
+    uint8_t bytes[4];
+    for (int i=0; i<4; i++) {
+        bytes[i] = (uint8_t)(len >> (i * 8));
+    }
+    write_bytes(w, bytes, 4);
+    write_bytes(w, s, len + 1);
+}
+
+static bool write_value(writer *w, const lval *v, int depth);
+
+// Callbacks for writing the keys and values of maps
+typedef struct {
+    writer *w;
+    int depth;
+    bool write_values; // false for sets
+    bool ok;
+} write_ctx;
+
+static void write_pmap_entry(const lval *key, const lval *value, void *ctx)
+{
+    write_ctx *c = ctx;
+    c->ok = c->ok && write_value(c->w, key, c->depth) &&
+            write_value(c->w, value, c->depth);
+}
+
+static bool write_btree_entry(const lval *key, const lval *value, void *ctx)
+{
+    write_ctx *c = ctx;
+    c->ok = write_value(c->w, key, c->depth) &&
+            (!c->write_values || write_value(c->w, value, c->depth));
+    return c->ok;
+}
+
+static bool write_value(writer *w, const lval *v, int depth)
+{
+    if (depth > SERIALIZE_MAX_DEPTH) {
+        snprintf(w->error, sizeof(w->error), "Value is nested more than "
+                 "%d levels deep", SERIALIZE_MAX_DEPTH);
+        return false;
+    }
+    depth++;
+    write_u8(w, (uint8_t)v->type);
+    switch (v->type) {
+        case LVAL_INT:
+            write_u64(w, (uint64_t)v->val.vint);
+            break;
+        case LVAL_FLT: {
+            uint64_t bits;
+            memcpy(&bits, &v->val.vflt, 8);
+            write_u64(w, bits);
+            break;
+        }
+        case LVAL_BYTE:
+            write_u8(w, v->val.vbyte);
+            break;
+        case LVAL_SYM:
+            write_string(w, v->val.vsym.name);
+            break;
+        case LVAL_STR:
+            write_string(w, v->val.vstr);
+            break;
+        case LVAL_BUF: {
+            write_u64(w, v->val.vbuf.size);
+            static const uint8_t padding[8] = {0};
+            write_bytes(w, padding, (8 - w->size % 8) % 8);
+            write_bytes(w, v->val.vbuf.data, v->val.vbuf.size);
+            break;
+        }
+        case LVAL_ERR:
+        case LVAL_CAUGHT_ERR:
+            write_string(w, v->val.verr.message);
+            write_u8(w, v->val.verr.stack_trace != NULL);
+            if (v->val.verr.stack_trace != NULL) {
+                write_string(w, v->val.verr.stack_trace->val.vstr);
+            }
+            break;
+        case LVAL_DICT: {
+            lval_entry **entries;
+            size_t n = lval_table_entries(v->val.vdict, &entries);
+            write_u64(w, n);
+            bool ok = true;
+            for (size_t i=0; ok && i<n; i++) {
+                ok = write_value(w, entries[i]->key, depth) &&
+                     write_value(w, entries[i]->value, depth);
+            }
+            free(entries);
+            return ok;
+        }
+        case LVAL_FUN:
+            if (v->val.vfunc.builtin != NULL) {
+                const char *c_name = builtin_c_name(v->val.vfunc.builtin);
+                if (c_name == NULL) {
+                    snprintf(w->error, sizeof(w->error),
+                             "Unknown built-in function");
+                    return false;
+                }
+                write_u8(w, 0);
+                write_string(w, c_name);
+                break;
+            }
+            write_u8(w, 1);
+            return write_value(w, v->val.vfunc.args, depth) &&
+                   write_value(w, v->val.vfunc.body, depth);
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            write_u64(w, count(v));
+            for (size_t i=0; i<count(v); i++) {
+                if (!write_value(w, child(v, i), depth)) {
+                    return false;
+                }
+            }
+            break;
+        case LVAL_TYPE:
+            if (v->val.vtype.props == NULL) {
+                write_u8(w, 0);
+                write_u8(w, (uint8_t)v->val.vtype.primitive);
+                break;
+            }
+            write_u8(w, 1);
+            write_string(w, v->val.vtype.name->val.vsym.name);
+            return write_value(w, v->val.vtype.props, depth);
+        case LVAL_CUSTOM_TYPE_INSTANCE: {
+            const lval *type = v->val.vinst.type;
+            if (!write_value(w, type, depth)) {
+                return false;
+            }
+            for (size_t i=0; i<custom_type_slot_count(type); i++) {
+                if (!write_value(w, v->val.vinst.slots[i], depth)) {
+                    return false;
+                }
+            }
+            break;
+        }
+        case LVAL_KEY_VALUE_PAIR:
+            return write_value(w, v->val.vkvpair.key, depth) &&
+                   write_value(w, v->val.vkvpair.value, depth);
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET: {
+            const lhashmap *map = v->val.vmap;
+            write_u64(w, map->count);
+            for (size_t i=0; i<map->entry_count; i++) {
+                const lhashmap_entry *entry = &map->entries[i];
+                if (entry->key == NULL) {
+                    continue;
+                }
+                if (!write_value(w, entry->key, depth) ||
+                    (v->type == LVAL_HASHMAP &&
+                     !write_value(w, entry->value, depth))) {
+                    return false;
+                }
+            }
+            break;
+        }
+        case LVAL_PERSISTENT_MAP: {
+            write_u64(w, v->val.vpmap.count);
+            write_ctx ctx = {w, depth, true, true};
+            lpmap_node_iterate(v->val.vpmap.root, write_pmap_entry, &ctx);
+            return ctx.ok;
+        }
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET: {
+            write_u64(w, lbtree_count(v->val.vbtree));
+            write_ctx ctx = {w, depth, v->type == LVAL_ORDERED_MAP, true};
+            lbtree_iterate(v->val.vbtree, NULL, NULL, write_btree_entry, &ctx);
+            return ctx.ok;
+        }
+        case LVAL_SEQUENCE:
+            snprintf(w->error, sizeof(w->error), "A Sequence can't be "
+                     "serialized (collect it into a List first)");
+            return false;
+    }
+    return true;
+}
+
+#pragma mark - Reading
+
+// Returns a pointer to the next size bytes, or NULL if there aren't enough
+static const uint8_t* read_bytes(reader *r, size_t size)
+{
+    if (size > r->size - r->pos) {
+        snprintf(r->error, sizeof(r->error), "Data ends unexpectedly");
+        return NULL;
+    }
+    const uint8_t *p = r->data + r->pos;
+    r->pos += size;
+    return p;
+}
+
+static bool read_u8(reader *r, uint8_t *x)
+{
+    const uint8_t *p = read_bytes(r, 1);
+    if (p != NULL) {
+        *x = *p;
+    }
+    return p != NULL;
+}
+
+static bool read_u64(reader *r, uint64_t *x)
+{
+    const uint8_t *p = read_bytes(r, 8);
+    if (p == NULL) {
+        return false;
+    }
+    *x = 0;
+    for (int i=0; i<8; i++) {
+        *x |= (uint64_t)p[i] << (i * 8);
+    }
+    return true;
+}
+
+// Reads a count of items, each at least min_size bytes
+// (so a bad count fails here, rather than allocating space for the items)
+static bool read_count(reader *r, size_t min_size, size_t *count)
+{
+    uint64_t n;
+    if (!read_u64(r, &n)) {
+        return false;
+    }
+    if (n > (r->size - r->pos) / min_size) {
+        snprintf(r->error, sizeof(r->error), "Data ends unexpectedly");
+        return false;
+    }
+    *count = (size_t)n;
+    return true;
+}
+
+// Returns a pointer to the next string (which is NUL terminated)
+static const char* read_string(reader *r)
+{
+    const uint8_t *p = read_bytes(r, 4);
+    if (p == NULL) {
+        return NULL;
+    }
+    uint32_t len = (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                   (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    const char *s = (const char *)read_bytes(r, (size_t)len + 1);
+    if (s != NULL && (s[len] != 0x00 || memchr(s, 0x00, len) != NULL)) {
+        snprintf(r->error, sizeof(r->error), "Invalid string");
+        return NULL;
+    }
+    return s;
+}
+
+static lval* read_value(reader *r, int depth);
+
+// Releases a value that may not have been read (if reading failed first)
+static void release_if_read(lval *v)
+{
+    if (v != NULL) {
+        lval_release(v);
+    }
+}
+
+// Reads a value that must have one of two types
+static lval* read_value_of_type(reader *r, int depth,
+                                lval_type t1, lval_type t2)
+{
+    lval *v = read_value(r, depth);
+    if (v != NULL && v->type != t1 && v->type != t2) {
+        snprintf(r->error, sizeof(r->error), "Unexpected %s",
+                 ltype_name(v->type));
+        lval_release(v);
+        return NULL;
+    }
+    return v;
+}
+
+// Reads a key for a map, setting hash to its lval_hash
+static lval* read_key(reader *r, int depth, uint64_t *hash)
+{
+    lval *key = read_value(r, depth);
+    if (key != NULL && !lval_hash(key, hash)) {
+        snprintf(r->error, sizeof(r->error), "%s can't be a key",
+                 ltype_name(key->type));
+        lval_release(key);
+        return NULL;
+    }
+    return key;
+}
+
+// Looks up the custom type called name, checking it has the properties props
+static lval* read_custom_type(reader *r, const char *name, const lval *props)
+{
+    lval *sym = lval_sym((char *)name);
+    lval *type = lenv_get(r->e, sym);
+    lval_release(sym);
+    if (type->type != LVAL_TYPE || type->val.vtype.props == NULL) {
+        snprintf(r->error, sizeof(r->error), "Unknown type '%.64s'", name);
+        lval_release(type);
+        return NULL;
+    }
+    bool same_props = custom_type_slot_count(type) == count(props);
+    for (size_t i=0; same_props && i<count(props); i++) {
+        lval *prop = child(props, i);
+        if (prop->type == LVAL_KEY_VALUE_PAIR) {
+            prop = prop->val.vkvpair.key;
+        }
+        same_props = prop->type == LVAL_SYM &&
+                     equal_symbols(custom_type_slot_name(type, i), prop);
+    }
+    if (!same_props) {
+        snprintf(r->error, sizeof(r->error), "Type '%.64s' has different "
+                 "properties to the serialized type", name);
+        lval_release(type);
+        return NULL;
+    }
+    return type;
+}
+
+static lval* read_value(reader *r, int depth)
+{
+    if (depth > SERIALIZE_MAX_DEPTH) {
+        snprintf(r->error, sizeof(r->error), "Value is nested more than "
+                 "%d levels deep", SERIALIZE_MAX_DEPTH);
+        return NULL;
+    }
+    depth++;
+    uint8_t tag;
+    if (!read_u8(r, &tag)) {
+        return NULL;
+    }
+    switch ((lval_type)tag) {
+        case LVAL_INT: {
+            uint64_t x;
+            return read_u64(r, &x) ? lval_int((long)x) : NULL;
+        }
+        case LVAL_FLT: {
+            uint64_t bits;
+            if (!read_u64(r, &bits)) {
+                return NULL;
+            }
+            double x;
+            memcpy(&x, &bits, 8);
+            return lval_float(x);
+        }
+        case LVAL_BYTE: {
+            uint8_t x;
+            return read_u8(r, &x) ? lval_byte(x) : NULL;
+        }
+        case LVAL_SYM:
+        case LVAL_STR: {
+            const char *s = read_string(r);
+            if (s == NULL) {
+                return NULL;
+            }
+            return tag == LVAL_SYM ? lval_sym((char *)s) : lval_str((char *)s);
+        }
+        case LVAL_BUF: {
+            uint64_t size;
+            if (!read_u64(r, &size) || !read_bytes(r, (8 - r->pos % 8) % 8)) {
+                return NULL;
+            }
+            uint8_t *data = (uint8_t *)read_bytes(r, (size_t)size);
+            if (data == NULL) {
+                return NULL;
+            }
+            if (r->owner != NULL) {
+                return lval_buf_view(r->owner, data, (size_t)size);
+            }
+            lval *v = lval_buf((size_t)size);
+            memcpy(v->val.vbuf.data, data, (size_t)size);
+            return v;
+        }
+        case LVAL_ERR:
+        case LVAL_CAUGHT_ERR: {
+            const char *message = read_string(r);
+            uint8_t has_stack_trace;
+            if (message == NULL || !read_u8(r, &has_stack_trace)) {
+                return NULL;
+            }
+            const char *stack_trace = has_stack_trace ? read_string(r) : "";
+            if (stack_trace == NULL) {
+                return NULL;
+            }
+            lval *v = lval_err("");
+            free(v->val.verr.message);
+            v->val.verr.message = strdup(message);
+            v->type = (lval_type)tag;
+            if (has_stack_trace) {
+                v->val.verr.stack_trace = lval_str((char *)stack_trace);
+            }
+            return v;
+        }
+        case LVAL_DICT: {
+            size_t n;
+            if (!read_count(r, 2, &n)) {
+                return NULL;
+            }
+            lval *v = lval_dict(MAX(n, 8));
+            for (size_t i=0; i<n; i++) {
+                lval *key = read_value_of_type(r, depth, LVAL_SYM, LVAL_SYM);
+                lval *value = key != NULL ? read_value(r, depth) : NULL;
+                if (value == NULL) {
+                    release_if_read(key);
+                    lval_release(v);
+                    return NULL;
+                }
+                lval_table_insert(v->val.vdict, key, value);
+                lval_release(key);
+                lval_release(value);
+            }
+            return v;
+        }
+        case LVAL_FUN: {
+            uint8_t kind;
+            if (!read_u8(r, &kind)) {
+                return NULL;
+            }
+            if (kind == 0) {
+                const char *c_name = read_string(r);
+                if (c_name == NULL) {
+                    return NULL;
+                }
+                lbuiltin func = builtin_named(c_name);
+                if (func == NULL) {
+                    snprintf(r->error, sizeof(r->error), "Unknown built-in "
+                             "function '%.64s'", c_name);
+                    return NULL;
+                }
+                return lval_fun(func);
+            }
+            lval *args = read_value_of_type(r, depth, LVAL_QEXPR, LVAL_QEXPR);
+            lval *body = args != NULL ?
+                read_value_of_type(r, depth, LVAL_QEXPR, LVAL_QEXPR) : NULL;
+            if (body == NULL) {
+                release_if_read(args);
+                return NULL;
+            }
+            // Look up parameter types, as builtin_lambda does
+            lval *resolved = resolve_param_types(r->e, args);
+            lval *v = lval_lambda(resolved, body);
+            lval_release(resolved);
+            lval_release(args);
+            lval_release(body);
+            return v;
+        }
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            size_t n;
+            if (!read_count(r, 1, &n)) {
+                return NULL;
+            }
+            lval *v = tag == LVAL_SEXPR ? lval_sexpr_with_size(n) :
+                                          lval_qexpr_with_size(n);
+            for (size_t i=0; i<n; i++) {
+                lval *x = read_value(r, depth);
+                if (x == NULL) {
+                    lval_release(v);
+                    return NULL;
+                }
+                lval_add(v, x);
+                lval_release(x);
+            }
+            return v;
+        }
+        case LVAL_TYPE: {
+            uint8_t kind;
+            if (!read_u8(r, &kind)) {
+                return NULL;
+            }
+            if (kind == 0) {
+                uint8_t primitive;
+                if (!read_u8(r, &primitive)) {
+                    return NULL;
+                }
+                if (primitive >= LVAL_TYPE_COUNT) {
+                    snprintf(r->error, sizeof(r->error), "Invalid type");
+                    return NULL;
+                }
+                return lval_primitive_type((lval_type)primitive);
+            }
+            const char *name = read_string(r);
+            lval *props = name != NULL ?
+                read_value_of_type(r, depth, LVAL_QEXPR, LVAL_QEXPR) : NULL;
+            if (props == NULL) {
+                return NULL;
+            }
+            lval *type = read_custom_type(r, name, props);
+            lval_release(props);
+            return type;
+        }
+        case LVAL_CUSTOM_TYPE_INSTANCE: {
+            lval *type = read_value_of_type(r, depth, LVAL_TYPE, LVAL_TYPE);
+            if (type == NULL) {
+                return NULL;
+            }
+            if (type->val.vtype.props == NULL) {
+                snprintf(r->error, sizeof(r->error), "Invalid type");
+                lval_release(type);
+                return NULL;
+            }
+            size_t n = custom_type_slot_count(type);
+            lval *props = lval_qexpr_with_size(n);
+            for (size_t i=0; i<n; i++) {
+                lval *x = read_value(r, depth);
+                if (x == NULL) {
+                    lval_release(props);
+                    lval_release(type);
+                    return NULL;
+                }
+                lval *prop = lval_kv_pair(custom_type_slot_name(type, i), x);
+                lval_add(props, prop);
+                lval_release(prop);
+                lval_release(x);
+            }
+            lval *v = lval_custom_type_instance(type, props);
+            lval_release(props);
+            lval_release(type);
+            return v;
+        }
+        case LVAL_KEY_VALUE_PAIR: {
+            lval *key = read_value_of_type(r, depth, LVAL_SYM, LVAL_SYM);
+            lval *value = key != NULL ? read_value(r, depth) : NULL;
+            if (value == NULL) {
+                release_if_read(key);
+                return NULL;
+            }
+            lval *v = lval_kv_pair(key, value);
+            lval_release(key);
+            lval_release(value);
+            return v;
+        }
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET: {
+            size_t n;
+            if (!read_count(r, 1, &n)) {
+                return NULL;
+            }
+            lval *v = tag == LVAL_HASHMAP ? lval_hashmap(n) : lval_hash_set(n);
+            for (size_t i=0; i<n; i++) {
+                uint64_t hash;
+                lval *key = read_key(r, depth, &hash);
+                lval *value = key == NULL ? NULL :
+                    tag == LVAL_HASHMAP ? read_value(r, depth) :
+                    lval_retain(key);
+                if (value == NULL) {
+                    release_if_read(key);
+                    lval_release(v);
+                    return NULL;
+                }
+                lhashmap_put(v->val.vmap, key, hash, value);
+                lval_release(key);
+                lval_release(value);
+            }
+            return v;
+        }
+        case LVAL_PERSISTENT_MAP: {
+            size_t n;
+            if (!read_count(r, 2, &n)) {
+                return NULL;
+            }
+            lpmap_node *root = NULL;
+            size_t added_count = 0;
+            for (size_t i=0; i<n; i++) {
+                uint64_t hash;
+                lval *key = read_key(r, depth, &hash);
+                lval *value = key != NULL ? read_value(r, depth) : NULL;
+                if (value == NULL) {
+                    release_if_read(key);
+                    lpmap_node_release(root);
+                    return NULL;
+                }
+                bool added;
+                lpmap_node *node = lpmap_node_assoc(root, key, hash, value,
+                                                    &added);
+                lpmap_node_release(root);
+                root = node;
+                added_count += added;
+                lval_release(key);
+                lval_release(value);
+            }
+            return lval_persistent_map(root, added_count);
+        }
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET: {
+            size_t n;
+            if (!read_count(r, 1, &n)) {
+                return NULL;
+            }
+            lval *v = lval_ordered_map((lval_type)tag);
+            for (size_t i=0; i<n; i++) {
+                lval *key = read_value(r, depth);
+                if (key != NULL && !lbtree_accepts_key(v->val.vbtree, key)) {
+                    snprintf(r->error, sizeof(r->error), "%s can't be a key "
+                             "in this map", ltype_name(key->type));
+                    lval_release(key);
+                    key = NULL;
+                }
+                lval *value = key == NULL ? NULL :
+                    tag == LVAL_ORDERED_MAP ? read_value(r, depth) :
+                    lval_retain(key);
+                if (value == NULL) {
+                    release_if_read(key);
+                    lval_release(v);
+                    return NULL;
+                }
+                lbtree_put(v->val.vbtree, key, value);
+                lval_release(key);
+                lval_release(value);
+            }
+            return v;
+        }
+        case LVAL_SEQUENCE:
+            break;
+    }
+    snprintf(r->error, sizeof(r->error), "Invalid value tag %d", tag);
+    return NULL;
+}
+
+// Deserializes size bytes of data (with buffers pointing into owner, if it
+// isn't NULL). a and func are used for errors
+static lval* deserialize(lenv *e, const lval *a, char *func,
+                         const uint8_t *data, size_t size, lval *owner)
+{
+    if (size < SERIALIZE_HEADER_SIZE || memcmp(data, SERIALIZE_MAGIC, 4) != 0) {
+        return lval_err_for_val(a, "Function '%s' passed data that isn't a "
+                                   "serialized value", func);
+    }
+    if (data[4] != SERIALIZE_VERSION) {
+        return lval_err_for_val(a, "Function '%s' passed data serialized with "
+                                   "an unsupported version (%d)", func, data[4]);
+    }
+    reader r = {
+        .e = e, .data = data, .size = size, .pos = SERIALIZE_HEADER_SIZE,
+        .owner = owner
+    };
+    lval *v = read_value(&r, 0);
+    if (v == NULL) {
+        return lval_err_for_val(a, "Function '%s' passed invalid serialized "
+                                   "data: %s (at offset %zu)", func, r.error,
+                                   r.pos);
+    }
+    if (r.pos != size) {
+        lval_release(v);
+        return lval_err_for_val(a, "Function '%s' passed invalid serialized "
+                                   "data: %zu unexpected bytes at the end",
+                                   func, size - r.pos);
+    }
+    return v;
+}
+
+#pragma mark - Built-in functions
+
+lval* builtin_serialize(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("serialize", a, 1);
+
+    writer w = {.data = NULL, .size = 0, .capacity = 0};
+    write_bytes(&w, SERIALIZE_MAGIC, 4);
+    const uint8_t version[4] = {SERIALIZE_VERSION, 0, 0, 0};
+    write_bytes(&w, version, 4);
+    if (!write_value(&w, child(a, 0), 0)) {
+        free(w.data);
+        return lval_err_for_val(a, "Function 'serialize' can't serialize the "
+                                   "value: %s", w.error);
+    }
+    lval *r = lval_buf(0);
+    free(r->val.vbuf.data);
+    r->val.vbuf.data = realloc(w.data, w.size);
+    r->val.vbuf.size = w.size;
+    return r;
+}
+
+lval* builtin_deserialize(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("deserialize", a, 1);
+    LASSERT_ARG_TYPE("deserialize", a, 0, LVAL_BUF);
+
+    const lval *buf = child(a, 0);
+    return deserialize(e, a, "deserialize", buf->val.vbuf.data,
+                       buf->val.vbuf.size, NULL);
+}
+
+lval* builtin_deserialize_file(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("deserialize-file", a, 1);
+    LASSERT_ARG_TYPE("deserialize-file", a, 0, LVAL_STR);
+
+    char *path = child(a, 0)->val.vstr;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return lval_err_for_val(a, "Unable to read the file at '%s'", path);
+    }
+    size_t size = (size_t)st.st_size;
+    if (size < SERIALIZE_HEADER_SIZE) {
+        close(fd);
+        return lval_err_for_val(a, "Function 'deserialize-file' passed a file "
+                                   "that isn't a serialized value");
+    }
+
+    // A private mapping, so buffers in the value can be changed without
+    // changing the file
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return lval_err_for_val(a, "Unable to read the file at '%s'", path);
+    }
+
+    // Buffers in the value keep the mapping alive, it's unmapped once
+    // they've all been freed
+    lval *owner = lval_buf_mapped(data, size);
+    lval *v = deserialize(e, a, "deserialize-file", data, size, owner);
+    lval_release(owner);
+    return v;
+}
@@ -0,0 +1,458 @@
+// This file implements built-in functions for packing values into binary
+// records, and unpacking them again (like Python's struct module)
+// A format string like "<HIi" describes the record: an optional byte order
+// ('<' little endian, '>' or '!' big endian, '=' or '@' native) followed by a
+// code for each field, optionally with a repeat count (eg "3H"):
+//   x  pad byte (no value)          b / B  signed / unsigned 8 bit integer
+//   h / H  16 bit integer           i / I  32 bit integer (also l / L)
+//   q / Q  64 bit integer           f / d  32 / 64 bit float
+//   s  string (the count is its length in bytes, eg "4s")
+// Fields are packed without any padding between them, and a record can be at
+// most 16MB (STRUCT_MAX_SIZE)
+// Formats are compiled into a list of fields the first time they are used,
+// and kept in a small cache, so packing the same kind of record again
+// doesn't parse the format again. Each record is bounds checked once,
+// rather than once per field
+// unpack-struct-array decodes each numeric field into a Buffer of elements
+// (see benzl-buffer-element.h), like csv-columns, rather than a list of
+// Integers or Floats
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "benzl-builtins.h"
+#include "benzl-lval.h"
+#include "benzl-buffer-element.h"
+#include "benzl-error-macros.h"
+
+// A field in a record
+typedef struct {
+    char code; // Format code, eg 'H'
+    uint8_t size; // Size of a single value in bytes (1 for 's' and 'x')
+    size_t count; // Length of a string, or number of pad bytes (1 otherwise)
+} struct_field;
+
+// A compiled format string
+typedef struct {
+    char *format; // The format string this was compiled from
+    bool big_endian;
+    size_t size; // Size of a record in bytes
+    size_t field_count;
+    size_t value_count; // Number of fields that have values (not 'x')
+    struct_field *fields;
+} struct_format;
+
+// Largest record a format can describe, in bytes (which also limits the
+// number of fields, as each takes at least a byte)
+#define STRUCT_MAX_SIZE ((size_t)1 << 24)
+
+// Formats compiled most recently (replaced in turn once the cache is full)
+#define STRUCT_FORMAT_CACHE_SIZE 16
+static struct_format *format_cache[STRUCT_FORMAT_CACHE_SIZE];
+static size_t next_cache_slot = 0;
+
+#pragma mark - Formats
+
+static bool native_big_endian(void)
+{
+    const uint16_t x = 1;
+    return *(const uint8_t *)&x == 0;
+}
+
+// Size in bytes of a value for a format code, or 0 if it isn't a valid code
+static uint8_t code_size(char code)
+{
+    switch (code) {
+        case 'x': case 'b': case 'B': case 's': return 1;
+        case 'h': case 'H': return 2;
+        case 'i': case 'I': case 'l': case 'L': case 'f': return 4;
+        case 'q': case 'Q': case 'd': return 8;
+        default: return 0;
+    }
+}
+
+static void struct_format_free(struct_format *f)
+{
+    free(f->format);
+    free(f->fields);
+    free(f);
+}
+
+// Compiles a format string
+// Returns NULL and sets error if the format isn't valid
+static struct_format* struct_format_compile(const char *format,
+                                            const char **error)
+{
+    struct_format *f = calloc(1, sizeof(struct_format));
+    f->format = strdup(format);
+    f->big_endian = native_big_endian();
+    const char *p = format;
+    switch (*p) {
+        case '<': f->big_endian = false; p++; break;
+        case '>': case '!': f->big_endian = true; p++; break;
+        case '=': case '@': p++; break;
+        default: break;
+    }
+    size_t capacity = 8;
+    f->fields = malloc(sizeof(struct_field) * capacity);
+    while (*p != '\0') {
+        if (isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        size_t repeat = 1;
+        if (isdigit((unsigned char)*p)) {
+            char *end;
+            errno = 0;
+            unsigned long long n = strtoull(p, &end, 10);
+            p = end;
+            if (n == 0 || n > STRUCT_MAX_SIZE || errno == ERANGE) {
+                *error = n == 0 ? "a count must be at least 1"
+                                : "count is too large";
+                struct_format_free(f);
+                return NULL;
+            }
+            repeat = (size_t)n;
+        }
+        uint8_t size = code_size(*p);
+        if (size == 0) {
+            *error = *p == '\0' ? "a count must be followed by a code"
+                                : "unknown code";
+            struct_format_free(f);
+            return NULL;
+        }
+        if (repeat > (STRUCT_MAX_SIZE - f->size) / size) {
+            *error = "records would be too large";
+            struct_format_free(f);
+            return NULL;
+        }
+        // Strings and padding are single fields, other values are repeated
+        size_t fields = (*p == 's' || *p == 'x') ? 1 : repeat;
+        size_t count = (*p == 's' || *p == 'x') ? repeat : 1;
+        for (size_t i=0; i<fields; i++) {
+            if (f->field_count == capacity) {
+                capacity *= 2;
+                f->fields = realloc(f->fields, sizeof(struct_field)*capacity);
+            }
+            f->fields[f->field_count++] = (struct_field){*p, size, count};
+            f->size += size * count;
+            if (*p != 'x') {
+                f->value_count++;
+            }
+        }
+        p++;
+    }
+    return f;
+}
+
+// Returns the compiled format for a format string (compiling it if it
+// isn't in the cache), or an error
+static lval* struct_format_for(const lval *a, char *func,
+                               const lval *format, struct_format **f)
+{
+    LASSERTV(a, func, format->type == LVAL_STR,
+             "Function '%s' passed incorrect type for arg 0 "
+             "(Got: %s Expected: String)", func, ltype_name(format->type));
+    for (size_t i=0; i<STRUCT_FORMAT_CACHE_SIZE; i++) {
+        if (format_cache[i] != NULL &&
+            strcmp(format_cache[i]->format, format->val.vstr) == 0) {
+            *f = format_cache[i];
+            return NULL;
+        }
+    }
+    const char *error = NULL;
+    struct_format *compiled = struct_format_compile(format->val.vstr, &error);
+    LASSERTV(a, func, compiled != NULL,
+             "Function '%s' passed invalid format \"%s\" (%s)",
+             func, format->val.vstr, error);
+    if (format_cache[next_cache_slot] != NULL) {
+        struct_format_free(format_cache[next_cache_slot]);
+    }
+    format_cache[next_cache_slot] = compiled;
+    next_cache_slot = (next_cache_slot + 1) % STRUCT_FORMAT_CACHE_SIZE;
+    *f = compiled;
+    return NULL;
+}
+
+#pragma mark - Packing and unpacking values
+
+// Writes the low size bytes of v to p, in the format's byte order
+static inline void write_uint(uint8_t *p, uint64_t v, size_t size,
+                              bool big_endian)
+{
+    for (size_t i=0; i<size; i++) {
+        p[big_endian ? size-1-i : i] = (uint8_t)(v >> (8*i));
+    }
+}
+
+// Reads a size byte unsigned integer from p, in the format's byte order
+static inline uint64_t read_uint(const uint8_t *p, size_t size,
+                                 bool big_endian)
+{
+    uint64_t v = 0;
+    for (size_t i=0; i<size; i++) {
+        v |= (uint64_t)p[big_endian ? size-1-i : i] << (8*i);
+    }
+    return v;
+}
+
+// Writes value v for field to p
+// Returns an error if the value is the wrong type for the field, or NULL
+static lval* pack_value(const lval *a, const struct_field *field,
+                        bool big_endian, const lval *v, uint8_t *p)
+{
+    switch (field->code) {
+        case 's': {
+            LASSERTV(a, "pack-struct", v->type == LVAL_STR,
+                     "Function 'pack-struct' passed %s for a string field "
+                     "(Expected: String)", ltype_name(v->type));
+            // Strings are truncated or padded with zeros to fit
+            size_t len = strlen(v->val.vstr);
+            memcpy(p, v->val.vstr, MIN(len, field->count));
+            return NULL;
+        }
+        case 'f': case 'd': {
+            LASSERTV(a, "pack-struct", lval_is_number(v),
+                     "Function 'pack-struct' passed %s for a '%c' field "
+                     "(Expected: a number)", ltype_name(v->type), field->code);
+            double d = v->type == LVAL_FLT ? v->val.vflt :
+                       v->type == LVAL_BYTE ? v->val.vbyte : v->val.vint;
+            uint64_t bits;
+            if (field->code == 'f') {
+                float x = (float)d;
+                uint32_t b;
+                memcpy(&b, &x, 4);
+                bits = b;
+            } else {
+                memcpy(&bits, &d, 8);
+            }
+            write_uint(p, bits, field->size, big_endian);
+            return NULL;
+        }
+        default: {
+            // Integers are truncated to the size of the field, like
+            // put-unsigned-short etc. do
+            LASSERTV(a, "pack-struct",
+                     v->type == LVAL_INT || v->type == LVAL_BYTE,
+                     "Function 'pack-struct' passed %s for a '%c' field "
+                     "(Expected: Integer)", ltype_name(v->type), field->code);
+            long x = v->type == LVAL_INT ? v->val.vint : v->val.vbyte;
+            write_uint(p, (uint64_t)x, field->size, big_endian);
+            return NULL;
+        }
+    }
+}
+
+// Reads the value of field from p
+static lval* unpack_value(const struct_field *field, bool big_endian,
+                          const uint8_t *p)
+{
+    if (field->code == 's') {
+        // Strings end at the first zero byte
+        size_t len = strnlen((const char *)p, field->count);
+        char *s = malloc(len + 1);
+        memcpy(s, p, len);
+        s[len] = '\0';
+        lval *r = lval_str(s);
+        free(s);
+        return r;
+    }
+    uint64_t v = read_uint(p, field->size, big_endian);
+    switch (field->code) {
+        case 'b': return lval_int((int8_t)v);
+        case 'h': return lval_int((int16_t)v);
+        case 'i': case 'l': return lval_int((int32_t)v);
+        case 'q': return lval_int((int64_t)v);
+        case 'f': {
+            uint32_t b = (uint32_t)v;
+            float x;
+            memcpy(&x, &b, 4);
+            return lval_float(x);
+        }
+        case 'd': {
+            double x;
+            memcpy(&x, &v, 8);
+            return lval_float(x);
+        }
+        default: return lval_int((long)v);
+    }
+}
+
+// Element type of the Buffer that a numeric field is unpacked into
+static element_type field_element_type(char code)
+{
+    switch (code) {
+        case 'b': return element_i8;
+        case 'B': return element_u8;
+        case 'h': return element_i16;
+        case 'H': return element_u16;
+        case 'i': case 'l': return element_i32;
+        case 'I': case 'L': return element_u32;
+        case 'q': return element_i64;
+        case 'Q': return element_u64;
+        case 'f': return element_f32;
+        default: return element_f64;
+    }
+}
+
+// Unpacks field from records records starting at p: a list of Strings for a
+// string field, otherwise a Buffer of elements in the native byte order
+static lval* unpack_column(const struct_format *f, const struct_field *field,
+                           const uint8_t *p, size_t records)
+{
+    if (field->code == 's') {
+        lval *column = lval_qexpr_with_size(records);
+        for (size_t n=0; n<records; n++) {
+            lval *v = unpack_value(field, f->big_endian, p + n*f->size);
+            lval_add(column, v);
+            lval_release(v);
+        }
+        return column;
+    }
+    size_t size = element_types[field_element_type(field->code)].size;
+    lval *column = lval_buf(records * size);
+    uint8_t *restrict d = column->val.vbuf.data;
+    if (f->big_endian == native_big_endian()) {
+        for (size_t n=0; n<records; n++) {
+            memcpy(d + n*size, p + n*f->size, size);
+        }
+    } else {
+        // The bytes of each element are in the opposite order
+        for (size_t n=0; n<records; n++) {
+            for (size_t i=0; i<size; i++) {
+                d[n*size + i] = p[n*f->size + size-1-i];
+            }
+        }
+    }
+    return column;
+}
+
+// Gets the offset argument i (if it was passed), and checks count records
+// fit in the buffer from there
+static lval* record_offset(const lval *a, char *func, size_t i,
+                           const struct_format *f, size_t records,
+                           size_t *offset)
+{
+    *offset = 0;
+    if (count(a) > i) {
+        LASSERT_ARG_TYPE(func, a, i, LVAL_INT);
+        LASSERTV(a, func, child(a, i)->val.vint >= 0,
+                 "Function '%s' passed a negative offset", func);
+        *offset = (size_t)child(a, i)->val.vint;
+    }
+    size_t size = child(a, 1)->val.vbuf.size;
+    // Any number of records of 0 bytes (eg for the format "<") fit
+    LASSERTV(a, func,
+             *offset <= size &&
+             (f->size == 0 || (size - *offset) / f->size >= records),
+             "Function '%s': %zu records of %zu bytes at offset %zu "
+             "don't fit in the buffer (Buffer size: %zu bytes)",
+             func, records, f->size, *offset, size);
+    return NULL;
+}
+
+#pragma mark - Built-ins
+
+lval* builtin_pack_struct(lenv *e, const lval *a)
+{
+    LASSERTV(a, "pack-struct", count(a) > 0,
+             "Function 'pack-struct' passed no arguments "
+             "(Expected: a format and its values)");
+    struct_format *f;
+    lval *err = struct_format_for(a, "pack-struct", child(a, 0), &f);
+    if (err != NULL) {
+        return err;
+    }
+    LASSERTV(a, "pack-struct", count(a) - 1 == f->value_count,
+             "Function 'pack-struct' passed %d values for format \"%s\" "
+             "(Expected: %zu)", count(a) - 1, f->format, f->value_count);
+
+    lval *r = lval_buf(f->size);
+    if (r->val.vbuf.data == NULL && f->size > 0) {
+        lval_release(r);
+        return lval_err_for_val(a, "Function 'pack-struct' couldn't allocate "
+                                   "%zu bytes", f->size);
+    }
+    uint8_t *p = r->val.vbuf.data;
+    size_t value = 1;
+    for (size_t i=0; i<f->field_count; i++) {
+        const struct_field *field = &f->fields[i];
+        if (field->code != 'x') {
+            err = pack_value(a, field, f->big_endian, child(a, value++), p);
+            if (err != NULL) {
+                lval_release(r);
+                return err;
+            }
+        }
+        p += field->size * field->count;
+    }
+    return r;
+}
+
+lval* builtin_unpack_struct(lenv *e, const lval *a)
+{
+    LASSERTV(a, "unpack-struct", count(a) == 2 || count(a) == 3,
+             "Function 'unpack-struct' passed wrong number of arguments "
+             "(Got: %d Expected: 2 or 3)", count(a));
+    LASSERT_ARG_TYPE("unpack-struct", a, 1, LVAL_BUF);
+    struct_format *f;
+    size_t offset;
+    lval *err = struct_format_for(a, "unpack-struct", child(a, 0), &f);
+    if (err == NULL) {
+        err = record_offset(a, "unpack-struct", 2, f, 1, &offset);
+    }
+    if (err != NULL) {
+        return err;
+    }
+
+    const uint8_t *p = child(a, 1)->val.vbuf.data + offset;
+    lval *r = lval_qexpr_with_size(f->value_count);
+    for (size_t i=0; i<f->field_count; i++) {
+        const struct_field *field = &f->fields[i];
+        if (field->code != 'x') {
+            lval *v = unpack_value(field, f->big_endian, p);
+            lval_add(r, v);
+            lval_release(v);
+        }
+        p += field->size * field->count;
+    }
+    return r;
+}
+
+lval* builtin_unpack_struct_array(lenv *e, const lval *a)
+{
+    LASSERT_NUM_ARGS("unpack-struct-array", a, 4);
+    LASSERT_ARG_TYPE("unpack-struct-array", a, 1, LVAL_BUF);
+    LASSERT_ARG_TYPE("unpack-struct-array", a, 3, LVAL_INT);
+    long records = child(a, 3)->val.vint;
+    LASSERTV(a, "unpack-struct-array", records >= 0,
+             "Function 'unpack-struct-array' passed a negative count");
+    struct_format *f;
+    size_t offset;
+    lval *err = struct_format_for(a, "unpack-struct-array", child(a, 0), &f);
+    if (err == NULL) {
+        err = record_offset(a, "unpack-struct-array", 2, f, records, &offset);
+    }
+    if (err != NULL) {
+        return err;
+    }
+
+    // One column for each field
+    const uint8_t *start = child(a, 1)->val.vbuf.data + offset;
+    lval *r = lval_qexpr_with_size(f->value_count);
+    for (size_t i=0; i<f->field_count; i++) {
+        const struct_field *field = &f->fields[i];
+        if (field->code != 'x') {
+            lval *column = unpack_column(f, field, start, (size_t)records);
+            lval_add(r, column);
+            lval_release(column);
+        }
+        start += field->size * field->count;
+    }
+    return r;
+}
@@ -88,7 +88,8 @@ lval* builtin_def_type(lenv *e, const lval *a)
     }
 
 
-    lval *props = lval_copy(args);
+    // Look up property types once, rather than every time an instance is made
+    lval *props = resolve_param_types(e, args);
     lval *name = lval_retain(child(props, 0));
     lval_pop(props, 0); // Remove the type name
     lval *v = lval_custom_type(name, props);
@@ -24,10 +24,23 @@ lval* builtin_eval(lenv *e, const lval *a);
 lval* builtin_eval_string(lenv *e, const lval *a);
 lval* builtin_load_str(lenv *e, char *input, lval *source_file);
 
+// Returns the full path (as a String) that load would use for file
+// (relative paths are resolved from the current directory, or script_path)
+lval* path_for_file(char *file, char *script_path);
+
 // Load contents of file and evaluate them
 // (load "~/myscript.benzl")
 lval* builtin_load(lenv *e, const lval *a);
 
+// (do (def {x} 1) (set {x} (+ x 1)) x) => 2
+// Evaluates each expression in order, returning the value of the last one
+// (do is a special form, see special_form_for)
+lval* builtin_do(lenv *e, const lval *a);
+lval* special_form_do(lenv *e, const lval *v);
+
+// (let {do (def {x} 1) (+ x 1)}) => 2 (and x is not defined afterwards)
+lval* builtin_let(lenv *e, const lval *a);
+
 
 #pragma mark - Conditionals
 // Implemented in benzl-builtin-conditional.c
@@ -44,6 +57,43 @@ lval* builtin_logical_and(lenv *e, const lval *a);
 // (not false false false true) => false
 lval* builtin_logical_not(lenv *e, const lval *a);
 
+// (select {(== x 1) "one"} {(== x 2) "two"} {else "many"})
+// (cond is the same function)
+lval* builtin_select(lenv *e, const lval *a);
+
+// (case x {1 "one"} {2 "two"})
+lval* builtin_case(lenv *e, const lval *a);
+
+// Special forms are given the expression they are called in, rather than its
+// evaluated arguments, so they can evaluate only the arguments they need:
+// and/or stop at the first argument that decides the result, select/case
+// only evaluate the clauses up to the one they choose, and do evaluates its
+// expressions one at a time without collecting them into a list.
+// Called as values (eg (unpack and l)) they are ordinary built-ins
+typedef lval* (*lspecial_form)(lenv *e, const lval *v);
+
+// Returns the special form for the built-in f, or NULL if it isn't one
+lspecial_form special_form_for(lbuiltin f);
+
+
+#pragma mark - Loops
+// Implemented in benzl-builtin-loop.c
+// The body is evaluated in one environment reused for every iteration, so
+// loops don't use any C stack, and all of them return {}
+
+// (while {< i 10} {set {i} (+ i 1)})
+lval* builtin_while(lenv *e, const lval *a);
+
+// (for {i 0 10} {print i}) => Prints 0 to 9
+// (for {i 10 0 -2} {print i}) => Prints 10 8 6 4 2
+lval* builtin_for(lenv *e, const lval *a);
+
+// (for-each {x {1 2 3}} {print x}) => Prints 1 2 3
+// Also iterates over the characters of a String, Bytes of a Buffer, values
+// of a Sequence or set, and {key value} entries of a map or dictionary
+// (for-each {k v (hash-map {{"a" 1}})} {print k v}) => Prints "a" 1
+lval* builtin_for_each(lenv *e, const lval *a);
+
 
 #pragma mark - Functions
 // Implemented in benzl-builtin-function.c
@@ -77,6 +127,14 @@ void lenv_add_builtins(lenv *e);
 // Returns the name of the passed function for debug printing
 char* builtin_func_string(lbuiltin func);
 
+// Returns the name of the C function for a built-in (eg "builtin_add" for +)
+// or NULL if it hasn't been loaded by lenv_add_builtins
+const char* builtin_c_name(lbuiltin func);
+
+// Returns the built-in whose C function is called c_name (the reverse of
+// builtin_c_name), or NULL if there isn't one
+lbuiltin builtin_named(const char *c_name);
+
 
 #pragma mark - List operations
 // Implemented in benzl-builtin-list.c
@@ -111,6 +169,7 @@ lval *builtin_drop(lenv *e, const lval *a);
 
 // (take 2 {1 2 3 5}) => {1 2}
 // (take 2 "hello") => "he"
+// (take 2 (range 10)) => (take 2 (range 0 10 1)) ; A Sequence
 lval *builtin_take(lenv *e, const lval *a);
 
 // (first {1 2 3 5}) => 1
@@ -130,6 +189,34 @@ lval* builtin_last(lenv *e, const lval* a);
 lval* builtin_nth(lenv *e, const lval* a);
 
 
+#pragma mark - Sequences
+// Implemented in benzl-builtin-sequence.c
+// Sequences are lazy: their values are only made when they are collected
+// (see benzl-sequence.h)
+
+// (range 5) => 0 1 2 3 4
+// (range 2 5) => 2 3 4
+// (range 10 0 -3) => 10 7 4 1
+lval* builtin_range(lenv *e, const lval *a);
+
+// Never ends, so must be followed by take or take-while:
+// (iterate (lambda {x} {* x 2}) 1) => 1 2 4 8 16...
+lval* builtin_iterate(lenv *e, const lval *a);
+
+// (lazy-map (lambda {x} {* x x}) (range 4)) => 0 1 4 9
+lval* builtin_lazy_map(lenv *e, const lval *a);
+
+// (lazy-filter (lambda {x} {% x 2}) (range 6)) => 1 3 5
+lval* builtin_lazy_filter(lenv *e, const lval *a);
+
+// (take-while (lambda {x} {< x 3}) (range 10)) => 0 1 2
+lval* builtin_take_while(lenv *e, const lval *a);
+
+// Makes a list of the values in a sequence:
+// (collect (take 3 (range 10))) => {0 1 2}
+lval* builtin_collect(lenv *e, const lval *a);
+
+
 #pragma mark - Mathematical operations
 // Implemented in benzl-builtin-math.c
 
@@ -227,6 +314,9 @@ lval* builtin_buffer_with_bytes(lenv *e, const lval *a);
 // Iterates over chunks of n bytes, creating a new
 // buffer with values supplied by the passed function
 // (buffer-map buffer 4 (lambda {currentBytes, offset} {...}))
+// Or passes each element as a number (u8, i8, u16, i16, u32, i32, u64, i64,
+// f32 or f64), and writes the number returned as the same type:
+// (buffer-map buffer "u32" (lambda {pixel, index} {...}))
 lval* builtin_buffer_map(lenv *e, const lval *a);
 
 // Sets the first byte of the buffer to 0xFF:
@@ -327,6 +417,79 @@ lval *builtin_put_bytes(lenv *e, const lval *a);
 lval *builtin_get_bytes(lenv *e, const lval *a);
 
 
+#pragma mark - Binary records
+// Implemented in benzl-builtin-struct.c
+// Formats are like Python's struct module: a byte order ('<' little endian,
+// '>' big endian, '=' native) then a code for each field, eg "<HIi"
+// (x pad byte, b/B 8 bit, h/H 16 bit, i/I 32 bit, q/Q 64 bit integers,
+// f/d 32/64 bit floats, s string - "4s" is 4 bytes), with repeat counts, eg "3H"
+
+// (pack-struct "<HI" 0x4D42 70) => <0x42 0x4D 0x46 0x00 0x00 0x00>
+lval* builtin_pack_struct(lenv *e, const lval *a);
+
+// (unpack-struct "<HI" buffer) => {19778 70}
+// (unpack-struct "<HI" buffer 14) ; Unpacks the record at offset 14
+lval* builtin_unpack_struct(lenv *e, const lval *a);
+
+// Unpacks count records in a row, returning a column for each field: a Buffer
+// of elements in the native byte order for numbers (b/B as i8/u8, h/H as
+// i16/u16, i/I and l/L as i32/u32, q/Q as i64/u64, f as f32 and d as f64),
+// or a list of Strings
+// (unpack-struct-array "<hB" buffer 0 3) => {<i16 Buffer> <u8 Buffer>}
+lval* builtin_unpack_struct_array(lenv *e, const lval *a);
+
+#pragma mark - Serialization
+// Implemented in benzl-builtin-serialize.c
+
+// Encodes any value (including lists, maps, functions and custom type
+// instances) in a compact binary form
+// (serialize {1 "two" 3.0}) => <0x42 0x4E 0x5A 0x4C ...>
+lval* builtin_serialize(lenv *e, const lval *a);
+
+// Decodes a value encoded with serialize
+// (deserialize (serialize {1 "two" 3.0})) => {1 "two" 3.0}
+lval* builtin_deserialize(lenv *e, const lval *a);
+
+// Decodes a value serialized to a file, mapping the file into memory
+// (Buffers in the value use the mapped file's memory rather than a copy)
+// (deserialize-file "~/my-data.bin")
+lval* builtin_deserialize_file(lenv *e, const lval *a);
+
+#pragma mark - JSON
+// Implemented in benzl-builtin-json.c
+// Objects are parsed into HashMaps with String keys, arrays into lists,
+// true and false into 1 and 0 and null into {}
+
+// (json-parse "{\"a\": [1, 2.5, null]}") => (hash-map {{"a" {1 2.5 {}}}})
+lval* builtin_json_parse(lenv *e, const lval *a);
+
+// Writes lists, sets and buffers as arrays, and maps, dictionaries and
+// custom type instances as objects
+// (json-stringify (hash-map {{"a" {1 2.5}}})) => "{\"a\":[1,2.5]}"
+lval* builtin_json_stringify(lenv *e, const lval *a);
+
+// Calls a function with each value in newline-delimited JSON (one value per
+// line), read from a file a line at a time or from a Buffer
+// Returns the number of values
+// (json-each "~/events.ndjson" (lambda {event} {print (get event "id")}))
+lval* builtin_json_each(lenv *e, const lval *a);
+
+#pragma mark - CSV
+// Implemented in benzl-builtin-csv.c
+// Both take a file path or a Buffer, and options delimiter:"\t" (a comma by
+// default) and header:true (to skip the first row)
+
+// Calls a function with each row as a list of Strings, reading one row at a
+// time. Returns the number of rows
+// (csv-each "~/sales.csv" (lambda {row} {print (head row)}) header:true)
+lval* builtin_csv_each(lenv *e, const lval *a);
+
+// Decodes columns into Buffers of numbers (u8, i8, u16, i16, u32, i32, u64,
+// i64, f32 or f64) or lists of Strings ("str"), leaving out "skip" columns
+// (csv-columns "~/sales.csv" {"str" "skip" "f64"} header:true)
+//   => {{"Apples" "Pears"} <0x00 0x00 ...>}
+lval* builtin_csv_columns(lenv *e, const lval *a);
+
 #pragma mark - Reading and writing files
 // Implemented in benzl-builtin-file.c
 
@@ -382,6 +545,147 @@ lval* builtin_to_number(lenv *e, const lval *a);
 lval* builtin_dictionary(lenv *e, const lval *a);
 
 
+#pragma mark - Maps and sets
+// Implemented in benzl-builtin-map.c
+// Keys can be any number, string, symbol, buffer, list, type, custom type
+// instance or persistent map (see benzl-hashmap.h)
+
+// (hash-map) => (Empty hash map)
+// (hash-map {{"a" 1} {2 "b"}}) => (Hash map with two initial entries)
+lval* builtin_hash_map(lenv *e, const lval *a);
+
+// (put m "a" 1) => m (after storing 1 for "a" in m)
+lval* builtin_put(lenv *e, const lval *a);
+
+// (remove m "a") => m (after removing "a" from m)
+lval* builtin_remove(lenv *e, const lval *a);
+
+// (persistent-map) => (Empty persistent map)
+// (persistent-map {{"a" 1} {2 "b"}}) => (Persistent map with two entries)
+lval* builtin_persistent_map(lenv *e, const lval *a);
+
+// (assoc p "a" 1) => (New version of p with 1 stored for "a")
+lval* builtin_assoc(lenv *e, const lval *a);
+
+// (dissoc p "a") => (New version of p without "a")
+lval* builtin_dissoc(lenv *e, const lval *a);
+
+// (ordered-map {{"b" 2} {"a" 1}}) => (Ordered map with keys "a" and "b")
+// Keys are sorted the way < sorts them, and must be all numbers or all strings
+// put and remove also work with ordered maps
+lval* builtin_ordered_map(lenv *e, const lval *a);
+
+// (ordered-set {3 1 2}) => (Ordered set of 1, 2 and 3)
+// remove also works with ordered sets
+lval* builtin_ordered_set(lenv *e, const lval *a);
+
+// (add s 4) => s (after adding 4 to the hash set or ordered set s)
+lval* builtin_add_key(lenv *e, const lval *a);
+
+// (rank (ordered-set {10 20 30}) 25) => 2 (The number of keys less than 25)
+lval* builtin_rank(lenv *e, const lval *a);
+
+// (key-at (ordered-set {10 20 30}) 1) => 20 (The key with rank 1)
+lval* builtin_key_at(lenv *e, const lval *a);
+
+// (between (ordered-set {10 20 30 40}) 20 40) => (ordered-set {20 30})
+// Returns the keys (and their values) from the first key (inclusive)
+// to the second (exclusive)
+lval* builtin_between(lenv *e, const lval *a);
+
+// get, has, keys, values and entries work with hash maps, persistent maps
+// and ordered maps (has and keys also work with hash sets and ordered sets)
+// (keys of persistent maps are listed in an order that depends on their hash,
+// keys of ordered maps are listed in sorted order)
+
+// (get (hash-map {{"a" 1}}) "a") => 1
+// (get (hash-map) "a" 0) => 0 (Errors if the key is missing and no default)
+lval* builtin_get(lenv *e, const lval *a);
+
+// (has (hash-map {{"a" 1}}) "a") => 1
+lval* builtin_has(lenv *e, const lval *a);
+
+// (keys (hash-map {{"a" 1} {"b" 2}})) => {"a" "b"}
+lval* builtin_keys(lenv *e, const lval *a);
+
+// (values (hash-map {{"a" 1} {"b" 2}})) => {1 2}
+lval* builtin_values(lenv *e, const lval *a);
+
+// (entries (hash-map {{"a" 1} {"b" 2}})) => {{"a" 1} {"b" 2}}
+lval* builtin_entries(lenv *e, const lval *a);
+
+// (hash-set) => (Empty hash set)
+// (hash-set {1 2 2 3}) => (hash-set {1 2 3})
+// Values can be anything that can be a hash map key
+// add, remove, has and len also work with hash sets
+lval* builtin_hash_set(lenv *e, const lval *a);
+
+// (from-list {"a" "b" "a"}) => (hash-set {"a" "b"})
+lval* builtin_from_list(lenv *e, const lval *a);
+
+// (to-list (hash-set {3 1 2})) => {3 1 2} (In the order values were added)
+// (to-list (ordered-set {3 1 2})) => {1 2 3}
+lval* builtin_to_list(lenv *e, const lval *a);
+
+// (union (hash-set {1 2}) (hash-set {2 3})) => (hash-set {1 2 3})
+lval* builtin_union(lenv *e, const lval *a);
+
+// (intersection (hash-set {1 2}) (hash-set {2 3})) => (hash-set {2})
+lval* builtin_intersection(lenv *e, const lval *a);
+
+// (difference (hash-set {1 2}) (hash-set {2 3})) => (hash-set {1})
+lval* builtin_difference(lenv *e, const lval *a);
+
+
+#pragma mark - Images
+// Implemented in benzl-builtin-image.c
+// An image is a Buffer of 0xRRGGBBAA pixels (4 bytes each) and its width, with
+// y = 0 at the top. Drawing functions return a new Buffer with the shape drawn
+// on it. Passing in-place:true as the last argument draws into the buffer
+// itself (and returns it) instead, so the change is seen through every value
+// that shares the buffer (but not map keys, which are copies)
+
+// (def {img} (create-buffer (* 4 100 50)))
+// (fill-rect img 100 10 10 20 5 0xFF0000FF) ; Fills a 20x5 red rectangle
+// at 10, 10
+lval* builtin_fill_rect(lenv *e, const lval *a);
+
+// (fill-gradient img 100 0 0 100 50 0xFFFFFFFF 0x0000FFFF)
+// ; Fills a 100x50 rectangle at 0, 0 with a gradient from white (top) to
+// ; blue (bottom)
+lval* builtin_fill_gradient(lenv *e, const lval *a);
+
+// (fill-circle img 100 50 25 10 0xFF0000FF) ; Fills a circle centered at
+// 50, 25 with radius 10
+// (fill-circle img 100 50 25 10 0xFFFF00FF 0xFF8000FF) ; Fills it with a
+// gradient from yellow (in the middle) to orange (at the edge)
+lval* builtin_fill_circle(lenv *e, const lval *a);
+
+// (draw-line img 100 0 0 99 49 0x000000FF) ; Draws a black line from 0, 0
+// to 99, 49
+lval* builtin_draw_line(lenv *e, const lval *a);
+
+// (blit img 100 icon 16 10 10) ; Copies the pixels of icon (16 pixels wide)
+// onto img with its top left corner at 10, 10
+lval* builtin_blit(lenv *e, const lval *a);
+
+// (blend img 100 icon 16 10 10) ; Like blit, but draws icon over img using
+// its alpha channel
+lval* builtin_blend(lenv *e, const lval *a);
+
+// (mix-rgba 0xFF0000FF 0x0000FFFF 0.5) => 0x7F007FFF
+// (mix-rgba img1 img2 0.5) ; Mixes two images (or rows of pixels) of the same
+// size pixel by pixel, returning a new Buffer
+lval* builtin_mix_rgba(lenv *e, const lval *a);
+
+// (write-file "image.bmp" (encode-bmp img 100)) ; Saves img as a 32 bit BMP
+lval* builtin_encode_bmp(lenv *e, const lval *a);
+
+// (write-file "image.ppm" (encode-ppm img 100)) ; Saves img as a binary PPM
+// (without its alpha channel)
+lval* builtin_encode_ppm(lenv *e, const lval *a);
+
+
 #pragma mark - Misc
 // Implemented in benzl-built-misc.c
 
@@ -393,10 +697,24 @@ lval* builtin_console_size(lenv *e, const lval *a);
 // (cpu-time-since start) => ms of CPU time used by benzl since first call
 lval* builtin_cpu_time_since(lenv *e, const lval *a);
 
+// (bench {fib 20} iterations:100 warmup:10) =>
+// (dict min:1.2 max:1.9 median:1.3 mean:1.35 p99:1.9 stddev:0.1 ...)
+// Evaluates the expression warmup times, then measures it iterations times
+// (defaults: 10 iterations, 1 warmup). Times are in ms (from a monotonic clock)
+// 'allocations' is the average number of lvals allocated per iteration and
+// 'heap-bytes' is the average growth in malloc'd memory per iteration
+lval* builtin_bench(lenv *e, const lval *a);
+
 // (exit 0) ; Exits program with no error
 // (exit 1) ; Exits program with error code
  __attribute__((noreturn)) lval* builtin_exit(lenv *e, const lval *a);
 
+// (runtime-stats) => (dict pool-allocations:123 pool-frees:100 ...)
+// Counters are zero unless counting was turned on at launch,
+// eg with --stats=all (see benzl-runtime-stats.h)
+// (except max-rss-kb - the peak memory used by benzl - which is always set)
+lval* builtin_runtime_stats(lenv *e, const lval *a);
+
 // (version) =>
 //--
 // benzl v0.1
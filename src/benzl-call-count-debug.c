@@ -4,13 +4,12 @@
 
 #include "benzl-call-count-debug.h"
 #include "benzl-hash-table.h"
-#include "benzl-config.h"
-
-#if LOG_CALL_STATS
+#include "benzl-runtime-stats.h"
 
 lval_table *call_counts = NULL;
 
 void record_function_call(lval *f) {
+    runtime_stats.function_calls++;
     if (call_counts == NULL) {
         call_counts = lval_table_alloc(2048);
     }
@@ -37,7 +36,20 @@ static int sort_entries(const void *v1, const void *v2)
     return 0;
 }
 
+lval* call_counts_dict(void) {
+    if (call_counts == NULL) {
+        return lval_dict(2);
+    }
+    lval *d = lval_dict(0);
+    lval_table_free(d->val.vdict);
+    d->val.vdict = lval_table_copy(call_counts);
+    return d;
+}
+
 void print_call_count_stats(void) {
+    if (!stats_enabled_for(STATS_CALLS)) {
+        return;
+    }
     printf("[CALL-STATS] Function call counts:-------------------\n");
     lval_entry **entries = NULL;
     size_t count = lval_table_entries(call_counts, &entries);
@@ -49,10 +61,3 @@ void print_call_count_stats(void) {
     }
     free(entries);
 }
-
-#else
-
-void record_function_call(lval *f) {}
-void print_call_count_stats(void) {}
-
-#endif
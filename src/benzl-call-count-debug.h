@@ -7,9 +7,12 @@
 #include "benzl-lval.h"
 
 // Record that a named function has been called
-// Does nothing when LOG_CALL_STATS is zero
+// Only called while STATS_CALLS stats are turned on
 void record_function_call(lval *f);
 
+// Returns a dictionary of the number of times each named function was called
+lval* call_counts_dict(void);
+
 // Print stats on how often each named function was called
-// Does nothing when LOG_CALL_STATS is zero
+// Does nothing unless STATS_CALLS stats are turned on
 void print_call_count_stats(void);
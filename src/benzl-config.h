@@ -11,19 +11,22 @@
 // Should be 0 unless debugging the benzl language
 #define DISABLE_POOL_ALLOCATION 0
 
-// Set to 1, and benzl will count the number of times named functions are called,
-// and print them out at the end of execution
-// (this is helpful for finding optimisation opportunities)
-// Should be 0 unless debugging the benzl language
-#define LOG_CALL_STATS 0
+// Number of samples per second (of CPU time) taken by the sampling profiler
+// when benzl is run with --profile=output.folded
+#define PROFILER_SAMPLE_FREQUENCY 1000
 
-// Set to 1, and benzl will measure how the global lval pool is used
-// and print out stats at the end
-// This is helpful for finding leaks
-// Should be 0 unless debugging the benzl language
-#define LOG_ALLOCATION_POOL_STATS 0
+// Number of consecutive calls with the same argument types before a call to an
+// arithmetic or comparison built-in is specialized for those types
+#define QUICKEN_THRESHOLD 8
 
-// Set to 1, and benzl will record the number of lookups and collisions
-// across all hash tables, and print out stats at the end
-// Should be 0 unless debugging the benzl language
-#define LOG_HASH_TABLE_STATS 0
+// Number of times a call site can lose its specialization (because it was
+// called with different types) before we stop specializing it
+#define QUICKEN_MAX_DEOPTS 4
+
+// Number of calls to a user-defined function before it is compiled to
+// machine code, when benzl is run with --jit
+#define JIT_CALL_THRESHOLD 100
+
+// Number of times compiled code for a function can deoptimize (fall back to
+// the interpreter) before we stop running it
+#define JIT_MAX_DEOPTS 16
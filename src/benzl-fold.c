@@ -0,0 +1,233 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdlib.h>
+
+#include "benzl-fold.h"
+#include "benzl-lval.h"
+#include "benzl-lenv.h"
+#include "benzl-lval-eval.h"
+#include "benzl-builtins.h"
+
+// A folded expression
+typedef struct {
+    lval *value; // Result of the expression
+    lval *builtins; // Built-in each symbol in the expression was bound to
+} folded_expression;
+
+// Folded expressions, indexed by vexp.native
+// An entry is freed (and its index reused) once its expression and every copy
+// of it have been freed, see release_folded_expression
+static folded_expression *folds = NULL;
+static size_t fold_capacity = 0;
+
+// Built-ins that only return new values, and always return the same value
+// for the same arguments
+static bool is_foldable_builtin(lbuiltin f)
+{
+    static const lbuiltin foldable[] = {
+        builtin_list, builtin_head, builtin_tail, builtin_join, builtin_len,
+        builtin_drop, builtin_take, builtin_first, builtin_second,
+        builtin_last, builtin_nth,
+        builtin_add, builtin_subtract, builtin_multiply, builtin_divide,
+        builtin_modulo, builtin_right_shift, builtin_left_shift,
+        builtin_bitwise_and, builtin_bitwise_or, builtin_bitwise_xor,
+        builtin_min, builtin_max, builtin_floor, builtin_ceil,
+        builtin_greater_than, builtin_less_than,
+        builtin_greater_than_or_equal, builtin_less_than_or_equal,
+        builtin_equal, builtin_not_equal,
+        builtin_logical_or, builtin_logical_and, builtin_logical_not
+    };
+    for (size_t i=0; i<sizeof(foldable)/sizeof(foldable[0]); i++) {
+        if (foldable[i] == f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if v is (or contains) a value that can be changed in place,
+// eg a Buffer (by the drawing functions). Folding returns the same value
+// every time, so these are never folded: each evaluation must get its own
+static bool can_change(const lval *v)
+{
+    switch (v->type) {
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for (size_t i=0; i<count(v); i++) {
+                if (can_change(child(v, i))) {
+                    return true;
+                }
+            }
+            return false;
+        case LVAL_INT:
+        case LVAL_FLT:
+        case LVAL_BYTE:
+        case LVAL_STR:
+        case LVAL_SYM:
+        case LVAL_TYPE:
+            return false;
+        default:
+            return true;
+    }
+}
+
+#pragma mark - Evaluating folded expressions
+
+// Checks the symbols in v are bound to the same built-ins as when it was folded
+static bool same_builtins(lenv *e, const lval *v, const lval *builtins,
+                          size_t *next)
+{
+    const lval *sym = child(v, 0);
+    const lval *builtin = child(builtins, (*next)++);
+    bool same = false;
+    lval_entry *entry = sym->val.vsym.cached_entry;
+    if (entry != NULL && sym->val.vsym.cached_epoch == lookup_epoch) {
+        same = entry->value == builtin;
+    } else {
+        lval *f = lenv_get_cached(e, sym);
+        same = f == builtin;
+        lval_release(f);
+    }
+    if (!same) {
+        return false;
+    }
+    for (size_t i=1; i<count(v); i++) {
+        if (child(v, i)->type == LVAL_SEXPR &&
+            !same_builtins(e, child(v, i), builtins, next)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Frees the folded expression at index, once its expression has been freed
+static void release_folded_expression(uint16_t index)
+{
+    lval_release(folds[index].value);
+    lval_release(folds[index].builtins);
+    folds[index] = (folded_expression){ NULL, NULL };
+}
+
+static lval* eval_folded_expression(lenv *e, const lval *v)
+{
+    folded_expression *fold = &folds[v->val.vexp.native];
+    size_t next = 0;
+    if (same_builtins(e, v, fold->builtins, &next)) {
+        return lval_retain(fold->value);
+    }
+    return lval_eval_sexpr_interpreted(e, v);
+}
+
+#pragma mark - Folding expressions
+
+// Returns the value of x if it is known before the program runs, or NULL
+static lval* constant_value(const lval *x)
+{
+    switch (x->type) {
+        case LVAL_INT:
+        case LVAL_FLT:
+        case LVAL_BYTE:
+        case LVAL_STR:
+        case LVAL_QEXPR:
+            return (lval *)x;
+        case LVAL_SEXPR:
+            if (x->val.vexp.native != 0 &&
+                lval_natives[x->val.vexp.native] == eval_folded_expression) {
+                return folds[x->val.vexp.native].value;
+            }
+            return NULL;
+        default:
+            return NULL;
+    }
+}
+
+// Folds v, if it is a call to a foldable built-in with constant arguments
+static void fold_call(lenv *root, lval *v)
+{
+    if (count(v) == 0 || v->val.vexp.native != 0 ||
+        child(v, 0)->type != LVAL_SYM) {
+        return;
+    }
+    lval_entry *entry = lval_table_get_entry(root->items, child(v, 0));
+    if (entry == NULL || entry->value->type != LVAL_FUN ||
+        !is_foldable_builtin(entry->value->val.vfunc.builtin)) {
+        return;
+    }
+    lval *f = entry->value;
+    lval *a = lval_sexpr_with_size(count(v)-1);
+    for (size_t i=1; i<count(v); i++) {
+        lval *x = constant_value(child(v, i));
+        if (x == NULL) {
+            lval_release(a);
+            return;
+        }
+        lval_add(a, x);
+    }
+    lval *r = f->val.vfunc.builtin(root, a);
+    lval_release(a);
+    if (r->type == LVAL_ERR || can_change(r)) {
+        lval_release(r);
+        return;
+    }
+
+    // Remember the built-ins this expression (and the calls in it) use
+    lval *builtins = lval_qexpr();
+    lval_add(builtins, f);
+    for (size_t i=1; i<count(v); i++) {
+        lval *x = child(v, i);
+        if (x->type == LVAL_SEXPR) {
+            lval *inner = folds[x->val.vexp.native].builtins;
+            for (size_t j=0; j<count(inner); j++) {
+                lval_add(builtins, child(inner, j));
+            }
+        }
+    }
+
+    if (!lval_attach_native(v, eval_folded_expression,
+                            release_folded_expression)) {
+        lval_release(r);
+        lval_release(builtins);
+        return;
+    }
+    size_t index = v->val.vexp.native;
+    if (index >= fold_capacity) {
+        size_t capacity = fold_capacity == 0 ? 1024 : fold_capacity;
+        while (capacity <= index) {
+            capacity *= 2;
+        }
+        folds = realloc(folds, sizeof(folded_expression)*capacity);
+        fold_capacity = capacity;
+    }
+    folds[index].value = r;
+    folds[index].builtins = builtins;
+}
+
+// Folds the calls in v (innermost first, so calls can use folded arguments)
+static void fold_expression(lenv *root, lval *v)
+{
+    for (size_t i=0; i<count(v); i++) {
+        lval *x = child(v, i);
+        if (x->type == LVAL_KEY_VALUE_PAIR) {
+            x = x->val.vkvpair.value;
+        }
+        if (x->type == LVAL_SEXPR || x->type == LVAL_QEXPR) {
+            fold_expression(root, x);
+        }
+    }
+    // Q-Expressions are folded too, as they may be evaluated as code
+    // (eg function bodies), but are still used as they are as data
+    fold_call(root, v);
+}
+
+void fold_constants(lenv *e, lval *expr)
+{
+    while (e->parent != NULL) {
+        e = e->parent;
+    }
+    for (size_t i=0; i<count(expr); i++) {
+        lval *x = child(expr, i);
+        if (x->type == LVAL_SEXPR || x->type == LVAL_QEXPR) {
+            fold_expression(e, x);
+        }
+    }
+}
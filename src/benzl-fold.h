@@ -0,0 +1,30 @@
+// Constant folding for calls to pure built-ins
+// Programs are full of expressions whose inputs are all literals, eg
+// (* 4 1024), (list 1 2 3) or (len {a b c}), which the interpreter would
+// evaluate again every time they are reached (eg in every call to the function
+// they are in).
+// When a file is loaded, calls to built-ins without side effects (maths,
+// comparisons and list built-ins like len, head and join) whose arguments are
+// all literals (or other folded calls) are evaluated once, and the result is
+// attached to the expression (see vexp.native). Calls whose result can be
+// changed in place (eg a Buffer from join) aren't folded, as every evaluation
+// would return the same value.
+// Evaluating a folded expression checks each symbol in it is still bound to
+// the same built-in (eg it isn't a parameter of the function it is in, or
+// hasn't been redefined with def) and returns the result. If not, the
+// expression is handed to the interpreter. Calls that return an error are
+// never folded, so errors and stack traces are the same as the interpreter's.
+// The parsed expressions themselves are unchanged, so printing a function
+// or using a Q-Expression as data isn't affected
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+// Forward declarations
+typedef struct lval lval;
+typedef struct lenv lenv;
+
+// Folds the calls to pure built-ins with constant arguments in expr
+// (the expressions parsed from a file)
+void fold_constants(lenv *e, lval *expr);
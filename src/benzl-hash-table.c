@@ -5,6 +5,7 @@
 #include "benzl-hash-table.h"
 #include "benzl-lval.h"
 #include "benzl-config.h"
+#include "benzl-runtime-stats.h"
 
 lval_table* lval_table_alloc(size_t size)
 {
@@ -161,6 +162,17 @@ lval_entry* lval_table_insert(lval_table *table, const lval *key,
 {
     assert(key->type == LVAL_SYM);
 
+    // If the key is already in the table, just replace the value
+    // Entries keep the same address for as long as their key is in the table,
+    // which means lookup caches can hold on to them (see benzl-lenv.h)
+    lval_entry *existing_entry = lval_table_get_entry(table, key);
+    if (existing_entry != NULL) {
+        lval *old_value = existing_entry->value;
+        existing_entry->value = lval_retain(value);
+        lval_release(old_value);
+        return existing_entry;
+    }
+
     lval_entry *entry = lval_entry_alloc(key, value);
     lval_table_insert_entry(table, entry);
 
@@ -205,11 +217,6 @@ void lval_table_remove(lval_table *table, const lval *key)
     lval_table_resize_if_needed(table);
 }
 
-#if LOG_HASH_TABLE_STATS
-static unsigned long global_lookup_collisions = 0;
-static unsigned long global_lookup_count = 0;
-#endif
-
 lval_entry* lval_table_get_entry(lval_table *table, const lval *key)
 {
     assert(key->type == LVAL_SYM);
@@ -219,22 +226,23 @@ lval_entry* lval_table_get_entry(lval_table *table, const lval *key)
     }
     lval_entry *entry = table->items[bucket_for_key(table, key)];
 
-#if LOG_HASH_TABLE_STATS
-    size_t lookup_count = 0;
-    while (entry != NULL && !equal_symbols(entry->key, key)) {
-        entry = entry->next;
-        lookup_count++;
+    if (stats_enabled_for(STATS_TABLES)) {
+        size_t lookup_count = 0;
+        while (entry != NULL && !equal_symbols(entry->key, key)) {
+            entry = entry->next;
+            lookup_count++;
+        }
+
+        table->worst_case_lookup_count = MAX(table->worst_case_lookup_count, lookup_count);
+        runtime_stats.table_lookups++;
+        runtime_stats.table_collisions+=lookup_count;
+        table->collision_count+=lookup_count;
+        return entry;
     }
-    
-    table->worst_case_lookup_count = MAX(table->worst_case_lookup_count, lookup_count);
-    global_lookup_count++;
-    global_lookup_collisions+=lookup_count;
-    table->collision_count+=lookup_count;
-#else
+
     while (entry != NULL && !equal_symbols(entry->key, key)) {
         entry = entry->next;
     }
-#endif
     return entry;
 }
 
@@ -333,9 +341,10 @@ bool lval_tables_equal(lval_table *t1,  lval_table *t2)
 }
 
 void print_lval_table_stats(void) {
-#if LOG_HASH_TABLE_STATS
+    if (!stats_enabled_for(STATS_TABLES)) {
+        return;
+    }
     printf("[TABLE-STATS] Did %lu lookups, collisions %lu, (%f%%)\n",
-           global_lookup_count, global_lookup_collisions,
-           (global_lookup_collisions/(double)global_lookup_count)*100);
-#endif
+           runtime_stats.table_lookups, runtime_stats.table_collisions,
+           (runtime_stats.table_collisions/(double)runtime_stats.table_lookups)*100);
 }
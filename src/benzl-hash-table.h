@@ -85,6 +85,7 @@ size_t lval_table_entries(const lval_table *table, lval_entry ***entries);
 bool lval_tables_equal(lval_table *t1, lval_table *t2);
 
 // For testing - prints statistics on total hash table lookups and collisions
+// Does nothing unless STATS_TABLES stats are turned on
 void print_lval_table_stats(void);
 
 // Hash function used for transforming symbols into an integer
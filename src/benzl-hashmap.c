@@ -0,0 +1,435 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "benzl-hashmap.h"
+#include "benzl-lval.h"
+#include "benzl-persistent-map.h"
+
+#pragma mark - Hashing
+
+// Tags mixed into hashes so values of different types with the same
+// contents (eg the string "a" and the symbol a) hash differently
+enum {
+    HASH_TAG_NUMBER = 1,
+    HASH_TAG_STRING,
+    HASH_TAG_SYMBOL,
+    HASH_TAG_BUFFER,
+    HASH_TAG_LIST,
+    HASH_TAG_SEXPR,
+    HASH_TAG_TYPE,
+    HASH_TAG_INSTANCE,
+    HASH_TAG_PAIR,
+    HASH_TAG_PERSISTENT_MAP,
+};
+
+// Mixes the bits of h (the splitmix64 finalizer)
+static inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static inline uint64_t combine(uint64_t h, uint64_t x)
+{
+    return mix(h ^ (x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+// FNV-1a hash of size bytes
+static uint64_t hash_bytes(uint64_t tag, const uint8_t *bytes, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ tag;
+    for (size_t i=0; i<size; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+    return mix(h);
+}
+
+// lval_eq compares Integers, Floats and Bytes by converting them to the same
+// type, so all numbers are hashed as the doubles they are equal to
+static uint64_t hash_number(double d)
+{
+    if (d == 0) {
+        d = 0; // -0.0 == 0.0
+    }
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return combine(HASH_TAG_NUMBER, bits);
+}
+
+// Hash of the entries of a persistent map, for lpmap_node_iterate
+typedef struct {
+    uint64_t sum;
+    bool hashable;
+} pmap_hash;
+
+// Adds the hash of an entry of a persistent map to the pmap_hash in ctx
+// (Entries are summed, so the hash doesn't depend on their order)
+static void add_pmap_entry_hash(const lval *key, const lval *value, void *ctx)
+{
+    pmap_hash *h = ctx;
+    uint64_t k, v;
+    if (!h->hashable || !lval_hash(key, &k) || !lval_hash(value, &v)) {
+        h->hashable = false;
+        return;
+    }
+    h->sum += combine(k, v);
+}
+
+bool lval_hash(const lval *v, uint64_t *hash)
+{
+    switch (v->type) {
+        case LVAL_INT:
+            *hash = hash_number((double)v->val.vint);
+            return true;
+        case LVAL_FLT:
+            *hash = hash_number(v->val.vflt);
+            return true;
+        case LVAL_BYTE:
+            *hash = hash_number((double)v->val.vbyte);
+            return true;
+        case LVAL_STR:
+            *hash = hash_bytes(HASH_TAG_STRING, (const uint8_t *)v->val.vstr,
+                               strlen(v->val.vstr));
+            return true;
+        case LVAL_SYM:
+            *hash = combine(HASH_TAG_SYMBOL, v->val.vsym.hash);
+            return true;
+        case LVAL_BUF:
+            *hash = hash_bytes(HASH_TAG_BUFFER, v->val.vbuf.data,
+                               v->val.vbuf.size);
+            return true;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR: {
+            uint64_t h = v->type == LVAL_QEXPR ? HASH_TAG_LIST : HASH_TAG_SEXPR;
+            for (size_t i=0; i<count(v); i++) {
+                uint64_t c;
+                if (!lval_hash(child(v, i), &c)) {
+                    return false;
+                }
+                h = combine(h, c);
+            }
+            *hash = combine(h, count(v));
+            return true;
+        }
+        case LVAL_TYPE:
+            if (v->val.vtype.props == NULL) {
+                *hash = combine(HASH_TAG_TYPE, v->val.vtype.primitive);
+            } else {
+                *hash = combine(HASH_TAG_TYPE, v->val.vtype.name->val.vsym.hash);
+            }
+            return true;
+        case LVAL_KEY_VALUE_PAIR: {
+            uint64_t h;
+            if (!lval_hash(v->val.vkvpair.value, &h)) {
+                return false;
+            }
+            h = combine(h, v->val.vkvpair.key->val.vsym.hash);
+            *hash = combine(HASH_TAG_PAIR, h);
+            return true;
+        }
+        case LVAL_CUSTOM_TYPE_INSTANCE: {
+            const lval *type = v->val.vinst.type;
+            uint64_t h = combine(HASH_TAG_INSTANCE,
+                                 type->val.vtype.name->val.vsym.hash);
+            for (size_t i=0; i<custom_type_slot_count(type); i++) {
+                uint64_t s;
+                if (!lval_hash(v->val.vinst.slots[i], &s)) {
+                    return false;
+                }
+                h = combine(h, s);
+            }
+            *hash = h;
+            return true;
+        }
+        case LVAL_PERSISTENT_MAP: {
+            pmap_hash h = { 0, true };
+            lpmap_node_iterate(v->val.vpmap.root, add_pmap_entry_hash, &h);
+            *hash = combine(HASH_TAG_PERSISTENT_MAP, h.sum);
+            return h.hashable;
+        }
+        default:
+            return false;
+    }
+}
+
+// Returns true if part of v can be changed in place: the contents of a Buffer
+// (eg by fill-rect) or the properties of a custom type instance (by set-prop)
+static bool can_change(const lval *v);
+
+static void check_pmap_entry_changes(const lval *key, const lval *value,
+                                     void *ctx)
+{
+    bool *changes = ctx;
+    *changes = *changes || can_change(key) || can_change(value);
+}
+
+static bool can_change(const lval *v)
+{
+    switch (v->type) {
+        case LVAL_BUF:
+        case LVAL_CUSTOM_TYPE_INSTANCE:
+            return true;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for (size_t i=0; i<count(v); i++) {
+                if (can_change(child(v, i))) {
+                    return true;
+                }
+            }
+            return false;
+        case LVAL_KEY_VALUE_PAIR:
+            return can_change(v->val.vkvpair.value);
+        case LVAL_PERSISTENT_MAP: {
+            bool changes = false;
+            lpmap_node_iterate(v->val.vpmap.root, check_pmap_entry_changes,
+                               &changes);
+            return changes;
+        }
+        default:
+            return false;
+    }
+}
+
+// Adds an entry of a persistent map, with its value copied by
+// lval_copy_key, to the persistent map in ctx
+static void add_pmap_entry_copy(const lval *key, const lval *value, void *ctx)
+{
+    lval *m = ctx;
+    uint64_t hash;
+    lval_hash(key, &hash);
+    lval *v = lval_copy_key(value);
+    bool added;
+    lpmap_node *root = lpmap_node_assoc(m->val.vpmap.root, key, hash, v,
+                                        &added);
+    lval_release(v);
+    lpmap_node_release(m->val.vpmap.root);
+    m->val.vpmap.root = root;
+    m->val.vpmap.count += added;
+}
+
+lval* lval_copy_key(const lval *key)
+{
+    if (!can_change(key)) {
+        return lval_retain(key);
+    }
+    switch (key->type) {
+        case LVAL_QEXPR:
+        case LVAL_SEXPR: {
+            size_t n = count(key);
+            lval *x = key->type == LVAL_QEXPR ? lval_qexpr_with_size(n)
+                                              : lval_sexpr_with_size(n);
+            for (size_t i=0; i<count(key); i++) {
+                lval *c = lval_copy_key(child(key, i));
+                lval_add(x, c);
+                lval_release(c);
+            }
+            return x;
+        }
+        case LVAL_KEY_VALUE_PAIR: {
+            lval *value = lval_copy_key(key->val.vkvpair.value);
+            lval *x = lval_kv_pair(key->val.vkvpair.key,
+                                   value);
+            lval_release(value);
+            return x;
+        }
+        case LVAL_PERSISTENT_MAP: {
+            // Keys of the new map are copied as they are added to it
+            lval *x = lval_persistent_map(NULL, 0);
+            lpmap_node_iterate(key->val.vpmap.root, add_pmap_entry_copy, x);
+            return x;
+        }
+        case LVAL_CUSTOM_TYPE_INSTANCE: {
+            // The copy has its own slots, so set-prop on key doesn't change it
+            lval *x = lval_copy(key);
+            size_t n = custom_type_slot_count(key->val.vinst.type);
+            for (size_t i=0; i<n; i++) {
+                lval *slot = x->val.vinst.slots[i];
+                x->val.vinst.slots[i] = lval_copy_key(slot);
+                lval_release(slot);
+            }
+            return x;
+        }
+        default:
+            return lval_copy(key);
+    }
+}
+
+#pragma mark - Maps
+
+// Size of the index for a map with space for capacity entries
+// (kept at most half full, so probe sequences stay short)
+static size_t index_size_for_capacity(size_t capacity)
+{
+    size_t size = 8;
+    while (size < capacity*2) {
+        size *= 2;
+    }
+    return size;
+}
+
+// Rebuilds the index from the entries array
+static void rebuild_index(lhashmap *map)
+{
+    memset(map->index, 0, sizeof(size_t)*map->index_size);
+    size_t mask = map->index_size-1;
+    for (size_t i=0; i<map->entry_count; i++) {
+        size_t slot = map->entries[i].hash & mask;
+        while (map->index[slot] != 0) {
+            slot = (slot+1) & mask;
+        }
+        map->index[slot] = i+1;
+    }
+}
+
+lhashmap* lhashmap_alloc(size_t capacity)
+{
+    capacity = MAX(4, capacity);
+    lhashmap *map = malloc(sizeof(lhashmap));
+    map->count = 0;
+    map->entry_count = 0;
+    map->entry_capacity = capacity;
+    map->entries = malloc(sizeof(lhashmap_entry)*capacity);
+    map->index_size = index_size_for_capacity(capacity);
+    map->index = calloc(map->index_size, sizeof(size_t));
+    return map;
+}
+
+void lhashmap_free(lhashmap *map)
+{
+    for (size_t i=0; i<map->entry_count; i++) {
+        lhashmap_entry *entry = &map->entries[i];
+        if (entry->key != NULL) {
+            lval_release(entry->key);
+            lval_release(entry->value);
+        }
+    }
+    free(map->entries);
+    free(map->index);
+    free(map);
+}
+
+lhashmap* lhashmap_copy(const lhashmap *map)
+{
+    lhashmap *copy = lhashmap_alloc(map->count);
+    for (size_t i=0; i<map->entry_count; i++) {
+        const lhashmap_entry *entry = &map->entries[i];
+        if (entry->key != NULL) {
+            copy->entries[copy->entry_count++] = (lhashmap_entry){
+                lval_retain(entry->key), lval_retain(entry->value), entry->hash
+            };
+        }
+    }
+    copy->count = copy->entry_count;
+    rebuild_index(copy);
+    return copy;
+}
+
+// Returns the index slot for key, or the empty slot where it would be stored
+static size_t find_slot(const lhashmap *map, const lval *key, uint64_t hash)
+{
+    size_t mask = map->index_size-1;
+    size_t slot = hash & mask;
+    while (map->index[slot] != 0) {
+        const lhashmap_entry *entry = &map->entries[map->index[slot]-1];
+        if (entry->key != NULL && entry->hash == hash &&
+            (entry->key == key || lval_eq(entry->key, key))) {
+            return slot;
+        }
+        slot = (slot+1) & mask;
+    }
+    return slot;
+}
+
+lval* lhashmap_get(const lhashmap *map, const lval *key, uint64_t hash)
+{
+    size_t slot = find_slot(map, key, hash);
+    if (map->index[slot] == 0) {
+        return NULL;
+    }
+    return map->entries[map->index[slot]-1].value;
+}
+
+// Makes space for another entry, removing the entries of removed keys, and
+// growing the map if it is more than half full
+static void make_space(lhashmap *map)
+{
+    if (map->count*2 > map->entry_capacity) {
+        map->entry_capacity *= 2;
+        map->entries = realloc(map->entries,
+                               sizeof(lhashmap_entry)*map->entry_capacity);
+        map->index_size = index_size_for_capacity(map->entry_capacity);
+        map->index = realloc(map->index, sizeof(size_t)*map->index_size);
+    }
+    size_t n = 0;
+    for (size_t i=0; i<map->entry_count; i++) {
+        if (map->entries[i].key != NULL) {
+            map->entries[n++] = map->entries[i];
+        }
+    }
+    map->entry_count = n;
+    rebuild_index(map);
+}
+
+void lhashmap_put(lhashmap *map, const lval *key, uint64_t hash,
+                  const lval *value)
+{
+    size_t slot = find_slot(map, key, hash);
+    if (map->index[slot] != 0) {
+        lhashmap_entry *entry = &map->entries[map->index[slot]-1];
+        lval *old = entry->value;
+        entry->value = lval_retain(value);
+        lval_release(old);
+        return;
+    }
+    if (map->entry_count == map->entry_capacity) {
+        make_space(map);
+        slot = find_slot(map, key, hash);
+    }
+    map->entries[map->entry_count] = (lhashmap_entry){
+        lval_copy_key(key), lval_retain(value), hash
+    };
+    map->index[slot] = ++map->entry_count;
+    map->count++;
+}
+
+bool lhashmap_remove(lhashmap *map, const lval *key, uint64_t hash)
+{
+    size_t slot = find_slot(map, key, hash);
+    if (map->index[slot] == 0) {
+        return false;
+    }
+    // The slot stays in the index, pointing at the removed entry,
+    // so lookups for keys stored after it keep probing past it
+    lhashmap_entry *entry = &map->entries[map->index[slot]-1];
+    lval_release(entry->key);
+    lval_release(entry->value);
+    entry->key = NULL;
+    entry->value = NULL;
+    map->count--;
+    return true;
+}
+
+bool lhashmaps_equal(const lhashmap *m1, const lhashmap *m2)
+{
+    if (m1->count != m2->count) {
+        return false;
+    }
+    for (size_t i=0; i<m1->entry_count; i++) {
+        const lhashmap_entry *entry = &m1->entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+        lval *value = lhashmap_get(m2, entry->key, entry->hash);
+        if (value == NULL || !lval_eq(value, entry->value)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+// lhashmap is the hash table behind the HashMap and HashSet types
+// (a set stores each of its values as both the key and the value)
+// Unlike lval_table (which only supports symbol keys), any hashable lval can
+// be used as a key: numbers, strings, symbols, buffers, lists, types,
+// custom type instances and persistent maps. Keys are compared with lval_eq,
+// and lval_hash gives equal values the same hash (so 1, 1.0 and 0x01 are all
+// the same key).
+// Entries are stored in an array in the order they were first inserted, and
+// an open addressing index (linear probing) maps hashes to entries, so
+// iterating a map visits its keys in insertion order.
+// Removing a key clears its entry (key is set to NULL), the array is compacted
+// the next time it needs to grow
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Forward declarations
+typedef struct lval lval;
+
+typedef struct {
+    lval *key; // NULL if this entry has been removed
+    lval *value;
+    uint64_t hash; // lval_hash of key
+} lhashmap_entry;
+
+typedef struct lhashmap {
+    size_t count; // Number of keys in the map
+    size_t entry_count; // Number of entries used (including removed entries)
+    size_t entry_capacity; // Number of entries we have space for
+    lhashmap_entry *entries; // Entries, in insertion order
+    size_t index_size; // Number of slots in index (a power of 2)
+    size_t *index; // Entry index + 1 for each slot, or 0 for empty slots
+} lhashmap;
+
+// Calculates a hash for v, consistent with lval_eq
+// (values that are lval_eq have the same hash)
+// Returns false if v can't be hashed (functions, dictionaries and the mutable
+// maps and sets, which either change or have no useful notion of equality)
+// Persistent maps are hashed by their contents, as they never change
+bool lval_hash(const lval *v, uint64_t *hash);
+
+// Returns key to store in a map: key itself (retained), or a copy if part of
+// it can be changed in place (Buffers and custom type instances), so changing
+// the original later doesn't change the map's key or its hash
+lval* lval_copy_key(const lval *key);
+
+// Create an empty map, with space for capacity keys
+lhashmap* lhashmap_alloc(size_t capacity);
+
+// Free the map, releasing its keys and values
+void lhashmap_free(lhashmap *map);
+
+// Returns a copy of the map (sharing its keys and values)
+lhashmap* lhashmap_copy(const lhashmap *map);
+
+// Get the value stored for key (whose lval_hash is hash), or NULL
+lval* lhashmap_get(const lhashmap *map, const lval *key, uint64_t hash);
+
+// Store value for key (whose lval_hash is hash), replacing any existing value
+// A new key is added after all existing keys (stored with lval_copy_key)
+void lhashmap_put(lhashmap *map, const lval *key, uint64_t hash,
+                  const lval *value);
+
+// Remove key (whose lval_hash is hash) from the map
+// Returns false if the map didn't contain key
+bool lhashmap_remove(lhashmap *map, const lval *key, uint64_t hash);
+
+// Returns true if the two maps have the same keys, with equal values
+bool lhashmaps_equal(const lhashmap *m1, const lhashmap *m2);
@@ -0,0 +1,1156 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "benzl-jit.h"
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+#include "benzl-lenv.h"
+#include "benzl-builtins.h"
+#include "benzl-stacktrace.h"
+#include "benzl-call-count-debug.h"
+#include "benzl-runtime-stats.h"
+#include "benzl-config.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+bool jit_enabled = false;
+
+// Check every compiled result against the interpreter
+static bool jit_verify = false;
+
+// Calls needed before a function is compiled
+static size_t jit_call_threshold = JIT_CALL_THRESHOLD;
+
+// Greater than 0 while the interpreter is checking a compiled result
+static int jit_paused = 0;
+
+// Set while compiled code calls another user-defined function
+// Compiled code never runs the interpreter: if the function it calls can't
+// run as machine code, the caller deoptimizes too (see jit_run)
+static bool jit_strict_call = false;
+
+// Returned by lval_call to compiled code when the function it called has
+// deoptimized
+static lval jit_deopt_marker;
+
+bool jit_supported(void)
+{
+    return JIT_SUPPORTED;
+}
+
+bool jit_start(bool verify)
+{
+    if (!JIT_SUPPORTED) {
+        return false;
+    }
+    jit_enabled = true;
+    jit_verify = verify;
+    if (verify) {
+        jit_call_threshold = 1;
+    }
+    return true;
+}
+
+// Signature of a compiled function
+typedef lval* (*ljit_entry)(lenv *e);
+
+typedef enum {
+    jit_state_counting = 0, // Counting calls until the function is hot
+    jit_state_compiling = 1, // Being compiled
+    jit_state_compiled = 2, // Compiled, and calls run the machine code
+    jit_state_interpreted = 3 // Could not be compiled, or deoptimizes too often
+} jit_state;
+
+struct ljit_function {
+    jit_state state;
+    bool pure; // Compiled successfully, so the body has no side effects
+    size_t calls; // Calls before being compiled
+    size_t deopts; // Number of times the compiled code has deoptimized
+    lval *constants; // Functions the compiled code expects to call
+    uint8_t *code; // Executable memory
+    size_t code_size;
+    ljit_entry entry;
+};
+
+void jit_free_function(ljit_function *info)
+{
+    if (info == NULL) {
+        return;
+    }
+#if JIT_SUPPORTED
+    if (info->code != NULL) {
+        munmap(info->code, info->code_size);
+    }
+#endif
+    if (info->constants != NULL) {
+        lval_release(info->constants);
+    }
+    free(info);
+}
+
+static ljit_function* jit_info_for_function(const lval *f)
+{
+    if (f->val.vfunc.jit == NULL) {
+        // Functions are constant, apart from their JIT state
+        ((lval *)f)->val.vfunc.jit = calloc(1, sizeof(ljit_function));
+    }
+    return f->val.vfunc.jit;
+}
+
+#if JIT_SUPPORTED
+
+#pragma mark - Built-ins that compiled code can call
+
+// Built-ins without side effects (they only return new values)
+static bool is_pure_builtin(lbuiltin f)
+{
+    static const lbuiltin pure[] = {
+        builtin_list, builtin_head, builtin_tail, builtin_join, builtin_len,
+        builtin_drop, builtin_take, builtin_first, builtin_second,
+        builtin_last, builtin_nth,
+        builtin_add, builtin_subtract, builtin_multiply, builtin_divide,
+        builtin_modulo, builtin_right_shift, builtin_left_shift,
+        builtin_bitwise_and, builtin_bitwise_or, builtin_bitwise_xor,
+        builtin_min, builtin_max, builtin_floor, builtin_ceil,
+        builtin_greater_than, builtin_less_than,
+        builtin_greater_than_or_equal, builtin_less_than_or_equal,
+        builtin_equal, builtin_not_equal,
+        builtin_logical_or, builtin_logical_and, builtin_logical_not,
+        builtin_do, builtin_create_buffer, builtin_buffer_with_bytes,
+        builtin_put_byte, builtin_get_byte,
+        builtin_put_unsigned_char, builtin_get_unsigned_char,
+        builtin_put_signed_char, builtin_get_signed_char,
+        builtin_put_unsigned_short, builtin_get_unsigned_short,
+        builtin_put_signed_short, builtin_get_signed_short,
+        builtin_put_unsigned_integer, builtin_get_unsigned_integer,
+        builtin_put_signed_integer, builtin_get_signed_integer,
+        builtin_put_unsigned_long, builtin_get_unsigned_long,
+        builtin_put_signed_long, builtin_get_signed_long,
+        builtin_put_string, builtin_get_string,
+        builtin_put_bytes, builtin_get_bytes,
+        builtin_type_of, builtin_to_string, builtin_to_number,
+        builtin_format, builtin_error
+    };
+    for (size_t i=0; i<sizeof(pure)/sizeof(pure[0]); i++) {
+        if (pure[i] == f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if calling f can't have side effects
+static bool is_pure_function(const lval *f)
+{
+    if (f->type != LVAL_FUN) {
+        return false;
+    }
+    if (f->val.vfunc.builtin != NULL) {
+        return is_pure_builtin(f->val.vfunc.builtin);
+    }
+    return f->val.vfunc.jit != NULL && f->val.vfunc.jit->pure;
+}
+
+#pragma mark - Runtime helpers called from compiled code
+
+// Moves the values in slots into a new argument list for a call
+static lval* jit_args(const lval *node, lval **slots, size_t n)
+{
+    lval *a = lval_sexpr_with_size(n);
+    a->source_position = code_pos_retain(node->source_position);
+    for (size_t i=0; i<n; i++) {
+        lval_add(a, slots[i]);
+        lval_release(slots[i]);
+        slots[i] = NULL;
+    }
+    return a;
+}
+
+// Calls f with the values in slots as arguments
+// node is pushed onto the stack during the call if push_frame is true
+// (otherwise the compiled code has already pushed it)
+// Returns NULL if f is a user-defined function that deoptimized
+static lval* jit_call(lenv *e, const lval *f, lval **slots, size_t n,
+                      const lval *node, bool push_frame)
+{
+    lval *a = jit_args(node, slots, n);
+    if (push_frame) {
+        stack_push_frame(node);
+    }
+    if (stats_enabled_for(STATS_CALLS) && f->bound_name != NULL) {
+        record_function_call((lval *)f);
+    }
+    jit_strict_call = f->val.vfunc.builtin == NULL;
+    lval *r = lval_call(e, f, a);
+    jit_strict_call = false;
+    if (push_frame) {
+        stack_pop_frame();
+    }
+    lval_release(a);
+    return r == &jit_deopt_marker ? NULL : r;
+}
+
+static lval* jit_call_known(lenv *e, const lval *f, lval **slots, size_t n,
+                            const lval *node, long push_frame)
+{
+    return jit_call(e, f, slots, n, node, push_frame);
+}
+
+// Calls the function in slots[0] with the rest of the slots as arguments
+// Returns NULL (to deoptimize) if the function might have side effects
+static lval* jit_call_value(lenv *e, lval **slots, size_t n,
+                            const lval *node, long push_frame)
+{
+    lval *f = slots[0];
+    if (!is_pure_function(f)) {
+        return NULL;
+    }
+    lval *r = jit_call(e, f, slots+1, n-1, node, push_frame);
+    lval_release(f);
+    slots[0] = NULL;
+    return r;
+}
+
+// Evaluates (p k), where p is a parameter: either reads property k from an
+// instance or dictionary, or calls the function p with k as its argument
+// Returns NULL (to deoptimize) for anything else
+static lval* jit_apply_parameter(lenv *e, lval **slots, const lval *k,
+                                 const lval *node)
+{
+    lval *p = slots[0];
+    if (p->type == LVAL_CUSTOM_TYPE_INSTANCE || p->type == LVAL_DICT) {
+        lval *value = NULL;
+        if (p->type == LVAL_DICT) {
+            lval_entry *entry = lval_table_get_entry(p->val.vdict, k);
+            value = entry != NULL ? entry->value : NULL;
+        } else {
+            long slot = instance_slot(p, k, 0);
+            value = slot >= 0 ? p->val.vinst.slots[slot] : NULL;
+        }
+        if (value == NULL || value->type == LVAL_FUN ||
+            value->type == LVAL_SEXPR || value->type == LVAL_SYM) {
+            return NULL;
+        }
+        lval *r = lval_retain(value);
+        lval_release(p);
+        slots[0] = NULL;
+        return r;
+    } else if (is_pure_function(p)) {
+        stack_push_frame(node);
+        lval *arg = lenv_get_cached(e, k);
+        if (arg->type == LVAL_ERR) {
+            stack_pop_frame();
+            return arg;
+        }
+        slots[1] = arg;
+        lval *r = jit_call(e, p, slots+1, 1, node, false);
+        stack_pop_frame();
+        lval_release(p);
+        slots[0] = NULL;
+        return r;
+    }
+    return NULL;
+}
+
+// Checks the function bound to sym is still the one we compiled a call to
+static long jit_guard(lenv *e, const lval *sym, const lval *expected)
+{
+    lval *v = lenv_get_cached(e, sym);
+    bool r = (v == expected);
+    lval_release(v);
+    return r;
+}
+
+static lval* jit_load_symbol(lenv *e, const lval *sym)
+{
+    return lenv_get_cached(e, sym);
+}
+
+// Boxes the result of an inline Integer operation, and releases its operands
+static lval* jit_int_result(long v, lval **slots)
+{
+    lval_release(slots[0]);
+    lval_release(slots[1]);
+    slots[0] = NULL;
+    slots[1] = NULL;
+    return lval_int(v);
+}
+
+// Returns 1 if the condition in slot is true, 0 if not,
+// or -1 if 'if' would reject it
+static long jit_condition(lval **slot)
+{
+    lval *v = *slot;
+    long r = -1;
+    if (v->type == LVAL_INT) {
+        r = v->val.vint != 0;
+    } else if (v->type == LVAL_FLT) {
+        r = v->val.vflt != 0;
+    } else if (v->type == LVAL_BYTE) {
+        r = v->val.vbyte != 0;
+    } else if (v->type == LVAL_STR) {
+        r = 1;
+    }
+    if (r != -1) {
+        lval_release(v);
+        *slot = NULL;
+    }
+    return r;
+}
+
+// Returns 1 if the value in slot is true, 0 if not (for and/or)
+static long jit_truth(lval **slot)
+{
+    long r = lval_is_true(*slot);
+    lval_release(*slot);
+    *slot = NULL;
+    return r;
+}
+
+// Releases the value in slot (for values do doesn't keep)
+static void jit_release_slot(lval **slot)
+{
+    lval_release(*slot);
+    *slot = NULL;
+}
+
+// Boxes the result of and/or
+static lval* jit_logical_result(long v)
+{
+    return lval_int(v);
+}
+
+static size_t jit_stack_depth(void)
+{
+    return stack_depth();
+}
+
+static void jit_push_frame(const lval *node)
+{
+    stack_push_frame(node);
+}
+
+static void jit_pop_frame(void)
+{
+    stack_pop_frame();
+}
+
+// Releases the values still in slots and pops the frames pushed by compiled
+// code (after an error or when deoptimizing)
+static void jit_unwind(lval **slots, long n, size_t depth)
+{
+    for (long i=0; i<n; i++) {
+        if (slots[i] != NULL) {
+            lval_release(slots[i]);
+        }
+    }
+    stack_unwind_to(depth);
+}
+
+#pragma mark - Compiler
+
+// Compiled code keeps the environment in rbx, the stack depth at entry in
+// r12, and the values it is working with in 8 byte slots at the top of the
+// machine stack. A slot is either NULL or holds a reference, so errors and
+// deoptimization can release whatever is left over
+
+typedef enum {
+    reg_rax = 0, reg_rcx = 1, reg_rdx = 2, reg_rbx = 3,
+    reg_rsp = 4, reg_rbp = 5, reg_rsi = 6, reg_rdi = 7
+} jit_reg;
+
+// Condition codes for jcc / setcc
+typedef enum {
+    cc_o = 0x0, cc_e = 0x4, cc_ne = 0x5, cc_s = 0x8,
+    cc_l = 0xC, cc_ge = 0xD, cc_le = 0xE, cc_g = 0xF
+} jit_cc;
+
+typedef struct {
+    const lval *f; // Function being compiled
+    lenv *env; // Environment used to find the functions the body calls
+    lval *constants; // Functions the code expects to call
+    uint8_t *code;
+    size_t len;
+    size_t capacity;
+    size_t slots; // Number of slots used
+    size_t *error_jumps; // Jumps to the error exit (error in rax)
+    size_t error_jump_count;
+    size_t *deopt_jumps; // Jumps to the deoptimization exit
+    size_t deopt_jump_count;
+} jit_compiler;
+
+static void emit(jit_compiler *c, const uint8_t *bytes, size_t n)
+{
+    if (c->len+n > c->capacity) {
+        c->capacity = (c->len+n)*2;
+        c->code = realloc(c->code, c->capacity);
+    }
+    memcpy(c->code+c->len, bytes, n);
+    c->len += n;
+}
+
+#define EMIT(c, ...) do { \
+    const uint8_t __bytes[] = {__VA_ARGS__}; \
+    emit(c, __bytes, sizeof(__bytes)); \
+} while (0)
+
+static void emit_u32(jit_compiler *c, uint32_t v)
+{
+    emit(c, (uint8_t *)&v, 4);
+}
+
+static void emit_u64(jit_compiler *c, uint64_t v)
+{
+    emit(c, (uint8_t *)&v, 8);
+}
+
+static void patch_u32(jit_compiler *c, size_t pos, uint32_t v)
+{
+    memcpy(c->code+pos, &v, 4);
+}
+
+// mov reg, imm64
+static void emit_mov_imm(jit_compiler *c, jit_reg reg, const void *v)
+{
+    EMIT(c, 0x48, 0xB8+reg);
+    emit_u64(c, (uint64_t)(uintptr_t)v);
+}
+
+// mov r8, imm64
+static void emit_mov_r8_imm(jit_compiler *c, const void *v)
+{
+    EMIT(c, 0x49, 0xB8);
+    emit_u64(c, (uint64_t)(uintptr_t)v);
+}
+
+// mov reg, [rsp+slot*8]
+static void emit_load_slot(jit_compiler *c, jit_reg reg, size_t slot)
+{
+    EMIT(c, 0x48, 0x8B, 0x84 | (reg << 3), 0x24);
+    emit_u32(c, (uint32_t)(slot*8));
+}
+
+// lea reg, [rsp+slot*8]
+static void emit_slot_address(jit_compiler *c, jit_reg reg, size_t slot)
+{
+    EMIT(c, 0x48, 0x8D, 0x84 | (reg << 3), 0x24);
+    emit_u32(c, (uint32_t)(slot*8));
+}
+
+// mov [rsp+slot*8], rax
+static void emit_store_slot(jit_compiler *c, size_t slot)
+{
+    EMIT(c, 0x48, 0x89, 0x84, 0x24);
+    emit_u32(c, (uint32_t)(slot*8));
+}
+
+// mov rdi, rbx (the environment is the first argument to most helpers)
+static void emit_env_arg(jit_compiler *c)
+{
+    EMIT(c, 0x48, 0x89, 0xDF);
+}
+
+// Calls a C function (arguments must already be in rdi, rsi, rdx, rcx, r8)
+static void emit_call(jit_compiler *c, const void *func)
+{
+    emit_mov_imm(c, reg_rax, func);
+    EMIT(c, 0xFF, 0xD0);
+}
+
+// cmp dword [reg+disp8], imm8
+static void emit_cmp_type(jit_compiler *c, jit_reg reg, lval_type type)
+{
+    EMIT(c, 0x83, 0x78 | reg, (uint8_t)offsetof(lval, type), (uint8_t)type);
+}
+
+// jcc rel32, returns the position to patch
+static size_t emit_jcc(jit_compiler *c, jit_cc cc)
+{
+    EMIT(c, 0x0F, 0x80 | cc);
+    emit_u32(c, 0);
+    return c->len-4;
+}
+
+// jmp rel32, returns the position to patch
+static size_t emit_jmp(jit_compiler *c)
+{
+    EMIT(c, 0xE9);
+    emit_u32(c, 0);
+    return c->len-4;
+}
+
+// Points the jump at pos to the current position
+static void patch_jump_here(jit_compiler *c, size_t pos)
+{
+    patch_u32(c, pos, (uint32_t)(c->len-(pos+4)));
+}
+
+static void add_jump(size_t **jumps, size_t *count, size_t pos)
+{
+    *jumps = realloc(*jumps, sizeof(size_t)*(*count+1));
+    (*jumps)[*count] = pos;
+    (*count)++;
+}
+
+static void emit_deopt_if(jit_compiler *c, jit_cc cc)
+{
+    add_jump(&c->deopt_jumps, &c->deopt_jump_count, emit_jcc(c, cc));
+}
+
+// Deoptimizes if rax is NULL, or exits with the error if rax is an error
+static void emit_check_result(jit_compiler *c, bool can_deopt)
+{
+    if (can_deopt) {
+        EMIT(c, 0x48, 0x85, 0xC0); // test rax, rax
+        emit_deopt_if(c, cc_e);
+    }
+    emit_cmp_type(c, reg_rax, LVAL_ERR);
+    add_jump(&c->error_jumps, &c->error_jump_count, emit_jcc(c, cc_e));
+}
+
+static void emit_push_frame(jit_compiler *c, const lval *node)
+{
+    emit_mov_imm(c, reg_rdi, node);
+    emit_call(c, jit_push_frame);
+}
+
+static void emit_pop_frame(jit_compiler *c)
+{
+    emit_call(c, jit_pop_frame);
+}
+
+static void use_slot(jit_compiler *c, size_t slot)
+{
+    if (slot+1 > c->slots) {
+        c->slots = slot+1;
+    }
+}
+
+// Is sym one of the parameters of the function being compiled?
+static bool is_parameter(jit_compiler *c, const lval *sym)
+{
+    const lval *args = c->f->val.vfunc.args;
+    for (size_t i=0; i<count(args); i++) {
+        lval *arg = child(args, i);
+        if (arg->type == LVAL_KEY_VALUE_PAIR) {
+            arg = arg->val.vkvpair.key;
+        }
+        if (arg->type == LVAL_SYM && equal_symbols(arg, sym)) {
+            return strcmp(sym->val.vsym.name, "&") != 0;
+        }
+    }
+    return false;
+}
+
+// Can evaluating v produce an error? (Parameters are always bound)
+static bool can_error(jit_compiler *c, const lval *v)
+{
+    if (v->type == LVAL_SYM) {
+        return !is_parameter(c, v);
+    }
+    return v->type == LVAL_SEXPR;
+}
+
+static bool any_can_error(jit_compiler *c, const lval *node, size_t start)
+{
+    for (size_t i=start; i<count(node); i++) {
+        if (can_error(c, child(node, i))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Finds what sym is currently bound to, without side effects
+static lval* resolve(jit_compiler *c, const lval *sym)
+{
+    for (lenv *e = c->env; e != NULL; e = e->parent) {
+        lval_entry *entry = lval_table_get_entry(e->items, sym);
+        if (entry != NULL) {
+            return entry->value;
+        }
+    }
+    return NULL;
+}
+
+// Deoptimizes unless sym is still bound to expected
+// The fast path checks sym's lookup cache (see benzl-lenv.h) directly
+static void emit_guard(jit_compiler *c, const lval *sym, const lval *expected)
+{
+    if (expected != c->f) {
+        lval_add(c->constants, expected);
+    }
+    emit_mov_imm(c, reg_rax, sym);
+    // mov rcx, [rax+cached_epoch]
+    EMIT(c, 0x48, 0x8B, 0x88);
+    emit_u32(c, (uint32_t)offsetof(lval, val.vsym.cached_epoch));
+    // cmp rcx, [lookup_epoch]
+    emit_mov_imm(c, reg_rdx, &lookup_epoch);
+    EMIT(c, 0x48, 0x3B, 0x0A);
+    size_t stale = emit_jcc(c, cc_ne);
+    // mov rcx, [rax+cached_entry]
+    EMIT(c, 0x48, 0x8B, 0x88);
+    emit_u32(c, (uint32_t)offsetof(lval, val.vsym.cached_entry));
+    EMIT(c, 0x48, 0x85, 0xC9); // test rcx, rcx
+    size_t uncached = emit_jcc(c, cc_e);
+    // mov rcx, [rcx+value]
+    EMIT(c, 0x48, 0x8B, 0x89);
+    emit_u32(c, (uint32_t)offsetof(lval_entry, value));
+    emit_mov_imm(c, reg_rdx, expected);
+    EMIT(c, 0x48, 0x39, 0xD1); // cmp rcx, rdx
+    size_t ok = emit_jcc(c, cc_e);
+
+    // Slow path: full lookup
+    patch_jump_here(c, stale);
+    patch_jump_here(c, uncached);
+    emit_env_arg(c);
+    emit_mov_imm(c, reg_rsi, sym);
+    emit_mov_imm(c, reg_rdx, expected);
+    emit_call(c, jit_guard);
+    EMIT(c, 0x85, 0xC0); // test eax, eax
+    emit_deopt_if(c, cc_e);
+    patch_jump_here(c, ok);
+}
+
+static bool compile_expression(jit_compiler *c, const lval *node, size_t slot);
+static bool compile_function(const lval *f, lenv *env);
+
+// Compiles code that puts the value of v (an argument in an expression)
+// into slot
+static bool compile_value(jit_compiler *c, const lval *v, size_t slot)
+{
+    use_slot(c, slot);
+    switch (v->type) {
+        case LVAL_SYM:
+            emit_env_arg(c);
+            emit_mov_imm(c, reg_rsi, v);
+            emit_call(c, jit_load_symbol);
+            if (!is_parameter(c, v)) {
+                emit_check_result(c, false);
+            }
+            emit_store_slot(c, slot);
+            return true;
+        case LVAL_SEXPR:
+            return compile_expression(c, v, slot);
+        case LVAL_INT:
+        case LVAL_FLT:
+        case LVAL_BYTE:
+        case LVAL_STR:
+        case LVAL_QEXPR:
+            // Literals are retained by the function body
+            emit_mov_imm(c, reg_rax, v);
+            // add dword [rax+ref_count], 1
+            EMIT(c, 0x83, 0x40, (uint8_t)offsetof(lval, ref_count), 0x01);
+            emit_store_slot(c, slot);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Compiles the arguments of node (children from 1) into slots from slot
+static bool compile_arguments(jit_compiler *c, const lval *node, size_t slot)
+{
+    for (size_t i=1; i<count(node); i++) {
+        if (!compile_value(c, child(node, i), slot+i-1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Calls the known function f with the arguments in slots
+static void emit_known_call(jit_compiler *c, const lval *f, const lval *node,
+                            size_t slot, bool frame_pushed)
+{
+    emit_env_arg(c);
+    emit_mov_imm(c, reg_rsi, f);
+    emit_slot_address(c, reg_rdx, slot);
+    EMIT(c, 0xB9); // mov ecx, imm32
+    emit_u32(c, (uint32_t)(count(node)-1));
+    emit_mov_r8_imm(c, node);
+    EMIT(c, 0x41, 0xB9); // mov r9d, imm32
+    emit_u32(c, frame_pushed ? 0 : 1);
+    emit_call(c, jit_call_known);
+    emit_check_result(c, f->val.vfunc.builtin == NULL);
+    emit_store_slot(c, slot);
+}
+
+// (+ a b) and friends: inline Integer arithmetic, with the built-in for
+// anything else
+static bool compile_integer_op(jit_compiler *c, const lval *node, size_t slot,
+                               const lval *f, bool frame_pushed)
+{
+    lbuiltin b = f->val.vfunc.builtin;
+    use_slot(c, slot+1);
+    emit_load_slot(c, reg_rdi, slot);
+    emit_load_slot(c, reg_rsi, slot+1);
+    emit_cmp_type(c, reg_rdi, LVAL_INT);
+    size_t slow1 = emit_jcc(c, cc_ne);
+    emit_cmp_type(c, reg_rsi, LVAL_INT);
+    size_t slow2 = emit_jcc(c, cc_ne);
+    uint8_t offset = (uint8_t)offsetof(lval, val.vint);
+    EMIT(c, 0x48, 0x8B, 0x47, offset); // mov rax, [rdi+vint]
+    EMIT(c, 0x48, 0x8B, 0x4E, offset); // mov rcx, [rsi+vint]
+
+    size_t slow3 = 0;
+    bool overflow_check = true;
+    if (b == builtin_add) {
+        EMIT(c, 0x48, 0x01, 0xC8); // add rax, rcx
+    } else if (b == builtin_subtract) {
+        EMIT(c, 0x48, 0x29, 0xC8); // sub rax, rcx
+    } else if (b == builtin_multiply) {
+        EMIT(c, 0x48, 0x0F, 0xAF, 0xC1); // imul rax, rcx
+    } else {
+        jit_cc cc = cc_e;
+        if (b == builtin_less_than) {
+            cc = cc_l;
+        } else if (b == builtin_greater_than) {
+            cc = cc_g;
+        } else if (b == builtin_less_than_or_equal) {
+            cc = cc_le;
+        } else if (b == builtin_greater_than_or_equal) {
+            cc = cc_ge;
+        } else if (b == builtin_not_equal) {
+            cc = cc_ne;
+        }
+        EMIT(c, 0x48, 0x39, 0xC8); // cmp rax, rcx
+        EMIT(c, 0x0F, 0x90 | cc, 0xC0); // setcc al
+        EMIT(c, 0x0F, 0xB6, 0xC0); // movzx eax, al
+        overflow_check = false;
+    }
+    if (overflow_check) {
+        slow3 = emit_jcc(c, cc_o);
+    }
+    EMIT(c, 0x48, 0x89, 0xC7); // mov rdi, rax
+    emit_slot_address(c, reg_rsi, slot);
+    emit_call(c, jit_int_result);
+    emit_store_slot(c, slot);
+    size_t done = emit_jmp(c);
+
+    // Anything else (Floats, overflow etc) goes to the built-in
+    patch_jump_here(c, slow1);
+    patch_jump_here(c, slow2);
+    if (overflow_check) {
+        patch_jump_here(c, slow3);
+    }
+    emit_known_call(c, f, node, slot, frame_pushed);
+    patch_jump_here(c, done);
+    return true;
+}
+
+// (if condition {then} {else})
+static bool compile_if(jit_compiler *c, const lval *node, size_t slot)
+{
+    if (count(node) != 4 || child(node, 2)->type != LVAL_QEXPR ||
+        child(node, 3)->type != LVAL_QEXPR) {
+        return false;
+    }
+    emit_push_frame(c, node);
+    if (!compile_value(c, child(node, 1), slot)) {
+        return false;
+    }
+    emit_slot_address(c, reg_rdi, slot);
+    emit_call(c, jit_condition);
+    EMIT(c, 0x48, 0x85, 0xC0); // test rax, rax
+    emit_deopt_if(c, cc_s);
+    size_t otherwise = emit_jcc(c, cc_e);
+    if (!compile_expression(c, child(node, 2), slot)) {
+        return false;
+    }
+    size_t done = emit_jmp(c);
+    patch_jump_here(c, otherwise);
+    if (!compile_expression(c, child(node, 3), slot)) {
+        return false;
+    }
+    patch_jump_here(c, done);
+    emit_pop_frame(c);
+    return true;
+}
+
+// (and ...) or (or ...): arguments are evaluated until one decides the result
+// (a false one for and, a true one for or), like the special forms do
+static bool compile_logical(jit_compiler *c, const lval *node, size_t slot,
+                            bool is_and)
+{
+    bool frame = any_can_error(c, node, 1);
+    if (frame) {
+        emit_push_frame(c, node);
+    }
+    size_t n = count(node);
+    size_t *decided = malloc(sizeof(size_t)*n);
+    for (size_t i=1; i<n; i++) {
+        if (!compile_value(c, child(node, i), slot)) {
+            free(decided);
+            return false;
+        }
+        emit_slot_address(c, reg_rdi, slot);
+        emit_call(c, jit_truth);
+        EMIT(c, 0x48, 0x85, 0xC0); // test rax, rax
+        decided[i] = emit_jcc(c, is_and ? cc_e : cc_ne);
+    }
+    EMIT(c, 0xBF); // mov edi, imm32
+    emit_u32(c, is_and ? 1 : 0);
+    size_t done = emit_jmp(c);
+    for (size_t i=1; i<n; i++) {
+        patch_jump_here(c, decided[i]);
+    }
+    free(decided);
+    EMIT(c, 0xBF); // mov edi, imm32
+    emit_u32(c, is_and ? 0 : 1);
+    patch_jump_here(c, done);
+    emit_call(c, jit_logical_result);
+    emit_store_slot(c, slot);
+    if (frame) {
+        emit_pop_frame(c);
+    }
+    return true;
+}
+
+// (do ...): each expression is evaluated in turn, keeping the last value
+static bool compile_do(jit_compiler *c, const lval *node, size_t slot)
+{
+    size_t n = count(node);
+    if (n < 2) {
+        return false;
+    }
+    bool frame = any_can_error(c, node, 1);
+    if (frame) {
+        emit_push_frame(c, node);
+    }
+    for (size_t i=1; i<n; i++) {
+        if (!compile_value(c, child(node, i), slot)) {
+            return false;
+        }
+        if (i+1 < n) {
+            emit_slot_address(c, reg_rdi, slot);
+            emit_call(c, jit_release_slot);
+        }
+    }
+    if (frame) {
+        emit_pop_frame(c);
+    }
+    return true;
+}
+
+// (p ...) where p is a parameter
+static bool compile_parameter_call(jit_compiler *c, const lval *node,
+                                   size_t slot)
+{
+    use_slot(c, slot+count(node)-1);
+    if (!compile_value(c, child(node, 0), slot)) {
+        return false;
+    }
+
+    // (p k): property access, or a call with one argument
+    if (count(node) == 2 && child(node, 1)->type == LVAL_SYM) {
+        emit_env_arg(c);
+        emit_slot_address(c, reg_rsi, slot);
+        emit_mov_imm(c, reg_rdx, child(node, 1));
+        emit_mov_imm(c, reg_rcx, node);
+        emit_call(c, jit_apply_parameter);
+        emit_check_result(c, true);
+        emit_store_slot(c, slot);
+        return true;
+    }
+
+    // Anything but a function would put the object's properties in scope
+    // while evaluating the arguments
+    emit_load_slot(c, reg_rax, slot);
+    emit_cmp_type(c, reg_rax, LVAL_FUN);
+    emit_deopt_if(c, cc_ne);
+
+    bool frame = any_can_error(c, node, 1);
+    if (frame) {
+        emit_push_frame(c, node);
+    }
+    for (size_t i=1; i<count(node); i++) {
+        if (!compile_value(c, child(node, i), slot+i)) {
+            return false;
+        }
+    }
+    emit_env_arg(c);
+    emit_slot_address(c, reg_rsi, slot);
+    EMIT(c, 0xBA); // mov edx, imm32
+    emit_u32(c, (uint32_t)count(node));
+    emit_mov_imm(c, reg_rcx, node);
+    emit_mov_r8_imm(c, frame ? (void *)0 : (void *)1);
+    emit_call(c, jit_call_value);
+    emit_check_result(c, true);
+    emit_store_slot(c, slot);
+    if (frame) {
+        emit_pop_frame(c);
+    }
+    return true;
+}
+
+// Compiles code that evaluates node as an S-Expression into slot
+static bool compile_expression(jit_compiler *c, const lval *node, size_t slot)
+{
+    use_slot(c, slot);
+    size_t n = count(node);
+    if (n == 0) {
+        return false;
+    }
+
+    // Single expression, eg {x}
+    if (n == 1) {
+        const lval *v = child(node, 0);
+        bool frame = can_error(c, v);
+        if (frame) {
+            emit_push_frame(c, node);
+        }
+        if (!compile_value(c, v, slot)) {
+            return false;
+        }
+        // The interpreter would call a function with no arguments
+        if (v->type == LVAL_SYM || v->type == LVAL_SEXPR) {
+            emit_load_slot(c, reg_rax, slot);
+            emit_cmp_type(c, reg_rax, LVAL_FUN);
+            emit_deopt_if(c, cc_e);
+        }
+        if (frame) {
+            emit_pop_frame(c);
+        }
+        return true;
+    }
+
+    const lval *head = child(node, 0);
+    if (head->type != LVAL_SYM) {
+        return false;
+    }
+    if (is_parameter(c, head)) {
+        return compile_parameter_call(c, node, slot);
+    }
+
+    const lval *f = resolve(c, head);
+    if (f == NULL || f->type != LVAL_FUN) {
+        return false;
+    }
+    lbuiltin b = f->val.vfunc.builtin;
+    if (b == NULL) {
+        // Calls to other functions need them to be compiled too
+        if (f != c->f && !compile_function(f, c->env)) {
+            return false;
+        }
+    } else if (b != builtin_if && !is_pure_builtin(b)) {
+        return false;
+    }
+
+    emit_guard(c, head, f);
+    if (b == builtin_if) {
+        return compile_if(c, node, slot);
+    } else if (b == builtin_logical_and || b == builtin_logical_or) {
+        return compile_logical(c, node, slot, b == builtin_logical_and);
+    } else if (b == builtin_do) {
+        return compile_do(c, node, slot);
+    }
+
+    use_slot(c, slot+n-2);
+    bool frame = any_can_error(c, node, 1);
+    if (frame) {
+        emit_push_frame(c, node);
+    }
+    if (!compile_arguments(c, node, slot)) {
+        return false;
+    }
+    if (n == 3 && (b == builtin_add || b == builtin_subtract ||
+                   b == builtin_multiply || b == builtin_less_than ||
+                   b == builtin_greater_than ||
+                   b == builtin_less_than_or_equal ||
+                   b == builtin_greater_than_or_equal ||
+                   b == builtin_equal || b == builtin_not_equal)) {
+        compile_integer_op(c, node, slot, f, frame);
+    } else {
+        emit_known_call(c, f, node, slot, frame);
+    }
+    if (frame) {
+        emit_pop_frame(c);
+    }
+    return true;
+}
+
+static bool compile_function(const lval *f, lenv *env)
+{
+    ljit_function *info = jit_info_for_function(f);
+    if (info->state == jit_state_compiled ||
+        info->state == jit_state_interpreted) {
+        return info->pure;
+    } else if (info->state == jit_state_compiling) {
+        // Mutual recursion
+        return false;
+    }
+    info->state = jit_state_compiling;
+
+    jit_compiler c = {0};
+    c.f = f;
+    c.env = env;
+    c.constants = lval_qexpr();
+
+    // Prologue
+    EMIT(&c, 0x53); // push rbx
+    EMIT(&c, 0x41, 0x54); // push r12
+    EMIT(&c, 0x41, 0x55); // push r13
+    EMIT(&c, 0x48, 0x81, 0xEC); // sub rsp, imm32
+    size_t frame_size_pos = c.len;
+    emit_u32(&c, 0);
+    EMIT(&c, 0x48, 0x89, 0xFB); // mov rbx, rdi
+    // Clear the slots: xor eax, eax; mov ecx, slots; mov rdi, rsp; rep stosq
+    EMIT(&c, 0x31, 0xC0, 0xB9);
+    size_t slot_count_pos = c.len;
+    emit_u32(&c, 0);
+    EMIT(&c, 0x48, 0x89, 0xE7, 0xF3, 0x48, 0xAB);
+    emit_call(&c, jit_stack_depth);
+    EMIT(&c, 0x49, 0x89, 0xC4); // mov r12, rax
+
+    bool ok = compile_expression(&c, f->val.vfunc.body, 0);
+
+    if (ok) {
+        emit_load_slot(&c, reg_rax, 0);
+        EMIT(&c, 0x49, 0x89, 0xC5); // mov r13, rax
+        size_t exit = emit_jmp(&c);
+
+        // Error exit: the error is in rax
+        size_t error_exit = c.len;
+        EMIT(&c, 0x49, 0x89, 0xC5); // mov r13, rax
+        size_t unwind = emit_jmp(&c);
+
+        // Deoptimization exit: return NULL
+        size_t deopt_exit = c.len;
+        EMIT(&c, 0x45, 0x31, 0xED); // xor r13d, r13d
+
+        patch_jump_here(&c, unwind);
+        EMIT(&c, 0x48, 0x89, 0xE7); // mov rdi, rsp
+        EMIT(&c, 0xBE); // mov esi, imm32
+        emit_u32(&c, (uint32_t)c.slots);
+        EMIT(&c, 0x4C, 0x89, 0xE2); // mov rdx, r12
+        emit_call(&c, jit_unwind);
+
+        // Epilogue
+        patch_jump_here(&c, exit);
+        EMIT(&c, 0x4C, 0x89, 0xE8); // mov rax, r13
+        EMIT(&c, 0x48, 0x81, 0xC4); // add rsp, imm32
+        size_t frame_size_pos2 = c.len;
+        emit_u32(&c, 0);
+        EMIT(&c, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3); // pop r13/r12/rbx; ret
+
+        // The slots keep the stack 16 byte aligned for calls
+        uint32_t frame_size = (uint32_t)((c.slots*8+15) & ~(size_t)15);
+        patch_u32(&c, frame_size_pos, frame_size);
+        patch_u32(&c, frame_size_pos2, frame_size);
+        patch_u32(&c, slot_count_pos, (uint32_t)c.slots);
+        for (size_t i=0; i<c.error_jump_count; i++) {
+            patch_u32(&c, c.error_jumps[i],
+                      (uint32_t)(error_exit-(c.error_jumps[i]+4)));
+        }
+        for (size_t i=0; i<c.deopt_jump_count; i++) {
+            patch_u32(&c, c.deopt_jumps[i],
+                      (uint32_t)(deopt_exit-(c.deopt_jumps[i]+4)));
+        }
+
+        // Copy the code into executable memory
+        uint8_t *code = mmap(NULL, c.len, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+            ok = false;
+        } else {
+            memcpy(code, c.code, c.len);
+            if (mprotect(code, c.len, PROT_READ | PROT_EXEC) != 0) {
+                munmap(code, c.len);
+                ok = false;
+            } else {
+                info->code = code;
+                info->code_size = c.len;
+                info->entry = (ljit_entry)(uintptr_t)code;
+            }
+        }
+    }
+
+    free(c.code);
+    free(c.error_jumps);
+    free(c.deopt_jumps);
+    if (ok) {
+        info->constants = c.constants;
+        info->state = jit_state_compiled;
+        info->pure = true;
+    } else {
+        lval_release(c.constants);
+        info->state = jit_state_interpreted;
+    }
+    return ok;
+}
+
+#else
+
+static bool compile_function(const lval *f, lenv *env)
+{
+    return false;
+}
+
+#endif
+
+#pragma mark - Running compiled functions
+
+// Checks a compiled result against the interpreter (--jit=verify)
+static lval* verify_result(const lval *f, lenv *env, lval *r)
+{
+    jit_paused++;
+    lval *expected = lval_eval_function_body(env, f);
+    jit_paused--;
+    if (r->type != expected->type || !lval_eq(r, expected)) {
+        char *fs = lval_to_string(f);
+        char *rs = lval_to_string(r);
+        char *es = lval_to_string(expected);
+        fprintf(stderr, "JIT result mismatch in '%s' %s\n"
+                "Compiled: %s\nInterpreted: %s\n",
+                bound_name_for_lval(f), fs, rs, es);
+        free(fs);
+        free(rs);
+        free(es);
+        abort();
+    }
+    lval_release(r);
+    return expected;
+}
+
+lval* jit_run(const lval *f, lenv *env)
+{
+    bool strict = jit_strict_call;
+    jit_strict_call = false;
+    if (jit_paused > 0) {
+        return NULL;
+    }
+    ljit_function *info = jit_info_for_function(f);
+    if (info->state == jit_state_counting) {
+        info->calls++;
+        if (info->calls >= jit_call_threshold) {
+            compile_function(f, env);
+        }
+    }
+    if (info->state != jit_state_compiled) {
+        return strict ? &jit_deopt_marker : NULL;
+    }
+
+    lval *r = info->entry(env);
+    if (r == NULL) {
+        info->deopts++;
+        if (info->deopts >= JIT_MAX_DEOPTS) {
+            info->state = jit_state_interpreted;
+        }
+        return strict ? &jit_deopt_marker : NULL;
+    }
+    if (jit_verify) {
+        return verify_result(f, env, r);
+    }
+    return r;
+}
@@ -0,0 +1,51 @@
+// An optional JIT compiler for hot benzl functions (x86-64 Linux only)
+// When benzl is run with --jit, user-defined functions that have been called
+// JIT_CALL_THRESHOLD times are compiled to machine code. The machine code is
+// stitched together from a template for each kind of expression: calls to
+// built-in functions and other compiled functions, 'if', property access and
+// inline Integer arithmetic and comparisons.
+//
+// Only functions that have no side effects are compiled (their bodies only
+// use built-ins like +, first or get-unsigned-integer that return new values,
+// and other compiled functions). This means compiled code can give up at any
+// point (eg when '+' has been redefined, or a value isn't the type we
+// guessed) and let the interpreter evaluate the whole call again - this is
+// called deoptimizing. Functions that deoptimize too often are no longer run
+// as machine code.
+//
+// Compiled code pushes the same stack frames as the interpreter whenever an
+// error could happen, so errors and stack traces are unchanged.
+// benzl --jit=verify compiles functions the first time they are called, and
+// checks every result against the interpreter (see 'make test-jit')
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stdbool.h>
+
+// Forward declarations
+typedef struct lval lval;
+typedef struct lenv lenv;
+
+// JIT state stored in each user-defined function
+typedef struct ljit_function ljit_function;
+
+// True if the JIT has been turned on
+extern bool jit_enabled;
+
+// True if the JIT is supported on this platform
+bool jit_supported(void);
+
+// Turns on the JIT. If verify is true, functions are compiled on their first
+// call and every result is checked against the interpreter
+// Returns false if the JIT isn't supported on this platform
+bool jit_start(bool verify);
+
+// Runs the compiled version of user-defined function f, with its arguments
+// already bound in env. Compiles the function first if it is hot enough
+// Returns NULL if the interpreter should evaluate the call instead
+lval* jit_run(const lval *f, lenv *env);
+
+// Frees the JIT state for a function
+void jit_free_function(ljit_function *info);
@@ -1,13 +1,28 @@
 // Part of benzl - https://github.com/pokeb/benzl
 
-#include <stdlib.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "benzl-lenv.h"
 #include "benzl-lval.h"
+#include "benzl-runtime-stats.h"
+
+// Epoch all valid lookup caches were filled in (0 while a proxy scope is open)
+size_t lookup_epoch = 1;
+
+// Epoch to return to when no proxy scope is open
+static size_t current_epoch = 1;
+
+// Number of nested proxy scopes open
+static size_t proxy_scope_depth = 0;
+
+// Names that have been bound in a function's environment (never cached)
+static lval_table *locally_bound_names = NULL;
 
 lenv* lenv_alloc(size_t bucket_count) {
+    if (stats_enabled_for(STATS_ENVS)) {
+        runtime_stats.env_allocs++;
+    }
     lenv *e = malloc(sizeof(lenv));
     e->parent = NULL;
     e->items = lval_table_alloc(bucket_count);
@@ -17,6 +32,17 @@ lenv* lenv_alloc(size_t bucket_count) {
 }
 
 void lenv_free(lenv *e) {
+    if (stats_enabled_for(STATS_ENVS)) {
+        runtime_stats.env_frees++;
+    }
+    // Caches point into the top level environment's table
+    if (e->parent == NULL) {
+        lenv_invalidate_lookup_caches();
+        if (locally_bound_names != NULL) {
+            lval_table_free(locally_bound_names);
+            locally_bound_names = NULL;
+        }
+    }
     if (e->script_path != NULL) {
         free(e->script_path);
     }
@@ -28,6 +54,9 @@ void lenv_free(lenv *e) {
 }
 
 lenv* lenv_copy(const lenv *e) {
+    if (stats_enabled_for(STATS_ENVS)) {
+        runtime_stats.env_allocs++;
+    }
     lenv *n = malloc(sizeof(lenv));
     n->parent = e->parent;
     n->items = lval_table_copy(e->items);
@@ -41,21 +70,87 @@ lval* lenv_get(lenv *e, const lval *k) {
     while (e != NULL) {
         lval *item = lval_table_get(e->items, k);
         if (item != NULL) {
-
-            // Retain first in case the existing bound name is the same
-            lval *bn = lval_retain(k);
-            if (item->bound_name != NULL) {
-                lval_release(item->bound_name);
-            }
-            // No retain since we've done that already
-            item->bound_name = bn;
-
+            lenv_set_bound_name(item, k);
             return item;
         }
         // Not found in this environment, check the parent environment
         e = e->parent;
     }
-    return lval_err_for_val(k, "Unbound symbol '%s'", k->val.vsym);
+    return lval_err_for_val(k, "Unbound symbol '%s'", k->val.vsym.name);
+}
+
+lval* lenv_get_and_cache(lenv *e, const lval *k) {
+
+    // Symbols are constant, apart from their cache
+    vsym *site = (vsym *)&k->val.vsym;
+
+    // In a proxy scope, or already known to be uncacheable in this epoch
+    if (lookup_epoch == 0 ||
+        (site->cached_entry == NULL && site->cached_epoch == lookup_epoch)) {
+        return lenv_get(e, k);
+    }
+
+    site->cached_entry = NULL;
+    site->cached_epoch = lookup_epoch;
+
+    if (locally_bound_names != NULL &&
+        lval_table_get_entry(locally_bound_names, k) != NULL) {
+        return lenv_get(e, k);
+    }
+
+    while (e != NULL) {
+        lval_entry *entry = lval_table_get_entry(e->items, k);
+        if (entry != NULL) {
+            if (e->parent == NULL) {
+                site->cached_entry = entry;
+            }
+            lenv_set_bound_name(entry->value, k);
+            return lval_retain(entry->value);
+        }
+        e = e->parent;
+    }
+    return lval_err_for_val(k, "Unbound symbol '%s'", k->val.vsym.name);
+}
+
+void lenv_invalidate_lookup_caches(void)
+{
+    current_epoch++;
+    if (proxy_scope_depth == 0) {
+        lookup_epoch = current_epoch;
+    }
+}
+
+void lenv_begin_proxy_scope(void)
+{
+    proxy_scope_depth++;
+    lookup_epoch = 0;
+}
+
+void lenv_end_proxy_scope(void)
+{
+    assert(proxy_scope_depth > 0);
+    proxy_scope_depth--;
+    if (proxy_scope_depth == 0) {
+        lookup_epoch = current_epoch;
+    }
+}
+
+// Records that k is being bound in a function's environment,
+// so top level lookups for it can no longer be cached
+static void note_binding(const lenv *e, const lval *k)
+{
+    if (e->parent == NULL || (k->val.vsym.flags & LSYM_BOUND_LOCALLY)) {
+        return;
+    }
+    if (locally_bound_names == NULL) {
+        locally_bound_names = lval_table_alloc(128);
+    }
+    if (lval_table_get_entry(locally_bound_names, k) == NULL) {
+        lval_table_insert(locally_bound_names, k, k);
+        lenv_invalidate_lookup_caches();
+    }
+    // Symbols are constant, apart from their cache and flags
+    ((lval *)k)->val.vsym.flags |= LSYM_BOUND_LOCALLY;
 }
 
 lval* lenv_set(lenv *e, const lval *k, const lval *v) {
@@ -70,7 +165,7 @@ lval* lenv_set(lenv *e, const lval *k, const lval *v) {
         e = e->parent;
     }
     return lval_err_for_val(v, "'%s' must be defined before it can be set",
-                            k->val.vsym);
+                            k->val.vsym.name);
 }
 
 lval* lenv_def(lenv *e, const lval *k, const lval *v) {
@@ -78,9 +173,10 @@ lval* lenv_def(lenv *e, const lval *k, const lval *v) {
     lval *item = lval_table_get(e->items, k);
     if (item != NULL) {
         lval_release(item);
-        return lval_err_for_val(v, "'%s' is already declared", k->val.vsym);
+        return lval_err_for_val(v, "'%s' is already declared", k->val.vsym.name);
     }
 
+    note_binding(e, k);
     lval_table_insert(e->items, k, v);
     return NULL;
 }
@@ -90,9 +186,10 @@ lval* lenv_def_with_type(lenv *e, const lval *k, const lval *v, const lval *t)
     lval *item = lval_table_get(e->items, k);
     if (item != NULL) {
         lval_release(item);
-        return lval_err_for_val(v, "'%s' is already declared", k->val.vsym);
+        return lval_err_for_val(v, "'%s' is already declared", k->val.vsym.name);
     }
 
+    note_binding(e, k);
     lval_entry *entry = lval_table_insert(e->items, k, v);
     entry->type = lval_retain(t);
     return NULL;
@@ -115,6 +212,39 @@ bool is_module_already_loaded(lenv *e, char *module_path) {
 
 lval* lenv_def_or_set(lenv *e, const lval *k, const lval *v)
 {
+    note_binding(e, k);
     lval_table_insert(e->items, k, v);
     return NULL;
 }
+
+void lenv_rebind(lenv **env, lenv *parent, lval *const *names,
+                 lval_entry **entries, lval **values, size_t n)
+{
+    if (*env == NULL) {
+        *env = lenv_alloc(n);
+        (*env)->parent = parent;
+        for (size_t i=0; i<n; i++) {
+            lenv_def_or_set(*env, names[i], values[i]);
+        }
+        // Entries keep their address while their key is in the table
+        for (size_t i=0; i<n; i++) {
+            entries[i] = lval_table_get_entry((*env)->items, names[i]);
+        }
+        return;
+    }
+    for (size_t i=0; i<n; i++) {
+        lval_entry *entry = entries[i];
+        if (entry->value != values[i]) {
+            lval_release(entry->value);
+            entry->value = lval_retain(values[i]);
+        }
+    }
+}
+
+void lenv_rebind_reset_if_changed(lenv **env, size_t n)
+{
+    if (*env != NULL && (*env)->items->count != n) {
+        lenv_free(*env);
+        *env = NULL;
+    }
+}
@@ -12,6 +12,7 @@
 
 #include <stddef.h>
 #include "benzl-hash-table.h"
+#include "benzl-lval.h"
 
 // Forward declarations
 typedef struct lval lval;
@@ -39,6 +40,10 @@ lenv* lenv_copy(const lenv *e);
 // Get a value from the environment
 lval* lenv_get(lenv *e, const lval *k);
 
+// Get a value from the environment, using (and filling) the lookup cache
+// stored in the symbol. Used when evaluating symbols in code
+static inline lval* lenv_get_cached(lenv *e, const lval *k);
+
 // Put a value into the environment, assuming the name is not bound
 lval* lenv_def(lenv *e, const lval *k, const lval *v);
 
@@ -50,8 +55,74 @@ lval* lenv_set(lenv *e, const lval *k, const lval *v);
 // Put a value into the environment (only used internally)
 lval* lenv_def_or_set(lenv *e, const lval *k, const lval *v);
 
+// Binds the n variables names[i] to values[i] in *env, for code that binds
+// the same variables over and over again (a function called for every element
+// of a buffer, or the body of a loop). The first time (when *env is NULL) this
+// allocates an environment whose parent is parent, and stores the entries of
+// the variables in entries. After that it only changes the values in entries
+void lenv_rebind(lenv **env, lenv *parent, lval *const *names,
+                 lval_entry **entries, lval **values, size_t n);
+
+// Frees *env and sets it to NULL if something apart from the n variables bound
+// by lenv_rebind was defined in it, so the next lenv_rebind starts with a
+// fresh environment (like a new call to a function would)
+void lenv_rebind_reset_if_changed(lenv **env, size_t n);
+
 // Used for recording which scripts have already been loaded
 void record_module_loaded(lenv *e, char *module_path);
 
 // Check if a script has already been loaded
 bool is_module_already_loaded(lenv *e, char *module_path);
+
+#pragma mark - Lookup caches
+
+// Symbols in code remember the top level entry they were resolved to, so
+// evaluating the same symbol again (eg 'first' in (first l) inside a loop)
+// costs one comparison instead of a hash table lookup in every environment
+// between the current one and the top level.
+//
+// Caches are only valid while the symbol's cached_epoch matches lookup_epoch:
+// - Entries keep their address while their key is in the table
+//   (setting a value replaces it in place), so def/set at the top level
+//   don't need to invalidate anything
+// - benzl uses dynamic scope, so a name bound in a function's environment
+//   can hide a top level value. Names that have ever been bound in a function
+//   environment are never cached, and the first time a name is bound in one we
+//   move to a new epoch so existing caches for it are refilled
+// - Evaluating a property access like (my-point x) puts the properties of
+//   my-point in scope. While that happens lookup_epoch is 0, which no cache
+//   can match
+extern size_t lookup_epoch;
+
+// Slow path for lenv_get_cached
+lval* lenv_get_and_cache(lenv *e, const lval *k);
+
+// Invalidates all lookup caches
+void lenv_invalidate_lookup_caches(void);
+
+// Called around evaluating code with the properties of an object in scope
+void lenv_begin_proxy_scope(void);
+void lenv_end_proxy_scope(void);
+
+// Records k as the name bound to v, for use in error messages
+static inline void lenv_set_bound_name(lval *v, const lval *k)
+{
+    if (v->bound_name != k) {
+        // Retain first in case the existing bound name is the same
+        lval *bn = lval_retain(k);
+        if (v->bound_name != NULL) {
+            lval_release(v->bound_name);
+        }
+        v->bound_name = bn;
+    }
+}
+
+static inline lval* lenv_get_cached(lenv *e, const lval *k)
+{
+    lval_entry *entry = k->val.vsym.cached_entry;
+    if (entry != NULL && k->val.vsym.cached_epoch == lookup_epoch) {
+        lenv_set_bound_name(entry->value, k);
+        return lval_retain(entry->value);
+    }
+    return lenv_get_and_cache(e, k);
+}
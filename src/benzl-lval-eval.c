@@ -5,12 +5,76 @@
 #include "benzl-lenv.h"
 #include "benzl-builtins.h"
 #include "benzl-call-count-debug.h"
+#include "benzl-jit.h"
+#include "benzl-quicken.h"
+#include "benzl-runtime-stats.h"
 #include "benzl-stacktrace.h"
 
+lnative *lval_natives = NULL;
+static size_t native_count = 0;
+static size_t native_capacity = 0;
+
+// For each index: the number of expressions using it, and its release function
+static size_t *native_refs = NULL;
+static lnative_release *native_releases = NULL;
+
+// Indexes whose expressions have all been freed, to be reused
+// (there is space for every index)
+static uint16_t *free_natives = NULL;
+static size_t free_native_count = 0;
+
+bool lval_attach_native(lval *v, lnative f, lnative_release release)
+{
+    size_t index;
+    if (free_native_count > 0) {
+        index = free_natives[--free_native_count];
+    } else {
+        // vexp.native is 16 bits, anything after that is interpreted
+        if (native_count+1 > UINT16_MAX) {
+            return false;
+        }
+        if (native_count+1 >= native_capacity) {
+            native_capacity = native_capacity == 0 ? 1024 : native_capacity*2;
+            lval_natives = realloc(lval_natives,
+                                   sizeof(lnative)*native_capacity);
+            native_refs = realloc(native_refs,
+                                  sizeof(size_t)*native_capacity);
+            native_releases = realloc(native_releases,
+                                      sizeof(lnative_release)*native_capacity);
+            free_natives = realloc(free_natives,
+                                   sizeof(uint16_t)*native_capacity);
+            lval_natives[0] = NULL;
+        }
+        index = ++native_count;
+    }
+    lval_natives[index] = f;
+    native_refs[index] = 1;
+    native_releases[index] = release;
+    v->val.vexp.native = (uint16_t)index;
+    return true;
+}
+
+void lval_native_retain(uint16_t index)
+{
+    native_refs[index]++;
+}
+
+void lval_native_release(uint16_t index)
+{
+    if (--native_refs[index] > 0) {
+        return;
+    }
+    if (native_releases[index] != NULL) {
+        native_releases[index](index);
+    }
+    lval_natives[index] = NULL;
+    free_natives[free_native_count++] = index;
+}
+
 lval* lval_eval(lenv *e, const lval *v) {
     lval *r = NULL;
     if (v->type == LVAL_SYM) {
-        r = lenv_get(e, v);
+        r = lenv_get_cached(e, v);
     } else if (v->type == LVAL_SEXPR) {
         r = lval_eval_sexpr(e, v);
     } else {
@@ -137,6 +201,15 @@ lval* lval_create_custom_type_instance(lenv *e, const lval *t, const lval *v)
 }
 
 lval* lval_eval_sexpr(lenv *e, const lval *v) {
+    // Expressions in programs compiled with --emit-c (and folded constants)
+    // have native code
+    if (v->val.vexp.native != 0) {
+        return lval_natives[v->val.vexp.native](e, v);
+    }
+    return lval_eval_sexpr_interpreted(e, v);
+}
+
+lval* lval_eval_sexpr_interpreted(lenv *e, const lval *v) {
 
     stack_push_frame(v);
 //    lval_print(v);
@@ -145,37 +218,86 @@ lval* lval_eval_sexpr(lenv *e, const lval *v) {
     // eg (mypoint x) ; where x is a value declared in the type of mypoint
     lenv *temp_env = NULL;
 
+    // If the first item is a custom instance, the instance
+    lval *inst = NULL;
+
     lval *nv = lval_sexpr_with_size(count(v));
     nv->source_position = code_pos_retain(v->source_position);
 
     // Evaluate children
     for (size_t i=0; i<count(v); i++) {
         lval *input = child(v, i);
-        lval *output = lval_eval(e, input);
+        lval *output = NULL;
+        if (inst != NULL && input->type == LVAL_SYM) {
+            // Read properties of custom instances from their slots,
+            // starting with the slot this site found last time
+            lsite *site = (lsite *)&v->val.vexp.site;
+            long slot = instance_slot(inst, input, site->slot_hint);
+            if (slot >= 0) {
+                site->slot_hint = (uint16_t)slot;
+                output = lval_retain(inst->val.vinst.slots[slot]);
+                lenv_set_bound_name(output, input);
+            }
+        } else if (inst != NULL && temp_env == NULL &&
+                   input->type == LVAL_SEXPR) {
+            // For anything more complicated, eg (mypoint (+ x y)), create a
+            // temporary environment with the instance's properties available
+            const lval *type = inst->val.vinst.type;
+            size_t n = custom_type_slot_count(type);
+            lval_table *props = lval_table_alloc(n*3);
+            for (size_t j=0; j<n; j++) {
+                lval_table_insert(props, custom_type_slot_name(type, j),
+                                  inst->val.vinst.slots[j]);
+            }
+            temp_env = malloc(sizeof(lenv));
+            temp_env->parent = e;
+            temp_env->items = props;
+            e = temp_env;
+            lenv_begin_proxy_scope();
+        }
+        if (output == NULL) {
+            output = lval_eval(e, input);
+        }
         lval_add(nv, output);
         lval_release(output);
 
         if (i==0) {
-            // If the first item is a custom instance,
-            // create a temporary environment with its properties available
+            // Special forms (like and/or) evaluate their own arguments
+            lspecial_form form = NULL;
+            if (output->type == LVAL_FUN && output->val.vfunc.builtin != NULL) {
+                form = special_form_for(output->val.vfunc.builtin);
+            }
+            if (form != NULL) {
+                if (stats_enabled_for(STATS_CALLS) &&
+                    output->bound_name != NULL) {
+                    record_function_call(output);
+                }
+                lval *r = form(e, v);
+                lval_release(nv);
+                stack_pop_frame();
+                return r;
+            }
             if (output->type == LVAL_CUSTOM_TYPE_INSTANCE) {
-                temp_env = malloc(sizeof(lenv));
-                temp_env->parent = e;
-                temp_env->items = output->val.vinst.props;
-                e = temp_env;
-            // Same thing for dictionaries
+                inst = output;
+            // If the first item is a dictionary,
+            // create a temporary environment with its properties available
             } else if (output->type == LVAL_DICT) {
                 temp_env = malloc(sizeof(lenv));
                 temp_env->parent = e;
                 temp_env->items = output->val.vdict;
                 e = temp_env;
+                lenv_begin_proxy_scope();
             }
         }
 
     }
 
     if (temp_env != NULL) {
+        lenv_end_proxy_scope();
         e = temp_env->parent;
+        if (inst != NULL) {
+            lval_table_free(temp_env->items);
+        }
         free(temp_env);
     }
 
@@ -234,12 +356,20 @@ lval* lval_eval_sexpr(lenv *e, const lval *v) {
     }
 
 
-    if (f->bound_name != NULL) {
+    if (stats_enabled_for(STATS_CALLS) && f->bound_name != NULL) {
         record_function_call(f);
     }
 
 
-    lval *r = lval_call(e, f, nv);
+    // Calls to arithmetic and comparison built-ins may have a specialized
+    // version for the types this call site has been seeing
+    lval *r = NULL;
+    if (f->val.vfunc.builtin != NULL) {
+        r = quickened_call(v, f, nv);
+    }
+    if (r == NULL) {
+        r = lval_call(e, f, nv);
+    }
 
     lval_release(f);
     lval_release(nv);
@@ -257,6 +387,16 @@ static lval* lval_subexp(const lval *a, size_t start) {
     return v;
 }
 
+lval* lval_eval_function_body(lenv *env, const lval *f)
+{
+    // The same as (eval body), without allocating the expression to pass eval
+    const lval *body = f->val.vfunc.body;
+    if (body->type == LVAL_QEXPR) {
+        return lval_eval_sexpr(env, body);
+    }
+    return lval_eval(env, body);
+}
+
 lval* lval_call(lenv *e, const lval *f, const lval *a)
 {
     if (f->val.vfunc.builtin) {
@@ -345,10 +485,13 @@ lval* lval_call(lenv *e, const lval *f, const lval *a)
 
     // If we've bound values for all arguments
     if (used_args == needed_args_count) {
-        lval *expr = lval_sexpr_with_size(1);
-        lval_add(expr, f->val.vfunc.body);
-        lval *r = builtin_eval(env, expr);
-        lval_release(expr);
+        lval *r = NULL;
+        if (jit_enabled) {
+            r = jit_run(f, env);
+        }
+        if (r == NULL) {
+            r = lval_eval_function_body(env, f);
+        }
         lenv_free(env);
         return r;
     }
@@ -362,3 +505,70 @@ lval* lval_call(lenv *e, const lval *f, const lval *a)
     lenv_free(env);
     return err;
 }
+
+#pragma mark - Repeated calls
+
+void lcall_frame_init(lcall_frame *frame, lenv *e, const lval *f,
+                      size_t arg_count)
+{
+    assert(arg_count <= LCALL_FRAME_MAX_ARGS);
+    frame->caller = e;
+    frame->f = f;
+    frame->arg_count = arg_count;
+    frame->env = NULL;
+    frame->reuse_env = !f->val.vfunc.builtin &&
+                       count(f->val.vfunc.args) == arg_count;
+    for (size_t i=0; i<arg_count && frame->reuse_env; i++) {
+        const lval *sym = child(f->val.vfunc.args, i);
+        frame->reuse_env = sym->type == LVAL_SYM &&
+                           strcmp(sym->val.vsym.name, "&") != 0;
+    }
+}
+
+lval* lcall_frame_call(lcall_frame *frame, lval **args)
+{
+    if (!frame->reuse_env) {
+        lval *a = lval_qexpr_with_size(frame->arg_count);
+        for (size_t i=0; i<frame->arg_count; i++) {
+            lval_add(a, args[i]);
+        }
+        lval *r = lval_call(frame->caller, frame->f, a);
+        lval_release(a);
+        return r;
+    }
+
+    const lval *params = frame->f->val.vfunc.args;
+    lenv_rebind(&frame->env, frame->caller, params->val.vexp.cell,
+                frame->params, args, frame->arg_count);
+
+    lval *r = NULL;
+    if (jit_enabled) {
+        r = jit_run(frame->f, frame->env);
+    }
+    if (r == NULL) {
+        r = lval_eval_function_body(frame->env, frame->f);
+    }
+
+    // If the function body defined something in its environment, start the
+    // next call with a fresh one (as it would get from lval_call)
+    lenv_rebind_reset_if_changed(&frame->env, frame->arg_count);
+    return r;
+}
+
+bool lcall_frame_arg_reusable(const lcall_frame *frame, size_t i,
+                              const lval *arg)
+{
+    int refs = 1;
+    if (frame->env != NULL && frame->params[i]->value == arg) {
+        refs++;
+    }
+    return arg->ref_count == refs;
+}
+
+void lcall_frame_free(lcall_frame *frame)
+{
+    if (frame->env != NULL) {
+        lenv_free(frame->env);
+        frame->env = NULL;
+    }
+}
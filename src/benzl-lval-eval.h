@@ -4,9 +4,40 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 // Forward declarations
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lval_entry lval_entry;
+
+// Native code for an S-Expression (or a Q-Expression evaluated as code)
+// Used by programs compiled with --emit-c and by constant folding
+typedef lval* (*lnative)(lenv *e, const lval *v);
+
+// Called when no expression uses the native code at index any more, to free
+// anything kept for it (eg the value of a folded expression)
+typedef void (*lnative_release)(uint16_t index);
+
+// Native code attached to expressions, indexed by vexp.native
+extern lnative *lval_natives;
+
+// Makes evaluating v call f, and sets v's vexp.native to the index of f
+// The index is shared by copies of v (see lval_native_retain), and is reused
+// once v and all its copies have been freed, after calling release (if it
+// isn't NULL)
+// Returns false if no more native code can be attached (v is unchanged):
+// vexp.native is 16 bits, so at most 65535 expressions can have native code
+// at the same time
+bool lval_attach_native(lval *v, lnative f, lnative_release release);
+
+// Records that another expression (a copy) uses the native code at index
+void lval_native_retain(uint16_t index);
+
+// Records that an expression using the native code at index has been freed
+void lval_native_release(uint16_t index);
 
 // Evaluates the passed lval
 lval* lval_eval(lenv *e, const lval *v);
@@ -15,9 +46,52 @@ lval* lval_eval(lenv *e, const lval *v);
 // Can also be used to evaluate q-expressions as if they were s-expressions
 lval* lval_eval_sexpr(lenv *e, const lval *v);
 
+// Evalulates the passed s-expression lval with the interpreter,
+// even if it has been compiled with --emit-c
+lval* lval_eval_sexpr_interpreted(lenv *e, const lval *v);
+
+// Evaluates the body of the user-defined function f,
+// with its arguments already bound in env
+lval* lval_eval_function_body(lenv *env, const lval *f);
+
 // Call the function f with argument list a
 lval* lval_call(lenv *e, const lval *f, const lval *a);
 
+#pragma mark - Repeated calls
+
+// Most arguments a function called over and over again can take
+#define LCALL_FRAME_MAX_ARGS 4
+
+// State for calling the same function many times (eg for every element of a
+// buffer). Rather than allocating an environment and binding the parameters
+// for every call like lval_call, the environment is kept between calls and
+// only the values bound to the parameters change
+// Functions with typed or & parameters, and built-ins, go through lval_call
+typedef struct {
+    lenv *caller; // Environment the function is called from
+    const lval *f; // Function to call
+    size_t arg_count; // Number of arguments passed to each call
+    bool reuse_env; // false if each call has to go through lval_call
+    lenv *env; // Environment with the parameters bound, or NULL
+    lval_entry *params[LCALL_FRAME_MAX_ARGS]; // Entries for each parameter
+} lcall_frame;
+
+// Prepares to call f with arg_count arguments (at most LCALL_FRAME_MAX_ARGS)
+void lcall_frame_init(lcall_frame *frame, lenv *e, const lval *f,
+                      size_t arg_count);
+
+// Calls the function with the frame's arg_count arguments in args
+lval* lcall_frame_call(lcall_frame *frame, lval **args);
+
+// Returns true if nothing apart from the caller and the frame refers to
+// args[i] after a call, so the caller can change it and pass it to the next
+// call rather than allocating a new value
+bool lcall_frame_arg_reusable(const lcall_frame *frame, size_t i,
+                              const lval *arg);
+
+// Frees the environment kept by the frame
+void lcall_frame_free(lcall_frame *frame);
+
 // Prints stats on the number of times each named function has been called
-// Does nothing if LOG_CALL_STATS is 0
+// Does nothing unless STATS_CALLS stats are turned on
 void print_call_count_stats(void);
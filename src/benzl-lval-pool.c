@@ -8,6 +8,7 @@
 #include "benzl-lval-pool.h"
 #include "benzl-lval.h"
 #include "benzl-config.h"
+#include "benzl-runtime-stats.h"
 
 static size_t block_element_count = 32;
 
@@ -16,7 +17,7 @@ static size_t block_element_count = 32;
 lval_pool* pool_alloc(void) {
     lval_pool *pool = malloc(sizeof(lval_pool));
     pool->total_allocated = 0;
-    pool->total_used = 0;
+    pool->total_freed = 0;
     pool->current_block = 0;
     pool->used_in_current_block = 0;
     pool->next_available = NULL;
@@ -53,11 +54,10 @@ static inline lval* reset_lval(lval *v)
 
 lval *pool_lval_alloc(lval_pool *pool) {
 
-#if LOG_ALLOCATION_POOL_STATS
-    pool->total_allocated++;
-    pool->total_used++;
-#endif
-    
+    if (stats_enabled_for(STATS_POOL)) {
+        pool->total_allocated++;
+    }
+
 #if DISABLE_POOL_ALLOCATION
     return reset_lval(malloc(sizeof(lval)));
 #else
@@ -108,10 +108,9 @@ lval *pool_lval_alloc(lval_pool *pool) {
 
 void pool_lval_free(lval_pool *pool, lval *v) {
 
-#if LOG_ALLOCATION_POOL_STATS
-    assert(pool->total_used > 0);
-    pool->total_used--;
-#endif
+    if (stats_enabled_for(STATS_POOL)) {
+        pool->total_freed++;
+    }
 
 #if DISABLE_POOL_ALLOCATION
     free(v);
@@ -138,8 +137,10 @@ lval_pool* global_pool(void) {
 
 void pool_print_stats(lval_pool *pool)
 {
-#if LOG_ALLOCATION_POOL_STATS
+    if (!stats_enabled_for(STATS_POOL)) {
+        return;
+    }
     printf("[POOL-STATS] %lu lvals / %lu blocks allocated, %lu still in use\n",
-           pool->total_allocated, pool->blocks_allocated, pool->total_used);
-#endif
+           pool->total_allocated, pool->blocks_allocated,
+           pool->total_allocated-pool->total_freed);
 }
@@ -27,9 +27,11 @@ typedef struct lval_ll {
 // Pool comprised of blocks of block_element_count lvals
 typedef struct {
     // Incremented every time an lval is allocated from the pool
+    // (only while STATS_POOL stats are turned on)
     size_t total_allocated;
-    // Stores the total number of lvals the pool has still allocated
-    size_t total_used;
+    // Incremented every time an lval is returned to the pool
+    // (only while STATS_POOL stats are turned on)
+    size_t total_freed;
     // Current block for new allocations
     size_t current_block;
     // Number elememts used in the current block
@@ -62,4 +64,5 @@ void pool_lval_free(lval_pool *pool, lval *v);
 lval_pool* global_pool(void);
 
 // Get statistics on how the pool has been used (for debugging benzl)
+// Does nothing unless STATS_POOL stats are turned on
 void pool_print_stats(lval_pool *pool);
@@ -7,13 +7,20 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #include "benzl-lval.h"
 #include "benzl-lenv.h"
+#include "benzl-lval-eval.h"
+#include "benzl-jit.h"
 #include "benzl-sprintf.h"
 #include "benzl-lval-pool.h"
 #include "benzl-builtins.h"
 #include "benzl-hash-table.h"
+#include "benzl-hashmap.h"
+#include "benzl-persistent-map.h"
+#include "benzl-ordered-map.h"
+#include "benzl-sequence.h"
 #include "benzl-stacktrace.h"
 
 #pragma mark - Constructors
@@ -78,7 +85,10 @@ lval* lval_sym(char *s) {
     lval *v = lval_alloc();
     v->type = LVAL_SYM;
     v->val.vsym.name = strdup(s);
-    v->val.vsym.hash = lval_table_hash(s);
+    v->val.vsym.hash = (uint32_t)lval_table_hash(s);
+    v->val.vsym.flags = 0;
+    v->val.vsym.cached_entry = NULL;
+    v->val.vsym.cached_epoch = 0;
     return v;
 }
 
@@ -94,6 +104,28 @@ lval* lval_buf(size_t size) {
     v->type = LVAL_BUF;
     v->val.vbuf.size = size;
     v->val.vbuf.data = calloc(size, sizeof(uint8_t));
+    v->val.vbuf.owner = NULL;
+    v->val.vbuf.mapped = false;
+    return v;
+}
+
+lval* lval_buf_view(lval *owner, uint8_t *data, size_t size) {
+    lval *v = lval_alloc();
+    v->type = LVAL_BUF;
+    v->val.vbuf.size = size;
+    v->val.vbuf.data = data;
+    v->val.vbuf.owner = lval_retain(owner);
+    v->val.vbuf.mapped = false;
+    return v;
+}
+
+lval* lval_buf_mapped(uint8_t *data, size_t size) {
+    lval *v = lval_alloc();
+    v->type = LVAL_BUF;
+    v->val.vbuf.size = size;
+    v->val.vbuf.data = data;
+    v->val.vbuf.owner = NULL;
+    v->val.vbuf.mapped = true;
     return v;
 }
 
@@ -104,12 +136,50 @@ lval* lval_dict(size_t bucket_count) {
     return v;
 }
 
+lval* lval_hashmap(size_t capacity) {
+    lval *v = lval_alloc();
+    v->type = LVAL_HASHMAP;
+    v->val.vmap = lhashmap_alloc(capacity);
+    return v;
+}
+
+lval* lval_hash_set(size_t capacity) {
+    lval *v = lval_alloc();
+    v->type = LVAL_HASH_SET;
+    v->val.vmap = lhashmap_alloc(capacity);
+    return v;
+}
+
+lval* lval_sequence(lseq *s) {
+    lval *v = lval_alloc();
+    v->type = LVAL_SEQUENCE;
+    v->val.vseq = s;
+    return v;
+}
+
+lval* lval_persistent_map(lpmap_node *root, size_t count) {
+    lval *v = lval_alloc();
+    v->type = LVAL_PERSISTENT_MAP;
+    v->val.vpmap.root = root;
+    v->val.vpmap.count = count;
+    return v;
+}
+
+lval* lval_ordered_map(lval_type type) {
+    lval *v = lval_alloc();
+    v->type = type;
+    v->val.vbtree = lbtree_alloc();
+    return v;
+}
+
 lval* lval_sexpr(void) {
     lval *v = lval_alloc();
     v->type = LVAL_SEXPR;
     v->val.vexp.count = 0;
     v->val.vexp.allocated_size = 0;
     v->val.vexp.cell = NULL;
+    v->val.vexp.site = (lsite){0};
+    v->val.vexp.native = 0;
     return v;
 }
 
@@ -119,6 +189,8 @@ lval* lval_sexpr_with_size(size_t size) {
     v->val.vexp.count = 0;
     v->val.vexp.allocated_size = size;
     v->val.vexp.cell = malloc(sizeof(lval*)*size);
+    v->val.vexp.site = (lsite){0};
+    v->val.vexp.native = 0;
     return v;
 }
 
@@ -128,6 +200,8 @@ lval* lval_qexpr(void) {
     v->val.vexp.count = 0;
     v->val.vexp.allocated_size = 0;
     v->val.vexp.cell = NULL;
+    v->val.vexp.site = (lsite){0};
+    v->val.vexp.native = 0;
     return v;
 }
 
@@ -137,6 +211,8 @@ lval* lval_qexpr_with_size(size_t size) {
     v->val.vexp.count = 0;
     v->val.vexp.allocated_size = size;
     v->val.vexp.cell = malloc(sizeof(lval*)*size);
+    v->val.vexp.site = (lsite){0};
+    v->val.vexp.native = 0;
     return v;
 }
 
@@ -154,6 +230,7 @@ lval* lval_lambda(lval *args, lval *body)
     v->val.vfunc.builtin = NULL;
     v->val.vfunc.args = lval_retain(args);
     v->val.vfunc.body = lval_retain(body);
+    v->val.vfunc.jit = NULL;
     return v;
 }
 
@@ -182,6 +259,7 @@ lval* lval_kv_pair(lval *key, lval *value)
     v->type = LVAL_KEY_VALUE_PAIR;
     v->val.vkvpair.key = lval_retain(key);
     v->val.vkvpair.value = lval_retain(value);
+    v->val.vkvpair.type = NULL;
     return v;
 }
 
@@ -190,15 +268,28 @@ lval* lval_custom_type_instance(const lval *type, const lval *props)
     lval *v = lval_alloc();
     v->type = LVAL_CUSTOM_TYPE_INSTANCE;
     v->val.vinst.type = lval_retain(type);
-    v->val.vinst.props = lval_table_alloc(count(props)*3);
+    v->val.vinst.slots = malloc(sizeof(lval *)*MAX(count(props), 1));
     for (size_t i=0; i<count(props); i++) {
-        lval *p = child(props, i);
-        lval_table_insert(v->val.vinst.props, p->val.vkvpair.key,
-                          p->val.vkvpair.value);
+        v->val.vinst.slots[i] = lval_retain(child(props, i)->val.vkvpair.value);
     }
     return v;
 }
 
+long instance_slot(const lval *inst, const lval *name, size_t hint)
+{
+    const lval *type = inst->val.vinst.type;
+    size_t n = custom_type_slot_count(type);
+    if (hint < n && equal_symbols(custom_type_slot_name(type, hint), name)) {
+        return (long)hint;
+    }
+    for (size_t i=0; i<n; i++) {
+        if (equal_symbols(custom_type_slot_name(type, i), name)) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
 #pragma mark - Casting
 
 lval* cast_to_buffer(const lval *v)
@@ -386,6 +477,7 @@ lval* lval_copy(const lval *v) {
                 x->val.vfunc.builtin = NULL;
                 x->val.vfunc.args = lval_copy(v->val.vfunc.args);
                 x->val.vfunc.body = lval_copy(v->val.vfunc.body);
+                x->val.vfunc.jit = NULL;
             }
             break;
         case LVAL_CAUGHT_ERR:
@@ -404,15 +496,38 @@ lval* lval_copy(const lval *v) {
             x->val.vbuf.size = v->val.vbuf.size;
             x->val.vbuf.data = malloc(v->val.vbuf.size);
             memcpy(x->val.vbuf.data, v->val.vbuf.data, v->val.vbuf.size);
+            x->val.vbuf.owner = NULL;
+            x->val.vbuf.mapped = false;
             break;
         case LVAL_DICT:
             x->val.vdict = lval_table_copy(v->val.vdict);
             break;
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET:
+            x->val.vmap = lhashmap_copy(v->val.vmap);
+            break;
+        case LVAL_PERSISTENT_MAP:
+            // Persistent maps never change, so the copy can share the nodes
+            x->val.vpmap.root = lpmap_node_retain(v->val.vpmap.root);
+            x->val.vpmap.count = v->val.vpmap.count;
+            break;
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET:
+            x->val.vbtree = lbtree_copy(v->val.vbtree);
+            break;
+        case LVAL_SEQUENCE:
+            x->val.vseq = lseq_copy(v->val.vseq);
+            break;
         case LVAL_QEXPR:
         case LVAL_SEXPR:
             x->val.vexp.count = v->val.vexp.count;
             x->val.vexp.allocated_size = count(v);
             x->val.vexp.cell = malloc(sizeof(lval*) * x->val.vexp.count);
+            x->val.vexp.site = (lsite){0};
+            x->val.vexp.native = v->val.vexp.native;
+            if (x->val.vexp.native != 0) {
+                lval_native_retain(x->val.vexp.native);
+            }
             for (size_t i = 0; i < count(x); i++) {
                 x->val.vexp.cell[i] = lval_copy(child(v, i));
             }
@@ -420,10 +535,16 @@ lval* lval_copy(const lval *v) {
         case LVAL_KEY_VALUE_PAIR:
             x->val.vkvpair.key = lval_copy(v->val.vkvpair.key);
             x->val.vkvpair.value = lval_copy(v->val.vkvpair.value);
+            x->val.vkvpair.type = v->val.vkvpair.type != NULL ?
+                lval_retain(v->val.vkvpair.type) : NULL;
             break;
         case LVAL_CUSTOM_TYPE_INSTANCE:
             x->val.vinst.type = lval_retain(v->val.vinst.type);
-            x->val.vinst.props = lval_table_copy(v->val.vinst.props);
+            size_t n = custom_type_slot_count(v->val.vinst.type);
+            x->val.vinst.slots = malloc(sizeof(lval *)*MAX(n, 1));
+            for (size_t i=0; i<n; i++) {
+                x->val.vinst.slots[i] = lval_retain(v->val.vinst.slots[i]);
+            }
             break;
     }
     return x;
@@ -435,8 +556,33 @@ bool lval_is_number(const lval *v) {
     return v->type == LVAL_BYTE || v->type == LVAL_INT || v->type == LVAL_FLT;
 }
 
+bool lval_is_true(const lval *a) {
+    if (a->type == LVAL_INT) {
+        if (a->val.vint != 0) {
+            return true;
+        }
+    } else if (a->type == LVAL_FLT) {
+        if (a->val.vflt != 0) {
+            return true;
+        }
+    } else if (a->type == LVAL_BYTE) {
+        if (a->val.vbyte != 0) {
+            return true;
+        }
+    } else if (a->type == LVAL_QEXPR) {
+        if (count(a) > 0) {
+            return true;
+        }
+    } else {
+        return true;
+    }
+    return false;
+}
+
 lval* type_from_pair(lenv *e, const lval *v) {
-    if (v->val.vkvpair.value->type == LVAL_TYPE) {
+    if (v->val.vkvpair.type != NULL) {
+        return lval_retain(v->val.vkvpair.type);
+    } else if (v->val.vkvpair.value->type == LVAL_TYPE) {
         return lval_retain(v->val.vkvpair.value);
     } else if (v->val.vkvpair.value->type == LVAL_SYM) {
         return lenv_get(e, v->val.vkvpair.value);
@@ -444,6 +590,30 @@ lval* type_from_pair(lenv *e, const lval *v) {
     return NULL;
 }
 
+lval* resolve_param_types(lenv *e, const lval *params)
+{
+    lval *r = lval_qexpr_with_size(count(params));
+    for (size_t i=0; i<count(params); i++) {
+        lval *p = child(params, i);
+        if (p->type == LVAL_KEY_VALUE_PAIR && p->val.vkvpair.type == NULL &&
+            p->val.vkvpair.value->type == LVAL_SYM) {
+            lval *type = lenv_get(e, p->val.vkvpair.value);
+            if (type->type == LVAL_TYPE) {
+                lval *resolved = lval_kv_pair(p->val.vkvpair.key,
+                                              p->val.vkvpair.value);
+                resolved->source_position = code_pos_retain(p->source_position);
+                resolved->val.vkvpair.type = type;
+                lval_add(r, resolved);
+                lval_release(resolved);
+                continue;
+            }
+            lval_release(type);
+        }
+        lval_add(r, p);
+    }
+    return r;
+}
+
 bool equal_types(const vtype *t1, const vtype *t2) {
     if (t1 == t2) {
         return true;
@@ -603,6 +773,21 @@ int lval_eq(const lval *x, const lval *y) {
         case LVAL_DICT:
             r = lval_tables_equal(x->val.vdict, y->val.vdict);
             break;
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET:
+            r = lhashmaps_equal(x->val.vmap, y->val.vmap);
+            break;
+        case LVAL_PERSISTENT_MAP:
+            r = x->val.vpmap.count == y->val.vpmap.count &&
+                lpmap_nodes_equal(x->val.vpmap.root, y->val.vpmap.root);
+            break;
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET:
+            r = lbtrees_equal(x->val.vbtree, y->val.vbtree);
+            break;
+        case LVAL_SEQUENCE:
+            r = lseq_equal(x->val.vseq, y->val.vseq);
+            break;
         case LVAL_FUN:
             if (x->val.vfunc.builtin || y->val.vfunc.builtin) {
                 r = x->val.vfunc.builtin == y->val.vfunc.builtin;
@@ -635,9 +820,11 @@ int lval_eq(const lval *x, const lval *y) {
             }
             break;
         case LVAL_CUSTOM_TYPE_INSTANCE:
-            if (x->val.vinst.type != y->val.vinst.type) {
-                r = lval_tables_equal(x->val.vinst.props, y->val.vinst.props);
+            r = lval_eq(x->val.vinst.type, y->val.vinst.type);
+            for (size_t i=0; r && i<count(x->val.vinst.type->val.vtype.props); i++) {
+                r = lval_eq(x->val.vinst.slots[i], y->val.vinst.slots[i]);
             }
+            break;
     }
     if (x1) {
         lval_release(x1);
@@ -693,6 +880,45 @@ void lval_expr_print(const lval *v, char open, char close) {
     putchar(close);
 }
 
+// Prints an entry of a persistent map
+static void lval_pmap_entry_print(const lval *key, const lval *value, void *ctx)
+{
+    size_t *printed = ctx;
+    if ((*printed)++ > 0) {
+        putchar(' ');
+    }
+    putchar('{');
+    lval_print(key);
+    putchar(' ');
+    lval_print(value);
+    putchar('}');
+}
+
+// Ordered map or set being printed
+typedef struct {
+    bool is_set;
+    size_t printed; // Number of entries printed so far
+} btree_print_state;
+
+// Prints an entry of an ordered map (or a key of an ordered set)
+static bool lval_btree_entry_print(const lval *key, const lval *value, void *ctx)
+{
+    btree_print_state *state = ctx;
+    if (state->printed++ > 0) {
+        putchar(' ');
+    }
+    if (state->is_set) {
+        lval_print(key);
+    } else {
+        putchar('{');
+        lval_print(key);
+        putchar(' ');
+        lval_print(value);
+        putchar('}');
+    }
+    return true;
+}
+
 // Prints an lval
 void lval_print(const lval *v) {
     switch (v->type) {
@@ -773,6 +999,63 @@ void lval_print(const lval *v) {
             free(props);
             return;
         }
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET: {
+            bool is_set = v->type == LVAL_HASH_SET;
+            printf(is_set ? "(hash-set" : "(hash-map");
+            const lhashmap *map = v->val.vmap;
+            if (map->count > 0) {
+                printf(" {");
+                size_t printed = 0;
+                for (size_t i=0; i<map->entry_count; i++) {
+                    const lhashmap_entry *entry = &map->entries[i];
+                    if (entry->key == NULL) {
+                        continue;
+                    }
+                    if (is_set) {
+                        lval_print(entry->key);
+                    } else {
+                        putchar('{');
+                        lval_print(entry->key);
+                        putchar(' ');
+                        lval_print(entry->value);
+                        putchar('}');
+                    }
+                    if (++printed < map->count) {
+                        putchar(' ');
+                    }
+                }
+                putchar('}');
+            }
+            putchar(')');
+            return;
+        }
+        case LVAL_PERSISTENT_MAP: {
+            printf("(persistent-map");
+            if (v->val.vpmap.count > 0) {
+                printf(" {");
+                size_t printed = 0;
+                lpmap_node_iterate(v->val.vpmap.root, lval_pmap_entry_print,
+                                   &printed);
+                putchar('}');
+            }
+            putchar(')');
+            return;
+        }
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET: {
+            bool is_set = v->type == LVAL_ORDERED_SET;
+            printf(is_set ? "(ordered-set" : "(ordered-map");
+            if (lbtree_count(v->val.vbtree) > 0) {
+                printf(" {");
+                btree_print_state state = { is_set, 0 };
+                lbtree_iterate(v->val.vbtree, NULL, NULL,
+                               lval_btree_entry_print, &state);
+                putchar('}');
+            }
+            putchar(')');
+            return;
+        }
         case LVAL_TYPE: {
             if (v->val.vtype.props) {
                 printf("(%s ", v->val.vtype.name->val.vsym.name);
@@ -799,20 +1082,26 @@ void lval_print(const lval *v) {
             printf("%s", val);
             free(val);
             return;
+        case LVAL_SEQUENCE: {
+            char *seq = lval_to_string(v);
+            printf("%s", seq);
+            free(seq);
+            return;
+        }
         case LVAL_CUSTOM_TYPE_INSTANCE: {
-            printf("<%s ", v->val.vinst.type->val.vtype.name->val.vsym.name);
-            lval_entry **props = NULL;
-            size_t prop_count = lval_table_entries(v->val.vinst.props, &props);
+            const lval *type = v->val.vinst.type;
+            printf("<%s ", type->val.vtype.name->val.vsym.name);
+            size_t prop_count = custom_type_slot_count(type);
             for (size_t i=0; i<prop_count; i++) {
-                char *val = lval_to_string(props[i]->value);
-                printf("%s:%s", props[i]->key->val.vsym.name, val);
+                char *val = lval_to_string(v->val.vinst.slots[i]);
+                printf("%s:%s", custom_type_slot_name(type, i)->val.vsym.name,
+                       val);
                 free(val);
                 if (i<prop_count-1) {
                     putchar(' ');
                 }
             }
             putchar('>');
-            free(props);
             break;
         }
 
@@ -850,6 +1139,7 @@ void lval_free(lval *v) {
             if (!v->val.vfunc.builtin) {
                 lval_release(v->val.vfunc.args);
                 lval_release(v->val.vfunc.body);
+                jit_free_function(v->val.vfunc.jit);
             }
             break;
         case LVAL_CAUGHT_ERR:
@@ -866,7 +1156,13 @@ void lval_free(lval *v) {
             free(v->val.vstr);
             break;
         case LVAL_BUF:
-            free(v->val.vbuf.data);
+            if (v->val.vbuf.owner != NULL) {
+                lval_release(v->val.vbuf.owner);
+            } else if (v->val.vbuf.mapped) {
+                munmap(v->val.vbuf.data, v->val.vbuf.size);
+            } else {
+                free(v->val.vbuf.data);
+            }
             break;
         case LVAL_QEXPR:
         case LVAL_SEXPR:
@@ -874,6 +1170,9 @@ void lval_free(lval *v) {
                 lval_release(child(v, i));
             }
             free(v->val.vexp.cell);
+            if (v->val.vexp.native != 0) {
+                lval_native_release(v->val.vexp.native);
+            }
             break;
         case LVAL_TYPE:
             if (v->val.vtype.name != NULL) {
@@ -886,14 +1185,32 @@ void lval_free(lval *v) {
         case LVAL_DICT:
             lval_table_free(v->val.vdict);
             break;
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET:
+            lhashmap_free(v->val.vmap);
+            break;
+        case LVAL_PERSISTENT_MAP:
+            lpmap_node_release(v->val.vpmap.root);
+            break;
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET:
+            lbtree_free(v->val.vbtree);
+            break;
+        case LVAL_SEQUENCE:
+            lseq_free(v->val.vseq);
+            break;
         case LVAL_KEY_VALUE_PAIR:
             lval_release(v->val.vkvpair.key);
             lval_release(v->val.vkvpair.value);
+            if (v->val.vkvpair.type != NULL) {
+                lval_release(v->val.vkvpair.type);
+            }
             break;
         case LVAL_CUSTOM_TYPE_INSTANCE:
-            if (v->val.vinst.props != NULL) {
-                lval_table_free(v->val.vinst.props);
+            for (size_t i=0; i<custom_type_slot_count(v->val.vinst.type); i++) {
+                lval_release(v->val.vinst.slots[i]);
             }
+            free(v->val.vinst.slots);
             lval_release(v->val.vinst.type);
             break;
     }
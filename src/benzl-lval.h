@@ -24,6 +24,11 @@
 // Forward declarations
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct ljit_function ljit_function;
+typedef struct lhashmap lhashmap;
+typedef struct lpmap_node lpmap_node;
+typedef struct lbtree lbtree;
+typedef struct lseq lseq;
 
 // Type representing a kind of value an lval can store
 typedef enum {
@@ -42,15 +47,25 @@ typedef enum {
     LVAL_TYPE = 12, // Reference to a type eg Integer, MyCustomType
     LVAL_CUSTOM_TYPE_INSTANCE = 13, // Instance of a custom type (struct)
     LVAL_KEY_VALUE_PAIR = 14, // In the form 'key:value' (Used internally only)
+    LVAL_HASHMAP = 15, // Hash map with keys of any hashable type
+    LVAL_PERSISTENT_MAP = 16, // Immutable hash map (updates return a new map)
+    LVAL_ORDERED_MAP = 17, // Map with sorted keys
+    LVAL_ORDERED_SET = 18, // Set of sorted keys
+    LVAL_HASH_SET = 19, // Set of hashable values
+    LVAL_SEQUENCE = 20, // Lazy sequence of values (see benzl-sequence.h)
 } lval_type;
 
+// Number of lval types
+#define LVAL_TYPE_COUNT 21
+
 // Human-readable name of an lval type (Used in errors)
 static inline char* ltype_name(lval_type t) {
-    if (t >= LVAL_INT && t <= LVAL_KEY_VALUE_PAIR) {
-        static char *names[15] = {
+    if (t >= LVAL_INT && t < LVAL_TYPE_COUNT) {
+        static char *names[LVAL_TYPE_COUNT] = {
             "Integer", "Float", "Byte", "Symbol", "String", "Buffer",
             "Dictionary", "Function", "S-Expression", "List", "UnhandledError",
-            "Error", "Type", "CustomTypeInstance", "KeyValuePair"
+            "Error", "Type", "CustomTypeInstance", "KeyValuePair", "HashMap",
+            "PersistentMap", "OrderedMap", "OrderedSet", "HashSet", "Sequence"
         };
         return names[t];
     }
@@ -64,6 +79,12 @@ typedef struct lval*(*lbuiltin)(struct lenv*, const struct lval*);
 typedef struct {
     size_t size;
     uint8_t *data;
+    // NULL if the buffer owns data. Otherwise data is part of the memory of
+    // owner (a mapped file, see deserialize-file), which is kept alive by
+    // the buffer
+    lval *owner;
+    // true if data is a file mapped into memory (unmapped when freed)
+    bool mapped;
 } vbuf;
 
 // Properties stored in an lval for a function
@@ -74,14 +95,34 @@ typedef struct {
     // For user defined functions
     lval *args; // List of arguments to the function
     lval *body; // Body of the function
+    ljit_function *jit; // JIT compiler state (see benzl-jit.h), or NULL
 } vfunc;
 
+// Call site state stored in an S-Expression, used to specialize calls to
+// arithmetic and comparison built-ins for the types they are called with
+// (see benzl-quicken.h), and to read properties of custom type instances
+typedef struct {
+    uint8_t op; // Operation seen (or specialized for) at this site
+    uint8_t types; // Argument types seen (or specialized for) at this site
+    uint8_t quickened; // 1 if the site is using the specialized operation
+    uint8_t deopts; // Number of times the specialization has been dropped
+    union {
+        // Number of consecutive calls with the same op and types
+        uint16_t hits;
+        // For sites that read a property of an instance, eg (p x), the slot
+        // the property was last found in (see instance_slot)
+        uint16_t slot_hint;
+    };
+} lsite;
+
 // Properties stored in an lval for an expression
 // (S-Expressions and Q-Expressions)
 typedef struct {
     size_t count; // Number of items in the list/expression
     size_t allocated_size; // Number of items we have space for without realloc
     struct lval ** cell; // Items in the list/expression
+    lsite site; // Call site state (S-Expressions in code only)
+    uint16_t native; // Index of compiled code for this expression (benzl-aot.h)
 } vexp;
 
 // Properties stored in an lval representing a type
@@ -97,25 +138,53 @@ typedef struct {
 // Properties stored in an lval representing a symbol
 // We pre-compute the hash (used for looking up the value
 // in the environment's hash table) when we create a symbol
+// Symbols in code also act as an inline cache for their lookup: the first
+// time a symbol is evaluated we remember the top level environment entry it
+// resolved to, along with the lookup epoch (see benzl-lenv.h). Until the epoch
+// changes, evaluating the symbol again doesn't need a hash table lookup
 typedef struct {
     char *name;
-    size_t hash;
+    uint32_t hash;
+    uint32_t flags; // See lsym_flags
+    lval_entry *cached_entry; // Cached top level entry, or NULL
+    size_t cached_epoch; // Lookup epoch when cached_entry was stored
 } vsym;
 
+// Flags stored in a symbol
+typedef enum {
+    // Set once a value has been bound to this symbol in a function's env
+    LSYM_BOUND_LOCALLY = 1 << 0,
+} lsym_flags;
+
 // Properties stored in an lval representing a key-value pair
 // These are only used internally in benzl for representing things like
 // 'parameter1:type parameter2:type' after parsing
 typedef struct {
     lval *key;
     lval *value;
+    // For typed function parameters and custom type properties,
+    // the type value refers to, resolved when the function or type is defined
+    // (or NULL if it hasn't been resolved)
+    lval *type;
 } vkvpair;
 
 // Properties stored in an lval representing an instance of a custom type
+// Instances all share the layout of their type: the value of each property
+// is stored in a slot, in the order the type declares its properties
+// (so (Point x:1 y:2) has x in slot 0 and y in slot 1)
 typedef struct {
     lval *type; // Type of this instance
-    lval_table *props; // Values defined in this instance for the type's keys
+    lval **slots; // Value of each of the type's properties
 } vcustom_type_instance;
 
+// Properties stored in an lval representing a persistent map
+// The nodes of the map's trie are shared with other versions of the map
+// (see benzl-persistent-map.h)
+typedef struct {
+    lpmap_node *root; // Root node, or NULL for an empty map
+    size_t count; // Number of keys in the map
+} vpmap;
+
 // Properties stored in a lvl representing an error (or caught error)
 typedef struct {
     // Error message
@@ -134,6 +203,10 @@ typedef union {
     verr verr; // Error value
     vbuf vbuf; // Buffer value
     lval_table *vdict; // Dictionary value
+    lhashmap *vmap; // Hash map value (see benzl-hashmap.h)
+    vpmap vpmap; // Persistent map value
+    lbtree *vbtree; // Ordered map or set value (see benzl-ordered-map.h)
+    lseq *vseq; // Sequence value (see benzl-sequence.h)
     vfunc vfunc; // Function value
     vexp vexp; // S/Q-Expression value
     vtype vtype; // Type definition value
@@ -149,10 +222,11 @@ typedef struct {
 } code_pos;
 
 // Represents a type of value we can use in our programs
+// (Fields are ordered to avoid padding, so an lval fits in 64 bytes)
 struct lval {
     lval_type type; // Type of value
-    code_pos source_position; // Line / Col number in source code
     int ref_count; // Reference count
+    code_pos source_position; // Line / Col number in source code
     lval *bound_name; // Name bound to this value, if applicable
     vval val; // Actual value (stores different things depending on type)
 };
@@ -213,9 +287,37 @@ lval* lval_str(char *s);
 // Create a new lval representing a buffer
 lval* lval_buf(size_t size);
 
+// Create a new lval representing a buffer of size bytes at data, which is
+// part of the memory of owner (another buffer, that's kept alive while this
+// buffer is). The bytes aren't copied
+lval* lval_buf_view(lval *owner, uint8_t *data, size_t size);
+
+// Create a new lval representing a buffer for a file mapped into memory
+// (data is unmapped when the buffer is freed)
+lval* lval_buf_mapped(uint8_t *data, size_t size);
+
 // Create a new lval representing a dictionary (hash table)
 lval* lval_dict(size_t bucket_count);
 
+// Create a new lval representing a hash map, with space for capacity keys
+lval* lval_hashmap(size_t capacity);
+
+// Create a new lval representing a hash set, with space for capacity values
+lval* lval_hash_set(size_t capacity);
+
+// Create a new lval representing a lazy sequence
+// Takes ownership of s
+lval* lval_sequence(lseq *s);
+
+// Create a new lval representing a persistent map with count keys under root
+// (which may be NULL for an empty map)
+// Takes ownership of the caller's reference to root
+lval* lval_persistent_map(lpmap_node *root, size_t count);
+
+// Create a new lval representing an empty ordered map (or set, if type is
+// LVAL_ORDERED_SET)
+lval* lval_ordered_map(lval_type type);
+
 // Create a new lval representing an s-expression
 lval* lval_sexpr(void);
 
@@ -244,8 +346,30 @@ lval* lval_kv_pair(lval *key, lval *value);
 
 // Create a new lval representing a typed custom property
 // eg: (Point 1 2 3)
+// props are key-value pairs, in the order type declares them
 lval* lval_custom_type_instance(const lval *type, const lval *props);
 
+// Returns the number of properties a custom type declares
+static inline size_t custom_type_slot_count(const lval *type)
+{
+    return type->val.vtype.props->val.vexp.count;
+}
+
+// Returns the name of property i of a custom type
+static inline lval* custom_type_slot_name(const lval *type, size_t i)
+{
+    lval *prop = type->val.vtype.props->val.vexp.cell[i];
+    if (prop->type == LVAL_KEY_VALUE_PAIR) {
+        return prop->val.vkvpair.key;
+    }
+    return prop;
+}
+
+// Returns the slot for the property called name in the custom type instance
+// inst, or -1 if its type has no such property
+// hint is the slot to try first (eg the one found last time at a call site)
+long instance_slot(const lval *inst, const lval *name, size_t hint);
+
 #pragma mark - Casting
 
 // Change the type of the passed val, converting its current value
@@ -259,9 +383,18 @@ lval *cast_list_to_type(const lval *l, lval_type type);
 // Returns true for Integers, Floats and Bytes
 bool lval_is_number(const lval *v);
 
+// Returns false for 0 and empty lists, which conditions treat as false,
+// and true for anything else
+bool lval_is_true(const lval *a);
+
 // Creates a type reference from the value of a KVPair
 lval* type_from_pair(lenv *e, const lval *v);
 
+// Returns a copy of the list of function parameters or custom type properties
+// params, with the types of typed parameters resolved in e (see vkvpair.type),
+// so calls don't need to look them up again
+lval* resolve_param_types(lenv *e, const lval *params);
+
 // Returns true if the passed types are equal
 // bool equal_types(vtype *t1, vtype *t2);
 
@@ -0,0 +1,522 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "benzl-ordered-map.h"
+#include "benzl-lval.h"
+
+#define T LBTREE_MIN_DEGREE
+
+#pragma mark - Comparing keys
+
+// Kind of key v is, or lbtree_keys_none if it can't be stored in a tree
+static lbtree_key_kind key_kind(const lval *v)
+{
+    if (v->type == LVAL_STR) {
+        return lbtree_keys_strings;
+    } else if (lval_is_number(v)) {
+        return lbtree_keys_numbers;
+    }
+    return lbtree_keys_none;
+}
+
+static inline double number_as_double(const lval *v)
+{
+    switch (v->type) {
+        case LVAL_FLT: return v->val.vflt;
+        case LVAL_BYTE: return v->val.vbyte;
+        default: return (double)v->val.vint;
+    }
+}
+
+// Compares two keys of the same kind, the way builtin_ord does
+// Returns < 0 if a < b, 0 if a == b and > 0 if a > b
+static int compare_keys(const lval *a, const lval *b)
+{
+    if (a->type == LVAL_STR) {
+        return strcmp(a->val.vstr, b->val.vstr);
+    } else if (a->type == LVAL_FLT || b->type == LVAL_FLT) {
+        double x = number_as_double(a);
+        double y = number_as_double(b);
+        return (x > y) - (x < y);
+    }
+    long x = a->type == LVAL_BYTE ? a->val.vbyte : a->val.vint;
+    long y = b->type == LVAL_BYTE ? b->val.vbyte : b->val.vint;
+    return (x > y) - (x < y);
+}
+
+// Returns the index of the first key in node that is >= key
+// Sets *found to true if that key is equal to key
+static uint16_t lower_bound(const lbtree_node *node, const lval *key,
+                            bool *found)
+{
+    uint16_t lo = 0, hi = node->count;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (compare_keys(node->keys[mid], key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < node->count && compare_keys(node->keys[lo], key) == 0;
+    return lo;
+}
+
+#pragma mark - Nodes
+
+static lbtree_node* node_alloc(bool leaf)
+{
+    // Leaves never have children, so don't need space for them
+    size_t children = leaf ? 0 : LBTREE_MAX_KEYS+1;
+    lbtree_node *node = malloc(sizeof(lbtree_node) +
+                               sizeof(lbtree_node *)*children);
+    node->size = 0;
+    node->count = 0;
+    node->leaf = leaf;
+    return node;
+}
+
+static void node_free(lbtree_node *node)
+{
+    for (uint16_t i=0; i<node->count; i++) {
+        lval_release(node->keys[i]);
+        lval_release(node->values[i]);
+    }
+    if (!node->leaf) {
+        for (uint16_t i=0; i<=node->count; i++) {
+            node_free(node->children[i]);
+        }
+    }
+    free(node);
+}
+
+static lbtree_node* node_copy(const lbtree_node *node)
+{
+    lbtree_node *copy = node_alloc(node->leaf);
+    copy->size = node->size;
+    copy->count = node->count;
+    for (uint16_t i=0; i<node->count; i++) {
+        copy->keys[i] = lval_retain(node->keys[i]);
+        copy->values[i] = lval_retain(node->values[i]);
+    }
+    if (!node->leaf) {
+        for (uint16_t i=0; i<=node->count; i++) {
+            copy->children[i] = node_copy(node->children[i]);
+        }
+    }
+    return copy;
+}
+
+// Moves n keys (and values) from position from in src to position to in dst
+static inline void move_keys(lbtree_node *dst, uint16_t to,
+                             const lbtree_node *src, uint16_t from, uint16_t n)
+{
+    memmove(dst->keys+to, src->keys+from, sizeof(lval *)*n);
+    memmove(dst->values+to, src->values+from, sizeof(lval *)*n);
+}
+
+// Moves n children from position from in src to position to in dst
+static inline void move_children(lbtree_node *dst, uint16_t to,
+                                 const lbtree_node *src, uint16_t from,
+                                 uint16_t n)
+{
+    memmove(dst->children+to, src->children+from, sizeof(lbtree_node *)*n);
+}
+
+#pragma mark - Trees
+
+lbtree* lbtree_alloc(void)
+{
+    lbtree *tree = malloc(sizeof(lbtree));
+    tree->root = NULL;
+    tree->key_kind = lbtree_keys_none;
+    return tree;
+}
+
+void lbtree_free(lbtree *tree)
+{
+    if (tree->root != NULL) {
+        node_free(tree->root);
+    }
+    free(tree);
+}
+
+lbtree* lbtree_copy(const lbtree *tree)
+{
+    lbtree *copy = lbtree_alloc();
+    copy->key_kind = tree->key_kind;
+    if (tree->root != NULL) {
+        copy->root = node_copy(tree->root);
+    }
+    return copy;
+}
+
+bool lbtree_accepts_key(const lbtree *tree, const lval *key)
+{
+    lbtree_key_kind kind = key_kind(key);
+    return kind != lbtree_keys_none &&
+           (tree->key_kind == lbtree_keys_none || tree->key_kind == kind);
+}
+
+lval* lbtree_get(const lbtree *tree, const lval *key)
+{
+    const lbtree_node *node = tree->root;
+    while (node != NULL) {
+        bool found;
+        uint16_t i = lower_bound(node, key, &found);
+        if (found) {
+            return node->values[i];
+        } else if (node->leaf) {
+            return NULL;
+        }
+        node = node->children[i];
+    }
+    return NULL;
+}
+
+#pragma mark - Adding keys
+
+// Splits the full child i of node in two, moving its middle key up into node
+static void split_child(lbtree_node *node, uint16_t i)
+{
+    lbtree_node *left = node->children[i];
+    lbtree_node *right = node_alloc(left->leaf);
+
+    // The right half of left's keys (and children) move to right
+    right->count = T-1;
+    move_keys(right, 0, left, T, T-1);
+    right->size = T-1;
+    if (!left->leaf) {
+        move_children(right, 0, left, T, T);
+        for (uint16_t j=0; j<T; j++) {
+            right->size += right->children[j]->size;
+        }
+    }
+    left->count = T-1;
+    left->size -= right->size + 1;
+
+    // The middle key moves up into node, between left and right
+    move_children(node, i+2, node, i+1, node->count-i);
+    node->children[i+1] = right;
+    move_keys(node, i+1, node, i, node->count-i);
+    node->keys[i] = left->keys[T-1];
+    node->values[i] = left->values[T-1];
+    node->count++;
+}
+
+// Inserts a key that isn't in the tree into node, which isn't full
+static void insert_nonfull(lbtree_node *node, const lval *key,
+                           const lval *value)
+{
+    while (true) {
+        bool found;
+        uint16_t i = lower_bound(node, key, &found);
+        node->size++;
+        if (node->leaf) {
+            move_keys(node, i+1, node, i, node->count-i);
+            node->keys[i] = lval_retain(key);
+            node->values[i] = lval_retain(value);
+            node->count++;
+            return;
+        }
+        if (node->children[i]->count == LBTREE_MAX_KEYS) {
+            split_child(node, i);
+            if (compare_keys(node->keys[i], key) < 0) {
+                i++;
+            }
+        }
+        node = node->children[i];
+    }
+}
+
+bool lbtree_put(lbtree *tree, const lval *key, const lval *value)
+{
+    // Replace the value if the key is already in the tree
+    lbtree_node *node = tree->root;
+    while (node != NULL) {
+        bool found;
+        uint16_t i = lower_bound(node, key, &found);
+        if (found) {
+            lval *old = node->values[i];
+            node->values[i] = lval_retain(value);
+            lval_release(old);
+            return false;
+        }
+        node = node->leaf ? NULL : node->children[i];
+    }
+
+    if (tree->root == NULL) {
+        tree->root = node_alloc(true);
+        tree->key_kind = key_kind(key);
+    } else if (tree->root->count == LBTREE_MAX_KEYS) {
+        // Split a full root, so the tree grows from the top
+        lbtree_node *root = node_alloc(false);
+        root->size = tree->root->size;
+        root->children[0] = tree->root;
+        split_child(root, 0);
+        tree->root = root;
+    }
+    insert_nonfull(tree->root, key, value);
+    return true;
+}
+
+#pragma mark - Removing keys
+
+// Merges child i+1 of node (and the key between them) into child i
+static void merge_children(lbtree_node *node, uint16_t i)
+{
+    lbtree_node *left = node->children[i];
+    lbtree_node *right = node->children[i+1];
+
+    left->keys[left->count] = node->keys[i];
+    left->values[left->count] = node->values[i];
+    move_keys(left, left->count+1, right, 0, right->count);
+    if (!left->leaf) {
+        move_children(left, left->count+1, right, 0, right->count+1);
+    }
+    left->count += right->count + 1;
+    left->size += right->size + 1;
+    free(right);
+
+    move_keys(node, i, node, i+1, node->count-i-1);
+    move_children(node, i+1, node, i+2, node->count-i-1);
+    node->count--;
+}
+
+// Moves the last key of child i-1 up into node, and the key between
+// them down into child i
+static void rotate_right(lbtree_node *node, uint16_t i)
+{
+    lbtree_node *left = node->children[i-1];
+    lbtree_node *child = node->children[i];
+
+    move_keys(child, 1, child, 0, child->count);
+    child->keys[0] = node->keys[i-1];
+    child->values[0] = node->values[i-1];
+    node->keys[i-1] = left->keys[left->count-1];
+    node->values[i-1] = left->values[left->count-1];
+    size_t moved = 1;
+    if (!child->leaf) {
+        move_children(child, 1, child, 0, child->count+1);
+        child->children[0] = left->children[left->count];
+        moved += child->children[0]->size;
+    }
+    child->count++;
+    child->size += moved;
+    left->count--;
+    left->size -= moved;
+}
+
+// Moves the first key of child i+1 up into node, and the key between
+// them down into child i
+static void rotate_left(lbtree_node *node, uint16_t i)
+{
+    lbtree_node *child = node->children[i];
+    lbtree_node *right = node->children[i+1];
+
+    child->keys[child->count] = node->keys[i];
+    child->values[child->count] = node->values[i];
+    node->keys[i] = right->keys[0];
+    node->values[i] = right->values[0];
+    size_t moved = 1;
+    if (!child->leaf) {
+        child->children[child->count+1] = right->children[0];
+        moved += right->children[0]->size;
+        move_children(right, 0, right, 1, right->count);
+    }
+    move_keys(right, 0, right, 1, right->count-1);
+    child->count++;
+    child->size += moved;
+    right->count--;
+    right->size -= moved;
+}
+
+// Removes key, which is in the tree under node
+// Every node this visits (except the root) has at least T keys before
+// a key is removed from it, so it never has fewer than T-1 afterwards
+static void remove_from(lbtree_node *node, const lval *key)
+{
+    while (true) {
+        bool found;
+        uint16_t i = lower_bound(node, key, &found);
+        node->size--;
+
+        if (found && node->leaf) {
+            lval_release(node->keys[i]);
+            lval_release(node->values[i]);
+            move_keys(node, i, node, i+1, node->count-i-1);
+            node->count--;
+            return;
+        }
+
+        if (found) {
+            lbtree_node *left = node->children[i];
+            lbtree_node *right = node->children[i+1];
+            if (left->count >= T || right->count >= T) {
+                // Replace the key with its predecessor (or successor),
+                // then remove that from the child it came from
+                lbtree_node *child = left->count >= T ? left : right;
+                const lbtree_node *n = child;
+                while (!n->leaf) {
+                    n = n->children[child == left ? n->count : 0];
+                }
+                uint16_t j = child == left ? n->count-1 : 0;
+                lval_release(node->keys[i]);
+                lval_release(node->values[i]);
+                node->keys[i] = lval_retain(n->keys[j]);
+                node->values[i] = lval_retain(n->values[j]);
+                key = node->keys[i];
+                node = child;
+                continue;
+            }
+            // Both children have the minimum number of keys: merge them,
+            // and remove the key from the merged child
+            merge_children(node, i);
+            node = left;
+            continue;
+        }
+
+        // Make sure the child we descend into has at least T keys
+        lbtree_node *child = node->children[i];
+        if (child->count == T-1) {
+            if (i > 0 && node->children[i-1]->count >= T) {
+                rotate_right(node, i);
+            } else if (i < node->count && node->children[i+1]->count >= T) {
+                rotate_left(node, i);
+            } else if (i < node->count) {
+                merge_children(node, i);
+            } else {
+                merge_children(node, i-1);
+                child = node->children[i-1];
+            }
+        }
+        node = child;
+    }
+}
+
+bool lbtree_remove(lbtree *tree, const lval *key)
+{
+    if (lbtree_get(tree, key) == NULL) {
+        return false;
+    }
+    remove_from(tree->root, key);
+
+    // Shrink the tree from the top if the root is now empty
+    lbtree_node *root = tree->root;
+    if (root->count == 0) {
+        tree->root = root->leaf ? NULL : root->children[0];
+        free(root);
+    }
+    if (tree->root == NULL) {
+        tree->key_kind = lbtree_keys_none;
+    }
+    return true;
+}
+
+#pragma mark - Rank queries
+
+size_t lbtree_rank(const lbtree *tree, const lval *key)
+{
+    size_t rank = 0;
+    const lbtree_node *node = tree->root;
+    while (node != NULL) {
+        bool found;
+        uint16_t i = lower_bound(node, key, &found);
+        rank += i;
+        if (!node->leaf) {
+            for (uint16_t j=0; j<i; j++) {
+                rank += node->children[j]->size;
+            }
+            if (found) {
+                rank += node->children[i]->size;
+            }
+        }
+        if (found || node->leaf) {
+            break;
+        }
+        node = node->children[i];
+    }
+    return rank;
+}
+
+void lbtree_at(const lbtree *tree, size_t index, lval **key, lval **value)
+{
+    const lbtree_node *node = tree->root;
+    while (!node->leaf) {
+        uint16_t i = 0;
+        for (; i<=node->count; i++) {
+            size_t child_size = node->children[i]->size;
+            if (index < child_size) {
+                break;
+            }
+            index -= child_size;
+            if (i < node->count) {
+                if (index == 0) {
+                    *key = node->keys[i];
+                    *value = node->values[i];
+                    return;
+                }
+                index--;
+            }
+        }
+        node = node->children[i];
+    }
+    *key = node->keys[index];
+    *value = node->values[index];
+}
+
+#pragma mark - Iterating
+
+// Calls f for the keys in from..to under node, returns false to stop
+static bool node_iterate(const lbtree_node *node, const lval *from,
+                         const lval *to, lbtree_iterator f, void *ctx)
+{
+    for (uint16_t i=0; i<=node->count; i++) {
+        // Skip keys before from (and the children before them)
+        if (i < node->count && from != NULL &&
+            compare_keys(node->keys[i], from) < 0) {
+            continue;
+        }
+        if (!node->leaf && !node_iterate(node->children[i], from, to, f, ctx)) {
+            return false;
+        }
+        if (i == node->count) {
+            break;
+        }
+        if (to != NULL && compare_keys(node->keys[i], to) >= 0) {
+            return false;
+        }
+        if (!f(node->keys[i], node->values[i], ctx)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void lbtree_iterate(const lbtree *tree, const lval *from, const lval *to,
+                    lbtree_iterator f, void *ctx)
+{
+    if (tree->root != NULL) {
+        node_iterate(tree->root, from, to, f, ctx);
+    }
+}
+
+bool lbtrees_equal(const lbtree *t1, const lbtree *t2)
+{
+    size_t n = lbtree_count(t1);
+    if (n != lbtree_count(t2)) {
+        return false;
+    }
+    // Both trees are sorted, so equal trees have equal keys at each rank
+    for (size_t i=0; i<n; i++) {
+        lval *k1, *v1, *k2, *v2;
+        lbtree_at(t1, i, &k1, &v1);
+        lbtree_at(t2, i, &k2, &v2);
+        if (!lval_eq(k1, k2) || !lval_eq(v1, v2)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,101 @@
+// lbtree is the B-tree behind the OrderedMap and OrderedSet types
+// Keys are kept sorted, using the same ordering as <, >, <= and >=
+// (numbers by value, strings with strcmp). A tree only holds one kind of key:
+// comparing a number with a string converts the number to a string, which
+// wouldn't give a consistent order, so keys must be all numbers or all strings.
+// Each node holds up to LBTREE_MAX_KEYS sorted keys (and for internal nodes,
+// the children between them), so lookups, inserts and removals visit
+// O(log n) nodes. Each node also stores the number of keys in its subtree,
+// which makes rank queries (how many keys are less than k, or which key has
+// rank i) O(log n) too.
+// Like hash maps, ordered maps and sets are mutable
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Forward declarations
+typedef struct lval lval;
+
+// Minimum degree of the B-tree: nodes other than the root have between
+// LBTREE_MIN_DEGREE-1 and 2*LBTREE_MIN_DEGREE-1 keys
+#define LBTREE_MIN_DEGREE 16
+#define LBTREE_MAX_KEYS (2*LBTREE_MIN_DEGREE-1)
+
+typedef struct lbtree_node lbtree_node;
+
+struct lbtree_node {
+    size_t size; // Number of keys in this node and all its descendants
+    uint16_t count; // Number of keys in this node
+    bool leaf; // true if this node has no children
+    lval *keys[LBTREE_MAX_KEYS];
+    lval *values[LBTREE_MAX_KEYS];
+    // Children (LBTREE_MAX_KEYS+1 of them, only allocated for internal nodes)
+    // Keys in children[i] are less than keys[i] and greater than keys[i-1]
+    lbtree_node *children[];
+};
+
+// Kind of keys stored in a tree
+typedef enum {
+    lbtree_keys_none = 0, // The tree is empty
+    lbtree_keys_numbers = 1,
+    lbtree_keys_strings = 2
+} lbtree_key_kind;
+
+typedef struct lbtree {
+    lbtree_node *root; // NULL if the tree is empty
+    lbtree_key_kind key_kind;
+} lbtree;
+
+// Callback for lbtree_iterate, return false to stop iterating
+typedef bool (*lbtree_iterator)(const lval *key, const lval *value, void *ctx);
+
+// Create an empty tree
+lbtree* lbtree_alloc(void);
+
+// Free the tree, releasing its keys and values
+void lbtree_free(lbtree *tree);
+
+// Returns a copy of the tree (sharing its keys and values)
+lbtree* lbtree_copy(const lbtree *tree);
+
+// Number of keys in the tree
+static inline size_t lbtree_count(const lbtree *tree)
+{
+    return tree->root != NULL ? tree->root->size : 0;
+}
+
+// Returns true if key can be stored in (or looked up in) the tree
+// (it must be the same kind of key as the keys already in the tree)
+bool lbtree_accepts_key(const lbtree *tree, const lval *key);
+
+// Get the value stored for key, or NULL
+lval* lbtree_get(const lbtree *tree, const lval *key);
+
+// Store value for key, replacing any existing value
+// Returns true if the key wasn't already in the tree
+bool lbtree_put(lbtree *tree, const lval *key, const lval *value);
+
+// Remove key from the tree
+// Returns false if the tree didn't contain key
+bool lbtree_remove(lbtree *tree, const lval *key);
+
+// Returns the number of keys in the tree that are less than key
+size_t lbtree_rank(const lbtree *tree, const lval *key);
+
+// Gets the key (and its value) with rank index (the smallest key is rank 0)
+// index must be less than the number of keys in the tree
+void lbtree_at(const lbtree *tree, size_t index, lval **key, lval **value);
+
+// Calls f for each key (and value) from from (inclusive) to to (exclusive),
+// in order
+// from and to can be NULL to start at the first key or end at the last key
+void lbtree_iterate(const lbtree *tree, const lval *from, const lval *to,
+                    lbtree_iterator f, void *ctx);
+
+// Returns true if the two trees have the same keys, with equal values
+bool lbtrees_equal(const lbtree *t1, const lbtree *t2);
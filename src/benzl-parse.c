@@ -85,7 +85,7 @@ size_t read_sym(lval *v, char *s, size_t i, code_pos *pos) {
 
     // Check if this symbol is a built-in type
     if (n == NULL) {
-        for (lval_type i=0; i<15; i++) {
+        for (lval_type i=0; i<LVAL_TYPE_COUNT; i++) {
             if (strcmp(part, ltype_name(i)) == 0) {
                 n = lval_primitive_type(i);
                 break;
@@ -0,0 +1,370 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "benzl-persistent-map.h"
+#include "benzl-hashmap.h"
+#include "benzl-lval.h"
+
+// Number of hash bits used by each level of the trie
+#define BITS_PER_LEVEL 5
+
+// Nodes at this shift or deeper (once all 64 bits of the hash have been used)
+// are collision nodes
+#define COLLISION_SHIFT 64
+
+#pragma mark - Nodes
+
+static lpmap_node* node_alloc(uint32_t count)
+{
+    lpmap_node *node = malloc(sizeof(lpmap_node) + sizeof(lpmap_item)*count);
+    node->ref_count = 1;
+    node->bitmap = 0;
+    node->count = count;
+    return node;
+}
+
+static void item_retain(const lpmap_item *item)
+{
+    if (item->key == NULL) {
+        lpmap_node_retain(item->node);
+    } else {
+        lval_retain(item->key);
+        lval_retain(item->value);
+    }
+}
+
+static void item_release(const lpmap_item *item)
+{
+    if (item->key == NULL) {
+        lpmap_node_release(item->node);
+    } else {
+        lval_release(item->key);
+        lval_release(item->value);
+    }
+}
+
+lpmap_node* lpmap_node_retain(lpmap_node *node)
+{
+    if (node != NULL) {
+        node->ref_count++;
+    }
+    return node;
+}
+
+void lpmap_node_release(lpmap_node *node)
+{
+    if (node == NULL || --node->ref_count > 0) {
+        return;
+    }
+    for (uint32_t i=0; i<node->count; i++) {
+        item_release(&node->items[i]);
+    }
+    free(node);
+}
+
+// Returns a copy of node, with space for extra more items at position pos
+// (or with the item at pos left out, if extra is -1)
+// The items of node are shared with the copy
+static lpmap_node* node_copy(const lpmap_node *node, uint32_t pos, int extra)
+{
+    lpmap_node *copy = node_alloc(node->count + extra);
+    copy->bitmap = node->bitmap;
+    if (extra >= 0) {
+        memcpy(copy->items, node->items, sizeof(lpmap_item)*pos);
+        memcpy(copy->items+pos+extra, node->items+pos,
+               sizeof(lpmap_item)*(node->count-pos));
+    } else {
+        memcpy(copy->items, node->items, sizeof(lpmap_item)*pos);
+        memcpy(copy->items+pos, node->items+pos+1,
+               sizeof(lpmap_item)*(node->count-pos-1));
+    }
+    for (uint32_t i=0; i<copy->count; i++) {
+        if (extra <= 0 || i < pos || i >= pos+extra) {
+            item_retain(&copy->items[i]);
+        }
+    }
+    return copy;
+}
+
+// Bit in a node's bitmap for hash at shift
+static inline uint32_t bit_for(uint64_t hash, unsigned shift)
+{
+    return 1u << ((hash >> shift) & 31);
+}
+
+// Position of the item for bit in a node's items
+static inline uint32_t position_for(const lpmap_node *node, uint32_t bit)
+{
+    return (uint32_t)__builtin_popcount(node->bitmap & (bit-1));
+}
+
+static inline bool item_has_key(const lpmap_item *item, const lval *key,
+                                uint64_t hash)
+{
+    return item->key != NULL && item->hash == hash &&
+           (item->key == key || lval_eq(item->key, key));
+}
+
+#pragma mark - Lookup
+
+static lval* node_get(const lpmap_node *node, const lval *key, uint64_t hash,
+                      unsigned shift)
+{
+    while (node != NULL) {
+        if (shift >= COLLISION_SHIFT) {
+            for (uint32_t i=0; i<node->count; i++) {
+                if (item_has_key(&node->items[i], key, hash)) {
+                    return node->items[i].value;
+                }
+            }
+            return NULL;
+        }
+        uint32_t bit = bit_for(hash, shift);
+        if ((node->bitmap & bit) == 0) {
+            return NULL;
+        }
+        const lpmap_item *item = &node->items[position_for(node, bit)];
+        if (item->key != NULL) {
+            return item_has_key(item, key, hash) ? item->value : NULL;
+        }
+        node = item->node;
+        shift += BITS_PER_LEVEL;
+    }
+    return NULL;
+}
+
+lval* lpmap_node_get(const lpmap_node *node, const lval *key, uint64_t hash)
+{
+    return node_get(node, key, hash, 0);
+}
+
+#pragma mark - Adding keys
+
+// Returns a node at shift containing the two (different) keys a and b
+static lpmap_node* node_with_pair(const lpmap_item *a, const lpmap_item *b,
+                                  unsigned shift)
+{
+    if (shift >= COLLISION_SHIFT) {
+        lpmap_node *node = node_alloc(2);
+        node->items[0] = *a;
+        node->items[1] = *b;
+        return node;
+    }
+    uint32_t bit_a = bit_for(a->hash, shift);
+    uint32_t bit_b = bit_for(b->hash, shift);
+    if (bit_a == bit_b) {
+        lpmap_node *node = node_alloc(1);
+        node->bitmap = bit_a;
+        node->items[0].key = NULL;
+        node->items[0].node = node_with_pair(a, b, shift + BITS_PER_LEVEL);
+        node->items[0].hash = 0;
+        return node;
+    }
+    lpmap_node *node = node_alloc(2);
+    node->bitmap = bit_a | bit_b;
+    node->items[bit_a < bit_b ? 0 : 1] = *a;
+    node->items[bit_a < bit_b ? 1 : 0] = *b;
+    return node;
+}
+
+// Returns an item for key and value
+static inline lpmap_item leaf_item(const lval *key, uint64_t hash,
+                                   const lval *value)
+{
+    return (lpmap_item){ lval_copy_key(key), { lval_retain(value) }, hash };
+}
+
+static lpmap_node* node_assoc(lpmap_node *node, const lval *key, uint64_t hash,
+                              const lval *value, unsigned shift, bool *added)
+{
+    if (shift >= COLLISION_SHIFT) {
+        for (uint32_t i=0; i<node->count; i++) {
+            if (item_has_key(&node->items[i], key, hash)) {
+                lpmap_node *copy = node_copy(node, 0, 0);
+                item_release(&copy->items[i]);
+                copy->items[i] = leaf_item(key, hash, value);
+                return copy;
+            }
+        }
+        lpmap_node *copy = node_copy(node, node->count, 1);
+        copy->items[node->count] = leaf_item(key, hash, value);
+        *added = true;
+        return copy;
+    }
+
+    uint32_t bit = bit_for(hash, shift);
+    uint32_t pos = position_for(node, bit);
+
+    // Nothing stored for these bits yet: add the key here
+    if ((node->bitmap & bit) == 0) {
+        lpmap_node *copy = node_copy(node, pos, 1);
+        copy->bitmap |= bit;
+        copy->items[pos] = leaf_item(key, hash, value);
+        *added = true;
+        return copy;
+    }
+
+    const lpmap_item *item = &node->items[pos];
+    lpmap_item replacement;
+    if (item->key == NULL) {
+        // A child node: add the key to it
+        replacement.key = NULL;
+        replacement.node = node_assoc(item->node, key, hash, value,
+                                      shift + BITS_PER_LEVEL, added);
+        replacement.hash = 0;
+    } else if (item_has_key(item, key, hash)) {
+        // The same key: replace its value
+        replacement = leaf_item(key, hash, value);
+    } else {
+        // A different key: move both keys into a new child node
+        lpmap_item leaf = leaf_item(key, hash, value);
+        item_retain(item);
+        replacement.key = NULL;
+        replacement.node = node_with_pair(item, &leaf, shift + BITS_PER_LEVEL);
+        replacement.hash = 0;
+        *added = true;
+    }
+    lpmap_node *copy = node_copy(node, 0, 0);
+    item_release(&copy->items[pos]);
+    copy->items[pos] = replacement;
+    return copy;
+}
+
+lpmap_node* lpmap_node_assoc(lpmap_node *node, const lval *key, uint64_t hash,
+                             const lval *value, bool *added)
+{
+    *added = false;
+    if (node == NULL) {
+        lpmap_node *empty = node_alloc(0);
+        lpmap_node *r = node_assoc(empty, key, hash, value, 0, added);
+        lpmap_node_release(empty);
+        return r;
+    }
+    return node_assoc(node, key, hash, value, 0, added);
+}
+
+#pragma mark - Removing keys
+
+// Returns a new version of node without key, or NULL if it would be empty
+// If node doesn't contain key, returns node (with *removed left false)
+static lpmap_node* node_dissoc(lpmap_node *node, const lval *key, uint64_t hash,
+                               unsigned shift, bool *removed)
+{
+    uint32_t pos;
+    if (shift >= COLLISION_SHIFT) {
+        for (pos=0; pos<node->count; pos++) {
+            if (item_has_key(&node->items[pos], key, hash)) {
+                break;
+            }
+        }
+        if (pos == node->count) {
+            return node;
+        }
+    } else {
+        uint32_t bit = bit_for(hash, shift);
+        if ((node->bitmap & bit) == 0) {
+            return node;
+        }
+        pos = position_for(node, bit);
+        const lpmap_item *item = &node->items[pos];
+        if (item->key == NULL) {
+            lpmap_node *child = node_dissoc(item->node, key, hash,
+                                            shift + BITS_PER_LEVEL, removed);
+            if (!*removed) {
+                return node;
+            }
+            if (child != NULL) {
+                lpmap_node *copy = node_copy(node, 0, 0);
+                lpmap_item *replaced = &copy->items[pos];
+                item_release(replaced);
+                // Pull a child that's down to a single key up into this node
+                if (child->count == 1 && child->items[0].key != NULL) {
+                    *replaced = child->items[0];
+                    item_retain(replaced);
+                    lpmap_node_release(child);
+                } else {
+                    replaced->node = child;
+                }
+                return copy;
+            }
+            // The child node is now empty: remove it (below)
+        } else if (!item_has_key(item, key, hash)) {
+            return node;
+        }
+        *removed = true;
+        if (node->count == 1) {
+            return NULL;
+        }
+        lpmap_node *copy = node_copy(node, pos, -1);
+        copy->bitmap &= ~bit;
+        return copy;
+    }
+    *removed = true;
+    if (node->count == 1) {
+        return NULL;
+    }
+    return node_copy(node, pos, -1);
+}
+
+lpmap_node* lpmap_node_dissoc(lpmap_node *node, const lval *key, uint64_t hash,
+                              bool *removed)
+{
+    *removed = false;
+    if (node == NULL) {
+        return NULL;
+    }
+    lpmap_node *r = node_dissoc(node, key, hash, 0, removed);
+    if (r == node) {
+        lpmap_node_retain(r);
+    }
+    return r;
+}
+
+#pragma mark - Iterating
+
+void lpmap_node_iterate(const lpmap_node *node, lpmap_iterator f, void *ctx)
+{
+    if (node == NULL) {
+        return;
+    }
+    for (uint32_t i=0; i<node->count; i++) {
+        const lpmap_item *item = &node->items[i];
+        if (item->key == NULL) {
+            lpmap_node_iterate(item->node, f, ctx);
+        } else {
+            f(item->key, item->value, ctx);
+        }
+    }
+}
+
+// Returns true if every key under n1 is in n2 with an equal value
+static bool node_contained_in(const lpmap_node *n1, const lpmap_node *n2)
+{
+    if (n1 == n2) {
+        return true;
+    }
+    for (uint32_t i=0; i<n1->count; i++) {
+        const lpmap_item *item = &n1->items[i];
+        if (item->key == NULL) {
+            if (!node_contained_in(item->node, n2)) {
+                return false;
+            }
+        } else {
+            lval *value = lpmap_node_get(n2, item->key, item->hash);
+            if (value == NULL || !lval_eq(value, item->value)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool lpmap_nodes_equal(const lpmap_node *n1, const lpmap_node *n2)
+{
+    if (n1 == NULL || n2 == NULL) {
+        return n1 == n2;
+    }
+    return node_contained_in(n1, n2);
+}
@@ -0,0 +1,73 @@
+// lpmap_node is a node in the hash array mapped trie (HAMT) behind the
+// PersistentMap type
+// Persistent maps are never changed: adding or removing a key returns a new
+// version of the map. Only the nodes on the path to the key are copied
+// (at most 13, as each level of the trie uses 5 bits of the key's lval_hash),
+// all the other nodes are shared with the previous version, so an update is
+// O(log32 n) rather than the O(n) of copying the whole map.
+// Nodes are reference counted, as they can be shared by many versions.
+// Each node has a bitmap with a bit set for each of the 32 possible values of
+// its 5 bits of hash that are in use, and a packed array of items (either a
+// key and value, or a child node) for the bits that are set.
+// Keys whose hashes are identical end up in a collision node at the bottom
+// of the trie, which is searched linearly
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Forward declarations
+typedef struct lval lval;
+typedef struct lpmap_node lpmap_node;
+
+typedef struct {
+    lval *key; // NULL if this item is a child node
+    union {
+        lval *value; // Value for key
+        lpmap_node *node; // Child node (if key is NULL)
+    };
+    uint64_t hash; // lval_hash of key
+} lpmap_item;
+
+struct lpmap_node {
+    int ref_count;
+    uint32_t bitmap; // Hash bits in use (unused for collision nodes)
+    uint32_t count; // Number of items
+    lpmap_item items[];
+};
+
+// Callback for lpmap_node_iterate
+typedef void (*lpmap_iterator)(const lval *key, const lval *value, void *ctx);
+
+// Get the value stored for key (whose lval_hash is hash) under node, or NULL
+lval* lpmap_node_get(const lpmap_node *node, const lval *key, uint64_t hash);
+
+// Returns a new node with value stored for key (whose lval_hash is hash),
+// sharing the unchanged parts of node (which may be NULL, for an empty map)
+// Sets *added to true if key wasn't already in the map
+lpmap_node* lpmap_node_assoc(lpmap_node *node, const lval *key, uint64_t hash,
+                             const lval *value, bool *added);
+
+// Returns a new node without key (whose lval_hash is hash), sharing the
+// unchanged parts of node, or NULL if the map is now empty
+// Sets *removed to true if key was in the map (if not, node is returned)
+lpmap_node* lpmap_node_dissoc(lpmap_node *node, const lval *key, uint64_t hash,
+                              bool *removed);
+
+// Calls f for each key and value under node
+void lpmap_node_iterate(const lpmap_node *node, lpmap_iterator f, void *ctx);
+
+// Returns true if the two maps have the same keys, with equal values
+// (n1 and n2 must contain the same number of keys)
+bool lpmap_nodes_equal(const lpmap_node *n1, const lpmap_node *n2);
+
+// Increments the ref count of node (which may be NULL)
+lpmap_node* lpmap_node_retain(lpmap_node *node);
+
+// Decrements the ref count of node (which may be NULL), freeing it when
+// it is no longer used
+void lpmap_node_release(lpmap_node *node);
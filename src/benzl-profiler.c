@@ -0,0 +1,243 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "benzl-profiler.h"
+#include "benzl-hash-table.h"
+#include "benzl-sprintf.h"
+
+volatile sig_atomic_t profiler_sample_pending = 0;
+
+// A unique stack seen while sampling
+// The frames are retained, so a frame's address stays unique for as long as
+// the profiler is running, and we can compare stacks by address (this keeps
+// the cost of taking a sample low - formatting only happens at the end)
+typedef struct {
+    uint64_t hash;
+    size_t depth;
+    lval **frames;
+    size_t samples;
+} profiler_stack;
+
+static bool profiler_running = false;
+static char *profiler_output_path = NULL;
+
+// Open addressing hash table of unique stacks (capacity is a power of 2)
+static profiler_stack *profiler_stacks = NULL;
+static size_t profiler_stack_capacity = 0;
+static size_t profiler_stack_count = 0;
+
+static void profiler_signal_handler(int sig)
+{
+    // Timer ticks that arrive before we take a sample are added to its weight
+    profiler_sample_pending++;
+}
+
+static uint64_t hash_frames(lval **frames, size_t depth)
+{
+    // FNV-1a over the frame addresses
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i=0; i<depth; i++) {
+        hash ^= (uint64_t)(uintptr_t)frames[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static profiler_stack* find_slot(profiler_stack *stacks, size_t capacity,
+                                 uint64_t hash, lval **frames, size_t depth)
+{
+    size_t i = hash & (capacity-1);
+    while (stacks[i].frames != NULL) {
+        profiler_stack *s = &stacks[i];
+        if (s->hash == hash && s->depth == depth &&
+            memcmp(s->frames, frames, depth*sizeof(lval *)) == 0) {
+            break;
+        }
+        i = (i+1) & (capacity-1);
+    }
+    return &stacks[i];
+}
+
+static void grow_stack_table(void)
+{
+    size_t new_capacity = MAX(256, profiler_stack_capacity*2);
+    profiler_stack *new_stacks = calloc(new_capacity, sizeof(profiler_stack));
+    for (size_t i=0; i<profiler_stack_capacity; i++) {
+        profiler_stack *s = &profiler_stacks[i];
+        if (s->frames != NULL) {
+            *find_slot(new_stacks, new_capacity, s->hash, s->frames, s->depth) = *s;
+        }
+    }
+    free(profiler_stacks);
+    profiler_stacks = new_stacks;
+    profiler_stack_capacity = new_capacity;
+}
+
+bool profiler_start(const char *output_path, int frequency)
+{
+    if (profiler_running || frequency <= 0) {
+        return false;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profiler_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        return false;
+    }
+
+    long interval = MAX(1, 1000000/frequency);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval/1000000;
+    timer.it_interval.tv_usec = interval%1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        return false;
+    }
+
+    profiler_output_path = strdup(output_path);
+    profiler_running = true;
+
+    // Make sure we still write out the samples if the program calls exit
+    static bool registered_exit_handler = false;
+    if (!registered_exit_handler) {
+        atexit(profiler_stop);
+        registered_exit_handler = true;
+    }
+    return true;
+}
+
+void profiler_take_sample(const lval *stack)
+{
+    size_t weight = profiler_sample_pending;
+    profiler_sample_pending = 0;
+
+    size_t depth = count(stack);
+    if (!profiler_running || depth == 0 || weight == 0) {
+        return;
+    }
+    if ((profiler_stack_count+1)*4 > profiler_stack_capacity*3) {
+        grow_stack_table();
+    }
+
+    lval **frames = stack->val.vexp.cell;
+    uint64_t hash = hash_frames(frames, depth);
+    profiler_stack *s = find_slot(profiler_stacks, profiler_stack_capacity,
+                                  hash, frames, depth);
+    if (s->frames == NULL) {
+        s->hash = hash;
+        s->depth = depth;
+        s->frames = malloc(depth*sizeof(lval *));
+        for (size_t i=0; i<depth; i++) {
+            s->frames[i] = lval_retain(frames[i]);
+        }
+        s->samples = 0;
+        profiler_stack_count++;
+    }
+    s->samples += weight;
+}
+
+// Appends a label for the frame, eg 'draw-line (image.benzl:42)'
+static void append_frame_label(const lval *frame, char **buf, size_t *len,
+                               size_t *buf_len)
+{
+    char *name = "<expr>";
+    if (count(frame) > 0) {
+        lval *head = child(frame, 0);
+        if (head->type == LVAL_SYM) {
+            name = head->val.vsym.name;
+        } else if (head->type == LVAL_FUN) {
+            name = head->bound_name != NULL ? head->bound_name->val.vsym.name : "<lambda>";
+        } else if (head->type == LVAL_SEXPR) {
+            name = "<lambda>";
+        }
+    }
+    char *file = "?";
+    if (frame->source_position.source_file != NULL) {
+        file = frame->source_position.source_file->val.vstr;
+        char *last_slash = strrchr(file, '/');
+        if (last_slash != NULL) {
+            file = last_slash+1;
+        }
+    }
+    resize_buffer_if_needed(buf, buf_len, *len+strlen(name)+strlen(file)+32);
+    *len += sprintf(*buf+*len, "%s%s (%s:%d)", *len > 0 ? ";" : "", name, file,
+                    frame->source_position.row+1);
+}
+
+static int sort_entries(const void *v1, const void *v2)
+{
+    lval_entry *e1 = *((lval_entry **)v1);
+    lval_entry *e2 = *((lval_entry **)v2);
+    return strcmp(e1->key->val.vsym.name, e2->key->val.vsym.name);
+}
+
+void profiler_stop(void)
+{
+    if (!profiler_running) {
+        return;
+    }
+    profiler_running = false;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    // Different frames can share a label (eg when a function is copied)
+    // so merge the unique stacks by their folded text
+    lval_table *folded = lval_table_alloc(MAX(16, profiler_stack_count));
+    size_t buf_len = 256;
+    char *buf = malloc(buf_len);
+    for (size_t i=0; i<profiler_stack_capacity; i++) {
+        profiler_stack *s = &profiler_stacks[i];
+        if (s->frames == NULL) {
+            continue;
+        }
+        size_t len = 0;
+        buf[0] = 0x00;
+        for (size_t f=0; f<s->depth; f++) {
+            append_frame_label(s->frames[f], &buf, &len, &buf_len);
+            lval_release(s->frames[f]);
+        }
+        free(s->frames);
+
+        lval *key = lval_sym(buf);
+        lval_entry *entry = lval_table_get_entry(folded, key);
+        if (entry != NULL) {
+            entry->value->val.vint += s->samples;
+        } else {
+            lval *v = lval_int(s->samples);
+            lval_table_insert(folded, key, v);
+            lval_release(v);
+        }
+        lval_release(key);
+    }
+    free(buf);
+    free(profiler_stacks);
+    profiler_stacks = NULL;
+    profiler_stack_capacity = 0;
+    profiler_stack_count = 0;
+
+    FILE *file = fopen(profiler_output_path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write profile to '%s'\n", profiler_output_path);
+    } else {
+        lval_entry **entries = NULL;
+        size_t count = lval_table_entries(folded, &entries);
+        qsort(entries, count, sizeof(lval_entry *), sort_entries);
+        for (size_t i=0; i<count; i++) {
+            fprintf(file, "%s %ld\n", entries[i]->key->val.vsym.name,
+                    entries[i]->value->val.vint);
+        }
+        free(entries);
+        fclose(file);
+    }
+    lval_table_free(folded);
+    free(profiler_output_path);
+    profiler_output_path = NULL;
+}
@@ -0,0 +1,33 @@
+// This file implements a sampling profiler for benzl programs
+// When enabled with --profile=out.folded, a SIGPROF timer fires at regular
+// intervals of CPU time, and the next time the interpreter pushes or pops a
+// stack frame we record the frames currently on the benzl stack.
+// When the program exits, the samples are written out as 'folded stacks'
+// (one line per unique stack, eg 'main (a.benzl:1);draw (a.benzl:12) 42')
+// which can be turned into a flame graph with flamegraph.pl
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <signal.h>
+#include <stdbool.h>
+
+#include "benzl-lval.h"
+
+// Set by the SIGPROF handler when a sample should be taken
+// (checked by stack_push_frame / stack_pop_frame)
+extern volatile sig_atomic_t profiler_sample_pending;
+
+// Start sampling at the passed frequency (samples per second of CPU time)
+// Samples will be written to output_path when profiler_stop is called
+// (or when the program exits)
+bool profiler_start(const char *output_path, int frequency);
+
+// Record the frames currently in the passed stack
+// (the list of expressions pushed by stack_push_frame)
+void profiler_take_sample(const lval *stack);
+
+// Stop sampling and write out the folded stacks
+// Does nothing if the profiler isn't running
+void profiler_stop(void);
@@ -0,0 +1,208 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <math.h>
+
+#include "benzl-quicken.h"
+#include "benzl-lval.h"
+#include "benzl-builtins.h"
+#include "benzl-config.h"
+
+// Operations that can be specialized
+typedef enum {
+    lquick_op_none = 0,
+    lquick_op_add,
+    lquick_op_subtract,
+    lquick_op_multiply,
+    lquick_op_divide,
+    lquick_op_modulo,
+    lquick_op_less_than,
+    lquick_op_greater_than,
+    lquick_op_less_than_or_equal,
+    lquick_op_greater_than_or_equal,
+    lquick_op_equal,
+    lquick_op_not_equal
+} lquick_op;
+
+// Argument types that can be specialized for
+typedef enum {
+    lquick_types_other = 0,
+    lquick_types_int_int = 1,
+    lquick_types_float_float = 2
+} lquick_types;
+
+// Sites that will never be specialized (eg calls to other built-ins)
+#define LSITE_NEVER UINT8_MAX
+
+static inline lquick_op op_for_builtin(lbuiltin f)
+{
+    if (f == builtin_add) {
+        return lquick_op_add;
+    } else if (f == builtin_subtract) {
+        return lquick_op_subtract;
+    } else if (f == builtin_multiply) {
+        return lquick_op_multiply;
+    } else if (f == builtin_divide) {
+        return lquick_op_divide;
+    } else if (f == builtin_modulo) {
+        return lquick_op_modulo;
+    } else if (f == builtin_less_than) {
+        return lquick_op_less_than;
+    } else if (f == builtin_greater_than) {
+        return lquick_op_greater_than;
+    } else if (f == builtin_less_than_or_equal) {
+        return lquick_op_less_than_or_equal;
+    } else if (f == builtin_greater_than_or_equal) {
+        return lquick_op_greater_than_or_equal;
+    } else if (f == builtin_equal) {
+        return lquick_op_equal;
+    } else if (f == builtin_not_equal) {
+        return lquick_op_not_equal;
+    }
+    return lquick_op_none;
+}
+
+// Built-in function for each operation
+static const lbuiltin builtin_for_op[] = {
+    NULL, builtin_add, builtin_subtract, builtin_multiply, builtin_divide,
+    builtin_modulo, builtin_less_than, builtin_greater_than,
+    builtin_less_than_or_equal, builtin_greater_than_or_equal,
+    builtin_equal, builtin_not_equal
+};
+
+static inline lquick_types types_for_args(const lval *x, const lval *y)
+{
+    if (x->type == LVAL_INT && y->type == LVAL_INT) {
+        return lquick_types_int_int;
+    } else if (x->type == LVAL_FLT && y->type == LVAL_FLT) {
+        return lquick_types_float_float;
+    }
+    return lquick_types_other;
+}
+
+// Returns NULL for anything the generic built-in needs to handle
+static lval* int_op(lquick_op op, long x, long y)
+{
+    long r;
+    switch (op) {
+        case lquick_op_add:
+            return __builtin_add_overflow(x, y, &r) ? NULL : lval_int(r);
+        case lquick_op_subtract:
+            return __builtin_sub_overflow(x, y, &r) ? NULL : lval_int(r);
+        case lquick_op_multiply:
+            return __builtin_mul_overflow(x, y, &r) ? NULL : lval_int(r);
+        case lquick_op_divide:
+            if (y == 0 || (x == LONG_MIN && y == -1)) {
+                return NULL;
+            }
+            return lval_int(x / y);
+        case lquick_op_modulo:
+            if (y == 0 || (x == LONG_MIN && y == -1)) {
+                return NULL;
+            }
+            return lval_int(x % y);
+        case lquick_op_less_than:
+            return lval_int(x < y);
+        case lquick_op_greater_than:
+            return lval_int(x > y);
+        case lquick_op_less_than_or_equal:
+            return lval_int(x <= y);
+        case lquick_op_greater_than_or_equal:
+            return lval_int(x >= y);
+        case lquick_op_equal:
+            return lval_int(x == y);
+        case lquick_op_not_equal:
+            return lval_int(x != y);
+        default:
+            return NULL;
+    }
+}
+
+// Returns NULL for anything the generic built-in needs to handle
+static lval* float_op(lquick_op op, double x, double y)
+{
+    switch (op) {
+        case lquick_op_add:
+            return lval_float(x + y);
+        case lquick_op_subtract:
+            return lval_float(x - y);
+        case lquick_op_multiply:
+            return lval_float(x * y);
+        case lquick_op_divide:
+            return y == 0 ? NULL : lval_float(x / y);
+        case lquick_op_modulo:
+            return y == 0 ? NULL : lval_float(fmod(x, y));
+        case lquick_op_less_than:
+            return lval_int(x < y);
+        case lquick_op_greater_than:
+            return lval_int(x > y);
+        case lquick_op_less_than_or_equal:
+            return lval_int(x <= y);
+        case lquick_op_greater_than_or_equal:
+            return lval_int(x >= y);
+        case lquick_op_equal:
+            return lval_int(x == y);
+        case lquick_op_not_equal:
+            return lval_int(x != y);
+        default:
+            return NULL;
+    }
+}
+
+lval* quickened_call(const lval *site_expr, const lval *f, const lval *args)
+{
+    // S-Expressions are constant, apart from their call site state
+    lsite *site = (lsite *)&site_expr->val.vexp.site;
+
+    if (site->deopts == LSITE_NEVER) {
+        return NULL;
+    }
+    if (count(args) != 2) {
+        site->deopts = LSITE_NEVER;
+        return NULL;
+    }
+
+    lval *x = child(args, 0);
+    lval *y = child(args, 1);
+    lquick_types types = types_for_args(x, y);
+
+    if (site->quickened) {
+        // Still seeing what we specialized for?
+        if (types == site->types &&
+            f->val.vfunc.builtin == builtin_for_op[site->op]) {
+            if (types == lquick_types_int_int) {
+                return int_op(site->op, x->val.vint, y->val.vint);
+            }
+            return float_op(site->op, x->val.vflt, y->val.vflt);
+        }
+        // No - go back to the generic built-in
+        site->quickened = 0;
+        site->hits = 0;
+        site->deopts++;
+        if (site->deopts >= QUICKEN_MAX_DEOPTS) {
+            site->deopts = LSITE_NEVER;
+        }
+        return NULL;
+    }
+
+    lquick_op op = op_for_builtin(f->val.vfunc.builtin);
+    if (op == lquick_op_none) {
+        site->deopts = LSITE_NEVER;
+        return NULL;
+    }
+    if (op != site->op || types != site->types) {
+        site->op = op;
+        site->types = types;
+        site->hits = 0;
+    }
+    if (types == lquick_types_other) {
+        return NULL;
+    }
+
+    // Sites that have lost their specialization before need to see
+    // the same types for longer before being specialized again
+    site->hits++;
+    if (site->hits >= (QUICKEN_THRESHOLD << site->deopts)) {
+        site->quickened = 1;
+    }
+    return NULL;
+}
@@ -0,0 +1,29 @@
+// Call site specialization ("quickening") for arithmetic and comparison
+// built-ins
+// The generic built-ins like + and < look at the types of all their arguments
+// on every call, then cast every argument to a common type before doing the
+// operation, which allocates a copy of each argument.
+// Most call sites always see the same types, eg (+ i 1) in a loop is always
+// called with two Integers. Each S-Expression remembers the operation and
+// argument types it was called with, and after QUICKEN_THRESHOLD calls with
+// the same ones it switches to a dedicated version of the operation for those
+// types, which only allocates the result.
+// If the site is later called with different types (or a different function),
+// it drops the specialization and goes back to the generic built-in. Sites
+// that keep changing are given longer to settle each time, and are no longer
+// specialized after QUICKEN_MAX_DEOPTS changes.
+// Anything unusual (integer overflow, division by zero etc) is handed to the
+// generic built-in, so specialized calls give exactly the same results
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+// Forward declarations
+typedef struct lval lval;
+
+// Calls the built-in f with args, using a specialized version for the types
+// of the arguments if the call site (the S-Expression being evaluated) has
+// seen them often enough
+// Returns NULL if the call should be handled by the generic built-in
+lval* quickened_call(const lval *site_expr, const lval *f, const lval *args);
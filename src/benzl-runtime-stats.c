@@ -0,0 +1,57 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benzl-runtime-stats.h"
+
+unsigned int stats_enabled = 0;
+
+runtime_counters runtime_stats = {0};
+
+bool stats_enable_categories(const char *categories)
+{
+    static const struct {
+        const char *name;
+        stats_category category;
+    } names[] = {
+        {"calls", STATS_CALLS},
+        {"pool", STATS_POOL},
+        {"tables", STATS_TABLES},
+        {"envs", STATS_ENVS},
+        {"all", STATS_ALL}
+    };
+
+    const char *start = categories;
+    while (*start != 0x00) {
+        size_t len = strcspn(start, ",");
+        bool found = false;
+        for (size_t i=0; i<sizeof(names)/sizeof(names[0]); i++) {
+            if (strlen(names[i].name) == len &&
+                strncmp(names[i].name, start, len) == 0) {
+                stats_enabled |= names[i].category;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+        start += len;
+        if (*start == ',') {
+            start++;
+        }
+    }
+    return true;
+}
+
+void print_env_stats(void)
+{
+    if (!stats_enabled_for(STATS_ENVS)) {
+        return;
+    }
+    printf("[ENV-STATS] %lu environments allocated, %lu still in use\n",
+           runtime_stats.env_allocs,
+           runtime_stats.env_allocs-runtime_stats.env_frees);
+}
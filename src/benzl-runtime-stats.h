@@ -0,0 +1,56 @@
+// Runtime statistics, used for debugging and optimising benzl
+// benzl can count calls to named functions, lval allocations from the pool,
+// hash table lookups and environment allocations.
+// Counting is turned off by default. It can be turned on at launch with
+// --stats=calls,pool,tables,envs (or --stats=all), or by setting the
+// BENZL_STATS environment variable to the same values. Stats for the enabled
+// categories are printed out when the program finishes, and benzl programs
+// can read the counters at any time with (runtime-stats)
+// While a category is turned off, counting costs a single predictable branch
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Categories of stats that can be turned on
+typedef enum {
+    STATS_CALLS = 1 << 0, // Calls to named functions
+    STATS_POOL = 1 << 1, // lval allocations and frees
+    STATS_TABLES = 1 << 2, // Hash table lookups and collisions
+    STATS_ENVS = 1 << 3, // Environment allocations and frees
+    STATS_ALL = STATS_CALLS | STATS_POOL | STATS_TABLES | STATS_ENVS
+} stats_category;
+
+// Counters that don't belong to a specific lval_table or lval_pool
+typedef struct {
+    size_t function_calls;
+    size_t table_lookups;
+    size_t table_collisions;
+    size_t env_allocs;
+    size_t env_frees;
+} runtime_counters;
+
+// Bit mask of the stats_category values currently being counted
+extern unsigned int stats_enabled;
+
+// Global counters
+extern runtime_counters runtime_stats;
+
+// Returns true if we are counting the passed category of stats
+// This is checked on very hot paths (eg every lval allocation), and stats are
+// normally turned off, so we tell the compiler to expect false
+static inline bool stats_enabled_for(stats_category category)
+{
+    return __builtin_expect((stats_enabled & category) != 0, 0);
+}
+
+// Turns on the categories in a comma separated list, eg "calls,pool" or "all"
+// Returns false if the list contains an unknown category
+bool stats_enable_categories(const char *categories);
+
+// Prints the environment allocation counts
+// Does nothing unless STATS_ENVS is turned on
+void print_env_stats(void);
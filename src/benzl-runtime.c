@@ -0,0 +1,121 @@
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benzl-runtime.h"
+#include "benzl-lval-pool.h"
+#include "benzl-lval-eval.h"
+#include "benzl-lenv.h"
+#include "benzl-builtins.h"
+#include "benzl-stdlib.h"
+#include "benzl-call-count-debug.h"
+#include "benzl-stacktrace.h"
+#include "benzl-profiler.h"
+#include "benzl-runtime-stats.h"
+
+char* benzl_standard_library(void)
+{
+    char *stl = malloc(src_stdlib_benzl_len+1);
+    memcpy(stl,src_stdlib_benzl,src_stdlib_benzl_len);
+    stl[src_stdlib_benzl_len] = 0x00;
+    return stl;
+}
+
+bool runtime_read_environment(void)
+{
+    // Stats can be turned on with an environment variable, eg BENZL_STATS=all
+    char *stats = getenv("BENZL_STATS");
+    if (stats != NULL && !stats_enable_categories(stats)) {
+        printf("Unknown stats in BENZL_STATS '%s' "
+               "(expected calls, pool, tables, envs or all)\n", stats);
+        return false;
+    }
+    return true;
+}
+
+lenv* runtime_create_env(void)
+{
+    // Create the top level enviroment (stores bound variables and functions)
+    // 416 buckets provides enough space for the stdlib and tests to run without
+    // the hash table resizing itself or storing more than 2 values per hash
+    lenv *e = lenv_alloc(416);
+
+    // Load built-in functions into the top level enviroment
+    lenv_add_builtins(e);
+    return e;
+}
+
+bool runtime_load_standard_library(lenv *e)
+{
+    // stdlib.benzl is converted to a header file (benzl-stdlib.h) during make
+    // so that its contents can be built directly into the benzl binary
+    char *stlib = benzl_standard_library();
+    lval *stdlib_label = lval_str("benzl-standard-library");
+    lval *r = builtin_load_str(e, stlib, stdlib_label);
+    lval_release(stdlib_label);
+    free(stlib);
+    bool ok = r->type != LVAL_ERR;
+    if (!ok) {
+        printf("Error in standard library:\n");
+        print_error_with_trace(r);
+    }
+    lval_release(r);
+    return ok;
+}
+
+void runtime_run_program(lenv *e, const char *path, int argc, char **argv)
+{
+    // Add the arguments after the path to a list
+    lval *launch_args = lval_qexpr_with_size(argc);
+    for (int i=0; i<argc; i++) {
+        lval *arg = lval_str(argv[i]);
+        lval_add(launch_args, arg);
+        lval_release(arg);
+    }
+    // Now set the launch-args variable in the root environment
+    // to make them available to benzl programs
+    lval *name = lval_sym("launch-args");
+    lenv_def(e, name, launch_args);
+    lval_release(launch_args);
+    lval_release(name);
+
+    // Load and evaluate the program
+    lval *args = lval_sexpr_with_size(1);
+    lval *file = lval_str((char *)path);
+    lval *r = builtin_load(e, lval_add(args, file));
+    if (r->type == LVAL_ERR) {
+        print_error_with_trace(r);
+    }
+    lval_release(args);
+    lval_release(file);
+    lval_release(r);
+}
+
+void runtime_finish(lenv *e)
+{
+    // Write out the profile (while the sampled frames are still valid)
+    profiler_stop();
+
+    // Clean up the environment
+    lenv_free(e);
+
+    // Clean up the stack
+    stack_cleanup();
+
+    // Print counts for functions called
+    print_call_count_stats();
+
+    // Print how many environments were allocated
+    print_env_stats();
+
+    // Print stats about how the pool allocator was used
+    pool_print_stats(global_pool());
+
+    // Clean up the lval pool allocator
+    pool_free(global_pool());
+
+    // Print stats about how all hash tables were used
+    print_lval_table_stats();
+}
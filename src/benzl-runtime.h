@@ -0,0 +1,35 @@
+// Functions for setting up and tearing down the benzl runtime
+// Used by the benzl executable, and by programs compiled to C with
+// benzl --emit-c (see benzl-aot.h)
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stdbool.h>
+
+// Forward declarations
+typedef struct lenv lenv;
+
+// Returns the contents of the standard library as a null-terminated string
+char* benzl_standard_library(void);
+
+// Turns on stats listed in the BENZL_STATS environment variable, eg all
+// Returns false (after printing a message) if the list isn't valid
+bool runtime_read_environment(void);
+
+// Creates the top level environment, with the built-in functions loaded
+lenv* runtime_create_env(void);
+
+// Loads the standard library into the top level environment
+// Returns false (after printing the error) if it failed to load
+bool runtime_load_standard_library(lenv *e);
+
+// Loads and evaluates the program at path, with the passed launch arguments
+// available to it as launch-args. Errors are printed out
+void runtime_run_program(lenv *e, const char *path,
+                         int argc, char **argv);
+
+// Frees the top level environment, the stack and the lval pool, and prints
+// any stats that were turned on
+void runtime_finish(lenv *e);
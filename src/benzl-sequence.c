@@ -0,0 +1,254 @@
+// This file implements lazy sequences (see benzl-sequence.h)
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "benzl-sequence.h"
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+
+#pragma mark - Sequences
+
+static lseq* lseq_alloc(lseq_kind kind)
+{
+    lseq *s = calloc(1, sizeof(lseq));
+    s->kind = kind;
+    return s;
+}
+
+lseq* lseq_range(long start, long end, long step)
+{
+    lseq *s = lseq_alloc(LSEQ_RANGE);
+    s->start = start;
+    s->end = end;
+    s->step = step;
+    return s;
+}
+
+lseq* lseq_iterate(lval *fn, lval *value)
+{
+    lseq *s = lseq_alloc(LSEQ_ITERATE);
+    s->fn = lval_retain(fn);
+    s->value = lval_retain(value);
+    return s;
+}
+
+lseq* lseq_list(lval *list)
+{
+    lseq *s = lseq_alloc(LSEQ_LIST);
+    s->value = lval_retain(list);
+    return s;
+}
+
+lseq* lseq_transform(lseq_kind kind, lval *fn, lval *source)
+{
+    lseq *s = lseq_alloc(kind);
+    s->fn = lval_retain(fn);
+    s->source = lval_retain(source);
+    return s;
+}
+
+lseq* lseq_take(size_t count, lval *source)
+{
+    lseq *s = lseq_alloc(LSEQ_TAKE);
+    s->count = count;
+    s->source = lval_retain(source);
+    return s;
+}
+
+lseq* lseq_copy(const lseq *s)
+{
+    lseq *x = lseq_alloc(s->kind);
+    *x = *s;
+    if (x->value != NULL) {
+        lval_retain(x->value);
+    }
+    if (x->fn != NULL) {
+        lval_retain(x->fn);
+    }
+    if (x->source != NULL) {
+        lval_retain(x->source);
+    }
+    return x;
+}
+
+// Compares two of a sequence's values, either of which may be NULL
+static bool optional_values_equal(const lval *x, const lval *y)
+{
+    if (x == NULL || y == NULL) {
+        return x == y;
+    }
+    return lval_eq(x, y);
+}
+
+bool lseq_equal(const lseq *s1, const lseq *s2)
+{
+    return s1->kind == s2->kind && s1->start == s2->start &&
+           s1->end == s2->end && s1->step == s2->step &&
+           s1->count == s2->count &&
+           optional_values_equal(s1->value, s2->value) &&
+           optional_values_equal(s1->fn, s2->fn) &&
+           optional_values_equal(s1->source, s2->source);
+}
+
+bool lseq_ends(const lseq *s)
+{
+    switch (s->kind) {
+        case LSEQ_ITERATE:
+            return false;
+        case LSEQ_MAP:
+        case LSEQ_FILTER:
+            return lseq_ends(s->source->val.vseq);
+        default:
+            return true;
+    }
+}
+
+void lseq_free(lseq *s)
+{
+    if (s->value != NULL) {
+        lval_release(s->value);
+    }
+    if (s->fn != NULL) {
+        lval_release(s->fn);
+    }
+    if (s->source != NULL) {
+        lval_release(s->source);
+    }
+    free(s);
+}
+
+#pragma mark - Iteration
+
+lseq_iter* lseq_iter_alloc(lenv *e, const lseq *s)
+{
+    lseq_iter *it = calloc(1, sizeof(lseq_iter));
+    it->seq = s;
+    it->next = s->kind == LSEQ_RANGE ? s->start : 0;
+    if (s->source != NULL) {
+        it->source = lseq_iter_alloc(e, s->source->val.vseq);
+    }
+    if (s->fn != NULL) {
+        lcall_frame_init(&it->frame, e, s->fn, 1);
+    }
+    return it;
+}
+
+// Calls the sequence's function with x
+static inline lval* call_fn(lseq_iter *it, lval *x)
+{
+    return lcall_frame_call(&it->frame, &x);
+}
+
+// Calls the sequence's function with x, returning 1 if the result is true,
+// 0 if it's false, or -1 if it's an error (stored in err)
+static int call_predicate(lseq_iter *it, lval *x, lval **err)
+{
+    lval *r = call_fn(it, x);
+    if (r->type == LVAL_ERR) {
+        *err = r;
+        return -1;
+    }
+    int result = lval_is_true(r) ? 1 : 0;
+    lval_release(r);
+    return result;
+}
+
+lval* lseq_iter_next(lseq_iter *it)
+{
+    if (it->finished) {
+        return NULL;
+    }
+    const lseq *s = it->seq;
+    switch (s->kind) {
+        case LSEQ_RANGE: {
+            long i = it->next;
+            if (s->step > 0 ? i >= s->end : i <= s->end) {
+                it->finished = true;
+                return NULL;
+            }
+            // Stop rather than overflowing past LONG_MAX or LONG_MIN
+            if (s->step > 0 ? i > LONG_MAX - s->step : i < LONG_MIN - s->step) {
+                it->finished = true;
+            } else {
+                it->next = i + s->step;
+            }
+            return lval_int(i);
+        }
+        case LSEQ_ITERATE: {
+            if (it->value == NULL) {
+                it->value = lval_retain(s->value);
+            } else {
+                lval *r = call_fn(it, it->value);
+                if (r->type == LVAL_ERR) {
+                    it->finished = true;
+                    return r;
+                }
+                lval_release(it->value);
+                it->value = r;
+            }
+            return lval_retain(it->value);
+        }
+        case LSEQ_LIST:
+            if ((size_t)it->next >= count(s->value)) {
+                it->finished = true;
+                return NULL;
+            }
+            return lval_retain(child(s->value, it->next++));
+        case LSEQ_MAP: {
+            lval *x = lseq_iter_next(it->source);
+            if (x == NULL || x->type == LVAL_ERR) {
+                return x;
+            }
+            lval *r = call_fn(it, x);
+            lval_release(x);
+            return r;
+        }
+        case LSEQ_FILTER:
+        case LSEQ_TAKE_WHILE:
+            while (true) {
+                lval *x = lseq_iter_next(it->source);
+                if (x == NULL || x->type == LVAL_ERR) {
+                    return x;
+                }
+                lval *err = NULL;
+                int keep = call_predicate(it, x, &err);
+                if (keep == 1) {
+                    return x;
+                }
+                lval_release(x);
+                if (keep == -1) {
+                    return err;
+                }
+                if (s->kind == LSEQ_TAKE_WHILE) {
+                    it->finished = true;
+                    return NULL;
+                }
+            }
+        case LSEQ_TAKE:
+            // The source isn't asked for any more values than are taken
+            if ((size_t)it->next >= s->count) {
+                it->finished = true;
+                return NULL;
+            }
+            it->next++;
+            return lseq_iter_next(it->source);
+    }
+    return NULL;
+}
+
+void lseq_iter_free(lseq_iter *it)
+{
+    if (it->source != NULL) {
+        lseq_iter_free(it->source);
+    }
+    if (it->seq->fn != NULL) {
+        lcall_frame_free(&it->frame);
+    }
+    if (it->value != NULL) {
+        lval_release(it->value);
+    }
+    free(it);
+}
@@ -0,0 +1,95 @@
+// lseq is the lazy sequence behind the Sequence type
+// A sequence describes values rather than storing them: a range of Integers,
+// repeatedly applying a function (iterate), the items of a List, or another
+// sequence transformed by lazy-map, lazy-filter, take-while or take.
+// Sequences never change, and nothing is evaluated when they are made.
+// Values are produced one at a time by an lseq_iter, which pulls each value
+// through every transformation in the chain before producing the next one, so
+// a chain of transformations is a single pass, with no intermediate lists
+// (eg (collect (lazy-map f (lazy-filter g (range 0 1000000)))) only makes the
+// final list). Each function in the chain is called with an lcall_frame, so
+// its environment is reused for every value
+//
+// Part of benzl - https://github.com/pokeb/benzl
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "benzl-lval.h"
+#include "benzl-lval-eval.h"
+
+// Kinds of sequence
+typedef enum {
+    LSEQ_RANGE, // Integers from start, by step, stopping before end
+    LSEQ_ITERATE, // value, (fn value), (fn (fn value))... (never ends)
+    LSEQ_LIST, // The items of value (a List)
+    LSEQ_MAP, // (fn x) for each x in source
+    LSEQ_FILTER, // Each x in source where (fn x) is true
+    LSEQ_TAKE_WHILE, // Each x in source, until (fn x) is false
+    LSEQ_TAKE, // The first count values in source
+} lseq_kind;
+
+typedef struct lseq {
+    lseq_kind kind;
+    long start; // LSEQ_RANGE
+    long end; // LSEQ_RANGE
+    long step; // LSEQ_RANGE
+    size_t count; // LSEQ_TAKE
+    lval *value; // LSEQ_ITERATE's first value, or LSEQ_LIST's list
+    lval *fn; // Function for LSEQ_ITERATE and transformations
+    lval *source; // Sequence being transformed
+} lseq;
+
+// Creates a sequence of Integers from start (inclusive) to end (exclusive)
+// step must not be 0
+lseq* lseq_range(long start, long end, long step);
+
+// Creates a sequence of value, (fn value), (fn (fn value))...
+lseq* lseq_iterate(lval *fn, lval *value);
+
+// Creates a sequence of the items in a List
+lseq* lseq_list(lval *list);
+
+// Creates a sequence transforming source (a Sequence) with fn
+// kind is LSEQ_MAP, LSEQ_FILTER or LSEQ_TAKE_WHILE
+lseq* lseq_transform(lseq_kind kind, lval *fn, lval *source);
+
+// Creates a sequence of the first count values of source (a Sequence)
+lseq* lseq_take(size_t count, lval *source);
+
+// Copies a sequence (the copy shares its functions, lists and sources)
+lseq* lseq_copy(const lseq *s);
+
+// Returns true if both sequences produce values the same way
+bool lseq_equal(const lseq *s1, const lseq *s2);
+
+// Returns false if the sequence would produce values forever
+// (a sequence using take-while might never end, but isn't known to be endless)
+bool lseq_ends(const lseq *s);
+
+void lseq_free(lseq *s);
+
+#pragma mark - Iteration
+
+typedef struct lseq_iter lseq_iter;
+
+// State for producing a sequence's values
+struct lseq_iter {
+    const lseq *seq;
+    lseq_iter *source; // Iterator over seq->source, or NULL
+    long next; // Next Integer in a range, or index in a list or take
+    lval *value; // Next value of an iterate sequence
+    lcall_frame frame; // For calling seq->fn
+    bool finished;
+};
+
+// Prepares to produce the values of s, calling its functions in env e
+lseq_iter* lseq_iter_alloc(lenv *e, const lseq *s);
+
+// Returns the next value, NULL once there are no more, or an error returned
+// by one of the sequence's functions
+lval* lseq_iter_next(lseq_iter *it);
+
+void lseq_iter_free(lseq_iter *it);
@@ -4,10 +4,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <float.h>
 
 #include "benzl-sprintf.h"
 #include "benzl-lval.h"
 #include "benzl-builtins.h"
+#include "benzl-hashmap.h"
+#include "benzl-persistent-map.h"
+#include "benzl-ordered-map.h"
+#include "benzl-sequence.h"
 
 /* Possible unescapable characters */
 char* lval_str_unescapable = "abfnrtv\\\'\"";
@@ -68,6 +73,45 @@ void lval_sprint_str(const lval *v, char **buf, size_t *offset, size_t *max_len)
 // Fwd declaration
 void lval_sprint(const lval *v, char **buf, size_t *offset, size_t *max_len, bool quote_strings);
 
+// Buffer to print the entries of a persistent map (or ordered map) to
+typedef struct {
+    char **buf;
+    size_t *offset;
+    size_t *max_len;
+    size_t printed; // Number of entries printed so far
+    bool is_set; // Print keys only (for ordered sets)
+} map_sprint_buffer;
+
+// Prints an entry of a persistent map to the buffer in ctx
+static void lval_pmap_entry_sprint(const lval *key, const lval *value, void *ctx)
+{
+    map_sprint_buffer *b = ctx;
+    if (b->printed++ > 0) {
+        print_char_to_buffer(b->buf, b->offset, b->max_len, ' ');
+    }
+    print_char_to_buffer(b->buf, b->offset, b->max_len, '{');
+    lval_sprint(key, b->buf, b->offset, b->max_len, true);
+    print_char_to_buffer(b->buf, b->offset, b->max_len, ' ');
+    lval_sprint(value, b->buf, b->offset, b->max_len, true);
+    print_char_to_buffer(b->buf, b->offset, b->max_len, '}');
+}
+
+// Prints an entry of an ordered map (or a key of an ordered set) to the buffer
+// in ctx
+static bool lval_btree_entry_sprint(const lval *key, const lval *value, void *ctx)
+{
+    map_sprint_buffer *b = ctx;
+    if (b->is_set) {
+        if (b->printed++ > 0) {
+            print_char_to_buffer(b->buf, b->offset, b->max_len, ' ');
+        }
+        lval_sprint(key, b->buf, b->offset, b->max_len, true);
+    } else {
+        lval_pmap_entry_sprint(key, value, ctx);
+    }
+    return true;
+}
+
 // Prints an expression lval to the passed buffer, resizing the buffer if needed
 void lval_expr_sprint(const lval *v, char open, char close, char **buf, size_t *offset, size_t *max_len) {
     if (count(v) == 0) {
@@ -95,8 +139,8 @@ void lval_sprint(const lval *v, char **buf, size_t *offset, size_t *max_len, boo
         }
         case LVAL_FLT:
         {
-            static char temp[22];
-            sprintf(temp, "%f", v->val.vflt);
+            static char temp[DBL_MAX_10_EXP + 16];
+            snprintf(temp, sizeof(temp), "%f", v->val.vflt);
             size_t len = strlen(temp);
             while (temp[len-1] == '0') {
                 len--;
@@ -213,23 +257,119 @@ void lval_sprint(const lval *v, char **buf, size_t *offset, size_t *max_len, boo
             free(props);
             return;
         }
+        case LVAL_HASHMAP:
+        case LVAL_HASH_SET: {
+            bool is_set = v->type == LVAL_HASH_SET;
+            print_to_buffer(buf, offset, max_len,
+                            is_set ? "(hash-set" : "(hash-map");
+            const lhashmap *map = v->val.vmap;
+            if (map->count > 0) {
+                print_to_buffer(buf, offset, max_len, " {");
+                size_t printed = 0;
+                for (size_t i=0; i<map->entry_count; i++) {
+                    const lhashmap_entry *entry = &map->entries[i];
+                    if (entry->key == NULL) {
+                        continue;
+                    }
+                    if (is_set) {
+                        lval_sprint(entry->key, buf, offset, max_len, true);
+                    } else {
+                        print_char_to_buffer(buf, offset, max_len, '{');
+                        lval_sprint(entry->key, buf, offset, max_len, true);
+                        print_char_to_buffer(buf, offset, max_len, ' ');
+                        lval_sprint(entry->value, buf, offset, max_len, true);
+                        print_char_to_buffer(buf, offset, max_len, '}');
+                    }
+                    if (++printed < map->count) {
+                        print_char_to_buffer(buf, offset, max_len, ' ');
+                    }
+                }
+                print_char_to_buffer(buf, offset, max_len, '}');
+            }
+            print_char_to_buffer(buf, offset, max_len, ')');
+            return;
+        }
+        case LVAL_PERSISTENT_MAP: {
+            print_to_buffer(buf, offset, max_len, "(persistent-map");
+            if (v->val.vpmap.count > 0) {
+                print_to_buffer(buf, offset, max_len, " {");
+                map_sprint_buffer b = { buf, offset, max_len, 0, false };
+                lpmap_node_iterate(v->val.vpmap.root, lval_pmap_entry_sprint, &b);
+                print_char_to_buffer(buf, offset, max_len, '}');
+            }
+            print_char_to_buffer(buf, offset, max_len, ')');
+            return;
+        }
+        // A sequence is printed as the expression that makes it
+        case LVAL_SEQUENCE: {
+            static const char *names[] = {
+                [LSEQ_RANGE] = "range", [LSEQ_ITERATE] = "iterate",
+                [LSEQ_LIST] = "", [LSEQ_MAP] = "lazy-map",
+                [LSEQ_FILTER] = "lazy-filter", [LSEQ_TAKE_WHILE] = "take-while",
+                [LSEQ_TAKE] = "take"
+            };
+            const lseq *s = v->val.vseq;
+            if (s->kind == LSEQ_LIST) {
+                lval_sprint(s->value, buf, offset, max_len, true);
+                return;
+            }
+            char temp[80];
+            snprintf(temp, sizeof(temp), "(%s", names[s->kind]);
+            print_to_buffer(buf, offset, max_len, temp);
+            if (s->kind == LSEQ_RANGE) {
+                snprintf(temp, sizeof(temp), " %ld %ld %ld", s->start, s->end,
+                         s->step);
+                print_to_buffer(buf, offset, max_len, temp);
+            } else if (s->kind == LSEQ_TAKE) {
+                snprintf(temp, sizeof(temp), " %zu", s->count);
+                print_to_buffer(buf, offset, max_len, temp);
+            }
+            if (s->fn != NULL) {
+                print_char_to_buffer(buf, offset, max_len, ' ');
+                lval_sprint(s->fn, buf, offset, max_len, true);
+            }
+            if (s->kind == LSEQ_ITERATE) {
+                print_char_to_buffer(buf, offset, max_len, ' ');
+                lval_sprint(s->value, buf, offset, max_len, true);
+            }
+            if (s->source != NULL) {
+                print_char_to_buffer(buf, offset, max_len, ' ');
+                lval_sprint(s->source, buf, offset, max_len, true);
+            }
+            print_char_to_buffer(buf, offset, max_len, ')');
+            return;
+        }
+        case LVAL_ORDERED_MAP:
+        case LVAL_ORDERED_SET: {
+            bool is_set = v->type == LVAL_ORDERED_SET;
+            print_to_buffer(buf, offset, max_len,
+                            is_set ? "(ordered-set" : "(ordered-map");
+            if (lbtree_count(v->val.vbtree) > 0) {
+                print_to_buffer(buf, offset, max_len, " {");
+                map_sprint_buffer b = { buf, offset, max_len, 0, is_set };
+                lbtree_iterate(v->val.vbtree, NULL, NULL,
+                               lval_btree_entry_sprint, &b);
+                print_char_to_buffer(buf, offset, max_len, '}');
+            }
+            print_char_to_buffer(buf, offset, max_len, ')');
+            return;
+        }
 
         case LVAL_CUSTOM_TYPE_INSTANCE: {
             print_char_to_buffer(buf, offset, max_len, '(');
-            print_to_buffer(buf, offset, max_len, v->val.vinst.type->val.vtype.name->val.vsym.name);
+            const lval *type = v->val.vinst.type;
+            print_to_buffer(buf, offset, max_len, type->val.vtype.name->val.vsym.name);
             print_char_to_buffer(buf, offset, max_len, ' ');
-            lval_entry **props = NULL;
-            size_t prop_count = lval_table_entries(v->val.vinst.props, &props);
+            size_t prop_count = custom_type_slot_count(type);
             for (size_t i=0; i<prop_count; i++) {
-                print_to_buffer(buf, offset, max_len, props[i]->key->val.vsym.name);
+                print_to_buffer(buf, offset, max_len, custom_type_slot_name(type, i)->val.vsym.name);
                 print_char_to_buffer(buf, offset, max_len, ':');
-                lval_sprint(props[i]->value, buf, offset, max_len, true);
+                lval_sprint(v->val.vinst.slots[i], buf, offset, max_len, true);
                 if (i<prop_count-1) {
                     print_char_to_buffer(buf, offset, max_len, ' ');
                 }
             }
             print_char_to_buffer(buf, offset, max_len, ')');
-            free(props);
             return;
         }
     }
@@ -5,6 +5,7 @@
 #include "benzl-builtins.h"
 #include "benzl-lval.h"
 #include "benzl-sprintf.h"
+#include "benzl-profiler.h"
 
 lval *shared_stack = NULL;
 
@@ -23,14 +24,35 @@ void stack_push_frame(const lval *v)
         shared_stack = lval_qexpr_with_size(64);
     }
     lval_add(shared_stack, v);
+    if (profiler_sample_pending) {
+        profiler_take_sample(shared_stack);
+    }
 }
 
 void stack_pop_frame(void) {
+    if (profiler_sample_pending) {
+        profiler_take_sample(shared_stack);
+    }
     lval_pop(shared_stack, count(shared_stack)-1);
 }
 
 
 
+size_t stack_depth(void)
+{
+    if (shared_stack == NULL) {
+        return 0;
+    }
+    return count(shared_stack);
+}
+
+void stack_unwind_to(size_t depth)
+{
+    while (stack_depth() > depth) {
+        stack_pop_frame();
+    }
+}
+
 lval* stack_trace(const lval *a)
 {
     if (shared_stack == NULL) {
@@ -38,7 +60,7 @@ lval* stack_trace(const lval *a)
     }
     size_t len = 0;
     size_t buf_len = 0;
-    char *buf = malloc(1);
+    char *buf = calloc(1, 1);
 
     for (size_t i= count(shared_stack)-1; i != -1; i--) {
         lval *frame = child(shared_stack, i);
@@ -13,6 +13,13 @@ void stack_push_frame(const lval *v);
 // Record that we popped the last expression from the stack
 void stack_pop_frame(void);
 
+// Returns the number of frames on the stack
+size_t stack_depth(void);
+
+// Pops frames until there are only depth frames on the stack
+// (Used by compiled code to clean up after an error)
+void stack_unwind_to(size_t depth);
+
 // Returns a stack trace
 lval* stack_trace(const lval *a);
 
@@ -12,76 +12,84 @@
 #include "benzl-lval-eval.h"
 #include "benzl-lenv.h"
 #include "benzl-builtins.h"
-#include "benzl-stdlib.h"
 #include "benzl-parse.h"
 #include "benzl-constants.h"
 #include "benzl-call-count-debug.h"
 #include "benzl-stacktrace.h"
-
-// Returns the contents of the standard library as a null-terminated string
-char* benzl_standard_library(void)
-{
-    char *stl = malloc(src_stdlib_benzl_len+1);
-    memcpy(stl,src_stdlib_benzl,src_stdlib_benzl_len);
-    stl[src_stdlib_benzl_len] = 0x00;
-    return stl;
-}
+#include "benzl-profiler.h"
+#include "benzl-config.h"
+#include "benzl-runtime-stats.h"
+#include "benzl-jit.h"
+#include "benzl-runtime.h"
+#include "benzl-aot.h"
 
 int main(int argc, char ** argv)
 {
-    // Create the top level enviroment (stores bound variables and functions)
-    // 416 buckets provides enough space for the stdlib and tests to run without
-    // the hash table resizing itself or storing more than 2 values per hash
-    lenv *e = lenv_alloc(416);
+    if (!runtime_read_environment()) {
+        return 1;
+    }
+
+    // Options come before the path to the script, eg:
+    // benzl --profile=out.folded my-script.benzl arg1 arg2
+    char *profile_path = NULL;
+    bool emit_c = false;
+    int first_arg = 1;
+    while (first_arg < argc && strncmp(argv[first_arg], "--", 2) == 0) {
+        char *option = argv[first_arg];
+        if (strncmp(option, "--profile=", 10) == 0 && strlen(option) > 10) {
+            profile_path = option+10;
+        } else if (strncmp(option, "--stats=", 8) == 0) {
+            if (!stats_enable_categories(option+8)) {
+                printf("Unknown stats in '%s' "
+                       "(expected calls, pool, tables, envs or all)\n", option);
+                return 1;
+            }
+        } else if (strcmp(option, "--jit") == 0 ||
+                   strcmp(option, "--jit=verify") == 0) {
+            if (!jit_start(strcmp(option, "--jit=verify") == 0)) {
+                printf("Warning: the JIT is only supported on x86-64 Linux, "
+                       "'%s' will be ignored\n", option);
+            }
+        } else if (strcmp(option, "--emit-c") == 0) {
+            emit_c = true;
+        } else {
+            printf("Unknown option '%s'\n", option);
+            return 1;
+        }
+        first_arg++;
+    }
 
-    // Load built-in functions into the top level enviroment
-    lenv_add_builtins(e);
+    if (emit_c && argc == first_arg) {
+        printf("Usage: benzl --emit-c program.benzl > program.c\n");
+        return 1;
+    }
 
-    // Load standard library
-    // stdlib.benzl is converted to a header file (benzl-stdlib.h) during make
-    // so that its contents can be built directly into the benzl binary
-    char *stlib = benzl_standard_library();
-    lval *stdlib_label = lval_str("benzl-standard-library");
-    lval *r = builtin_load_str(e, stlib, stdlib_label);
-    lval_release(stdlib_label);
-    free(stlib);
-    if (r->type == LVAL_ERR) {
-        printf("Error in standard library:\n");
-        print_error_with_trace(r);
-        lval_release(r);
+    int status = 0;
+    lenv *e = runtime_create_env();
+    if (!runtime_load_standard_library(e)) {
         goto end;
     }
-    lval_release(r);
 
+    // Translate the program to C rather than running it
+    if (emit_c) {
+        status = aot_emit_c(e, argv[first_arg], stdout);
+        goto end;
+    }
+
+    // Start the sampling profiler, if requested
+    // (after loading the standard library, so we only profile the program)
+    if (profile_path != NULL &&
+        !profiler_start(profile_path, PROFILER_SAMPLE_FREQUENCY)) {
+        printf("Could not start the profiler\n");
+    }
 
     // If we got arguments, we'll assume we don't want to run the REPL
-    if (argc >= 2) {
+    if (argc > first_arg) {
 
         // benzl will load the first argument as a .benzl program
-        // If we got more arguments than that, add them to a list
-        lval *launch_args = lval_qexpr_with_size(argc-2);
-        for (int i=2; i<argc; i++) {
-            lval *arg = lval_str(argv[i]);
-            lval_add(launch_args, arg);
-            lval_release(arg);
-        }
-        // Now set the launch-args variable in the root environment
-        // to make them available to benzl programs
-        lval *name = lval_sym("launch-args");
-        lenv_def(e, name, launch_args);
-        lval_release(launch_args);
-        lval_release(name);
-
-        // If we got a .benzl source file as the first argument, load and evaluate it
-        lval *args = lval_sexpr_with_size(1);
-        lval *file = lval_str(argv[1]);
-        lval *r = builtin_load(e, lval_add(args, file));
-        if (r->type == LVAL_ERR) {
-            print_error_with_trace(r);
-        }
-        lval_release(args);
-        lval_release(file);
-        lval_release(r);
+        // If we got more arguments than that, pass them to the program
+        runtime_run_program(e, argv[first_arg],
+                            argc-first_arg-1, argv+first_arg+1);
         goto end;
     }
 
@@ -107,24 +115,6 @@ int main(int argc, char ** argv)
     }
 
 end:
-    // Clean up the environment
-    lenv_free(e);
-
-    // Clean up the stack
-    stack_cleanup();
-
-    // Print counts for functions called
-    print_call_count_stats();
-
-    // Print stats about how the pool allocator was used
-    pool_print_stats(global_pool());
-
-    // Clean up the lval pool allocator
-    pool_free(global_pool());
-
-    // Print stats about how all hash tables were used
-    print_lval_table_stats();
-
-    return 0;
+    runtime_finish(e);
+    return status;
 }
-